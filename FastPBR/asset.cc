@@ -0,0 +1,23 @@
+#include "asset.hh"
+#include <algorithm>
+#include <cfloat>
+
+MeshAsset buildMeshAsset(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+	uint32_t maxLodCount) {
+	MeshAsset asset;
+	asset.vertices = vertices;
+	asset.lods = buildLodChain(vertices, indices, asset.indices, maxLodCount);
+
+	glm::vec3 lower(FLT_MAX), upper(-FLT_MAX);
+	for (const auto& vertex : vertices) {
+		lower = glm::min(lower, vertex.pos);
+		upper = glm::max(upper, vertex.pos);
+	}
+	glm::vec3 center = (lower + upper) * 0.5f;
+	float radius = 0;
+	for (const auto& vertex : vertices) {
+		radius = std::max(radius, glm::length(vertex.pos - center));
+	}
+	asset.bounds = glm::vec4(center, radius);
+	return asset;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "geometry.hh"
+#include "lod.hh"
+#include <vector>
+
+// a mesh with its precomputed lod chain, built offline and stored by SceneBuilder::addMesh
+struct MeshAsset {
+	std::vector<Vertex> vertices;
+	// index ranges of all lods back to back
+	std::vector<uint32_t> indices;
+	std::vector<MeshLod> lods;
+	// object space bounding sphere, radius in w
+	glm::vec4 bounds;
+};
+
+MeshAsset buildMeshAsset(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+	uint32_t maxLodCount = 8);
@@ -0,0 +1,3036 @@
+#include "benchmark.hh"
+#include "asset.hh"
+#include "bsdf.hh"
+#include "bvh.hh"
+#include "compute.hh"
+#include "computescene.hh"
+#include "culling.hh"
+#include "denoiser.hh"
+#include "display.hh"
+#include "environment.hh"
+#include "lightbvh.hh"
+#include "meshlet.hh"
+#include "packet.hh"
+#include "pathtracer.hh"
+#include "progressive.hh"
+#include "refit.hh"
+#include "sampler.hh"
+#include "scene.hh"
+#include "texturecache.hh"
+#include "tlas.hh"
+#include "transform.hh"
+#include "triangles.hh"
+#include "widebvh.hh"
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+int runBenchmark(const char *name, size_t size) {
+	if (std::strcmp(name, "culling") == 0) {
+		return benchmarkCulling(size ? size : 1000000);
+	}
+	if (std::strcmp(name, "meshlets") == 0) {
+		return benchmarkMeshlets(size ? size : 512);
+	}
+	if (std::strcmp(name, "lod") == 0) {
+		return benchmarkLod(size ? size : 10000);
+	}
+	if (std::strcmp(name, "scene") == 0) {
+		return benchmarkScene(size ? size : 256);
+	}
+	if (std::strcmp(name, "transforms") == 0) {
+		return benchmarkTransforms(size ? size : 200000);
+	}
+	if (std::strcmp(name, "pathtracer") == 0) {
+		return benchmarkPathTracer(size ? size : 16);
+	}
+	if (std::strcmp(name, "bvh") == 0) {
+		return benchmarkBvh(size ? size : 1000000);
+	}
+	if (std::strcmp(name, "lbvh") == 0) {
+		return benchmarkLbvh(size ? size : 1000000);
+	}
+	if (std::strcmp(name, "refit") == 0) {
+		return benchmarkRefit(size ? size : 1000000);
+	}
+	if (std::strcmp(name, "widebvh") == 0) {
+		return benchmarkWideBvh(size ? size : 1000000);
+	}
+	if (std::strcmp(name, "packets") == 0) {
+		return benchmarkPackets(size ? size : 1000000);
+	}
+	if (std::strcmp(name, "triangles") == 0) {
+		return benchmarkTriangles(size ? size : 1000000);
+	}
+	if (std::strcmp(name, "tlas") == 0) {
+		return benchmarkTlas(size ? size : 10000);
+	}
+	if (std::strcmp(name, "wavefront") == 0) {
+		return benchmarkWavefront(size ? size : 16);
+	}
+	if (std::strcmp(name, "tiles") == 0) {
+		return benchmarkTiles(size ? size : 64);
+	}
+	if (std::strcmp(name, "bsdf") == 0) {
+		return benchmarkBsdf(size ? size : 1 << 16);
+	}
+	if (std::strcmp(name, "environment") == 0) {
+		return benchmarkEnvironment(size ? size : 2000);
+	}
+	if (std::strcmp(name, "lights") == 0) {
+		return benchmarkLights(size ? size : 10000);
+	}
+	if (std::strcmp(name, "samplers") == 0) {
+		return benchmarkSamplers(size ? size : 1024);
+	}
+	if (std::strcmp(name, "adaptive") == 0) {
+		return benchmarkAdaptive(size ? size : 512);
+	}
+	if (std::strcmp(name, "textures") == 0) {
+		return benchmarkTextures(size ? size : 48);
+	}
+	if (std::strcmp(name, "denoiser") == 0) {
+		return benchmarkDenoiser(size ? size : 256);
+	}
+	if (std::strcmp(name, "display") == 0) {
+		return benchmarkDisplay(size ? size : 64);
+	}
+	if (std::strcmp(name, "computescene") == 0) {
+		return benchmarkComputeScene(size ? size : 1000000);
+	}
+	if (std::strcmp(name, "compute") == 0) {
+		return benchmarkCompute(size ? size : 4 << 20);
+	}
+	std::cout << "unknown benchmark: " << name << std::endl;
+	return 1;
+}
+
+static double millisecondsSince(std::chrono::high_resolution_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// uv sphere with a texture seam at u = 0 and one wedge per pole row
+static void makeSphere(uint32_t segments, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+	for (uint32_t y = 0; y <= segments; ++y) {
+		for (uint32_t x = 0; x <= segments; ++x) {
+			float u = x / (float)segments, v = y / (float)segments;
+			float theta = (x == segments ? 0.0f : u) * glm::two_pi<float>(), phi = v * glm::pi<float>();
+			Vertex vertex;
+			vertex.pos = glm::vec3(std::sin(phi) * std::cos(theta), std::sin(phi) * std::sin(theta), std::cos(phi));
+			if (y == 0 || y == segments) {
+				vertex.pos = glm::vec3(0.0f, 0.0f, y == 0 ? 1.0f : -1.0f);
+			}
+			vertex.color = glm::vec3(1.0f);
+			vertex.texCoord = glm::vec2(u, v);
+			vertices.push_back(vertex);
+		}
+	}
+	for (uint32_t y = 0; y < segments; ++y) {
+		for (uint32_t x = 0; x < segments; ++x) {
+			uint32_t a = y * (segments + 1) + x, b = a + 1, c = a + segments + 1, d = c + 1;
+			indices.insert(indices.end(), { a, c, b, b, c, d });
+		}
+	}
+}
+
+int benchmarkCulling(size_t objectCount) {
+	std::mt19937 rng(1337);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+	std::uniform_real_distribution<float> radius(0.5f, 4.0f);
+
+	CullingSystem culling;
+	std::vector<glm::vec4> spheres(objectCount);
+	for (size_t i = 0; i < objectCount; ++i) {
+		spheres[i] = glm::vec4(position(rng), position(rng), position(rng), radius(rng));
+		culling.addObject(glm::vec3(spheres[i]), spheres[i].w, (uint32_t)i);
+	}
+
+	glm::mat4 proj = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+	const int kFrames = 64;
+	double total = 0, best = 1e30;
+	size_t visible = 0, mismatches = 0;
+	std::vector<uint8_t> culled(objectCount);
+	for (int frame = 0; frame < kFrames; ++frame) {
+		// orbit the camera so the visible set changes every frame
+		float angle = frame * glm::two_pi<float>() / kFrames;
+		glm::vec3 eye(std::cos(angle) * 50.0f, 10.0f, std::sin(angle) * 50.0f);
+		glm::mat4 view = glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0, 1, 0));
+		const std::vector<uint32_t>& drawList = culling.cull(proj * view);
+		visible += drawList.size();
+		total += culling.lastCullMilliseconds();
+		best = std::min(best, culling.lastCullMilliseconds());
+
+		// the lanes against one sphere at a time, spheres within rounding of a plane may go either way
+		Frustum frustum = Frustum::fromMatrix(proj * view);
+		std::fill(culled.begin(), culled.end(), 1);
+		for (uint32_t drawId : drawList) {
+			culled[drawId] = 0;
+		}
+		for (size_t i = 0; i < objectCount; ++i) {
+			float margin = FLT_MAX;
+			for (const glm::vec4& plane : frustum.planes) {
+				margin = std::min(margin, glm::dot(glm::vec3(plane), glm::vec3(spheres[i])) + plane.w + spheres[i].w);
+			}
+			mismatches += (margin < 0.0f) != (culled[i] != 0) && std::abs(margin) > 1e-3f;
+		}
+	}
+
+	std::cout << "culling: " << objectCount << " objects, " << JobSystem::shared().threadCount() << " threads, "
+		<< "avg " << total / kFrames << " ms, best " << best << " ms, "
+		<< objectCount / (best * 1000.0) << " Mobjects/s, "
+		<< visible / kFrames << " visible" << (mismatches ? ", MISMATCHES AGAINST ONE SPHERE AT A TIME" : "")
+		<< std::endl;
+	return mismatches ? 1 : 0;
+}
+
+int benchmarkMeshlets(size_t segments) {
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	makeSphere((uint32_t)segments, vertices, indices);
+	std::vector<glm::vec3> positions;
+	for (const Vertex& vertex : vertices) {
+		positions.push_back(vertex.pos);
+	}
+	auto buildStart = std::chrono::high_resolution_clock::now();
+	MeshletMesh mesh = buildMeshlets(positions, indices);
+	double buildMilliseconds = millisecondsSince(buildStart);
+	std::cout << "meshlets: " << indices.size() / 3 << " triangles in " << mesh.meshlets.size() << " meshlets, built in "
+		<< buildMilliseconds << " ms" << std::endl;
+
+	// close to the sphere and circling it, so the frustum cuts it and half of it faces away
+	glm::mat4 proj = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+	const int kFrames = 64;
+	std::vector<uint32_t> culled(indices.size());
+	double cullMilliseconds = 0;
+	size_t drawn = 0, outside = 0, backfacing = 0, wronglyCulled = 0;
+	for (int frame = 0; frame < kFrames; ++frame) {
+		float angle = frame * glm::two_pi<float>() / kFrames;
+		glm::vec3 camera(std::cos(angle) * 1.6f, std::sin(angle) * 1.6f, 0.4f);
+		Frustum frustum = Frustum::fromMatrix(proj * glm::lookAt(camera, glm::vec3(0.0f, 0.0f, 0.6f),
+			glm::vec3(0, 0, 1)));
+		auto start = std::chrono::high_resolution_clock::now();
+		uint32_t indexCount = cullMeshlets(mesh.meshlets.data(), mesh.vertices.data(), mesh.triangles.data(), 0,
+			(uint32_t)mesh.meshlets.size(), frustum, camera, culled.data());
+		cullMilliseconds += millisecondsSince(start);
+		drawn += indexCount / 3;
+
+		// every triangle of a culled meshlet has to be outside a plane or facing away, zero area ones aside
+		for (const Meshlet& meshlet : mesh.meshlets) {
+			bool meshletOutside = false;
+			for (const glm::vec4& plane : frustum.planes) {
+				meshletOutside = meshletOutside
+					|| glm::dot(glm::vec3(plane), glm::vec3(meshlet.sphere)) + plane.w < -meshlet.sphere.w;
+			}
+			bool meshletBackfacing = !meshletOutside && isMeshletBackfacing(meshlet, camera);
+			outside += meshletOutside ? meshlet.triangleCount : 0;
+			backfacing += meshletBackfacing ? meshlet.triangleCount : 0;
+			for (uint32_t i = 0; i < meshlet.triangleCount && (meshletOutside || meshletBackfacing); ++i) {
+				uint32_t packed = mesh.triangles[meshlet.triangleOffset + i];
+				glm::vec3 corners[3];
+				for (uint32_t corner = 0; corner < 3; ++corner) {
+					corners[corner] = positions[mesh.vertices[meshlet.vertexOffset + (packed >> (corner * 8) & 0xff)]];
+				}
+				bool triangleOutside = false;
+				for (const glm::vec4& plane : frustum.planes) {
+					bool allOutside = true;
+					for (const glm::vec3& corner : corners) {
+						allOutside = allOutside && glm::dot(glm::vec3(plane), corner) + plane.w < 1e-5f;
+					}
+					triangleOutside = triangleOutside || allOutside;
+				}
+				glm::vec3 normal = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+				bool triangleBackfacing = glm::length(normal) == 0.0f
+					|| glm::dot(glm::normalize(normal), glm::normalize(corners[0] - camera)) >= -1e-4f;
+				wronglyCulled += meshletOutside ? !triangleOutside : !triangleBackfacing;
+			}
+		}
+	}
+	size_t total = indices.size() / 3 * kFrames;
+	std::cout << "  " << kFrames << " views: " << cullMilliseconds / kFrames << " ms, "
+		<< indices.size() / 3 / (cullMilliseconds / kFrames * 1000.0) << " Mtris/s, "
+		<< 100.0 * drawn / total << "% drawn, " << 100.0 * outside / total << "% outside, "
+		<< 100.0 * backfacing / total << "% facing away, " << (wronglyCulled ? "VISIBLE TRIANGLES CULLED"
+		: "every culled triangle is outside or facing away") << std::endl;
+	return wronglyCulled || drawn + outside + backfacing != total ? 1 : 0;
+}
+
+int benchmarkLod(size_t instanceCount) {
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	makeSphere(256, vertices, indices);
+
+	// offline: simplify and lay the chain out with its meshlets the way a scene file stores it
+	auto buildStart = std::chrono::high_resolution_clock::now();
+	MeshAsset asset = buildMeshAsset(vertices, indices);
+	double buildMilliseconds = millisecondsSince(buildStart);
+	std::cout << "lod: simplified " << indices.size() / 3 << " triangles in " << buildMilliseconds << " ms, "
+		<< indices.size() / 3 / (buildMilliseconds * 1000.0) << " Mtris/s" << std::endl;
+	for (size_t lod = 0; lod < asset.lods.size(); ++lod) {
+		std::cout << "  lod " << lod << ": " << asset.lods[lod].indexCount / 3 << " triangles, error "
+			<< asset.lods[lod].error << std::endl;
+	}
+	SceneBuilder builder;
+	builder.addMesh(asset);
+	SceneFile scene;
+	scene.openMemory(builder.serialize());
+	const SceneMesh& mesh = scene.meshes()[0];
+
+	// instances spread over a large field, seen from a camera flying across it
+	std::mt19937 rng(1337);
+	std::uniform_real_distribution<float> position(-2000.0f, 2000.0f);
+	std::uniform_real_distribution<float> scale(0.5f, 4.0f);
+	CullingSystem culling;
+	std::vector<glm::vec4> spheres(instanceCount);
+	std::vector<float> scales(instanceCount);
+	for (size_t i = 0; i < instanceCount; ++i) {
+		scales[i] = scale(rng);
+		spheres[i] = glm::vec4(position(rng), 0.0f, position(rng), mesh.bounds.w * scales[i]);
+		culling.addObject(glm::vec3(spheres[i]), spheres[i].w, (uint32_t)i);
+	}
+
+	// a frame is the cpu side of the launcher's draw: cull the instances, pick their lods and cluster cull
+	// the picked range in object space, lods off keeps every instance at lod 0
+	glm::mat4 proj = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 5000.0f);
+	float pixelScale = lodPixelScale(proj, 1080.0f);
+	const int kFrames = 8;
+	std::vector<uint32_t> selected(instanceCount);
+	auto runFrames = [&](bool useLods, double& frameMilliseconds, size_t& triangles, size_t& drawn) {
+		frameMilliseconds = 0;
+		triangles = drawn = 0;
+		for (int frame = 0; frame < kFrames; ++frame) {
+			glm::vec3 camera(-2000.0f + frame * 4000.0f / kFrames, 20.0f, 0.0f);
+			glm::mat4 view = glm::lookAt(camera, camera + glm::vec3(1.0f, -0.05f, 0.3f), glm::vec3(0, 1, 0));
+			auto start = std::chrono::high_resolution_clock::now();
+			const std::vector<uint32_t>& drawList = culling.cull(proj * view);
+			std::atomic<size_t> frameTriangles{ 0 }, frameDrawn{ 0 };
+			JobSystem::shared().parallelFor(drawList.size(), 16, [&](size_t begin, size_t end) {
+				std::vector<uint32_t> clusterIndices(scene.lods()[mesh.firstLod].indexCount);
+				size_t jobTriangles = 0, jobDrawn = 0;
+				for (size_t i = begin; i < end; ++i) {
+					uint32_t instance = drawList[i];
+					uint32_t lod = useLods ? selectLod(&scene.lods()[mesh.firstLod], mesh.lodCount, spheres[instance],
+						scales[instance], camera, pixelScale) : 0;
+					glm::mat4 model = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(spheres[instance])),
+						glm::vec3(scales[instance]));
+					glm::vec3 objectCamera = glm::vec3(glm::inverse(model) * glm::vec4(camera, 1.0f));
+					glm::uvec2 lodMeshlets = scene.lodMeshlets()[mesh.firstLod + lod];
+					jobTriangles += scene.lods()[mesh.firstLod + lod].indexCount / 3;
+					jobDrawn += cullMeshlets(scene.meshlets().data(), scene.meshletVertices().data(),
+						scene.meshletTriangles().data(), lodMeshlets.x, lodMeshlets.y,
+						Frustum::fromMatrix(proj * view * model), objectCamera, clusterIndices.data()) / 3;
+				}
+				frameTriangles += jobTriangles;
+				frameDrawn += jobDrawn;
+			});
+			frameMilliseconds += millisecondsSince(start);
+			triangles += frameTriangles;
+			drawn += frameDrawn;
+		}
+		frameMilliseconds /= kFrames;
+		triangles /= kFrames;
+		drawn /= kFrames;
+	};
+
+	double lodMilliseconds, fullMilliseconds;
+	size_t lodTriangles, fullTriangles, lodDrawn, fullDrawn;
+	runFrames(true, lodMilliseconds, lodTriangles, lodDrawn);
+	runFrames(false, fullMilliseconds, fullTriangles, fullDrawn);
+	std::cout << "lod: " << instanceCount << " instances, " << JobSystem::shared().threadCount() << " threads"
+		<< std::endl;
+	std::cout << "  lods on:  " << lodMilliseconds << " ms/frame, " << lodTriangles << " triangles/frame, "
+		<< lodDrawn << " drawn, " << lodTriangles / (lodMilliseconds * 1000.0) << " Mtris/s" << std::endl;
+	std::cout << "  lods off: " << fullMilliseconds << " ms/frame, " << fullTriangles << " triangles/frame, "
+		<< fullDrawn << " drawn, " << fullTriangles / (fullMilliseconds * 1000.0) << " Mtris/s" << std::endl;
+	std::cout << "  " << (double)fullTriangles / lodTriangles << "x fewer triangles, "
+		<< fullMilliseconds / lodMilliseconds << "x faster frames" << std::endl;
+	return 0;
+}
+
+int benchmarkScene(size_t megabytes) {
+	// one lod is enough here, only the amount of data matters
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	makeSphere(128, vertices, indices);
+	MeshAsset asset;
+	asset.vertices = vertices;
+	asset.indices = indices;
+	asset.lods.push_back({ 0, (uint32_t)indices.size(), 0.0f });
+	asset.bounds = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+	SceneBuilder builder;
+	SceneMaterial material = {};
+	material.baseColorTexture = builder.addTexture("textures/chicks.jpg");
+	material.metallicRoughnessTexture = kSceneNone;
+	uint32_t materialIndex = builder.addMaterial(material);
+	uint32_t mesh = builder.addMesh(asset);
+	size_t meshBytes = builder.serialize().size();
+	size_t meshCount = std::max<size_t>(1, megabytes * 1024 * 1024 / meshBytes);
+	for (size_t i = 0; i < meshCount; ++i) {
+		if (i > 0) {
+			mesh = builder.addMesh(asset);
+		}
+		glm::mat4 local = glm::translate(glm::mat4(1.0f), glm::vec3((float)i * 3.0f, 0.0f, 0.0f));
+		builder.addNode(local, kSceneNone, mesh, materialIndex);
+	}
+	const char *filename = "benchmark.fpbrscene";
+	builder.write(filename);
+
+	// map and validate, nothing is read beyond the header
+	auto openStart = std::chrono::high_resolution_clock::now();
+	SceneFile scene;
+	scene.open(filename);
+	double openMilliseconds = millisecondsSince(openStart);
+
+	// what uploading costs on top: every array copied once, as into a staging buffer
+	std::vector<uint8_t> staging(scene.byteSize());
+	auto copyStart = std::chrono::high_resolution_clock::now();
+	size_t offset = 0;
+	auto copy = [&](const auto& view) {
+		size_t bytes = sizeof(view[0]) * view.size();
+		if (bytes > 0) {
+			std::memcpy(staging.data() + offset, view.data(), bytes);
+		}
+		offset += bytes;
+	};
+	copy(scene.vertices());
+	copy(scene.indices());
+	copy(scene.meshlets());
+	copy(scene.meshletVertices());
+	copy(scene.meshletTriangles());
+	double copyMilliseconds = millisecondsSince(copyStart);
+
+	// the same file read through a stream for reference
+	auto readStart = std::chrono::high_resolution_clock::now();
+	std::ifstream file(filename, std::ios::binary);
+	std::vector<char> contents(scene.byteSize());
+	file.read(contents.data(), contents.size());
+	double readMilliseconds = millisecondsSince(readStart);
+
+	double mb = scene.byteSize() / (1024.0 * 1024.0);
+	std::cout << "scene: " << mb << " MB, " << scene.nodes().size() << " nodes, "
+		<< scene.meshlets().size() << " meshlets" << std::endl;
+	std::cout << "  open (map + validate): " << openMilliseconds << " ms" << std::endl;
+	std::cout << "  copy out of the mapping: " << copyMilliseconds << " ms, " << offset / (1024.0 * 1024.0) /
+		(copyMilliseconds / 1000.0) << " MB/s" << std::endl;
+	std::cout << "  stream read: " << readMilliseconds << " ms, " << mb / (readMilliseconds / 1000.0) << " MB/s"
+		<< std::endl;
+	file.close();
+	scene.close();
+	std::remove(filename);
+	return 0;
+}
+
+int benchmarkTransforms(size_t nodeCount) {
+	// random tree, a few roots and every other node hanging off an earlier one
+	std::mt19937 rng(1337);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	std::vector<uint32_t> parents(nodeCount);
+	std::vector<glm::vec3> translations(nodeCount);
+	std::vector<glm::quat> rotations(nodeCount);
+	std::vector<glm::vec3> scales(nodeCount);
+	for (size_t i = 0; i < nodeCount; ++i) {
+		parents[i] = i < 16 ? kTransformNone : std::uniform_int_distribution<uint32_t>(0, (uint32_t)i - 1)(rng);
+		translations[i] = glm::vec3(unit(rng), unit(rng), unit(rng));
+		rotations[i] = glm::angleAxis(unit(rng) * glm::pi<float>(),
+			glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng) + 2.0f)));
+		scales[i] = glm::vec3(1.0f + unit(rng) * 0.01f);
+	}
+
+	TransformHierarchy hierarchy;
+	for (size_t i = 0; i < nodeCount; ++i) {
+		hierarchy.addNode(parents[i], translations[i], rotations[i], scales[i]);
+	}
+	hierarchy.update();
+
+	// per node glm composition, the straightforward version of the same thing
+	std::vector<glm::mat4> naiveWorld(nodeCount);
+	auto naiveUpdate = [&]() {
+		for (size_t i = 0; i < nodeCount; ++i) {
+			glm::mat4 local = glm::translate(glm::mat4(1.0f), translations[i]) * glm::mat4_cast(rotations[i])
+				* glm::scale(glm::mat4(1.0f), scales[i]);
+			naiveWorld[i] = parents[i] == kTransformNone ? local : naiveWorld[parents[i]] * local;
+		}
+	};
+
+	const int kFrames = 16;
+	std::vector<uint32_t> animated;
+	double naiveMilliseconds = 0, fullMilliseconds = 0, partialMilliseconds = 0;
+	size_t partialNodes = 0;
+	for (int frame = 0; frame < kFrames; ++frame) {
+		glm::quat spin = glm::angleAxis(0.01f * (frame + 1), glm::vec3(0.0f, 1.0f, 0.0f));
+		for (size_t i = 0; i < nodeCount; ++i) {
+			rotations[i] = glm::normalize(spin * rotations[i]);
+			hierarchy.setRotation((uint32_t)i, rotations[i]);
+		}
+		auto naiveStart = std::chrono::high_resolution_clock::now();
+		naiveUpdate();
+		naiveMilliseconds += millisecondsSince(naiveStart);
+		hierarchy.update();
+		fullMilliseconds += hierarchy.lastUpdateMilliseconds();
+
+		// a typical frame only animates a few nodes
+		for (size_t i = 0; i < nodeCount / 100; ++i) {
+			uint32_t node = std::uniform_int_distribution<uint32_t>(0, (uint32_t)nodeCount - 1)(rng);
+			rotations[node] = glm::normalize(spin * rotations[node]);
+			hierarchy.setRotation(node, rotations[node]);
+		}
+		partialNodes += hierarchy.update();
+		partialMilliseconds += hierarchy.lastUpdateMilliseconds();
+	}
+
+	naiveUpdate();
+	float maxError = 0;
+	for (size_t i = 0; i < nodeCount; ++i) {
+		for (int c = 0; c < 4; ++c) {
+			glm::vec4 difference = glm::abs(hierarchy.world((uint32_t)i)[c] - naiveWorld[i][c]);
+			maxError = std::max(maxError, std::max(std::max(difference.x, difference.y),
+				std::max(difference.z, difference.w)));
+		}
+	}
+
+	std::cout << "transforms: " << nodeCount << " nodes, " << JobSystem::shared().threadCount() << " threads"
+		<< std::endl;
+	std::cout << "  naive glm: " << naiveMilliseconds / kFrames << " ms/frame" << std::endl;
+	std::cout << "  hierarchy, all dirty: " << fullMilliseconds / kFrames << " ms/frame ("
+		<< naiveMilliseconds / fullMilliseconds << "x)" << std::endl;
+	std::cout << "  hierarchy, 1% animated: " << partialMilliseconds / kFrames << " ms/frame, "
+		<< partialNodes / kFrames << " nodes updated" << std::endl;
+	std::cout << "  max difference to glm: " << maxError << std::endl;
+	return 0;
+}
+
+int benchmarkPathTracer(size_t sphereCount) {
+	// a row of spheres on a floor in front of the default camera
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	makeSphere(32, vertices, indices);
+	SceneBuilder builder;
+	SceneMaterial material = {};
+	material.baseColor = glm::vec4(0.8f, 0.8f, 0.8f, 1.0f);
+	material.roughness = 1.0f;
+	material.baseColorTexture = kSceneNone;
+	material.metallicRoughnessTexture = kSceneNone;
+	uint32_t white = builder.addMaterial(material);
+	MeshAsset sphere;
+	sphere.vertices = vertices;
+	sphere.indices = indices;
+	sphere.lods.push_back({ 0, (uint32_t)indices.size(), 0.0f });
+	sphere.bounds = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	uint32_t sphereMesh = builder.addMesh(sphere);
+	for (size_t i = 0; i < sphereCount; ++i) {
+		float x = ((float)i / std::max<size_t>(1, sphereCount - 1) - 0.5f) * 1.6f;
+		glm::mat4 local = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(x, -0.2f, -(float)(i % 3) * 0.3f)),
+			glm::vec3(0.1f));
+		builder.addNode(local, kSceneNone, sphereMesh, white);
+	}
+	std::vector<Vertex> floorVertices = {
+		{ { -5.0f, -0.3f, -5.0f }, { 1.0f, 1.0f, 1.0f }, { 0.0f, 0.0f } },
+		{ { 5.0f, -0.3f, -5.0f }, { 1.0f, 1.0f, 1.0f }, { 1.0f, 0.0f } },
+		{ { 5.0f, -0.3f, 5.0f }, { 1.0f, 1.0f, 1.0f }, { 1.0f, 1.0f } },
+		{ { -5.0f, -0.3f, 5.0f }, { 1.0f, 1.0f, 1.0f }, { 0.0f, 1.0f } }
+	};
+	MeshAsset floor;
+	floor.vertices = floorVertices;
+	floor.indices = { 0, 2, 1, 0, 3, 2 };
+	floor.lods.push_back({ 0, 6, 0.0f });
+	floor.bounds = glm::vec4(0.0f, -0.3f, 0.0f, 7.1f);
+	builder.addNode(glm::mat4(1.0f), kSceneNone, builder.addMesh(floor), white);
+
+	SceneFile scene;
+	scene.openMemory(builder.serialize());
+	PathTracer pathTracer;
+	pathTracer.setScene(scene);
+	pathTracer.setSamplesPerPixel(4);
+	HdrImage image;
+	image.resize(640, 360);
+	auto renderStart = std::chrono::high_resolution_clock::now();
+	pathTracer.render(defaultFrame(640.0f / 360.0f), image);
+	double renderMilliseconds = millisecondsSince(renderStart);
+
+	std::cout << "pathtracer: " << pathTracer.triangleCount() << " triangles, " << image.width << "x"
+		<< image.height << " at " << pathTracer.samplesPerPixel() << " spp, " << JobSystem::shared().threadCount()
+		<< " threads" << std::endl;
+	std::cout << "  " << renderMilliseconds << " ms, " << pathTracer.lastRayCount() / (renderMilliseconds * 1000.0)
+		<< " Mrays/s" << std::endl;
+	writeHdr("benchmark_pathtracer.hdr", image);
+	return 0;
+}
+
+// corners of the test meshes the bvh benchmarks run on, about triangleCount triangles each
+static std::vector<std::pair<const char*, std::vector<glm::vec3>>> makeTestMeshes(size_t triangleCount) {
+	std::vector<std::pair<const char*, std::vector<glm::vec3>>> meshes;
+
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	makeSphere((uint32_t)std::max(4.0, std::sqrt(triangleCount / 2.0)), vertices, indices);
+	std::vector<glm::vec3> sphere;
+	for (uint32_t index : indices) {
+		sphere.push_back(vertices[index].pos);
+	}
+	meshes.push_back({ "sphere", sphere });
+
+	// rolling height field, long thin triangles along one axis
+	uint32_t gridSize = (uint32_t)std::max(2.0, std::sqrt(triangleCount / 2.0));
+	auto height = [](float x, float z) { return 0.1f * std::sin(x * 7.0f) * std::cos(z * 5.0f); };
+	std::vector<glm::vec3> terrain;
+	for (uint32_t z = 0; z < gridSize; ++z) {
+		for (uint32_t x = 0; x < gridSize; ++x) {
+			float x0 = (float)x / gridSize * 4.0f - 2.0f, x1 = (float)(x + 1) / gridSize * 4.0f - 2.0f;
+			float z0 = (float)z / gridSize - 0.5f, z1 = (float)(z + 1) / gridSize - 0.5f;
+			glm::vec3 a(x0, height(x0, z0), z0), b(x1, height(x1, z0), z0);
+			glm::vec3 c(x1, height(x1, z1), z1), d(x0, height(x0, z1), z1);
+			terrain.insert(terrain.end(), { a, b, c, a, c, d });
+		}
+	}
+	meshes.push_back({ "terrain", terrain });
+
+	// small triangles scattered through a cube, the worst case for overlap
+	std::mt19937 rng(1337);
+	std::uniform_real_distribution<float> position(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> jitter(-0.01f, 0.01f);
+	std::vector<glm::vec3> soup;
+	for (size_t i = 0; i < triangleCount; ++i) {
+		glm::vec3 center(position(rng), position(rng), position(rng));
+		for (int corner = 0; corner < 3; ++corner) {
+			soup.push_back(center + glm::vec3(jitter(rng), jitter(rng), jitter(rng)));
+		}
+	}
+	meshes.push_back({ "soup", soup });
+	return meshes;
+}
+
+// rays from a sphere around the mesh towards random points inside it
+static std::vector<Ray> makeTestRays(size_t rayCount) {
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	std::vector<Ray> rays(rayCount);
+	for (auto& ray : rays) {
+		glm::vec3 from = glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng))) * 4.0f;
+		glm::vec3 to(unit(rng) * 0.5f, unit(rng) * 0.5f, unit(rng) * 0.5f);
+		ray.origin = from;
+		ray.direction = glm::normalize(to - from);
+		ray.tMin = 0.0f;
+		ray.tMax = FLT_MAX;
+	}
+	return rays;
+}
+
+// Mrays/s through the bvh, the first rays are checked against every triangle
+static double traceTestRays(const Bvh& bvh, const std::vector<glm::vec3>& corners, const std::vector<Ray>& rays,
+	size_t& mismatches) {
+	auto intersectCorners = [&](const Ray& ray, uint32_t triangle, RayHit& hit) {
+		return intersectTriangle(ray, corners[triangle * 3], corners[triangle * 3 + 1], corners[triangle * 3 + 2],
+			triangle, hit);
+	};
+	auto traceStart = std::chrono::high_resolution_clock::now();
+	std::vector<RayHit> hits(rays.size());
+	JobSystem::shared().parallelFor(rays.size(), 1024, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			bvh.intersect(rays[i], hits[i], [&](uint32_t triangle, RayHit& hit) {
+				return intersectCorners(rays[i], triangle, hit);
+			});
+		}
+	});
+	double traceMilliseconds = millisecondsSince(traceStart);
+
+	mismatches = 0;
+	for (size_t i = 0; i < std::min<size_t>(64, rays.size()); ++i) {
+		RayHit reference;
+		for (uint32_t triangle = 0; triangle < corners.size() / 3; ++triangle) {
+			intersectCorners(rays[i], triangle, reference);
+		}
+		mismatches += reference.t != hits[i].t;
+	}
+	return rays.size() / (traceMilliseconds * 1000.0);
+}
+
+int benchmarkBvh(size_t triangleCount) {
+	std::cout << "bvh: binned sah, " << Bvh::kBinCount << " bins, " << JobSystem::shared().threadCount()
+		<< " threads" << std::endl;
+	std::vector<Ray> rays = makeTestRays(200000);
+	bool failed = false;
+	for (const auto& mesh : makeTestMeshes(triangleCount)) {
+		const std::vector<glm::vec3>& corners = mesh.second;
+		size_t meshTriangles = corners.size() / 3;
+		Bvh bvh;
+		bvh.buildTriangles(corners.data(), meshTriangles);
+		size_t mismatches;
+		double megaRays = traceTestRays(bvh, corners, rays, mismatches);
+
+		std::cout << "  " << mesh.first << ": " << meshTriangles << " triangles, " << bvh.nodes().size()
+			<< " nodes, built in " << bvh.lastBuildMilliseconds() << " ms, "
+			<< meshTriangles / (bvh.lastBuildMilliseconds() * 1000.0) << " Mtris/s, sah cost " << bvh.sahCost()
+			<< ", " << megaRays << " Mrays/s" << (mismatches ? ", MISMATCHES AGAINST BRUTE FORCE" : "") << std::endl;
+		failed = failed || mismatches;
+	}
+	return failed ? 1 : 0;
+}
+
+int benchmarkLbvh(size_t triangleCount) {
+	std::cout << "lbvh: linear builds against binned sah, " << JobSystem::shared().threadCount() << " threads"
+		<< std::endl;
+	std::vector<Ray> rays = makeTestRays(200000);
+	bool failed = false;
+	for (const auto& mesh : makeTestMeshes(triangleCount)) {
+		const std::vector<glm::vec3>& corners = mesh.second;
+		size_t meshTriangles = corners.size() / 3;
+		std::vector<Aabb> bounds(meshTriangles);
+		for (size_t i = 0; i < meshTriangles; ++i) {
+			bounds[i].grow(corners[i * 3]);
+			bounds[i].grow(corners[i * 3 + 1]);
+			bounds[i].grow(corners[i * 3 + 2]);
+		}
+		std::cout << "  " << mesh.first << ": " << meshTriangles << " triangles" << std::endl;
+		const char *builders[] = { "sah", "linear", "linear + treelets" };
+		for (int builder = 0; builder < 3; ++builder) {
+			// best of a few builds, the first one also pays for page faults
+			Bvh bvh;
+			double best = 1e30;
+			for (int run = 0; run < 3; ++run) {
+				if (builder == 0) {
+					bvh.build(bounds.data(), meshTriangles);
+				} else {
+					bvh.buildLinear(bounds.data(), meshTriangles, builder == 2);
+				}
+				best = std::min(best, bvh.lastBuildMilliseconds());
+			}
+			size_t mismatches;
+			double megaRays = traceTestRays(bvh, corners, rays, mismatches);
+			std::cout << "    " << builders[builder] << ": built in " << best << " ms, "
+				<< meshTriangles / (best * 1000.0) << " Mtris/s, " << bvh.nodes().size() << " nodes, sah cost "
+				<< bvh.sahCost() << ", " << megaRays << " Mrays/s"
+				<< (mismatches ? ", MISMATCHES AGAINST BRUTE FORCE" : "") << std::endl;
+			failed = failed || mismatches;
+		}
+	}
+	return failed ? 1 : 0;
+}
+
+int benchmarkRefit(size_t triangleCount) {
+	// the sphere twists around the x axis further every frame, nearby triangles drift apart
+	std::vector<glm::vec3> rest = makeTestMeshes(triangleCount)[0].second;
+	size_t meshTriangles = rest.size() / 3;
+	const int kFrames = 60;
+	auto deform = [&](int frame, std::vector<glm::vec3>& corners) {
+		float twist = 4.0f * frame / kFrames;
+		JobSystem::shared().parallelFor(rest.size(), 16384, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				glm::vec3 p = rest[i];
+				float angle = twist * p.x;
+				float c = std::cos(angle), s = std::sin(angle);
+				corners[i] = glm::vec3(p.x * (1.0f + 0.2f * frame / kFrames), c * p.y - s * p.z, s * p.y + c * p.z);
+			}
+		});
+	};
+
+	std::cout << "refit: twisting sphere, " << meshTriangles << " triangles, " << kFrames << " frames, "
+		<< JobSystem::shared().threadCount() << " threads" << std::endl;
+	const char *policies[] = { "refit only", "refit, rotate past 1.05, rebuild past 1.3", "rebuild every frame" };
+	const char *updateNames[] = { "refit", "rotate", "rebuild" };
+	std::vector<Ray> rays = makeTestRays(100000);
+	bool failed = false;
+	for (int policy = 0; policy < 3; ++policy) {
+		std::vector<glm::vec3> corners(rest.size());
+		deform(0, corners);
+		DeformingBvh deforming;
+		if (policy == 0) {
+			deforming.setThresholds(FLT_MAX, FLT_MAX);
+		} else if (policy == 2) {
+			deforming.setThresholds(FLT_MAX, 0.0f);
+		}
+		deforming.build(corners.data(), meshTriangles);
+		std::cout << "  " << policies[policy] << ":" << std::endl;
+		double total = 0;
+		int counts[3] = {};
+		for (int frame = 1; frame <= kFrames; ++frame) {
+			deform(frame, corners);
+			const DeformingBvh::UpdateStats& stats = deforming.update(corners.data());
+			total += stats.milliseconds;
+			++counts[(int)stats.update];
+			if (frame % 10 == 0) {
+				std::cout << "    frame " << frame << ": " << updateNames[(int)stats.update] << " in "
+					<< stats.milliseconds << " ms, refit " << deforming.bvh().lastRefitMilliseconds()
+					<< " ms, sah cost " << stats.sahCost << ", drift " << stats.drift << std::endl;
+			}
+		}
+		size_t mismatches;
+		double megaRays = traceTestRays(deforming.bvh(), corners, rays, mismatches);
+		std::cout << "    avg " << total / kFrames << " ms per frame, " << counts[0] << " refits, " << counts[1]
+			<< " rotating refits, " << counts[2] << " rebuilds, last frame " << megaRays << " Mrays/s"
+			<< (mismatches ? ", MISMATCHES AGAINST BRUTE FORCE" : "") << std::endl;
+		failed = failed || mismatches;
+	}
+	return failed ? 1 : 0;
+}
+
+// pinhole camera rays looking at the origin, row by row
+static std::vector<Ray> makeCameraRays(uint32_t width, uint32_t height, const glm::vec3& eye) {
+	glm::vec3 forward = glm::normalize(-eye);
+	glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+	glm::vec3 up = glm::cross(right, forward);
+	float tanHalfFov = std::tan(glm::radians(30.0f));
+	std::vector<Ray> rays((size_t)width * height);
+	for (uint32_t y = 0; y < height; ++y) {
+		for (uint32_t x = 0; x < width; ++x) {
+			float u = ((x + 0.5f) / width * 2.0f - 1.0f) * tanHalfFov * width / height;
+			float v = (1.0f - (y + 0.5f) / height * 2.0f) * tanHalfFov;
+			Ray& ray = rays[(size_t)y * width + x];
+			ray.origin = eye;
+			ray.direction = glm::normalize(forward + right * u + up * v);
+			ray.tMin = 0.0f;
+			ray.tMax = FLT_MAX;
+		}
+	}
+	return rays;
+}
+
+// cosine distributed bounces off every hit of the given rays
+static std::vector<Ray> makeDiffuseRays(const std::vector<glm::vec3>& corners, const std::vector<Ray>& rays,
+	const std::vector<RayHit>& hits) {
+	std::mt19937 rng(11);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::vector<Ray> bounces;
+	for (size_t i = 0; i < rays.size(); ++i) {
+		if (!hits[i].valid()) {
+			continue;
+		}
+		const glm::vec3 *triangle = &corners[(size_t)hits[i].triangle * 3];
+		glm::vec3 normal = glm::normalize(glm::cross(triangle[1] - triangle[0], triangle[2] - triangle[0]));
+		if (glm::dot(normal, rays[i].direction) > 0.0f) {
+			normal = -normal;
+		}
+		glm::vec3 tangent = glm::normalize(glm::cross(std::abs(normal.x) > 0.5f ? glm::vec3(0, 1, 0)
+			: glm::vec3(1, 0, 0), normal));
+		glm::vec3 bitangent = glm::cross(normal, tangent);
+		float radius = std::sqrt(unit(rng)), phi = glm::two_pi<float>() * unit(rng);
+		Ray bounce;
+		bounce.origin = rays[i].origin + rays[i].direction * hits[i].t + normal * 1e-4f;
+		bounce.direction = glm::normalize(tangent * (radius * std::cos(phi)) + bitangent * (radius * std::sin(phi))
+			+ normal * std::sqrt(std::max(0.0f, 1.0f - radius * radius)));
+		bounce.tMin = 0.0f;
+		bounce.tMax = FLT_MAX;
+		bounces.push_back(bounce);
+	}
+	return bounces;
+}
+
+int benchmarkWideBvh(size_t triangleCount) {
+	std::cout << "widebvh: binary against 4 and 8 wide traversal, " << JobSystem::shared().threadCount()
+		<< " threads" << std::endl;
+	std::vector<Ray> cameraRays = makeCameraRays(1280, 720, glm::vec3(0.0f, 1.5f, 3.5f));
+	bool failed = false;
+	for (const auto& mesh : makeTestMeshes(triangleCount)) {
+		const std::vector<glm::vec3>& corners = mesh.second;
+		size_t meshTriangles = corners.size() / 3;
+		Bvh bvh;
+		bvh.buildTriangles(corners.data(), meshTriangles);
+		Bvh4 bvh4;
+		bvh4.collapse(bvh);
+		Bvh8 bvh8;
+		bvh8.collapse(bvh);
+		std::cout << "  " << mesh.first << ": " << meshTriangles << " triangles, " << bvh.nodes().size()
+			<< " binary nodes, " << bvh4.nodes().size() << " bvh4 nodes collapsed in " << bvh4.lastCollapseMilliseconds()
+			<< " ms, " << bvh8.nodes().size() << " bvh8 nodes collapsed in " << bvh8.lastCollapseMilliseconds() << " ms"
+			<< std::endl;
+
+		auto trace = [&](int width, const std::vector<Ray>& rays, std::vector<RayHit>& hits) {
+			hits.assign(rays.size(), RayHit());
+			auto traceStart = std::chrono::high_resolution_clock::now();
+			JobSystem::shared().parallelFor(rays.size(), 1024, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; ++i) {
+					const Ray& ray = rays[i];
+					auto intersectCorners = [&](uint32_t triangle, RayHit& hit) {
+						const glm::vec3 *triangleCorners = &corners[(size_t)triangle * 3];
+						return intersectTriangle(ray, triangleCorners[0], triangleCorners[1], triangleCorners[2], triangle,
+							hit);
+					};
+					if (width == 2) {
+						bvh.intersect(ray, hits[i], intersectCorners);
+					} else if (width == 4) {
+						bvh4.intersect(ray, hits[i], intersectCorners);
+					} else {
+						bvh8.intersect(ray, hits[i], intersectCorners);
+					}
+				}
+			});
+			return rays.size() / (millisecondsSince(traceStart) * 1000.0);
+		};
+
+		std::vector<RayHit> cameraHits;
+		trace(2, cameraRays, cameraHits);
+		std::vector<Ray> diffuseRays = makeDiffuseRays(corners, cameraRays, cameraHits);
+		const std::pair<const char*, const std::vector<Ray>*> batches[] = {
+			{ "primary", &cameraRays }, { "diffuse", &diffuseRays } };
+		for (const auto& batch : batches) {
+			std::vector<RayHit> reference, hits;
+			double binary = trace(2, *batch.second, reference);
+			std::cout << "    " << batch.first << ", " << batch.second->size() << " rays: binary " << binary
+				<< " Mrays/s";
+			for (int width : { 4, 8 }) {
+				double megaRays = trace(width, *batch.second, hits);
+				size_t mismatches = 0;
+				for (size_t i = 0; i < hits.size(); ++i) {
+					mismatches += hits[i].t != reference[i].t;
+				}
+				std::cout << ", bvh" << width << " " << megaRays << " Mrays/s (" << megaRays / binary << "x)"
+					<< (mismatches ? ", MISMATCHES" : "");
+				failed = failed || mismatches;
+			}
+			std::cout << std::endl;
+		}
+	}
+	return failed ? 1 : 0;
+}
+
+// screen tiles of Size pixels, 4 wide, become one packet each. with shadows set the rays are shadow
+// rays and only the lanes marked in active are traced, occlusion ends up in the hit's triangle
+template <uint32_t Size>
+static double tracePackets(const Bvh& bvh, const std::vector<glm::vec3>& corners, const std::vector<Ray>& rays,
+	uint32_t width, uint32_t height, bool shadows, const std::vector<uint8_t>& active, std::vector<RayHit>& hits) {
+	const uint32_t tileWidth = 4, tileHeight = Size / 4;
+	uint32_t tilesX = width / tileWidth, tilesY = height / tileHeight;
+	hits.assign(rays.size(), RayHit());
+	auto traceStart = std::chrono::high_resolution_clock::now();
+	JobSystem::shared().parallelFor((size_t)tilesX * tilesY, 64, [&](size_t begin, size_t end) {
+		RayPacket<Size> packet;
+		size_t pixels[Size];
+		for (size_t tile = begin; tile < end; ++tile) {
+			uint32_t x0 = (uint32_t)(tile % tilesX) * tileWidth, y0 = (uint32_t)(tile / tilesX) * tileHeight;
+			uint32_t activeMask = 0;
+			for (uint32_t lane = 0; lane < Size; ++lane) {
+				pixels[lane] = (size_t)(y0 + lane / tileWidth) * width + x0 + lane % tileWidth;
+				packet.setRay(lane, rays[pixels[lane]]);
+				activeMask |= (shadows ? active[pixels[lane]] : 1u) << lane;
+			}
+			if (shadows) {
+				uint32_t occluded = occludedPacket(bvh, corners.data(), packet, activeMask);
+				for (uint32_t lane = 0; lane < Size; ++lane) {
+					hits[pixels[lane]].triangle = occluded >> lane & 1 ? 0 : ~0u;
+				}
+			} else {
+				intersectPacket(bvh, corners.data(), packet);
+				for (uint32_t lane = 0; lane < Size; ++lane) {
+					hits[pixels[lane]] = packet.hit(lane);
+				}
+			}
+		}
+	});
+	return (double)tilesX * tilesY * Size / (millisecondsSince(traceStart) * 1000.0);
+}
+
+int benchmarkPackets(size_t triangleCount) {
+	const uint32_t width = 1920, height = 1080;
+	std::cout << "packets: " << width << "x" << height << " primary and shadow rays, "
+		<< JobSystem::shared().threadCount() << " threads" << std::endl;
+	std::vector<Ray> cameraRays = makeCameraRays(width, height, glm::vec3(0.0f, 0.8f, 1.8f));
+	const glm::vec3 light(2.0f, 4.0f, 3.0f);
+	bool failed = false;
+	for (const auto& mesh : makeTestMeshes(triangleCount)) {
+		const std::vector<glm::vec3>& corners = mesh.second;
+		size_t meshTriangles = corners.size() / 3;
+		Bvh bvh;
+		bvh.buildTriangles(corners.data(), meshTriangles);
+		Bvh8 bvh8;
+		bvh8.collapse(bvh);
+		std::cout << "  " << mesh.first << ": " << meshTriangles << " triangles" << std::endl;
+
+		// single rays through the binary and the 8 wide bvh are the baseline
+		auto traceSingle = [&](bool wide, const std::vector<Ray>& rays, const std::vector<uint8_t> *active,
+			std::vector<RayHit>& hits) {
+			hits.assign(rays.size(), RayHit());
+			auto traceStart = std::chrono::high_resolution_clock::now();
+			size_t traced = 0;
+			JobSystem::shared().parallelFor(rays.size(), 4096, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; ++i) {
+					if (active && !(*active)[i]) {
+						continue;
+					}
+					const Ray& ray = rays[i];
+					auto intersectCorners = [&](uint32_t triangle, RayHit& hit) {
+						const glm::vec3 *triangleCorners = &corners[(size_t)triangle * 3];
+						return intersectTriangle(ray, triangleCorners[0], triangleCorners[1], triangleCorners[2], triangle,
+							hit);
+					};
+					if (wide) {
+						bvh8.intersect(ray, hits[i], intersectCorners);
+					} else {
+						bvh.intersect(ray, hits[i], intersectCorners);
+					}
+				}
+			});
+			for (size_t i = 0; i < rays.size(); ++i) {
+				traced += !active || (*active)[i];
+			}
+			return traced / (millisecondsSince(traceStart) * 1000.0);
+		};
+		// hits are only read once the arguments are evaluated, whichever order that happens in. the lanes
+		// and the scalar test may contract to fma differently, so distances only agree to rounding and rays
+		// through an edge can go either way, a traversal bug loses far more than one ray in 10000
+		auto report = [&](const char *mode, double megaRays, double baseline, const std::vector<RayHit>& reference,
+			const std::vector<RayHit>& hits, bool occlusionOnly) {
+			size_t differing = 0;
+			for (size_t i = 0; i < reference.size(); ++i) {
+				differing += reference[i].valid() != hits[i].valid() || (!occlusionOnly && reference[i].valid()
+					&& std::abs(reference[i].t - hits[i].t) > 1e-5f * reference[i].t);
+			}
+			bool mismatches = differing > reference.size() / 10000;
+			std::cout << ", " << mode << " " << megaRays << " (" << megaRays / baseline << "x)"
+				<< (mismatches ? " MISMATCHES" : "");
+			failed = failed || mismatches;
+		};
+
+		std::vector<RayHit> reference, hits;
+		std::vector<uint8_t> noMask;
+		double binary = traceSingle(false, cameraRays, nullptr, reference);
+		std::cout << "    primary Mrays/s: binary " << binary;
+		report("bvh8", traceSingle(true, cameraRays, nullptr, hits), binary, reference, hits, false);
+		report("packet8", tracePackets<8>(bvh, corners, cameraRays, width, height, false, noMask, hits), binary,
+			reference, hits, false);
+		report("packet16", tracePackets<16>(bvh, corners, cameraRays, width, height, false, noMask, hits), binary,
+			reference, hits, false);
+		std::cout << std::endl;
+
+		// shadow rays end at the light, closest hit traversal is the single ray baseline
+		std::vector<Ray> shadowRays(cameraRays.size());
+		std::vector<uint8_t> hitMask(cameraRays.size());
+		for (size_t i = 0; i < cameraRays.size(); ++i) {
+			shadowRays[i] = cameraRays[i];
+			hitMask[i] = reference[i].valid();
+			if (hitMask[i]) {
+				shadowRays[i].origin = cameraRays[i].origin + cameraRays[i].direction * reference[i].t;
+				shadowRays[i].direction = light - shadowRays[i].origin;
+				shadowRays[i].tMin = 1e-4f;
+				shadowRays[i].tMax = 1.0f;
+			}
+		}
+		std::vector<RayHit> shadowReference;
+		double shadowBinary = traceSingle(false, shadowRays, &hitMask, shadowReference);
+		std::cout << "    shadow Mrays/s: binary " << shadowBinary;
+		report("bvh8", traceSingle(true, shadowRays, &hitMask, hits), shadowBinary,
+			shadowReference, hits, true);
+		report("packet8", tracePackets<8>(bvh, corners, shadowRays, width, height, true, hitMask, hits), shadowBinary,
+			shadowReference, hits, true);
+		report("packet16", tracePackets<16>(bvh, corners, shadowRays, width, height, true, hitMask, hits),
+			shadowBinary, shadowReference, hits, true);
+		std::cout << std::endl;
+	}
+	return failed ? 1 : 0;
+}
+
+int benchmarkTriangles(size_t triangleCount) {
+	std::cout << "triangles: moller-trumbore against the watertight test in 4 and 8 wide blocks" << std::endl;
+
+	bool failed = false;
+	// conformance: rays from inside a closed sphere through its vertices and through points on its
+	// edges have to hit it, a miss is a crack between neighbouring triangles
+	{
+		std::vector<Vertex> vertices;
+		std::vector<uint32_t> indices;
+		makeSphere(32, vertices, indices);
+		glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(0.37f, -1.13f, 2.71f))
+			* glm::rotate(glm::mat4(1.0f), 0.83f, glm::normalize(glm::vec3(0.3f, 1.0f, -0.6f)));
+		std::vector<glm::vec3> corners;
+		for (uint32_t index : indices) {
+			corners.push_back(glm::vec3(transform * glm::vec4(vertices[index].pos, 1.0f)));
+		}
+		size_t sphereTriangles = corners.size() / 3;
+		Bvh bvh;
+		bvh.buildTriangles(corners.data(), sphereTriangles);
+		TriangleBlocks<4> blocks4;
+		blocks4.build(bvh, corners.data());
+		TriangleBlocks<8> blocks8;
+		blocks8.build(bvh, corners.data());
+
+		std::mt19937 rng(5);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		std::vector<Ray> rays;
+		for (size_t triangle = 0; triangle < sphereTriangles; ++triangle) {
+			const glm::vec3 *triangleCorners = &corners[triangle * 3];
+			for (int corner = 0; corner < 3; ++corner) {
+				glm::vec3 origin(transform * glm::vec4(unit(rng) * 0.2f, unit(rng) * 0.2f, unit(rng) * 0.2f, 1.0f));
+				glm::vec3 edgePoint = glm::mix(triangleCorners[corner], triangleCorners[(corner + 1) % 3], unit(rng));
+				for (const glm::vec3& target : { triangleCorners[corner], edgePoint }) {
+					Ray ray;
+					ray.origin = origin;
+					ray.direction = glm::normalize(target - origin);
+					ray.tMin = 0.0f;
+					ray.tMax = FLT_MAX;
+					rays.push_back(ray);
+				}
+			}
+		}
+
+		// every triangle is tested, so only the triangle tests can lose a hit
+		size_t misses[4] = {};
+		float barycentricError = 0.0f;
+		for (const Ray& ray : rays) {
+			WatertightRay watertight(ray);
+			RayHit hits[4];
+			for (uint32_t triangle = 0; triangle < sphereTriangles; ++triangle) {
+				const glm::vec3 *triangleCorners = &corners[(size_t)triangle * 3];
+				intersectTriangle(ray, triangleCorners[0], triangleCorners[1], triangleCorners[2], triangle, hits[0]);
+				intersectTriangleWatertight(watertight, triangleCorners[0], triangleCorners[1], triangleCorners[2],
+					triangle, hits[1]);
+			}
+			for (const auto& block : blocks4.blocks()) {
+				intersectBlock(watertight, block, hits[2]);
+			}
+			for (const auto& block : blocks8.blocks()) {
+				intersectBlock(watertight, block, hits[3]);
+			}
+			for (int method = 0; method < 4; ++method) {
+				misses[method] += !hits[method].valid();
+			}
+			// the barycentrics have to give back the point the ray reached
+			for (int method = 1; method < 4 && hits[method].valid(); ++method) {
+				const glm::vec3 *triangleCorners = &corners[(size_t)hits[method].triangle * 3];
+				glm::vec3 point = triangleCorners[0] * (1.0f - hits[method].u - hits[method].v)
+					+ triangleCorners[1] * hits[method].u + triangleCorners[2] * hits[method].v;
+				barycentricError = std::max(barycentricError,
+					glm::length(point - (ray.origin + ray.direction * hits[method].t)));
+			}
+		}
+		std::cout << "  conformance, " << rays.size() << " rays through vertices and edges of " << sphereTriangles
+			<< " triangles: misses moller-trumbore " << misses[0] << ", watertight " << misses[1] << ", block4 "
+			<< misses[2] << ", block8 " << misses[3] << ", largest barycentric error " << barycentricError
+			<< (misses[1] + misses[2] + misses[3] ? ", CRACKS" : "")
+			<< (barycentricError > 1e-4f ? ", BARYCENTRICS MISS THE HIT POINT" : "") << std::endl;
+		failed = misses[1] + misses[2] + misses[3] || barycentricError > 1e-4f;
+	}
+
+	std::vector<Ray> testRays = makeTestRays(1000000);
+	std::vector<Ray> cameraRays = makeCameraRays(1280, 720, glm::vec3(0.0f, 1.5f, 3.5f));
+	for (const auto& mesh : makeTestMeshes(triangleCount)) {
+		const std::vector<glm::vec3>& corners = mesh.second;
+		size_t meshTriangles = corners.size() / 3;
+		Bvh bvh;
+		bvh.buildTriangles(corners.data(), meshTriangles);
+		Bvh8 bvh8;
+		bvh8.collapse(bvh);
+		// blocks want full leaves, the second bvh prices its leaves by 8 wide blocks
+		Bvh blockBvh;
+		blockBvh.setLeafBlocks(8, TriangleBlocks<8>::kBlockCost);
+		blockBvh.buildTriangles(corners.data(), meshTriangles);
+		Bvh8 blockBvh8;
+		blockBvh8.collapse(blockBvh);
+		TriangleBlocks<4> blocks4;
+		blocks4.build(blockBvh, corners.data());
+		TriangleBlocks<8> blocks8;
+		blocks8.build(blockBvh, corners.data());
+		std::cout << "  " << mesh.first << ": " << meshTriangles << " triangles, " << bvh.primitives().size()
+			/ (float)(bvh.nodes().size() / 2 + 1) << " per leaf, priced by blocks " << blockBvh.primitives().size()
+			/ (float)(blockBvh.nodes().size() / 2 + 1) << " per leaf, corners "
+			<< corners.size() * sizeof(glm::vec3) / (1024 * 1024) << " MB, block4 " << blocks4.memoryBytes() / (1024 * 1024)
+			<< " MB, block8 " << blocks8.memoryBytes() / (1024 * 1024) << " MB" << std::endl;
+
+		// every ray against the triangles of a window of leaves, as many tests as traversal would make
+		std::vector<std::pair<uint32_t, uint32_t>> leaves;
+		for (const BvhNode& node : blockBvh.nodes()) {
+			if (node.isLeaf()) {
+				leaves.push_back({ node.offset, node.count });
+			}
+		}
+		const size_t kLeafWindow = 16;
+		auto testLeaves = [&](int method) {
+			const std::vector<uint32_t>& primitives = blockBvh.primitives();
+			std::vector<size_t> tests(testRays.size()), found(testRays.size());
+			auto testStart = std::chrono::high_resolution_clock::now();
+			JobSystem::shared().parallelFor(testRays.size(), 1024, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; ++i) {
+					const Ray& ray = testRays[i];
+					WatertightRay watertight(ray);
+					RayHit hit;
+					size_t firstLeaf = i * 7919 % (leaves.size() - std::min(leaves.size() - 1, kLeafWindow));
+					for (size_t leaf = firstLeaf; leaf < std::min(leaves.size(), firstLeaf + kLeafWindow); ++leaf) {
+						uint32_t first = leaves[leaf].first, count = leaves[leaf].second;
+						if (method == 2) {
+							blocks4.intersect(watertight, first, count, hit);
+						} else if (method == 3) {
+							blocks8.intersect(watertight, first, count, hit);
+						} else {
+							for (uint32_t entry = first; entry < first + count; ++entry) {
+								const glm::vec3 *triangleCorners = &corners[(size_t)primitives[entry] * 3];
+								if (method == 0) {
+									intersectTriangle(ray, triangleCorners[0], triangleCorners[1], triangleCorners[2],
+										primitives[entry], hit);
+								} else {
+									intersectTriangleWatertight(watertight, triangleCorners[0], triangleCorners[1],
+										triangleCorners[2], primitives[entry], hit);
+								}
+							}
+						}
+						tests[i] += count;
+					}
+					found[i] = hit.valid();
+				}
+			});
+			double milliseconds = millisecondsSince(testStart);
+			size_t testCount = 0, hitCount = 0;
+			for (size_t i = 0; i < tests.size(); ++i) {
+				testCount += tests[i];
+				hitCount += found[i];
+			}
+			return std::make_pair(testCount / (milliseconds * 1000.0), hitCount);
+		};
+		const char *methods[] = { "moller-trumbore", "watertight", "block4", "block8" };
+		std::cout << "    Mtests/s:";
+		for (int method = 0; method < 4; ++method) {
+			auto result = testLeaves(method);
+			std::cout << (method ? ", " : " ") << methods[method] << " " << result.first << " (" << result.second
+				<< " hits)";
+		}
+		std::cout << std::endl;
+
+		// whole traversals through the 8 wide bvhs, hits may only differ on edges
+		auto trace = [&](bool useBlocks, const std::vector<Ray>& rays, std::vector<RayHit>& hits) {
+			hits.assign(rays.size(), RayHit());
+			auto traceStart = std::chrono::high_resolution_clock::now();
+			JobSystem::shared().parallelFor(rays.size(), 1024, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; ++i) {
+					const Ray& ray = rays[i];
+					if (useBlocks) {
+						WatertightRay watertight(ray);
+						blockBvh8.intersectLeaves(ray, hits[i], [&](uint32_t first, uint32_t count, RayHit& hit) {
+							return blocks8.intersect(watertight, first, count, hit);
+						});
+					} else {
+						bvh8.intersect(ray, hits[i], [&](uint32_t triangle, RayHit& hit) {
+							const glm::vec3 *triangleCorners = &corners[(size_t)triangle * 3];
+							return intersectTriangle(ray, triangleCorners[0], triangleCorners[1], triangleCorners[2],
+								triangle, hit);
+						});
+					}
+				}
+			});
+			return rays.size() / (millisecondsSince(traceStart) * 1000.0);
+		};
+		const std::pair<const char*, const std::vector<Ray>*> batches[] = {
+			{ "primary", &cameraRays }, { "random", &testRays } };
+		for (const auto& batch : batches) {
+			std::vector<RayHit> reference, hits;
+			double scalar = trace(false, *batch.second, reference);
+			double blocked = trace(true, *batch.second, hits);
+			size_t differences = 0;
+			for (size_t i = 0; i < hits.size(); ++i) {
+				differences += hits[i].valid() != reference[i].valid()
+					|| std::abs(hits[i].t - reference[i].t) > 1e-4f * std::max(1.0f, reference[i].t);
+			}
+			std::cout << "    bvh8 " << batch.first << " Mrays/s: moller-trumbore " << scalar << ", block8 " << blocked
+				<< " (" << blocked / scalar << "x), " << differences << " differing hits" << std::endl;
+		}
+	}
+	return failed ? 1 : 0;
+}
+
+int benchmarkTlas(size_t instanceCount) {
+	std::cout << "tlas: " << instanceCount << " instances of shared meshes against one flattened bvh, "
+		<< JobSystem::shared().threadCount() << " threads" << std::endl;
+	// lumpy spheres of different detail, every instance picks one
+	const uint32_t kSegments[] = { 10, 14, 18, 22, 26, 30 };
+	const size_t kMeshCount = sizeof(kSegments) / sizeof(kSegments[0]);
+	std::vector<std::vector<glm::vec3>> meshCorners(kMeshCount);
+	for (size_t mesh = 0; mesh < kMeshCount; ++mesh) {
+		std::vector<Vertex> vertices;
+		std::vector<uint32_t> indices;
+		makeSphere(kSegments[mesh], vertices, indices);
+		for (uint32_t index : indices) {
+			glm::vec3 position = vertices[index].pos;
+			float lump = 1.0f + 0.25f * std::sin(position.x * 3.0f + (float)mesh) * std::cos(position.y * 2.0f);
+			meshCorners[mesh].push_back(position * lump);
+		}
+	}
+
+	std::vector<Blas> blases(kMeshCount);
+	auto blasStart = std::chrono::high_resolution_clock::now();
+	size_t blasBytes = 0;
+	for (size_t mesh = 0; mesh < kMeshCount; ++mesh) {
+		blases[mesh].build(meshCorners[mesh].data(), meshCorners[mesh].size() / 3);
+		blasBytes += blases[mesh].memoryBytes();
+	}
+	double blasMilliseconds = millisecondsSince(blasStart);
+
+	std::mt19937 rng(17);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::vector<BlasInstance> instances(instanceCount);
+	std::vector<glm::vec3> positions(instanceCount);
+	std::vector<glm::quat> rotations(instanceCount);
+	std::vector<float> scales(instanceCount);
+	size_t instancedTriangles = 0;
+	for (size_t i = 0; i < instanceCount; ++i) {
+		positions[i] = glm::vec3(unit(rng) * 200.0f - 100.0f, unit(rng) * 2.0f, unit(rng) * 200.0f - 100.0f);
+		rotations[i] = glm::angleAxis(unit(rng) * glm::two_pi<float>(),
+			glm::normalize(glm::vec3(unit(rng) - 0.5f, 1.0f, unit(rng) - 0.5f)));
+		scales[i] = 0.5f + unit(rng) * 1.5f;
+		instances[i].blas = &blases[(size_t)(unit(rng) * kMeshCount) % kMeshCount];
+		instancedTriangles += instances[i].blas->triangleCount();
+	}
+	auto placeInstances = [&](float time) {
+		for (size_t i = 0; i < instanceCount; ++i) {
+			glm::quat spin = glm::angleAxis(time * (0.5f + (i % 7) * 0.1f), glm::vec3(0.0f, 1.0f, 0.0f));
+			glm::vec3 bob(0.0f, std::sin(time * 2.0f + (float)i) * 0.5f, 0.0f);
+			instances[i].transform = glm::translate(glm::mat4(1.0f), positions[i] + bob)
+				* glm::mat4_cast(spin * rotations[i]) * glm::scale(glm::mat4(1.0f), glm::vec3(scales[i]));
+		}
+	};
+	placeInstances(0.0f);
+	Tlas tlas;
+	tlas.build(instances.data(), instanceCount);
+	std::cout << "  " << kMeshCount << " blases, " << instancedTriangles << " instanced triangles" << std::endl;
+	std::cout << "    two level: blases built in " << blasMilliseconds << " ms, " << blasBytes / (1024.0 * 1024.0)
+		<< " MB, tlas built in " << tlas.lastBuildMilliseconds() << " ms, " << tlas.memoryBytes() / (1024.0 * 1024.0)
+		<< " MB" << std::endl;
+
+	// the same scene baked into world space
+	std::vector<glm::vec3> flattenedCorners;
+	flattenedCorners.reserve(instancedTriangles * 3);
+	for (const BlasInstance& instance : instances) {
+		const glm::vec3 *corners = instance.blas->corners(0);
+		for (size_t corner = 0; corner < instance.blas->triangleCount() * 3; ++corner) {
+			flattenedCorners.push_back(glm::vec3(instance.transform * glm::vec4(corners[corner], 1.0f)));
+		}
+	}
+	Blas flattened;
+	auto flattenedStart = std::chrono::high_resolution_clock::now();
+	flattened.build(flattenedCorners.data(), instancedTriangles);
+	double flattenedMilliseconds = millisecondsSince(flattenedStart);
+	flattenedCorners = std::vector<glm::vec3>();
+	size_t twoLevelBytes = blasBytes + tlas.memoryBytes();
+	std::cout << "    flattened: built in " << flattenedMilliseconds << " ms, " << flattened.memoryBytes()
+		/ (1024.0 * 1024.0) << " MB, " << (double)flattened.memoryBytes() / twoLevelBytes << "x the two level memory"
+		<< std::endl;
+
+	// every instance moves each frame, only the tlas is rebuilt
+	const int kFrames = 16;
+	double rebuildMilliseconds = 0, worstMilliseconds = 0;
+	for (int frame = 1; frame <= kFrames; ++frame) {
+		placeInstances(frame / 30.0f);
+		tlas.build(instances.data(), instanceCount);
+		rebuildMilliseconds += tlas.lastBuildMilliseconds();
+		worstMilliseconds = std::max(worstMilliseconds, tlas.lastBuildMilliseconds());
+	}
+	std::cout << "    moving instances: tlas rebuild " << rebuildMilliseconds / kFrames << " ms average, "
+		<< worstMilliseconds << " ms worst" << std::endl;
+
+	// camera over the field, the flattened scene is the one of frame 0
+	placeInstances(0.0f);
+	tlas.build(instances.data(), instanceCount);
+	std::vector<Ray> rays = makeCameraRays(1280, 720, glm::vec3(0.0f, 25.0f, 120.0f));
+	std::vector<InstanceHit> instanceHits(rays.size());
+	std::vector<RayHit> flattenedHits(rays.size());
+	auto tlasStart = std::chrono::high_resolution_clock::now();
+	JobSystem::shared().parallelFor(rays.size(), 1024, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			tlas.intersect(rays[i], instanceHits[i]);
+		}
+	});
+	double tlasMegaRays = rays.size() / (millisecondsSince(tlasStart) * 1000.0);
+	auto flattenedTraceStart = std::chrono::high_resolution_clock::now();
+	JobSystem::shared().parallelFor(rays.size(), 1024, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			flattened.intersect(rays[i], flattenedHits[i]);
+		}
+	});
+	double flattenedMegaRays = rays.size() / (millisecondsSince(flattenedTraceStart) * 1000.0);
+	// object space rays round differently, only distances that disagree by more than that count
+	size_t differences = 0, hitCount = 0;
+	for (size_t i = 0; i < rays.size(); ++i) {
+		hitCount += flattenedHits[i].valid();
+		differences += instanceHits[i].valid() != flattenedHits[i].valid()
+			|| std::abs(instanceHits[i].t - flattenedHits[i].t) > 1e-3f * std::max(1.0f, flattenedHits[i].t);
+	}
+	std::cout << "    1280x720 camera rays, " << hitCount << " hits: tlas " << tlasMegaRays << " Mrays/s, flattened "
+		<< flattenedMegaRays << " Mrays/s, " << differences << " differing hits" << std::endl;
+	return 0;
+}
+
+// rows of spheres on a textured floor, neighbours never share a material
+static void addMixedScene(SceneBuilder& builder, uint32_t materialCount) {
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	makeSphere(32, vertices, indices);
+	uint32_t textures[] = { builder.addTexture("textures/wood.jpg"), builder.addTexture("textures/chicks.jpg") };
+	std::vector<uint32_t> materials;
+	for (uint32_t i = 0; i < materialCount; ++i) {
+		float hue = i / (float)materialCount * glm::two_pi<float>();
+		SceneMaterial material = {};
+		material.baseColor = glm::vec4(0.5f + 0.4f * std::cos(hue), 0.5f + 0.4f * std::cos(hue + 2.1f),
+			0.5f + 0.4f * std::cos(hue + 4.2f), 1.0f);
+		material.emissive = i % 7 == 5 ? glm::vec4(4.0f, 3.5f, 3.0f, 0.0f) : glm::vec4(0.0f);
+		material.roughness = 1.0f;
+		material.baseColorTexture = i % 4 == 1 ? textures[0] : i % 4 == 3 ? textures[1] : kSceneNone;
+		material.metallicRoughnessTexture = kSceneNone;
+		materials.push_back(builder.addMaterial(material));
+	}
+	MeshAsset sphere;
+	sphere.vertices = vertices;
+	sphere.indices = indices;
+	sphere.lods.push_back({ 0, (uint32_t)indices.size(), 0.0f });
+	sphere.bounds = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	uint32_t sphereMesh = builder.addMesh(sphere);
+	for (uint32_t row = 0; row < 6; ++row) {
+		for (uint32_t column = 0; column < 8; ++column) {
+			glm::vec3 position((column / 7.0f - 0.5f) * 1.6f + (row % 2) * 0.1f, -0.22f, -(float)row * 0.25f);
+			glm::mat4 local = glm::scale(glm::translate(glm::mat4(1.0f), position), glm::vec3(0.08f));
+			builder.addNode(local, kSceneNone, sphereMesh, materials[(row * 8 + column) * 7 % materialCount]);
+		}
+	}
+	MeshAsset floor;
+	floor.vertices = {
+		{ { -5.0f, -0.3f, -5.0f }, { 1.0f, 1.0f, 1.0f }, { 0.0f, 0.0f } },
+		{ { 5.0f, -0.3f, -5.0f }, { 1.0f, 1.0f, 1.0f }, { 8.0f, 0.0f } },
+		{ { 5.0f, -0.3f, 5.0f }, { 1.0f, 1.0f, 1.0f }, { 8.0f, 8.0f } },
+		{ { -5.0f, -0.3f, 5.0f }, { 1.0f, 1.0f, 1.0f }, { 0.0f, 8.0f } }
+	};
+	floor.indices = { 0, 2, 1, 0, 3, 2 };
+	floor.lods.push_back({ 0, 6, 0.0f });
+	floor.bounds = glm::vec4(0.0f, -0.3f, 0.0f, 7.1f);
+	builder.addNode(glm::mat4(1.0f), kSceneNone, builder.addMesh(floor), materials[1]);
+}
+
+int benchmarkWavefront(size_t samplesPerPixel) {
+	const uint32_t kMaterialCount = 16;
+	SceneBuilder builder;
+	addMixedScene(builder, kMaterialCount);
+
+	SceneFile scene;
+	scene.openMemory(builder.serialize());
+	PathTracer pathTracer;
+	pathTracer.setScene(scene);
+	pathTracer.setSamplesPerPixel((uint32_t)samplesPerPixel);
+	std::cout << "wavefront: " << pathTracer.triangleCount() << " triangles, " << kMaterialCount << " materials, "
+		<< "640x360 at " << pathTracer.samplesPerPixel() << " spp, " << JobSystem::shared().threadCount()
+		<< " threads" << std::endl;
+
+	HdrImage images[2];
+	double samplesPerSecond[2] = {};
+	const std::pair<const char*, PathTracer::Schedule> schedules[] = {
+		{ "per pixel", PathTracer::Schedule::PerPixel }, { "wavefront", PathTracer::Schedule::Wavefront } };
+	for (int i = 0; i < 2; ++i) {
+		pathTracer.setSchedule(schedules[i].second);
+		images[i].resize(640, 360);
+		auto renderStart = std::chrono::high_resolution_clock::now();
+		pathTracer.render(defaultFrame(640.0f / 360.0f), images[i]);
+		double renderMilliseconds = millisecondsSince(renderStart);
+		glm::dvec3 mean(0.0);
+		for (const glm::vec3& pixel : images[i].pixels) {
+			mean += glm::dvec3(pixel);
+		}
+		mean /= (double)images[i].pixels.size();
+		samplesPerSecond[i] = images[i].pixels.size() * (double)pathTracer.samplesPerPixel() / renderMilliseconds / 1000.0;
+		std::cout << "  " << schedules[i].first << ": " << renderMilliseconds << " ms, " << samplesPerSecond[i]
+			<< " Msamples/s, " << pathTracer.lastRayCount() / (renderMilliseconds * 1000.0) << " Mrays/s, mean "
+			<< mean.r << " " << mean.g << " " << mean.b;
+		if (i > 0) {
+			std::cout << " (" << samplesPerSecond[i] / samplesPerSecond[0] << "x)";
+		}
+		std::cout << std::endl;
+	}
+	writeHdr("benchmark_wavefront.hdr", images[1]);
+	return 0;
+}
+
+int benchmarkTiles(size_t maxThreads) {
+	SceneBuilder builder;
+	addMixedScene(builder, 16);
+	SceneFile scene;
+	scene.openMemory(builder.serialize());
+	PathTracer pathTracer;
+	pathTracer.setScene(scene);
+	pathTracer.setSamplesPerPixel(4);
+	const UniformBufferObject frame = defaultFrame(640.0f / 360.0f);
+	HdrImage image;
+	image.resize(640, 360);
+	std::cout << "tiles: 640x360 at " << pathTracer.samplesPerPixel() << " spp, hilbert order, "
+		<< std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+
+	// the same frame on job systems of growing size, a warm up render first so caches and the tlas are settled
+	double singleMilliseconds = 0;
+	for (uint32_t threadCount = 1; threadCount <= maxThreads; threadCount *= 2) {
+		JobSystem jobs(threadCount);
+		pathTracer.setJobSystem(jobs);
+		pathTracer.render(frame, image);
+		jobs.resetThreadStats();
+		auto renderStart = std::chrono::high_resolution_clock::now();
+		pathTracer.render(frame, image);
+		double renderMilliseconds = millisecondsSince(renderStart);
+		if (threadCount == 1) {
+			singleMilliseconds = renderMilliseconds;
+		}
+		double minUtilization = 1e30, meanUtilization = 0;
+		uint64_t jobCount = 0, steals = 0;
+		for (const JobSystem::ThreadStats& stats : jobs.threadStats()) {
+			double utilization = stats.busyMilliseconds / renderMilliseconds;
+			minUtilization = std::min(minUtilization, utilization);
+			meanUtilization += utilization / threadCount;
+			jobCount += stats.jobs;
+			steals += stats.steals;
+		}
+		std::cout << "  " << threadCount << " threads: " << renderMilliseconds << " ms, "
+			<< singleMilliseconds / renderMilliseconds << "x, utilization min " << minUtilization * 100.0
+			<< "% mean " << meanUtilization * 100.0 << "%, " << jobCount << " jobs, " << steals << " steals"
+			<< std::endl;
+	}
+	pathTracer.setJobSystem(JobSystem::shared());
+
+	// passes run on a thread of their own like an interactive view would, the main thread cancels
+	ProgressiveRenderer progressive(pathTracer);
+	progressive.restart(frame, 640, 360);
+	const uint32_t kPasses = 4;
+	auto passStart = std::chrono::high_resolution_clock::now();
+	for (uint32_t pass = 0; pass < kPasses; ++pass) {
+		progressive.renderPass();
+	}
+	double passMilliseconds = millisecondsSince(passStart) / kPasses;
+	std::atomic<bool> started{ false };
+	std::thread passes([&]() {
+		started = true;
+		while (progressive.renderPass()) {
+		}
+	});
+	while (!started) {
+		std::this_thread::yield();
+	}
+	std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(passMilliseconds * 1.5));
+	auto cancelStart = std::chrono::high_resolution_clock::now();
+	progressive.cancel();
+	passes.join();
+	std::cout << "  progressive: " << passMilliseconds << " ms/pass, cancelled after " << progressive.passCount()
+		<< " passes in " << millisecondsSince(cancelStart) << " ms" << std::endl;
+	writeHdr("benchmark_tiles.hdr", progressive.image());
+	return 0;
+}
+
+int benchmarkBsdf(size_t sampleCount) {
+	sampleCount = (sampleCount + 7) / 8 * 8;
+	std::mt19937 rng(1337);
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	std::vector<float> randoms(sampleCount * 3);
+	for (float& random : randoms) {
+		random = uniform(rng);
+	}
+	const float kRoughness[] = { 0.0f, 0.25f, 0.5f, 0.75f, 1.0f };
+	const float kCosOut[] = { 0.05f, 0.2f, 0.5f, 0.8f, 1.0f };
+
+	// white furnace: a white surface under uniform white light reflects all of it, so the mean sample
+	// weight toward every wo has to be one. the 8 lane version sees the same random numbers
+	std::cout << "bsdf: white furnace, " << sampleCount << " samples per direction, albedo at cos wo";
+	for (float cosOut : kCosOut) {
+		std::cout << " " << cosOut;
+	}
+	std::cout << std::endl;
+	double worstError = 0, worstLaneDifference = 0, worstPdfError = 0;
+	for (float metallic : { 0.0f, 1.0f }) {
+		for (float roughness : kRoughness) {
+			bsdf::BsdfMaterial material = { glm::vec3(1.0f), metallic, roughness };
+			bsdf8::BsdfMaterial lanes = { Vec3x8(1.0f), metallic, roughness };
+			std::cout << "  " << (metallic > 0.0f ? "metal" : "dielectric") << " roughness " << roughness << ":";
+			for (float cosOut : kCosOut) {
+				glm::vec3 wo(std::sqrt(1.0f - cosOut * cosOut), 0.0f, cosOut);
+				double albedo = 0, laneAlbedo = 0, pdfIntegral = 0, lost = 0;
+				for (size_t i = 0; i < sampleCount; i += 8) {
+					glm::vec3 wi;
+					float pdf;
+					for (size_t lane = 0; lane < 8; ++lane) {
+						const float *u = &randoms[(i + lane) * 3];
+						albedo += bsdf::sampleBsdf(material, wo, u[0], u[1], u[2], wi, pdf).g;
+						lost += wi.z <= 0.0f;
+						// the pdf integrates to one less what VNDF samples lose below the horizon, checked with
+						// uniform directions over the hemisphere where the lobes are wide enough for that
+						float z = u[1], radius = std::sqrt(1.0f - z * z), phi = glm::two_pi<float>() * u[2];
+						bsdf::evaluateBsdf(material, wo, glm::vec3(radius * std::cos(phi), radius * std::sin(phi), z), pdf);
+						pdfIntegral += pdf * glm::two_pi<float>();
+					}
+					Float8 u[3];
+					for (int k = 0; k < 3; ++k) {
+						float values[8];
+						for (int lane = 0; lane < 8; ++lane) {
+							values[lane] = randoms[(i + lane) * 3 + k];
+						}
+						u[k] = Float8::load(values);
+					}
+					Vec3x8 laneWi;
+					Float8 lanePdf;
+					Vec3x8 weight = bsdf8::sampleBsdf(lanes, Vec3x8(wo.x, wo.y, wo.z), u[0], u[1], u[2], laneWi, lanePdf);
+					for (int lane = 0; lane < 8; ++lane) {
+						laneAlbedo += ::lane(weight.y, lane);
+					}
+				}
+				albedo /= sampleCount;
+				laneAlbedo /= sampleCount;
+				pdfIntegral /= sampleCount;
+				lost /= sampleCount;
+				std::cout << " " << albedo;
+				worstError = std::max(worstError, std::abs(albedo - 1.0));
+				worstLaneDifference = std::max(worstLaneDifference, std::abs(albedo - laneAlbedo));
+				if (roughness >= 0.5f) {
+					worstPdfError = std::max(worstPdfError, std::abs(pdfIntegral + lost - 1.0));
+				}
+			}
+			std::cout << std::endl;
+		}
+	}
+	std::cout << "  worst |1 - albedo| " << worstError << ", scalar against 8 lanes " << worstLaneDifference
+		<< ", worst |1 - pdf integral - lost samples| " << worstPdfError << std::endl;
+
+	// sampling throughput over mixed materials and directions
+	const size_t kSamples = 1 << 22;
+	std::vector<glm::vec3> directions(kSamples);
+	for (glm::vec3& direction : directions) {
+		float z = uniform(rng), radius = std::sqrt(1.0f - z * z), phi = glm::two_pi<float>() * uniform(rng);
+		direction = glm::vec3(radius * std::cos(phi), radius * std::sin(phi), z);
+	}
+	glm::dvec3 sum(0.0);
+	auto scalarStart = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < kSamples; ++i) {
+		const float *u = &randoms[(i * 3) % (randoms.size() - 2)];
+		bsdf::BsdfMaterial material = { glm::vec3(0.8f, 0.6f, 0.4f), (i & 7) / 7.0f, u[0] };
+		glm::vec3 wi;
+		float pdf;
+		sum += glm::dvec3(bsdf::sampleBsdf(material, directions[i], u[0], u[1], u[2], wi, pdf));
+	}
+	double scalarMilliseconds = millisecondsSince(scalarStart);
+	Vec3x8 laneSum(0.0f);
+	glm::dvec3 laneTotal(0.0);
+	auto laneStart = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < kSamples; i += 8) {
+		float metallic[8], u[3][8];
+		for (int lane = 0; lane < 8; ++lane) {
+			const float *random = &randoms[((i + lane) * 3) % (randoms.size() - 2)];
+			metallic[lane] = lane / 7.0f;
+			for (int k = 0; k < 3; ++k) {
+				u[k][lane] = random[k];
+			}
+		}
+		bsdf8::BsdfMaterial material = { Vec3x8(0.8f, 0.6f, 0.4f), Float8::load(metallic), Float8::load(u[0]) };
+		Vec3x8 wi;
+		Float8 pdf;
+		laneSum = laneSum + bsdf8::sampleBsdf(material, Vec3x8::gather(&directions[i]), Float8::load(u[0]),
+			Float8::load(u[1]), Float8::load(u[2]), wi, pdf);
+		// float sums drift over millions of samples, they go to doubles now and then
+		if (i % 4096 == 4088) {
+			glm::vec3 laneTotals[8];
+			laneSum.scatter(laneTotals);
+			for (const glm::vec3& total : laneTotals) {
+				laneTotal += glm::dvec3(total);
+			}
+			laneSum = Vec3x8(0.0f);
+		}
+	}
+	double laneMilliseconds = millisecondsSince(laneStart);
+	std::cout << "  sampling: scalar " << kSamples / (scalarMilliseconds * 1000.0) << " Msamples/s, 8 lanes "
+		<< kSamples / (laneMilliseconds * 1000.0) << " Msamples/s (" << scalarMilliseconds / laneMilliseconds
+		<< "x), mean weight " << sum.g / kSamples << " and " << laneTotal.g / kSamples << std::endl;
+	return 0;
+}
+
+int benchmarkEnvironment(size_t milliseconds) {
+	// a dim sky over a dark ground and a small sun thousands of times brighter, the case uniform
+	// sampling never finds. written out and read back so the stbi_loadf path runs too
+	const glm::vec3 sunDirection = glm::normalize(glm::vec3(0.6f, 0.7f, -0.4f));
+	HdrImage sky;
+	sky.resize(1024, 512);
+	for (uint32_t y = 0; y < sky.height; ++y) {
+		for (uint32_t x = 0; x < sky.width; ++x) {
+			float phi = (x + 0.5f) / sky.width * glm::two_pi<float>(), theta = (y + 0.5f) / sky.height * glm::pi<float>();
+			glm::vec3 direction(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+			glm::vec3 color = direction.y > 0.0f ? glm::mix(glm::vec3(0.6f, 0.7f, 0.9f), glm::vec3(0.15f, 0.3f, 0.7f),
+				direction.y) * 0.5f : glm::vec3(0.05f, 0.04f, 0.03f);
+			if (glm::dot(direction, sunDirection) > std::cos(glm::radians(1.5f))) {
+				color = glm::vec3(4000.0f, 3600.0f, 3000.0f);
+			}
+			sky.at(x, y) = color;
+		}
+	}
+	writeHdr("benchmark_environment_map.hdr", sky);
+	EnvironmentMap environment;
+	environment.load("benchmark_environment_map.hdr");
+	environment.setImage(environment.image());
+	std::cout << "environment: " << environment.image().width << "x" << environment.image().height
+		<< " map, alias tables built in " << environment.lastBuildMilliseconds() << " ms" << std::endl;
+
+	// the sampled pdf has to integrate the map it was built from: E[L / pdf] over the sphere against the
+	// sum over texels of L times their solid angle
+	const uint32_t kChecks = 1 << 20;
+	std::mt19937 rng(1337);
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	glm::dvec3 estimate(0.0), exact(0.0);
+	uint32_t mismatches = 0;
+	auto sampleStart = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < kChecks; ++i) {
+		float pdf;
+		glm::vec3 direction = environment.sample(glm::vec2(uniform(rng), uniform(rng)), pdf);
+		estimate += glm::dvec3(environment.radiance(direction) / pdf);
+		// the lookup may land in the neighbouring texel when the sample sits on an edge
+		mismatches += std::abs(environment.pdf(direction) / pdf - 1.0f) > 1e-3f;
+	}
+	double sampleMilliseconds = millisecondsSince(sampleStart);
+	const HdrImage& map = environment.image();
+	for (uint32_t y = 0; y < map.height; ++y) {
+		double solidAngle = glm::two_pi<double>() / map.width * (std::cos(glm::pi<double>() * y / map.height)
+			- std::cos(glm::pi<double>() * (y + 1) / map.height));
+		for (uint32_t x = 0; x < map.width; ++x) {
+			exact += glm::dvec3(map.at(x, y)) * solidAngle;
+		}
+	}
+	estimate /= (double)kChecks;
+	std::cout << "  integral of the map " << exact.g << ", importance estimate " << estimate.g << ", pdf lookup "
+		<< "disagrees for " << mismatches << " samples, " << kChecks / sampleMilliseconds / 1e3 << " Msamples/s" << std::endl;
+
+	SceneBuilder builder;
+	addMixedScene(builder, 16);
+	SceneFile scene;
+	scene.openMemory(builder.serialize());
+	PathTracer pathTracer;
+	pathTracer.setScene(scene);
+	pathTracer.setEnvironment(&environment);
+	pathTracer.setSamplesPerPixel(1);
+	const uint32_t kWidth = 160, kHeight = 90;
+	const UniformBufferObject frame = defaultFrame(kWidth / (float)kHeight);
+
+	// passes of one sample until the time is up, so every method gets the same budget
+	auto renderFor = [&](PathTracer::EnvironmentSampling sampling, double budget, uint32_t& passes) {
+		pathTracer.setEnvironmentSampling(sampling);
+		ProgressiveRenderer progressive(pathTracer);
+		progressive.restart(frame, kWidth, kHeight);
+		auto start = std::chrono::high_resolution_clock::now();
+		while (millisecondsSince(start) < budget) {
+			progressive.renderPass();
+		}
+		passes = progressive.passCount();
+		return progressive.image();
+	};
+	uint32_t referencePasses;
+	HdrImage reference = renderFor(PathTracer::EnvironmentSampling::Importance, milliseconds * 8.0, referencePasses);
+	writeHdr("benchmark_environment_reference.hdr", reference);
+	std::cout << "  " << kWidth << "x" << kHeight << ", reference " << referencePasses << " spp with importance "
+		<< "sampling, equal time of " << milliseconds << " ms each:" << std::endl;
+
+	const std::pair<const char*, PathTracer::EnvironmentSampling> kMethods[] = {
+		{ "bsdf only", PathTracer::EnvironmentSampling::Bsdf },
+		{ "uniform + mis", PathTracer::EnvironmentSampling::Uniform },
+		{ "importance + mis", PathTracer::EnvironmentSampling::Importance }
+	};
+	for (const auto& method : kMethods) {
+		uint32_t passes;
+		HdrImage image = renderFor(method.second, (double)milliseconds, passes);
+		double squaredError = 0, referenceMean = 0, mean = 0;
+		for (size_t i = 0; i < image.pixels.size(); ++i) {
+			glm::dvec3 difference = glm::dvec3(image.pixels[i]) - glm::dvec3(reference.pixels[i]);
+			squaredError += glm::dot(difference, difference) / 3.0;
+			referenceMean += (reference.pixels[i].r + reference.pixels[i].g + reference.pixels[i].b) / 3.0;
+			mean += (image.pixels[i].r + image.pixels[i].g + image.pixels[i].b) / 3.0;
+		}
+		referenceMean /= image.pixels.size();
+		mean /= image.pixels.size();
+		std::cout << "    " << method.first << ": " << passes << " spp, rmse "
+			<< std::sqrt(squaredError / image.pixels.size()) << ", mean " << mean << " against " << referenceMean
+			<< std::endl;
+		if (method.second == PathTracer::EnvironmentSampling::Importance) {
+			writeHdr("benchmark_environment.hdr", image);
+		}
+	}
+
+	// the wavefront shades eight lanes at once and has to see the same image in expectation
+	pathTracer.setSchedule(PathTracer::Schedule::Wavefront);
+	uint32_t wavefrontPasses;
+	HdrImage wavefront = renderFor(PathTracer::EnvironmentSampling::Importance, (double)milliseconds, wavefrontPasses);
+	double wavefrontMean = 0, referenceMean = 0;
+	for (size_t i = 0; i < wavefront.pixels.size(); ++i) {
+		wavefrontMean += (wavefront.pixels[i].r + wavefront.pixels[i].g + wavefront.pixels[i].b) / 3.0;
+		referenceMean += (reference.pixels[i].r + reference.pixels[i].g + reference.pixels[i].b) / 3.0;
+	}
+	std::cout << "  wavefront: " << wavefrontPasses << " spp, mean " << wavefrontMean / wavefront.pixels.size()
+		<< " against " << referenceMean / wavefront.pixels.size() << std::endl;
+	return 0;
+}
+
+int benchmarkLights(size_t lightCount) {
+	// small emitting triangles of 16 colors and two decades of brightness scattered over the room above a
+	// floor and spheres, and nothing from the environment
+	const uint32_t kMaterialCount = 16;
+	std::mt19937 rng(1337);
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	SceneBuilder builder;
+	std::vector<uint32_t> materials;
+	for (uint32_t i = 0; i < kMaterialCount; ++i) {
+		float hue = i / (float)kMaterialCount * glm::two_pi<float>();
+		SceneMaterial material = {};
+		material.baseColor = glm::vec4(1.0f);
+		material.emissive = glm::vec4(0.6f + 0.4f * std::cos(hue), 0.6f + 0.4f * std::cos(hue + 2.1f),
+			0.6f + 0.4f * std::cos(hue + 4.2f), 0.0f) * std::pow(100.0f, uniform(rng)) * 0.5f;
+		material.roughness = 1.0f;
+		material.baseColorTexture = kSceneNone;
+		material.metallicRoughnessTexture = kSceneNone;
+		materials.push_back(builder.addMaterial(material));
+	}
+	for (uint32_t i = 0; i < kMaterialCount; ++i) {
+		MeshAsset lights;
+		Aabb bounds;
+		size_t count = lightCount / kMaterialCount + (i < lightCount % kMaterialCount ? 1 : 0);
+		for (size_t light = 0; light < count; ++light) {
+			glm::vec3 center(uniform(rng) * 3.0f - 1.5f, 0.05f + uniform(rng) * 0.9f, -uniform(rng) * 3.0f + 0.3f);
+			glm::vec3 axis = glm::normalize(glm::vec3(uniform(rng), uniform(rng), uniform(rng)) - 0.5f);
+			glm::vec3 side = glm::normalize(glm::cross(axis, glm::vec3(0.3f, 1.0f, 0.2f)));
+			glm::vec3 other = glm::cross(axis, side);
+			for (int corner = 0; corner < 3; ++corner) {
+				float angle = corner * glm::two_pi<float>() / 3.0f;
+				glm::vec3 position = center + (side * std::cos(angle) + other * std::sin(angle)) * 0.02f;
+				lights.vertices.push_back({ position, glm::vec3(1.0f), glm::vec2(0.0f) });
+				lights.indices.push_back((uint32_t)lights.indices.size());
+				bounds.grow(position);
+			}
+		}
+		lights.lods.push_back({ 0, (uint32_t)lights.indices.size(), 0.0f });
+		lights.bounds = glm::vec4(bounds.center(), glm::length(bounds.max - bounds.min) * 0.5f);
+		builder.addNode(glm::mat4(1.0f), kSceneNone, builder.addMesh(lights), materials[i]);
+	}
+	SceneMaterial gray = {};
+	gray.baseColor = glm::vec4(0.7f, 0.7f, 0.7f, 1.0f);
+	gray.roughness = 0.6f;
+	gray.baseColorTexture = kSceneNone;
+	gray.metallicRoughnessTexture = kSceneNone;
+	uint32_t grayMaterial = builder.addMaterial(gray);
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	makeSphere(32, vertices, indices);
+	MeshAsset sphere;
+	sphere.vertices = vertices;
+	sphere.indices = indices;
+	sphere.lods.push_back({ 0, (uint32_t)indices.size(), 0.0f });
+	sphere.bounds = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	uint32_t sphereMesh = builder.addMesh(sphere);
+	for (uint32_t i = 0; i < 6; ++i) {
+		glm::vec3 position((i / 5.0f - 0.5f) * 1.5f, -0.15f, -0.4f - (i % 2) * 0.6f);
+		builder.addNode(glm::scale(glm::translate(glm::mat4(1.0f), position), glm::vec3(0.15f)), kSceneNone,
+			sphereMesh, grayMaterial);
+	}
+	MeshAsset floor;
+	floor.vertices = {
+		{ { -5.0f, -0.3f, -5.0f }, { 1.0f, 1.0f, 1.0f }, { 0.0f, 0.0f } },
+		{ { 5.0f, -0.3f, -5.0f }, { 1.0f, 1.0f, 1.0f }, { 1.0f, 0.0f } },
+		{ { 5.0f, -0.3f, 5.0f }, { 1.0f, 1.0f, 1.0f }, { 1.0f, 1.0f } },
+		{ { -5.0f, -0.3f, 5.0f }, { 1.0f, 1.0f, 1.0f }, { 0.0f, 1.0f } }
+	};
+	floor.indices = { 0, 2, 1, 0, 3, 2 };
+	floor.lods.push_back({ 0, 6, 0.0f });
+	floor.bounds = glm::vec4(0.0f, -0.3f, 0.0f, 7.1f);
+	builder.addNode(glm::mat4(1.0f), kSceneNone, builder.addMesh(floor), grayMaterial);
+
+	SceneFile scene;
+	scene.openMemory(builder.serialize());
+	PathTracer pathTracer;
+	pathTracer.setScene(scene);
+	HdrImage black;
+	black.resize(1, 1);
+	EnvironmentMap environment;
+	environment.setImage(black);
+	pathTracer.setEnvironment(&environment);
+	pathTracer.setEnvironmentSampling(PathTracer::EnvironmentSampling::Bsdf);
+	const LightBvh& lights = pathTracer.lights();
+	std::cout << "lights: " << lights.lightCount() << " emissive triangles, light bvh built in "
+		<< lights.lastBuildMilliseconds() << " ms, " << lights.memoryBytes() / 1024 << " KiB" << std::endl;
+
+	// select() and selectionProbability() have to agree for MIS to weigh hits right
+	uint32_t mismatches = 0, misses = 0;
+	const uint32_t kChecks = 100000;
+	for (uint32_t i = 0; i < kChecks; ++i) {
+		glm::vec3 point(uniform(rng) * 3.0f - 1.5f, -0.3f + uniform(rng) * 0.9f, -uniform(rng) * 3.0f + 0.3f);
+		glm::vec3 normal = glm::normalize(glm::vec3(uniform(rng), uniform(rng), uniform(rng)) - 0.5f);
+		float probability;
+		uint32_t light = lights.select(point, normal, uniform(rng), probability);
+		if (light == ~0u) {
+			++misses;
+			continue;
+		}
+		mismatches += std::abs(lights.selectionProbability(point, normal, light) / probability - 1.0f) > 1e-3f;
+	}
+	std::cout << "  " << kChecks << " random points: " << misses << " saw no light, selection probability "
+		<< "disagrees for " << mismatches << std::endl;
+
+	const uint32_t kWidth = 160, kHeight = 90, kSamples = 4, kReferenceSamples = 128;
+	const UniformBufferObject frame = defaultFrame(kWidth / (float)kHeight);
+	HdrImage reference, image;
+	reference.resize(kWidth, kHeight);
+	image.resize(kWidth, kHeight);
+	// pixels that see a light themselves are noisy from antialiasing alone, the lighting is compared on the rest
+	pathTracer.setMaxBounces(0);
+	pathTracer.setSamplesPerPixel(16);
+	pathTracer.render(frame, image);
+	std::vector<uint8_t> lit(image.pixels.size());
+	size_t litCount = 0;
+	for (size_t i = 0; i < image.pixels.size(); ++i) {
+		lit[i] = image.pixels[i] == glm::vec3(0.0f);
+		litCount += lit[i];
+	}
+	pathTracer.setMaxBounces(4);
+	pathTracer.setLightSampling(PathTracer::LightSampling::Bvh);
+	pathTracer.setSamplesPerPixel(kReferenceSamples);
+	auto referenceStart = std::chrono::high_resolution_clock::now();
+	pathTracer.render(frame, reference);
+	std::cout << "  " << kWidth << "x" << kHeight << ", reference " << kReferenceSamples << " spp with the light bvh in "
+		<< millisecondsSince(referenceStart) << " ms, " << kSamples << " spp each, error over the " << litCount
+		<< " pixels that see no light directly:" << std::endl;
+	writeHdr("benchmark_lights_reference.hdr", reference);
+
+	const std::pair<const char*, PathTracer::LightSampling> kMethods[] = {
+		{ "bsdf only", PathTracer::LightSampling::Bsdf },
+		{ "uniform + mis", PathTracer::LightSampling::Uniform },
+		{ "light bvh + mis", PathTracer::LightSampling::Bvh }
+	};
+	pathTracer.setSamplesPerPixel(kSamples);
+	for (const auto& method : kMethods) {
+		pathTracer.setLightSampling(method.second);
+		auto renderStart = std::chrono::high_resolution_clock::now();
+		pathTracer.render(frame, image);
+		double renderMilliseconds = millisecondsSince(renderStart);
+		double squaredError = 0, referenceMean = 0, mean = 0;
+		for (size_t i = 0; i < image.pixels.size(); ++i) {
+			if (!lit[i]) {
+				continue;
+			}
+			glm::dvec3 difference = glm::dvec3(image.pixels[i]) - glm::dvec3(reference.pixels[i]);
+			squaredError += glm::dot(difference, difference) / 3.0;
+			referenceMean += (reference.pixels[i].r + reference.pixels[i].g + reference.pixels[i].b) / 3.0;
+			mean += (image.pixels[i].r + image.pixels[i].g + image.pixels[i].b) / 3.0;
+		}
+		std::cout << "    " << method.first << ": " << renderMilliseconds << " ms, " << pathTracer.lastRayCount()
+			<< " rays, rmse " << std::sqrt(squaredError / litCount) << ", mean " << mean / litCount << " against "
+			<< referenceMean / litCount << std::endl;
+		if (method.second == PathTracer::LightSampling::Bvh) {
+			writeHdr("benchmark_lights.hdr", image);
+		}
+	}
+	return 0;
+}
+
+// least squares slope of log2 error over log2 samples, the convergence rate
+static double convergenceRate(const std::vector<uint32_t>& samples, const std::vector<double>& errors) {
+	double meanX = 0, meanY = 0, xx = 0, xy = 0;
+	for (size_t i = 0; i < samples.size(); ++i) {
+		meanX += std::log2((double)samples[i]) / samples.size();
+		meanY += std::log2(errors[i]) / samples.size();
+	}
+	for (size_t i = 0; i < samples.size(); ++i) {
+		double x = std::log2((double)samples[i]) - meanX;
+		xx += x * x;
+		xy += x * (std::log2(errors[i]) - meanY);
+	}
+	return xy / xx;
+}
+
+int benchmarkSamplers(size_t maxSamples) {
+	const std::pair<const char*, Sampler::Type> kTypes[] = {
+		{ "independent", Sampler::Type::Independent },
+		{ "sobol", Sampler::Type::Sobol },
+		{ "blue noise", Sampler::Type::BlueNoise }
+	};
+	std::ofstream csv("benchmark_samplers.csv");
+	csv << "test,sampler,spp,rmse" << std::endl;
+
+	// integrands with known values, every pixel of a 16x16 block is one estimate. the 8d one spans two
+	// sets like two bounces do
+	const double gaussian = 0.746824132812427;
+	struct Integrand {
+		const char *name;
+		uint32_t dimensions;
+		double value;
+		double (*function)(const float *u);
+	};
+	const Integrand kIntegrands[] = {
+		{ "disk 2d", 2, glm::pi<double>() / 4.0,
+			[](const float *u) { return u[0] * u[0] + u[1] * u[1] < 1.0f ? 1.0 : 0.0; } },
+		{ "gaussian 4d", 4, std::pow(gaussian, 4.0), [](const float *u) {
+			return std::exp(-(double)(u[0] * u[0] + u[1] * u[1] + u[2] * u[2] + u[3] * u[3]));
+		} },
+		{ "gaussian 8d", 8, std::pow(gaussian, 8.0), [](const float *u) {
+			double sum = 0;
+			for (int d = 0; d < 8; ++d) {
+				sum += u[d] * u[d];
+			}
+			return std::exp(-sum);
+		} }
+	};
+	std::vector<uint32_t> sampleCounts;
+	for (uint32_t count = 1; count <= maxSamples; count *= 2) {
+		sampleCounts.push_back(count);
+	}
+	std::cout << "samplers: rmse over 256 pixels at " << sampleCounts.back()
+		<< " spp, the fitted rate and the 1 spp rmse after a 3x3 box filter" << std::endl;
+	for (const Integrand& integrand : kIntegrands) {
+		std::cout << "  " << integrand.name << ":";
+		for (const auto& type : kTypes) {
+			std::vector<double> errors(sampleCounts.size(), 0.0), firstErrors(256);
+			for (uint32_t pixel = 0; pixel < 256; ++pixel) {
+				double sum = 0;
+				size_t next = 0;
+				for (uint32_t index = 0; index < sampleCounts.back(); ++index) {
+					Sampler sampler(type.second, pixel % 16, pixel / 16, 7, index);
+					float u[8];
+					for (uint32_t d = 0; d < integrand.dimensions; ++d) {
+						if (d % 4 == 0) {
+							sampler.startSet(1 + d / 4);
+						}
+						u[d] = sampler.next();
+					}
+					sum += integrand.function(u);
+					if (index + 1 == sampleCounts[next]) {
+						double error = sum / (index + 1) - integrand.value;
+						errors[next++] += error * error / 256.0;
+						firstErrors[pixel] = index ? firstErrors[pixel] : error;
+					}
+				}
+			}
+			for (size_t i = 0; i < errors.size(); ++i) {
+				errors[i] = std::sqrt(errors[i]);
+				csv << integrand.name << "," << type.first << "," << sampleCounts[i] << "," << errors[i] << std::endl;
+			}
+			// the 1 spp error after a 3x3 box filter, low when neighbouring pixels err in opposite directions
+			double filteredError = 0;
+			for (uint32_t y = 1; y < 15; ++y) {
+				for (uint32_t x = 1; x < 15; ++x) {
+					double error = 0;
+					for (uint32_t k = 0; k < 9; ++k) {
+						error += firstErrors[(y + k / 3 - 1) * 16 + x + k % 3 - 1] / 9.0;
+					}
+					filteredError += error * error / (14 * 14);
+				}
+			}
+			std::cout << " " << type.first << " " << errors.back() << " (N^" << convergenceRate(sampleCounts, errors)
+				<< ", filtered " << std::sqrt(filteredError) << ")";
+		}
+		std::cout << std::endl;
+	}
+
+	// generation speed, one value at a time and eight lanes at once, which have to agree
+	const uint32_t kGenerated = 1 << 20;
+	for (const auto& type : kTypes) {
+		std::vector<Sampler> scalar(8), lanes(8);
+		// the timed loops sum what they generate, the sums are compared so neither loop can be dropped
+		float scalarSum = 0, lanesSum = 0;
+		float values[8];
+		uint32_t mismatches = 0;
+		auto scalarStart = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < kGenerated / 8; ++i) {
+			for (uint32_t lane = 0; lane < 8; ++lane) {
+				scalar[lane] = Sampler(type.second, lane * 5, i % 64, 3, i);
+				scalar[lane].startSet(4);
+				scalarSum += scalar[lane].next();
+			}
+		}
+		double scalarMilliseconds = millisecondsSince(scalarStart);
+		Sampler *pointers[8];
+		auto lanesStart = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < kGenerated / 8; ++i) {
+			for (uint32_t lane = 0; lane < 8; ++lane) {
+				lanes[lane] = Sampler(type.second, lane * 5, i % 64, 3, i);
+				lanes[lane].startSet(4);
+				pointers[lane] = &lanes[lane];
+			}
+			Sampler::nextLanes(pointers, values);
+			for (uint32_t lane = 0; lane < 8; ++lane) {
+				lanesSum += values[lane];
+			}
+		}
+		double lanesMilliseconds = millisecondsSince(lanesStart);
+		for (uint32_t i = 0; i < 4096; ++i) {
+			for (uint32_t lane = 0; lane < 8; ++lane) {
+				scalar[lane] = Sampler(type.second, lane * 5, i % 64, 3, i);
+				scalar[lane].startSet(i % 9);
+				lanes[lane] = scalar[lane];
+				pointers[lane] = &lanes[lane];
+			}
+			for (uint32_t dimension = 0; dimension < 6; ++dimension) {
+				Sampler::nextLanes(pointers, values);
+				for (uint32_t lane = 0; lane < 8; ++lane) {
+					mismatches += scalar[lane].next() != values[lane];
+				}
+			}
+		}
+		mismatches += scalarSum != lanesSum;
+		std::cout << "  " << type.first << ": " << kGenerated / scalarMilliseconds / 1e3 << " Msamples/s scalar, "
+			<< kGenerated / lanesMilliseconds / 1e3 << " in lanes, " << mismatches << " lane values differ"
+			<< std::endl;
+	}
+
+	// the path tracer with one sample per pass, against a reference of independent samples with another seed
+	SceneBuilder builder;
+	addMixedScene(builder, 16);
+	SceneFile scene;
+	scene.openMemory(builder.serialize());
+	PathTracer pathTracer;
+	pathTracer.setScene(scene);
+	const uint32_t kWidth = 128, kHeight = 72, kReferenceSamples = 512;
+	const UniformBufferObject frame = defaultFrame(kWidth / (float)kHeight);
+	HdrImage reference;
+	reference.resize(kWidth, kHeight);
+	pathTracer.setSampler(Sampler::Type::Independent, 1);
+	pathTracer.setSamplesPerPixel(kReferenceSamples);
+	pathTracer.render(frame, reference);
+	pathTracer.setSamplesPerPixel(1);
+	std::vector<uint32_t> passCounts;
+	for (uint32_t count = 1; count <= std::min<size_t>(maxSamples, 64); count *= 2) {
+		passCounts.push_back(count);
+	}
+	std::cout << "  " << kWidth << "x" << kHeight << " render against " << kReferenceSamples << " spp, rmse at 1.."
+		<< passCounts.back() << " spp, and at 1 spp after a 3x3 box filter:" << std::endl;
+	for (const auto& type : kTypes) {
+		pathTracer.setSampler(type.second);
+		ProgressiveRenderer progressive(pathTracer);
+		progressive.restart(frame, kWidth, kHeight);
+		std::vector<double> errors;
+		double filteredError = 0;
+		while (errors.size() < passCounts.size()) {
+			progressive.renderPass();
+			if (progressive.passCount() != passCounts[errors.size()]) {
+				continue;
+			}
+			const HdrImage& image = progressive.image();
+			double squaredError = 0;
+			for (size_t i = 0; i < image.pixels.size(); ++i) {
+				glm::dvec3 difference = glm::dvec3(image.pixels[i]) - glm::dvec3(reference.pixels[i]);
+				squaredError += glm::dot(difference, difference) / 3.0;
+			}
+			errors.push_back(std::sqrt(squaredError / image.pixels.size()));
+			csv << "render," << type.first << "," << progressive.passCount() << "," << errors.back() << std::endl;
+			// blue noise moves the error to high frequencies, which a small filter or the eye averages away
+			for (uint32_t y = 1; progressive.passCount() == 1 && y + 1 < kHeight; ++y) {
+				for (uint32_t x = 1; x + 1 < kWidth; ++x) {
+					glm::dvec3 difference(0.0);
+					for (int dy = -1; dy <= 1; ++dy) {
+						for (int dx = -1; dx <= 1; ++dx) {
+							difference += glm::dvec3(image.at(x + dx, y + dy)) - glm::dvec3(reference.at(x + dx, y + dy));
+						}
+					}
+					difference /= 9.0;
+					filteredError += glm::dot(difference, difference) / 3.0 / ((kWidth - 2) * (kHeight - 2));
+				}
+			}
+		}
+		std::cout << "    " << type.first << ":";
+		for (double error : errors) {
+			std::cout << " " << error;
+		}
+		std::cout << " (N^" << convergenceRate(passCounts, errors) << "), filtered " << std::sqrt(filteredError)
+			<< std::endl;
+	}
+	return 0;
+}
+
+int benchmarkAdaptive(size_t referenceSamples) {
+	SceneBuilder builder;
+	addMixedScene(builder, 16);
+	SceneFile scene;
+	scene.openMemory(builder.serialize());
+	PathTracer pathTracer;
+	pathTracer.setScene(scene);
+	const uint32_t kWidth = 192, kHeight = 108, kPasses = 256;
+	const UniformBufferObject frame = defaultFrame(kWidth / (float)kHeight);
+	// another scramble of the same sequence, so the reference's own error stays out of the way
+	HdrImage reference;
+	reference.resize(kWidth, kHeight);
+	pathTracer.setSampler(Sampler::Type::Sobol, 1);
+	pathTracer.setSamplesPerPixel((uint32_t)referenceSamples);
+	pathTracer.render(frame, reference);
+	pathTracer.setSampler(Sampler::Type::Sobol, 0);
+	pathTracer.setSamplesPerPixel(1);
+	auto rmse = [&](const HdrImage& image) {
+		double squaredError = 0;
+		for (size_t i = 0; i < image.pixels.size(); ++i) {
+			glm::dvec3 difference = glm::dvec3(image.pixels[i]) - glm::dvec3(reference.pixels[i]);
+			squaredError += glm::dot(difference, difference) / 3.0;
+		}
+		return std::sqrt(squaredError / image.pixels.size());
+	};
+	std::cout << "adaptive: " << kWidth << "x" << kHeight << ", 1 spp passes against " << referenceSamples
+		<< " spp" << std::endl;
+
+	// render time and error after every pass, the error outside of the timing
+	struct Point {
+		double milliseconds;
+		double samplesPerPixel;
+		double error;
+	};
+	ProgressiveRenderer progressive(pathTracer);
+	auto run = [&](float threshold, double timeLimit) {
+		std::vector<Point> points;
+		progressive.setErrorThreshold(threshold);
+		progressive.setTimeLimit(timeLimit);
+		progressive.restart(frame, kWidth, kHeight);
+		double milliseconds = 0;
+		while (true) {
+			auto passStart = std::chrono::high_resolution_clock::now();
+			bool rendered = progressive.renderPass();
+			milliseconds += millisecondsSince(passStart);
+			if (!rendered || (threshold == 0.0f && progressive.passCount() > kPasses)) {
+				break;
+			}
+			points.push_back({ milliseconds, progressive.meanSamplesPerPixel(), rmse(progressive.image()) });
+		}
+		return points;
+	};
+	std::vector<Point> uniform = run(0.0f, 0.0);
+	std::ofstream csv("benchmark_adaptive.csv");
+	csv << "run,milliseconds,spp,rmse" << std::endl;
+	for (const Point& point : uniform) {
+		csv << "uniform," << point.milliseconds << "," << point.samplesPerPixel << "," << point.error << std::endl;
+	}
+	auto report = [&](const char *name, const std::vector<Point>& points) {
+		for (const Point& point : points) {
+			csv << name << "," << point.milliseconds << "," << point.samplesPerPixel << "," << point.error << std::endl;
+		}
+		const Point& last = points.back();
+		std::cout << "  " << name << ": " << progressive.passCount() << " passes, " << progressive.activeTileCount()
+			<< " tiles active, " << last.milliseconds << " ms, " << last.samplesPerPixel << " spp on average, rmse "
+			<< last.error << ", estimate " << progressive.errorEstimate() << std::endl;
+		auto reached = std::find_if(uniform.begin(), uniform.end(), [&](const Point& point) {
+			return point.error <= last.error;
+		});
+		if (reached == uniform.end()) {
+			std::cout << "    uniform does not reach it in " << kPasses << " spp" << std::endl;
+		} else {
+			std::cout << "    uniform reaches it at " << reached->samplesPerPixel << " spp in " << reached->milliseconds
+				<< " ms (" << reached->milliseconds / last.milliseconds << "x)" << std::endl;
+		}
+	};
+
+	// the quality target alone ends these
+	for (float threshold : { 0.1f, 0.05f, 0.02f }) {
+		std::string name = "threshold " + std::to_string(threshold).substr(0, 4);
+		report(name.c_str(), run(threshold, 0.0));
+	}
+	// and the time limit this one
+	const double kTimeLimit = 1000.0;
+	report("1000 ms limit", run(0.02f, kTimeLimit));
+	auto sameTime = std::find_if(uniform.begin(), uniform.end(), [&](const Point& point) {
+		return point.milliseconds > kTimeLimit;
+	});
+	std::cout << "    uniform after the same time: rmse " << (sameTime - 1)->error << std::endl;
+	pathTracer.setSchedule(PathTracer::Schedule::Wavefront);
+	report("threshold 0.10, wavefront", run(0.1f, 0.0));
+	writeHdr("benchmark_adaptive.hdr", progressive.image());
+	return 0;
+}
+
+int benchmarkTextures(size_t textureCount) {
+	// checkers and thin lines that alias without filtering, a different scale and tint per texture
+	const uint32_t kTextureSize = 1024;
+	auto makeTexels = [kTextureSize](uint32_t texture, std::vector<uint8_t>& texels) {
+		texels.resize((size_t)kTextureSize * kTextureSize * 4);
+		uint32_t shift = 2 + texture % 3;
+		for (uint32_t y = 0; y < kTextureSize; ++y) {
+			for (uint32_t x = 0; x < kTextureSize; ++x) {
+				bool checker = ((x >> shift) ^ (y >> shift)) & 1, line = x % 37 == 0 || y % 41 == 0;
+				uint8_t *rgba = &texels[((size_t)y * kTextureSize + x) * 4];
+				rgba[0] = line ? 255 : checker ? (uint8_t)(40 + texture * 37 % 200) : 20;
+				rgba[1] = line ? 255 : checker ? (uint8_t)(40 + texture * 91 % 200) : 20;
+				rgba[2] = line ? 255 : checker ? (uint8_t)(40 + texture * 53 % 200) : 20;
+				rgba[3] = 255;
+			}
+		}
+	};
+	std::vector<std::vector<uint8_t>> images(textureCount);
+	for (uint32_t texture = 0; texture < textureCount; ++texture) {
+		makeTexels(texture, images[texture]);
+	}
+	auto addTextures = [&](TextureCache& cache) {
+		for (uint32_t texture = 0; texture < textureCount; ++texture) {
+			cache.addTexture([=](uint32_t& width, uint32_t& height, std::vector<uint8_t>& texels) {
+				width = height = kTextureSize;
+				makeTexels(texture, texels);
+				return true;
+			});
+		}
+	};
+
+	// a floor seen from 1.5 units up out to the horizon, cells of 4x4 units each with a texture of its own
+	// and 4 repeats over a cell. uv and its pixel differentials come from the plane in closed form
+	const uint32_t kWidth = 512, kHeight = 288;
+	const float kHeightAbove = 1.5f, kCellSize = 4.0f, kRepeats = 4.0f;
+	const uint32_t cellsX = (uint32_t)std::ceil(std::sqrt((double)textureCount));
+	struct Lookup {
+		uint32_t texture;
+		TextureFootprint footprint;
+	};
+	auto floorPoint = [&](float x, float y, glm::vec2& point) {
+		// the camera looks down 20 degrees with a 60 degree vertical field of view
+		float tanHalf = std::tan(glm::radians(30.0f)), pitch = glm::radians(20.0f);
+		glm::vec3 view((2.0f * x / kWidth - 1.0f) * tanHalf * kWidth / kHeight, (1.0f - 2.0f * y / kHeight) * tanHalf,
+			-1.0f);
+		glm::vec3 direction(view.x, view.y * std::cos(pitch) + view.z * std::sin(pitch),
+			-view.y * std::sin(pitch) + view.z * std::cos(pitch));
+		if (direction.y >= -1e-3f) {
+			return false;
+		}
+		float t = kHeightAbove / -direction.y;
+		point = glm::vec2(direction.x * t, -direction.z * t) + glm::vec2(cellsX * kCellSize * 0.5f, 0.0f);
+		return true;
+	};
+	auto textureAt = [&](glm::vec2 point) {
+		glm::ivec2 cell = glm::ivec2(glm::floor(point / kCellSize));
+		return (uint32_t)(((cell.y % cellsX + cellsX) % cellsX * cellsX + (cell.x % cellsX + cellsX) % cellsX)
+			% textureCount);
+	};
+	std::vector<Lookup> lookups;
+	std::vector<uint32_t> lookupPixels;
+	std::vector<uint32_t> order = hilbertTileOrder(kWidth / 16, kHeight / 16);
+	for (uint32_t tile : order) {
+		for (uint32_t y = tile / (kWidth / 16) * 16; y < tile / (kWidth / 16) * 16 + 16; ++y) {
+			for (uint32_t x = tile % (kWidth / 16) * 16; x < tile % (kWidth / 16) * 16 + 16; ++x) {
+				glm::vec2 center, right, down;
+				if (!floorPoint(x + 0.5f, y + 0.5f, center) || !floorPoint(x + 1.5f, y + 0.5f, right)
+					|| !floorPoint(x + 0.5f, y + 1.5f, down)) {
+					continue;
+				}
+				float scale = kRepeats / kCellSize;
+				lookups.push_back({ textureAt(center), { center * scale, (right - center) * scale * 0.5f,
+					(down - center) * scale * 0.5f } });
+				lookupPixels.push_back(y * kWidth + x);
+			}
+		}
+	}
+	std::cout << "textures: " << textureCount << " textures of " << kTextureSize << "x" << kTextureSize << ", "
+		<< lookups.size() << " floor pixels in hilbert tile order" << std::endl;
+
+	// the old lookup: level 0 of a row major image, bilinear with repeat addressing
+	const std::vector<float> srgb = []() {
+		std::vector<float> values(256);
+		for (int i = 0; i < 256; ++i) {
+			float c = i / 255.0f;
+			values[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		return values;
+	}();
+	auto rowMajorBilinear = [&](uint32_t texture, glm::vec2 uv) {
+		const std::vector<uint8_t>& image = images[texture];
+		float x = (uv.x - std::floor(uv.x)) * kTextureSize - 0.5f, y = (uv.y - std::floor(uv.y)) * kTextureSize - 0.5f;
+		float floorX = std::floor(x), floorY = std::floor(y);
+		auto texel = [&](int tx, int ty) {
+			const uint8_t *rgba = &image[((size_t)((ty + kTextureSize) % kTextureSize) * kTextureSize
+				+ (tx + kTextureSize) % kTextureSize) * 4];
+			return glm::vec3(srgb[rgba[0]], srgb[rgba[1]], srgb[rgba[2]]);
+		};
+		int ix = (int)floorX, iy = (int)floorY;
+		return glm::mix(glm::mix(texel(ix, iy), texel(ix + 1, iy), x - floorX),
+			glm::mix(texel(ix, iy + 1), texel(ix + 1, iy + 1), x - floorX), y - floorY);
+	};
+
+	// reference: the pixel's box averaged over 8x8 level 0 lookups
+	std::vector<glm::vec3> reference(lookups.size());
+	JobSystem::shared().parallelFor(lookups.size(), 256, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			float x = (float)(lookupPixels[i] % kWidth), y = (float)(lookupPixels[i] / kWidth);
+			glm::vec3 sum(0.0f);
+			for (uint32_t k = 0; k < 64; ++k) {
+				glm::vec2 point;
+				if (floorPoint(x + (k % 8 + 0.5f) / 8.0f, y + (k / 8 + 0.5f) / 8.0f, point)) {
+					sum += rowMajorBilinear(textureAt(point), point * (kRepeats / kCellSize));
+				}
+			}
+			reference[i] = sum / 64.0f;
+		}
+	});
+	auto rmse = [&](const std::vector<glm::vec3>& colors) {
+		double squaredError = 0;
+		for (size_t i = 0; i < colors.size(); ++i) {
+			glm::dvec3 difference = glm::dvec3(colors[i]) - glm::dvec3(reference[i]);
+			squaredError += glm::dot(difference, difference) / 3.0;
+		}
+		return std::sqrt(squaredError / colors.size());
+	};
+	std::vector<glm::vec3> colors(lookups.size());
+	const int kRepetitions = 3;
+	auto timeLookups = [&](const std::function<void(size_t begin, size_t end)>& body) {
+		double best = 1e30;
+		for (int repetition = 0; repetition < kRepetitions; ++repetition) {
+			auto start = std::chrono::high_resolution_clock::now();
+			JobSystem::shared().parallelFor(lookups.size(), 1024, body);
+			best = std::min(best, millisecondsSince(start));
+		}
+		return best;
+	};
+
+	double rowMajorMilliseconds = timeLookups([&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			colors[i] = rowMajorBilinear(lookups[i].texture, lookups[i].footprint.uv);
+		}
+	});
+	std::cout << "  row major level 0: " << rowMajorMilliseconds << " ms, " << lookups.size() / rowMajorMilliseconds
+		/ 1e3 << " Mlookups/s, rmse " << rmse(colors) << std::endl;
+
+	TextureCache cache;
+	addTextures(cache);
+	const std::pair<const char*, TextureCache::Filter> kFilters[] = {
+		{ "bilinear", TextureCache::Filter::Bilinear },
+		{ "trilinear", TextureCache::Filter::Trilinear },
+		{ "anisotropic", TextureCache::Filter::Anisotropic }
+	};
+	std::vector<glm::vec3> scalarColors;
+	for (const auto& filter : kFilters) {
+		cache.setFilter(filter.second);
+		cache.resetStatistics();
+		// the first pass decodes the textures it touches, the timing is of a warm cache
+		double milliseconds = timeLookups([&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				colors[i] = cache.sample(lookups[i].texture, lookups[i].footprint, true);
+			}
+		});
+		scalarColors = colors;
+		double requestsPerLookup = (double)cache.statistics().tileRequests / (kRepetitions * lookups.size());
+		// runs of lookups into one texture go eight at a time
+		double lanesMilliseconds = timeLookups([&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end;) {
+				TextureFootprint footprints[8];
+				glm::vec3 results[8];
+				uint32_t count = 0;
+				while (count < 8 && i + count < end && lookups[i + count].texture == lookups[i].texture) {
+					footprints[count] = lookups[i + count].footprint;
+					++count;
+				}
+				for (uint32_t lane = count; lane < 8; ++lane) {
+					footprints[lane] = footprints[count - 1];
+				}
+				cache.sampleLanes(lookups[i].texture, footprints, true, results);
+				std::copy(results, results + count, colors.begin() + i);
+				i += count;
+			}
+		});
+		float lanesDifference = 0.0f;
+		for (size_t i = 0; i < colors.size(); ++i) {
+			glm::vec3 difference = glm::abs(colors[i] - scalarColors[i]);
+			lanesDifference = std::max(lanesDifference, std::max(difference.x, std::max(difference.y, difference.z)));
+		}
+		std::cout << "  " << filter.first << ": " << milliseconds << " ms, " << lookups.size() / milliseconds / 1e3
+			<< " Mlookups/s, " << requestsPerLookup << " shared tile requests per lookup, lanes " << lanesMilliseconds << " ms (" << milliseconds / lanesMilliseconds
+			<< "x, largest difference " << lanesDifference << "), rmse " << rmse(scalarColors) << std::endl;
+	}
+
+	// the same lookups under memory budgets smaller than the pyramids, from a cold cache
+	for (size_t budget : { (size_t)1024 << 20, (size_t)64 << 20, (size_t)16 << 20 }) {
+		TextureCache bounded(budget);
+		addTextures(bounded);
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int repetition = 0; repetition < kRepetitions; ++repetition) {
+			JobSystem::shared().parallelFor(lookups.size(), 1024, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; ++i) {
+					colors[i] = bounded.sample(lookups[i].texture, lookups[i].footprint, true);
+				}
+			});
+		}
+		double milliseconds = millisecondsSince(start) / kRepetitions;
+		TextureCache::Statistics statistics = bounded.statistics();
+		std::cout << "  budget " << (budget >> 20) << " MiB: " << milliseconds << " ms per pass, peak "
+			<< statistics.peakResidentBytes / 1048576.0 << " MiB, " << statistics.loads << " loads, "
+			<< statistics.tileMisses << " misses of " << statistics.tileRequests << " shared lookups, rmse "
+			<< rmse(colors) << std::endl;
+	}
+
+	// the path tracer over the textured spheres and floor of the mixed scene
+	SceneBuilder builder;
+	addMixedScene(builder, 16);
+	SceneFile scene;
+	scene.openMemory(builder.serialize());
+	PathTracer pathTracer;
+	pathTracer.setScene(scene);
+	pathTracer.setSamplesPerPixel(4);
+	HdrImage image;
+	image.resize(640, 360);
+	for (const auto& filter : kFilters) {
+		pathTracer.textures().setFilter(filter.second);
+		for (PathTracer::Schedule schedule : { PathTracer::Schedule::PerPixel, PathTracer::Schedule::Wavefront }) {
+			pathTracer.setSchedule(schedule);
+			pathTracer.restartSequences();
+			auto start = std::chrono::high_resolution_clock::now();
+			pathTracer.render(defaultFrame(640.0f / 360.0f), image);
+			double milliseconds = millisecondsSince(start);
+			glm::dvec3 mean(0.0);
+			for (const glm::vec3& pixel : image.pixels) {
+				mean += glm::dvec3(pixel) / (double)image.pixels.size();
+			}
+			std::cout << "  path tracer, " << filter.first << (schedule == PathTracer::Schedule::PerPixel
+				? " per pixel: " : " wavefront: ") << milliseconds << " ms, mean " << mean.x << " " << mean.y << " "
+				<< mean.z << std::endl;
+		}
+	}
+	writeHdr("benchmark_textures.hdr", image);
+	return 0;
+}
+
+int benchmarkDenoiser(size_t referenceSamples) {
+	SceneBuilder builder;
+	addMixedScene(builder, 16);
+	SceneFile scene;
+	scene.openMemory(builder.serialize());
+	PathTracer pathTracer;
+	pathTracer.setScene(scene);
+	const uint32_t kWidth = 512, kHeight = 288, kFrames = 8;
+	const UniformBufferObject frame = defaultFrame(kWidth / (float)kHeight);
+	// the camera swung around the scene's vertical axis, the last frames of the moving run end at frame
+	auto swungFrame = [&](float degrees) {
+		UniformBufferObject swung = frame;
+		glm::vec3 eye = glm::vec3(glm::rotate(glm::mat4(1.0f), glm::radians(degrees), glm::vec3(0.0f, 1.0f, 0.0f))
+			* glm::vec4(0.0f, 0.0f, 2.0f, 1.0f));
+		swung.view = glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		return swung;
+	};
+	HdrImage reference;
+	reference.resize(kWidth, kHeight);
+	pathTracer.setSampler(Sampler::Type::Sobol, 1);
+	pathTracer.setSamplesPerPixel((uint32_t)referenceSamples);
+	pathTracer.render(frame, reference);
+	pathTracer.setSampler(Sampler::Type::Sobol, 0);
+	auto rmse = [&](const HdrImage& image) {
+		double squaredError = 0;
+		for (size_t i = 0; i < image.pixels.size(); ++i) {
+			glm::dvec3 difference = glm::dvec3(image.pixels[i]) - glm::dvec3(reference.pixels[i]);
+			squaredError += glm::dot(difference, difference) / 3.0;
+		}
+		return std::sqrt(squaredError / image.pixels.size());
+	};
+	std::cout << "denoiser: " << kWidth << "x" << kHeight << ", 1 spp frames against " << referenceSamples << " spp, "
+		<< JobSystem::shared().threadCount() << " threads" << std::endl;
+
+	// both schedules fill the same features
+	FeatureBuffers features[2];
+	HdrImage image;
+	image.resize(kWidth, kHeight);
+	pathTracer.setSamplesPerPixel(4);
+	for (int i = 0; i < 2; ++i) {
+		pathTracer.setSchedule(i == 0 ? PathTracer::Schedule::PerPixel : PathTracer::Schedule::Wavefront);
+		pathTracer.setFeatureBuffers(&features[i]);
+		pathTracer.restartSequences();
+		pathTracer.render(frame, image);
+	}
+	pathTracer.setSchedule(PathTracer::Schedule::PerPixel);
+	float largestDifference = 0.0f;
+	for (size_t i = 0; i < features[0].albedo.size(); ++i) {
+		glm::vec3 albedo = glm::abs(features[0].albedo[i] - features[1].albedo[i]);
+		float depth = features[0].depths[i] == features[1].depths[i] ? 0.0f
+			: std::fabs(features[0].depths[i] - features[1].depths[i]);
+		largestDifference = std::max({ largestDifference, albedo.x, albedo.y, albedo.z, depth,
+			glm::length(features[0].normals[i] - features[1].normals[i]),
+			std::fabs(features[0].luminances[i] - features[1].luminances[i]) });
+	}
+	std::cout << "  features at 4 spp, largest difference between the schedules " << largestDifference << std::endl;
+
+	// frames of one spp each, filtered with and without history, against averaging the frames
+	pathTracer.setSamplesPerPixel(1);
+	pathTracer.setFeatureBuffers(&features[0]);
+	Denoiser temporal, spatial;
+	spatial.setTemporal(false);
+	HdrImage average, filtered, spatialFiltered;
+	auto runFrames = [&](bool moving) {
+		pathTracer.restartSequences();
+		temporal.reset();
+		average.resize(kWidth, kHeight);
+		std::cout << (moving ? "  camera swinging 1.5 degrees a frame into place:" : "  static camera:") << std::endl;
+		double temporalMilliseconds = 0.0;
+		for (uint32_t frameIndex = 0; frameIndex < kFrames; ++frameIndex) {
+			UniformBufferObject current = moving ? swungFrame(1.5f * (kFrames - 1 - frameIndex)) : frame;
+			pathTracer.render(current, image);
+			for (size_t i = 0; i < image.pixels.size(); ++i) {
+				average.pixels[i] += (image.pixels[i] - average.pixels[i]) / (float)(frameIndex + 1);
+			}
+			auto start = std::chrono::high_resolution_clock::now();
+			temporal.denoise(current, image, features[0], filtered);
+			temporalMilliseconds += millisecondsSince(start);
+			double temporalError = rmse(filtered);
+			float reprojected = temporal.lastReprojectedFraction();
+			spatial.denoise(current, image, features[0], spatialFiltered);
+			if (frameIndex == 0 || frameIndex == 1 || frameIndex == 3 || frameIndex == kFrames - 1) {
+				// only the last frame of a moving camera sees what the reference does
+				std::cout << "    frame " << frameIndex + 1 << ": rmse 1 spp " << rmse(image);
+				if (!moving) {
+					std::cout << ", average of frames " << rmse(average);
+				}
+				std::cout << ", spatial " << rmse(spatialFiltered) << ", temporal " << temporalError << ", "
+					<< reprojected * 100.0f << "% reprojected" << std::endl;
+			}
+		}
+		writeHdr(moving ? "benchmark_denoiser_moving.hdr" : "benchmark_denoiser.hdr", filtered);
+		return temporalMilliseconds / kFrames;
+	};
+	double milliseconds = runFrames(false);
+	runFrames(true);
+	std::cout << "  " << milliseconds << " ms a frame at " << kWidth << "x" << kHeight << std::endl;
+
+	// full hd, the time of the filter alone once history exists
+	const uint32_t kFullWidth = 1920, kFullHeight = 1080;
+	const UniformBufferObject fullFrame = defaultFrame(kFullWidth / (float)kFullHeight);
+	image.resize(kFullWidth, kFullHeight);
+	pathTracer.render(fullFrame, image);
+	double best = 1e30;
+	for (int repetition = 0; repetition < 4; ++repetition) {
+		auto start = std::chrono::high_resolution_clock::now();
+		temporal.denoise(fullFrame, image, features[0], filtered);
+		best = std::min(best, millisecondsSince(start));
+	}
+	std::cout << "  " << kFullWidth << "x" << kFullHeight << ": " << best << " ms with " << temporal.iterations()
+		<< " iterations, " << best * JobSystem::shared().threadCount() << " thread ms" << std::endl;
+	return 0;
+}
+
+int benchmarkDisplay(size_t passCount) {
+	// radiance from 2^-14 to 2^8 across, hues down, with pixel noise so neighbouring lanes differ
+	const uint32_t kWidth = 1920, kHeight = 1080;
+	HdrImage image;
+	image.resize(kWidth, kHeight);
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> noise(0.9f, 1.1f);
+	for (uint32_t y = 0; y < kHeight; ++y) {
+		float hue = y / (float)kHeight * glm::two_pi<float>();
+		glm::vec3 tint = glm::vec3(std::cos(hue), std::cos(hue - 2.094f), std::cos(hue + 2.094f)) * 0.5f + 0.5f;
+		for (uint32_t x = 0; x < kWidth; ++x) {
+			image.at(x, y) = tint * std::exp2(-14.0f + 22.0f * x / kWidth) * noise(rng);
+		}
+	}
+	std::cout << "display: " << kWidth << "x" << kHeight << ", " << JobSystem::shared().threadCount() << " threads"
+		<< std::endl;
+
+	// the lanes against the per pixel reference, best of a few resolves
+	DisplayResolver resolver;
+	std::vector<uint8_t> texels((size_t)kWidth * kHeight * 4);
+	for (DisplayResolver::Tonemap tonemap : { DisplayResolver::Tonemap::Aces, DisplayResolver::Tonemap::AgX }) {
+		resolver.setTonemap(tonemap);
+		double best = 1e30;
+		for (int run = 0; run < 4; ++run) {
+			auto start = std::chrono::high_resolution_clock::now();
+			resolver.resolve(image, texels.data());
+			best = std::min(best, millisecondsSince(start));
+		}
+		auto start = std::chrono::high_resolution_clock::now();
+		int largestDifference = 0;
+		size_t differences = 0;
+		for (size_t i = 0; i < image.pixels.size(); ++i) {
+			uint32_t reference = resolver.resolvePixel(image.pixels[i]);
+			for (int channel = 0; channel < 3; ++channel) {
+				int difference = std::abs((int)texels[i * 4 + channel] - (int)(reference >> (8 * channel) & 0xff));
+				largestDifference = std::max(largestDifference, difference);
+				differences += difference != 0;
+			}
+		}
+		double referenceMilliseconds = millisecondsSince(start);
+		std::cout << "  " << (tonemap == DisplayResolver::Tonemap::Aces ? "aces" : "agx") << ": " << best
+			<< " ms, per pixel " << referenceMilliseconds << " ms, " << differences << " of "
+			<< image.pixels.size() * 3 << " codes differ, by " << largestDifference << " at most" << std::endl;
+	}
+
+	// adaptive passes resolved tile by tile into two staging copies taking turns, like the launcher's frames
+	// in flight, each has to end up as a full resolve of the same image
+	SceneBuilder builder;
+	addMixedScene(builder, 16);
+	SceneFile scene;
+	scene.openMemory(builder.serialize());
+	PathTracer pathTracer;
+	pathTracer.setScene(scene);
+	pathTracer.setSamplesPerPixel(1);
+	const uint32_t kPassWidth = 640, kPassHeight = 360;
+	ProgressiveRenderer progressive(pathTracer);
+	progressive.setErrorThreshold(0.05f);
+	progressive.restart(defaultFrame(kPassWidth / (float)kPassHeight), kPassWidth, kPassHeight);
+	resolver.setTonemap(DisplayResolver::Tonemap::Aces);
+	std::vector<uint8_t> staging[2], full((size_t)kPassWidth * kPassHeight * 4);
+	uint64_t updates[2] = { 0, 0 };
+	staging[0].resize(full.size());
+	staging[1].resize(full.size());
+	double passMilliseconds = 0, resolveMilliseconds = 0;
+	uint64_t resolvedTiles = 0;
+	bool matches = true;
+	uint32_t pass = 0;
+	for (; pass < passCount; ++pass) {
+		auto passStart = std::chrono::high_resolution_clock::now();
+		if (!progressive.renderPass()) {
+			break;
+		}
+		passMilliseconds += millisecondsSince(passStart);
+		auto resolveStart = std::chrono::high_resolution_clock::now();
+		resolvedTiles += resolver.resolve(progressive, staging[pass % 2].data(), updates[pass % 2]);
+		resolveMilliseconds += millisecondsSince(resolveStart);
+		resolver.resolve(progressive.image(), full.data());
+		matches = matches && full == staging[pass % 2];
+	}
+	std::cout << "  " << kPassWidth << "x" << kPassHeight << " adaptive: " << pass << " passes of "
+		<< passMilliseconds / pass << " ms, resolves of " << resolveMilliseconds / pass << " ms over "
+		<< (double)resolvedTiles / pass << " of " << progressive.tileCount() << " tiles, "
+		<< (matches ? "every resolve matches a full one" : "RESOLVES DIFFER FROM FULL ONES") << std::endl;
+	return matches ? 0 : 1;
+}
+
+int benchmarkComputeScene(size_t rayCount) {
+	// the mixed scene with a dense sphere in the middle, so the flattened bvh gets some depth
+	SceneBuilder builder;
+	addMixedScene(builder, 16);
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	makeSphere(256, vertices, indices);
+	MeshAsset sphere;
+	sphere.vertices = vertices;
+	sphere.indices = indices;
+	sphere.lods.push_back({ 0, (uint32_t)indices.size(), 0.0f });
+	sphere.bounds = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	glm::mat4 local = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -0.4f)), glm::vec3(0.2f));
+	builder.addNode(local, kSceneNone, builder.addMesh(sphere), kSceneNone);
+	SceneFile scene;
+	scene.openMemory(builder.serialize());
+	PathTracer pathTracer;
+	pathTracer.setScene(scene);
+
+	auto buildStart = std::chrono::high_resolution_clock::now();
+	ComputeScene computeScene;
+	computeScene.build(scene);
+	double buildMilliseconds = millisecondsSince(buildStart);
+	size_t bytes = sizeof(BvhNode) * computeScene.nodes().size()
+		+ sizeof(ComputeScene::Triangle) * computeScene.triangles().size()
+		+ sizeof(ComputeScene::Material) * computeScene.materials().size();
+	std::cout << "computescene: " << computeScene.triangles().size() << " triangles, " << computeScene.nodes().size()
+		<< " nodes, " << computeScene.materials().size() << " materials, " << bytes / (1024.0 * 1024.0)
+		<< " MiB of buffers, built in " << buildMilliseconds << " ms" << std::endl;
+
+	// camera rays of the default frame, and from every hit a ray in a random direction like a bounce
+	std::mt19937 rng(11);
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	const UniformBufferObject frame = defaultFrame(16.0f / 9.0f);
+	glm::mat4 inverseViewProjection = glm::inverse(frame.invert * frame.proj * frame.view);
+	std::vector<Ray> rays;
+	rays.reserve(rayCount);
+	while (rays.size() < rayCount) {
+		glm::vec2 ndc(uniform(rng) * 2.0f - 1.0f, uniform(rng) * 2.0f - 1.0f);
+		glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndc, 0.0f, 1.0f);
+		glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+		Ray ray;
+		ray.origin = glm::vec3(nearPoint) / nearPoint.w;
+		ray.direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - ray.origin);
+		ray.tMin = 0.0f;
+		ray.tMax = FLT_MAX;
+		rays.push_back(ray);
+		InstanceHit hit;
+		if (rays.size() < rayCount && pathTracer.intersect(ray, hit)) {
+			float z = 1.0f - 2.0f * uniform(rng), phi = glm::two_pi<float>() * uniform(rng);
+			float radius = std::sqrt(std::max(0.0f, 1.0f - z * z));
+			Ray bounce;
+			bounce.origin = ray.origin + ray.direction * hit.t;
+			bounce.direction = glm::vec3(radius * std::cos(phi), z, radius * std::sin(phi));
+			bounce.origin += bounce.direction * 1e-3f;
+			bounce.tMin = 0.0f;
+			bounce.tMax = FLT_MAX;
+			rays.push_back(bounce);
+		}
+	}
+
+	// the shader's walk over the flattened arrays against the two level bvh of the cpu path tracer
+	std::vector<float> distances(rays.size());
+	auto tlasStart = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < rays.size(); ++i) {
+		InstanceHit hit;
+		distances[i] = pathTracer.intersect(rays[i], hit) ? hit.t : FLT_MAX;
+	}
+	double tlasMilliseconds = millisecondsSince(tlasStart);
+	size_t mismatches = 0, materialMismatches = 0;
+	uint32_t deepestStack = 0;
+	auto flatStart = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < rays.size(); ++i) {
+		RayHit hit;
+		uint32_t stackDepth;
+		bool found = computeScene.intersect(rays[i], hit, stackDepth);
+		deepestStack = std::max(deepestStack, stackDepth);
+		if (found != (distances[i] != FLT_MAX)
+			|| (found && std::abs(hit.t - distances[i]) > 1e-4f * std::max(1.0f, distances[i]))) {
+			++mismatches;
+		}
+		materialMismatches += found && ComputeScene::material(computeScene.triangles()[hit.triangle])
+			>= computeScene.materials().size();
+	}
+	double flatMilliseconds = millisecondsSince(flatStart);
+	bool passed = mismatches * 10000 <= rays.size() && materialMismatches == 0
+		&& deepestStack <= computeScene.stackSize();
+	std::cout << "  " << rays.size() << " rays: flattened " << rays.size() / (flatMilliseconds * 1000.0)
+		<< " Mrays/s, tlas " << rays.size() / (tlasMilliseconds * 1000.0) << " Mrays/s, one thread, "
+		<< mismatches << " hits differ, stack " << deepestStack << " of " << computeScene.stackSize() << ", "
+		<< (passed ? "layout matches" : "FLATTENED SCENE DIFFERS") << std::endl;
+	return passed ? 0 : 1;
+}
+
+// Every rule of compute.hh on one backend, each failure printed. The old adder() example comes first.
+static bool checkComputeBackend(ComputeBackend& backend) {
+	bool passed = true;
+	auto check = [&](bool condition, const char *what) {
+		if (!condition) {
+			std::cout << "  " << backend.name() << ": " << what << " FAILED" << std::endl;
+			passed = false;
+		}
+	};
+	ComputeKernel add = backend.createKernel(kComputeAdd);
+	ComputeKernel saxpy = backend.createKernel(kComputeSaxpy);
+	ComputeKernel hash = backend.createKernel(kComputeHash);
+	ComputeQueue queue = backend.createQueue();
+	ComputeQueue other = backend.createQueue();
+	ComputeEvent event = backend.createEvent();
+
+	const int32_t a[5] = { 1, 2, 3, 4, 5 };
+	const int32_t b[5] = { 10, 20, 30, 40, 50 };
+	int32_t c[5] = {};
+	ComputeBuffer bufferA = backend.createBuffer(sizeof(a));
+	ComputeBuffer bufferB = backend.createBuffer(sizeof(b));
+	ComputeBuffer bufferC = backend.createBuffer(sizeof(c));
+	backend.upload(queue, bufferA, 0, a, sizeof(a));
+	backend.upload(queue, bufferB, 0, b, sizeof(b));
+	backend.launch(queue, add, 5, ComputeArguments().addBuffer(bufferA).addBuffer(bufferB).addBuffer(bufferC));
+	backend.download(queue, bufferC, 0, c, sizeof(c));
+	backend.finish(queue);
+	check(c[0] == 11 && c[1] == 22 && c[2] == 33 && c[3] == 44 && c[4] == 55, "{1,2,3,4,5} + {10,20,30,40,50}");
+
+	// a count no group size divides, so the last group runs past the end
+	const uint32_t kCount = 100003;
+	std::mt19937 rng(5);
+	std::uniform_int_distribution<int32_t> integers(-1000000, 1000000);
+	std::uniform_real_distribution<float> reals(-1.0f, 1.0f);
+	std::vector<int32_t> left(kCount), right(kCount), sums(kCount);
+	std::vector<float> x(kCount), y(kCount), result(kCount);
+	std::vector<uint32_t> values(kCount), hashed(kCount);
+	for (uint32_t i = 0; i < kCount; ++i) {
+		left[i] = integers(rng);
+		right[i] = integers(rng);
+		x[i] = reals(rng);
+		y[i] = reals(rng);
+		values[i] = (uint32_t)integers(rng);
+	}
+	ComputeBuffer bufferLeft = backend.createBuffer(kCount * sizeof(int32_t));
+	ComputeBuffer bufferRight = backend.createBuffer(kCount * sizeof(int32_t));
+	ComputeBuffer bufferSums = backend.createBuffer(kCount * sizeof(int32_t));
+	backend.upload(queue, bufferLeft, 0, left.data(), kCount * sizeof(int32_t));
+	backend.upload(queue, bufferRight, 0, right.data(), kCount * sizeof(int32_t));
+	backend.launch(queue, add, kCount,
+		ComputeArguments().addBuffer(bufferLeft).addBuffer(bufferRight).addBuffer(bufferSums));
+	backend.download(queue, bufferSums, 0, sums.data(), kCount * sizeof(int32_t));
+	backend.finish(queue);
+	bool sumsMatch = true;
+	for (uint32_t i = 0; i < kCount; ++i) {
+		sumsMatch = sumsMatch && sums[i] == left[i] + right[i];
+	}
+	check(sumsMatch, "add over an odd count");
+
+	// three launches in a row on one queue with nothing between them, each reading what the last wrote.
+	// devices may fuse the multiply and add, hence the tolerance
+	const float kAlpha = 0.75f;
+	ComputeBuffer bufferX = backend.createBuffer(kCount * sizeof(float));
+	ComputeBuffer bufferY = backend.createBuffer(kCount * sizeof(float));
+	backend.upload(queue, bufferX, 0, x.data(), kCount * sizeof(float));
+	backend.upload(queue, bufferY, 0, y.data(), kCount * sizeof(float));
+	ComputeArguments saxpyArguments;
+	saxpyArguments.addBuffer(bufferX).addBuffer(bufferY).setConstants(ComputeSaxpyConstants{ kAlpha });
+	for (int launch = 0; launch < 3; ++launch) {
+		backend.launch(queue, saxpy, kCount, saxpyArguments);
+	}
+	backend.download(queue, bufferY, 0, result.data(), kCount * sizeof(float));
+	backend.finish(queue);
+	bool saxpyMatches = true;
+	for (uint32_t i = 0; i < kCount; ++i) {
+		float expected = y[i];
+		for (int launch = 0; launch < 3; ++launch) {
+			expected = kAlpha * x[i] + expected;
+		}
+		saxpyMatches = saxpyMatches && std::abs(result[i] - expected) <= 1e-5f * std::max(1.0f, std::abs(expected));
+	}
+	check(saxpyMatches, "saxpy launches in order on one queue");
+
+	// parts of buffers: an upload into the middle, a download of a range across its end
+	const uint32_t kOffset = 1001, kPart = 5003;
+	std::vector<int32_t> part(kPart);
+	backend.upload(queue, bufferSums, kOffset * sizeof(int32_t), right.data(), kPart * sizeof(int32_t));
+	backend.download(queue, bufferSums, (kOffset - 1) * sizeof(int32_t), part.data(), kPart * sizeof(int32_t));
+	backend.finish(queue);
+	check(part[0] == left[kOffset - 1] + right[kOffset - 1]
+		&& std::equal(part.begin() + 1, part.end(), right.begin()), "copies at offsets");
+
+	// a long hash on one queue, the other waits for its event before reading the values back
+	const uint32_t kRounds = 64;
+	std::vector<uint32_t> halfHashed(kCount);
+	for (uint32_t i = 0; i < kCount; ++i) {
+		uint32_t value = values[i];
+		for (uint32_t round = 0; round < kRounds; ++round) {
+			value = computeHash(value);
+			if (round + 1 == kRounds / 2) {
+				halfHashed[i] = value;
+			}
+		}
+		hashed[i] = value;
+	}
+	ComputeBuffer bufferValues = backend.createBuffer(kCount * sizeof(uint32_t));
+	std::vector<uint32_t> waited(kCount);
+	backend.upload(queue, bufferValues, 0, values.data(), kCount * sizeof(uint32_t));
+	backend.launch(queue, hash, kCount,
+		ComputeArguments().addBuffer(bufferValues).setConstants(ComputeHashConstants{ kRounds }));
+	backend.record(queue, event);
+	backend.wait(other, event);
+	backend.download(other, bufferValues, 0, waited.data(), kCount * sizeof(uint32_t));
+	backend.finish(other);
+	check(waited == hashed, "a queue waiting for another's event");
+	backend.finish(queue);
+
+	// an event recorded twice completes with its second recording, and synchronize() alone makes the
+	// downloads before it visible
+	std::vector<uint32_t> first(kCount), second(kCount);
+	backend.upload(queue, bufferValues, 0, values.data(), kCount * sizeof(uint32_t));
+	backend.launch(queue, hash, kCount,
+		ComputeArguments().addBuffer(bufferValues).setConstants(ComputeHashConstants{ kRounds / 2 }));
+	backend.download(queue, bufferValues, 0, first.data(), kCount * sizeof(uint32_t));
+	backend.record(queue, event);
+	backend.launch(queue, hash, kCount,
+		ComputeArguments().addBuffer(bufferValues).setConstants(ComputeHashConstants{ kRounds / 2 }));
+	backend.download(queue, bufferValues, 0, second.data(), kCount * sizeof(uint32_t));
+	backend.record(queue, event);
+	backend.synchronize(event);
+	check(first == halfHashed && second == hashed && backend.complete(event),
+		"synchronize on an event recorded again");
+	backend.finish(queue);
+	check(backend.complete(event), "an event after finish()");
+	ComputeEvent unrecorded = backend.createEvent();
+	check(backend.complete(unrecorded), "an event never recorded");
+
+	// mistakes throw when called
+	bool missingFormThrows = false, rangeThrows = false, offsetThrows = false;
+	try {
+		backend.createKernel(ComputeKernelSource{ "empty", nullptr, 1, nullptr, nullptr, 1 });
+	} catch (const std::runtime_error&) {
+		missingFormThrows = true;
+	}
+	try {
+		backend.upload(queue, bufferA, 0, a, sizeof(a) + 1);
+	} catch (const std::runtime_error&) {
+		rangeThrows = true;
+	}
+	try {
+		backend.download(queue, bufferA, sizeof(a) + 4, c, 0);
+	} catch (const std::runtime_error&) {
+		offsetThrows = true;
+	}
+	check(missingFormThrows && rangeThrows && offsetThrows, "throwing on a missing kernel form and bad copies");
+
+	// buffers go once nothing queued uses them
+	backend.destroyBuffer(bufferLeft);
+	backend.destroyBuffer(bufferRight);
+	ComputeBuffer recreated = backend.createBuffer(sizeof(a));
+	std::memset(c, 0, sizeof(c));
+	backend.upload(queue, recreated, 0, b, sizeof(b));
+	backend.launch(queue, add, 5, ComputeArguments().addBuffer(bufferA).addBuffer(recreated).addBuffer(bufferC));
+	backend.download(queue, bufferC, 0, c, sizeof(c));
+	backend.finish(queue);
+	check(c[0] == 11 && c[4] == 55, "a buffer created after others were destroyed");
+	return passed;
+}
+
+// the backend's add bandwidth, copy bandwidth from allocateHost() memory, and chunks of upload, hash and
+// download pipelined over two queues against the same chunks on one
+static void benchmarkComputeBackend(ComputeBackend& backend, uint32_t itemCount) {
+	const int kRuns = 4;
+	size_t bytes = (size_t)itemCount * sizeof(uint32_t);
+	ComputeKernel add = backend.createKernel(kComputeAdd);
+	ComputeKernel hash = backend.createKernel(kComputeHash);
+	ComputeQueue queues[2] = { backend.createQueue(), backend.createQueue() };
+	uint32_t *host = static_cast<uint32_t*>(backend.allocateHost(bytes));
+	for (uint32_t i = 0; i < itemCount; ++i) {
+		host[i] = i;
+	}
+	ComputeBuffer buffers[3] = { backend.createBuffer(bytes), backend.createBuffer(bytes),
+		backend.createBuffer(bytes) };
+	backend.upload(queues[0], buffers[0], 0, host, bytes);
+	backend.upload(queues[0], buffers[1], 0, host, bytes);
+	backend.finish(queues[0]);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	ComputeArguments addArguments;
+	addArguments.addBuffer(buffers[0]).addBuffer(buffers[1]).addBuffer(buffers[2]);
+	for (int run = 0; run < kRuns; ++run) {
+		backend.launch(queues[0], add, itemCount, addArguments);
+	}
+	backend.finish(queues[0]);
+	double addMilliseconds = millisecondsSince(start) / kRuns;
+	start = std::chrono::high_resolution_clock::now();
+	for (int run = 0; run < kRuns; ++run) {
+		backend.upload(queues[0], buffers[0], 0, host, bytes);
+	}
+	backend.finish(queues[0]);
+	double uploadMilliseconds = millisecondsSince(start) / kRuns;
+	start = std::chrono::high_resolution_clock::now();
+	for (int run = 0; run < kRuns; ++run) {
+		backend.download(queues[0], buffers[2], 0, host, bytes);
+	}
+	backend.finish(queues[0]);
+	double downloadMilliseconds = millisecondsSince(start) / kRuns;
+	std::cout << "  " << backend.name() << ": add " << 3.0 * bytes / (addMilliseconds * 1e6) << " GB/s, upload "
+		<< bytes / (uploadMilliseconds * 1e6) << " GB/s, download " << bytes / (downloadMilliseconds * 1e6)
+		<< " GB/s" << std::endl;
+
+	// each chunk in buffers of its own, so chunks on different queues share nothing
+	const uint32_t kChunks = 8;
+	const uint32_t kRounds = 16;
+	uint32_t chunkItems = itemCount / kChunks;
+	size_t chunkBytes = (size_t)chunkItems * sizeof(uint32_t);
+	std::vector<ComputeBuffer> chunks(kChunks);
+	for (ComputeBuffer& chunk : chunks) {
+		chunk = backend.createBuffer(chunkBytes);
+	}
+	double pipelineMilliseconds[2];
+	for (uint32_t queueCount = 1; queueCount <= 2; ++queueCount) {
+		start = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < kChunks; ++i) {
+			ComputeQueue queue = queues[i % queueCount];
+			backend.upload(queue, chunks[i], 0, host + (size_t)i * chunkItems, chunkBytes);
+			backend.launch(queue, hash, chunkItems,
+				ComputeArguments().addBuffer(chunks[i]).setConstants(ComputeHashConstants{ kRounds }));
+			backend.download(queue, chunks[i], 0, host + (size_t)i * chunkItems, chunkBytes);
+		}
+		for (uint32_t queue = 0; queue < queueCount; ++queue) {
+			backend.finish(queues[queue]);
+		}
+		pipelineMilliseconds[queueCount - 1] = millisecondsSince(start);
+	}
+	std::cout << "  " << backend.name() << ": " << kChunks << " chunks of upload, hash and download, one queue "
+		<< pipelineMilliseconds[0] << " ms, two queues " << pipelineMilliseconds[1] << " ms, "
+		<< pipelineMilliseconds[0] / pipelineMilliseconds[1] << "x" << std::endl;
+	backend.freeHost(host);
+}
+
+int benchmarkCompute(size_t itemCount) {
+	std::cout << "compute: " << itemCount << " items, " << JobSystem::shared().threadCount() << " threads"
+		<< std::endl;
+	const ComputeBackend::Type kTypes[] = { ComputeBackend::Type::Cpu, ComputeBackend::Type::Cuda,
+		ComputeBackend::Type::Vulkan };
+	const char *kTypeNames[] = { "cpu", "cuda", "vulkan" };
+	bool passed = true;
+	for (int i = 0; i < 3; ++i) {
+		if (!computeBackendBuilt(kTypes[i])) {
+			std::cout << "  " << kTypeNames[i] << ": not built in" << std::endl;
+			continue;
+		}
+		// a built in backend without a device is skipped, one failing once created is not
+		std::unique_ptr<ComputeBackend> backend;
+		try {
+			backend = createComputeBackend(kTypes[i]);
+		} catch (const std::exception& error) {
+			std::cout << "  " << kTypeNames[i] << ": " << error.what() << std::endl;
+			continue;
+		}
+		try {
+			bool backendPassed = checkComputeBackend(*backend);
+			std::cout << "  " << backend->name() << ": " << (backendPassed ? "conforms" : "DOES NOT CONFORM")
+				<< std::endl;
+			benchmarkComputeBackend(*backend, (uint32_t)itemCount);
+			passed = passed && backendPassed;
+		} catch (const std::exception& error) {
+			std::cout << "  " << backend->name() << ": " << error.what() << " FAILED" << std::endl;
+			passed = false;
+		}
+	}
+	return passed ? 0 : 1;
+}
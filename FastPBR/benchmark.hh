@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+
+// headless measurements, run with FastPBR --bench <name> [size]
+int runBenchmark(const char *name, size_t size);
+
+int benchmarkCulling(size_t objectCount);
+int benchmarkMeshlets(size_t segments);
+int benchmarkLod(size_t instanceCount);
+int benchmarkScene(size_t megabytes);
+int benchmarkTransforms(size_t nodeCount);
+int benchmarkPathTracer(size_t sphereCount);
+int benchmarkBvh(size_t triangleCount);
+int benchmarkLbvh(size_t triangleCount);
+int benchmarkRefit(size_t triangleCount);
+int benchmarkWideBvh(size_t triangleCount);
+int benchmarkPackets(size_t triangleCount);
+int benchmarkTriangles(size_t triangleCount);
+int benchmarkTlas(size_t instanceCount);
+int benchmarkWavefront(size_t samplesPerPixel);
+int benchmarkTiles(size_t maxThreads);
+int benchmarkBsdf(size_t sampleCount);
+int benchmarkEnvironment(size_t milliseconds);
+int benchmarkLights(size_t lightCount);
+int benchmarkSamplers(size_t maxSamples);
+int benchmarkAdaptive(size_t referenceSamples);
+int benchmarkTextures(size_t textureCount);
+int benchmarkDenoiser(size_t referenceSamples);
+int benchmarkDisplay(size_t passCount);
+int benchmarkComputeScene(size_t rayCount);
+int benchmarkCompute(size_t itemCount);
@@ -0,0 +1,39 @@
+#pragma once
+#include "lanes.hh"
+#include <glm/glm.hpp>
+
+// The BSDF of shaders/bsdf.glsl for the CPU side, built once over floats in bsdf:: and once over eight
+// lanes in bsdf8::, so runs of hits with one material are shaded eight at a time.
+
+#define BSDF_FUNCTION inline
+#define BSDF_OUT(type) type&
+
+namespace bsdf {
+
+using namespace glm;
+typedef float BsdfFloat;
+typedef glm::vec3 BsdfVec3;
+typedef bool BsdfBool;
+
+template <typename T>
+inline T bsdfSelect(bool condition, const T& a, const T& b) { return condition ? a : b; }
+
+#include "shaders/bsdf.glsl"
+
+}
+
+namespace bsdf8 {
+
+typedef Float8 BsdfFloat;
+typedef Vec3x8 BsdfVec3;
+typedef Mask8 BsdfBool;
+
+inline Float8 bsdfSelect(Mask8 condition, Float8 a, Float8 b) { return mix(b, a, condition); }
+inline Vec3x8 bsdfSelect(Mask8 condition, const Vec3x8& a, const Vec3x8& b) { return mix(b, a, condition); }
+
+#include "shaders/bsdf.glsl"
+
+}
+
+#undef BSDF_FUNCTION
+#undef BSDF_OUT
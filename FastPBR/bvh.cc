@@ -0,0 +1,385 @@
+#include "bvh.hh"
+#include <chrono>
+#include <immintrin.h>
+
+namespace {
+
+// primitives per job for the parallel passes
+const size_t kChunkSize = 16384;
+
+struct alignas(16) Bin {
+	__m128 min;
+	__m128 max;
+	uint32_t count;
+};
+
+// bins of all three axes, filled in one pass
+struct BinSet {
+	Bin bins[3][Bvh::kBinCount];
+
+	void clear() {
+		for (auto& axis : bins) {
+			for (auto& bin : axis) {
+				bin.min = _mm_set1_ps(FLT_MAX);
+				bin.max = _mm_set1_ps(-FLT_MAX);
+				bin.count = 0;
+			}
+		}
+	}
+
+	void merge(const BinSet& other) {
+		for (int axis = 0; axis < 3; ++axis) {
+			for (uint32_t i = 0; i < Bvh::kBinCount; ++i) {
+				bins[axis][i].min = _mm_min_ps(bins[axis][i].min, other.bins[axis][i].min);
+				bins[axis][i].max = _mm_max_ps(bins[axis][i].max, other.bins[axis][i].max);
+				bins[axis][i].count += other.bins[axis][i].count;
+			}
+		}
+	}
+};
+
+float halfArea(__m128 min, __m128 max) {
+	alignas(16) float extent[4];
+	_mm_store_ps(extent, _mm_max_ps(_mm_sub_ps(max, min), _mm_setzero_ps()));
+	return extent[0] * extent[1] + extent[1] * extent[2] + extent[2] * extent[0];
+}
+
+// the fourth lane holds the primitive index, which must not leak into the bounds
+template <typename BuildBounds>
+__m128 loadMin(const BuildBounds& bounds) {
+	return _mm_and_ps(_mm_load_ps(bounds.min), _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0)));
+}
+
+__m128 centroidOf(__m128 min, __m128 max) {
+	return _mm_mul_ps(_mm_add_ps(min, max), _mm_set1_ps(0.5f));
+}
+
+Aabb toAabb(__m128 min, __m128 max) {
+	alignas(16) float lower[4], upper[4];
+	_mm_store_ps(lower, min);
+	_mm_store_ps(upper, max);
+	Aabb bounds;
+	bounds.min = glm::vec3(lower[0], lower[1], lower[2]);
+	bounds.max = glm::vec3(upper[0], upper[1], upper[2]);
+	return bounds;
+}
+
+}
+
+struct alignas(16) Bvh::RangeBounds {
+	__m128 min;
+	__m128 max;
+	__m128 centroidMin;
+	__m128 centroidMax;
+
+	void clear() {
+		min = centroidMin = _mm_set1_ps(FLT_MAX);
+		max = centroidMax = _mm_set1_ps(-FLT_MAX);
+	}
+
+	void grow(__m128 primitiveMin, __m128 primitiveMax, __m128 centroid) {
+		min = _mm_min_ps(min, primitiveMin);
+		max = _mm_max_ps(max, primitiveMax);
+		centroidMin = _mm_min_ps(centroidMin, centroid);
+		centroidMax = _mm_max_ps(centroidMax, centroid);
+	}
+
+	void merge(const RangeBounds& other) {
+		grow(other.min, other.max, other.centroidMin);
+		centroidMax = _mm_max_ps(centroidMax, other.centroidMax);
+	}
+};
+
+void Bvh::setLeafBlocks(uint32_t width, float blockCost) {
+	_leafBlockWidth = std::max(width, 1u);
+	_leafBlockCost = blockCost;
+}
+
+void Bvh::build(const Aabb *primitiveBounds, size_t primitiveCount, JobSystem& jobs) {
+	auto startTime = std::chrono::high_resolution_clock::now();
+	_nodes.clear();
+	_refitRanges.clear();
+	_primitives.resize(primitiveCount);
+	_buildBounds.resize(primitiveCount);
+	if (primitiveCount == 0) {
+		_lastBuildMilliseconds = 0;
+		return;
+	}
+	jobs.parallelFor(primitiveCount, kChunkSize, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			const Aabb& bounds = primitiveBounds[i];
+			BuildBounds& buildBounds = _buildBounds[i];
+			buildBounds.min[0] = bounds.min.x;
+			buildBounds.min[1] = bounds.min.y;
+			buildBounds.min[2] = bounds.min.z;
+			buildBounds.primitive = (uint32_t)i;
+			_mm_store_ps(buildBounds.max, _mm_setr_ps(bounds.max.x, bounds.max.y, bounds.max.z, 0.0f));
+		}
+	});
+
+	_buildNodes.resize(primitiveCount * 2);
+	std::atomic<uint32_t> nodeCount{ 1 };
+	RangeBounds range;
+	gatherBounds(0, (uint32_t)primitiveCount, range, jobs);
+	buildNode(0, 0, (uint32_t)primitiveCount, range, 0, nodeCount, jobs);
+	flatten(nodeCount.load());
+	for (size_t i = 0; i < primitiveCount; ++i) {
+		_primitives[i] = _buildBounds[i].primitive;
+	}
+
+	_buildBounds.clear();
+	_buildBounds.shrink_to_fit();
+	_buildNodes.clear();
+	_buildNodes.shrink_to_fit();
+	auto endTime = std::chrono::high_resolution_clock::now();
+	_lastBuildMilliseconds = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+}
+
+void Bvh::buildTriangles(const glm::vec3 *corners, size_t triangleCount, JobSystem& jobs) {
+	std::vector<Aabb> bounds(triangleCount);
+	jobs.parallelFor(triangleCount, kChunkSize, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			bounds[i].grow(corners[i * 3]);
+			bounds[i].grow(corners[i * 3 + 1]);
+			bounds[i].grow(corners[i * 3 + 2]);
+		}
+	});
+	build(bounds.data(), triangleCount, jobs);
+}
+
+float Bvh::sahCost() const {
+	if (_nodes.empty()) {
+		return 0;
+	}
+	Aabb root;
+	root.min = _nodes[0].boundsMin;
+	root.max = _nodes[0].boundsMax;
+	float rootArea = std::max(root.surfaceArea(), FLT_MIN);
+	double cost = 0;
+	for (const auto& node : _nodes) {
+		Aabb bounds;
+		bounds.min = node.boundsMin;
+		bounds.max = node.boundsMax;
+		cost += bounds.surfaceArea() / rootArea * (node.isLeaf() ? (float)node.count : 1.0f);
+	}
+	return (float)cost;
+}
+
+void Bvh::gatherBounds(uint32_t begin, uint32_t end, RangeBounds& range, JobSystem& jobs) const {
+	auto gather = [&](size_t first, size_t last, RangeBounds& bounds) {
+		bounds.clear();
+		for (size_t i = first; i < last; ++i) {
+			__m128 min = loadMin(_buildBounds[i]);
+			__m128 max = _mm_load_ps(_buildBounds[i].max);
+			bounds.grow(min, max, centroidOf(min, max));
+		}
+	};
+	if (end - begin < kParallelBinningSize) {
+		gather(begin, end, range);
+		return;
+	}
+	std::vector<RangeBounds> chunks((end - begin + kChunkSize - 1) / kChunkSize);
+	jobs.parallelFor(chunks.size(), 1, [&](size_t first, size_t last) {
+		for (size_t chunk = first; chunk < last; ++chunk) {
+			size_t chunkBegin = begin + chunk * kChunkSize;
+			gather(chunkBegin, std::min<size_t>(end, chunkBegin + kChunkSize), chunks[chunk]);
+		}
+	});
+	range.clear();
+	for (const auto& chunk : chunks) {
+		range.merge(chunk);
+	}
+}
+
+void Bvh::buildNode(uint32_t node, uint32_t begin, uint32_t end, const RangeBounds& range, uint32_t depth,
+	std::atomic<uint32_t>& nodeCount, JobSystem& jobs) {
+	uint32_t count = end - begin;
+	BuildNode& current = _buildNodes[node];
+	current.bounds = toAabb(range.min, range.max);
+	current.begin = begin;
+	current.count = count;
+	if (count == 1) {
+		return;
+	}
+
+	// bin index of every axis from one multiply, flat axes put everything into bin 0
+	alignas(16) float centroidExtent[4];
+	_mm_store_ps(centroidExtent, _mm_sub_ps(range.centroidMax, range.centroidMin));
+	alignas(16) float binScale[4];
+	for (int axis = 0; axis < 4; ++axis) {
+		bool flat = axis == 3 || !(centroidExtent[axis] > 1e-12f);
+		binScale[axis] = flat ? 0.0f : kBinCount * 0.9999f / centroidExtent[axis];
+	}
+	const __m128 scale = _mm_load_ps(binScale);
+	const __m128 offset = range.centroidMin;
+	auto binIndices = [&](__m128 centroid, int32_t *binIndex) {
+		_mm_store_si128(reinterpret_cast<__m128i*>(binIndex),
+			_mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(centroid, offset), scale)));
+	};
+	auto fillBins = [&](size_t first, size_t last, BinSet& binSet) {
+		binSet.clear();
+		for (size_t i = first; i < last; ++i) {
+			__m128 min = loadMin(_buildBounds[i]);
+			__m128 max = _mm_load_ps(_buildBounds[i].max);
+			alignas(16) int32_t binIndex[4];
+			binIndices(centroidOf(min, max), binIndex);
+			for (int axis = 0; axis < 3; ++axis) {
+				Bin& bin = binSet.bins[axis][std::min<uint32_t>((uint32_t)binIndex[axis], kBinCount - 1)];
+				bin.min = _mm_min_ps(bin.min, min);
+				bin.max = _mm_max_ps(bin.max, max);
+				++bin.count;
+			}
+		}
+	};
+
+	int bestAxis = -1;
+	uint32_t bestSplit = 0;
+	float bestCost = FLT_MAX;
+	if (depth < kMaxSahDepth) {
+		BinSet binSet;
+		if (count >= kParallelBinningSize) {
+			std::vector<BinSet> chunks((count + kChunkSize - 1) / kChunkSize);
+			jobs.parallelFor(chunks.size(), 1, [&](size_t first, size_t last) {
+				for (size_t chunk = first; chunk < last; ++chunk) {
+					size_t chunkBegin = begin + chunk * kChunkSize;
+					fillBins(chunkBegin, std::min<size_t>(end, chunkBegin + kChunkSize), chunks[chunk]);
+				}
+			});
+			binSet = chunks[0];
+			for (size_t chunk = 1; chunk < chunks.size(); ++chunk) {
+				binSet.merge(chunks[chunk]);
+			}
+		} else {
+			fillBins(begin, end, binSet);
+		}
+
+		// sweep from the right for the suffix areas, then from the left evaluating every plane
+		for (int axis = 0; axis < 3; ++axis) {
+			if (binScale[axis] == 0.0f) {
+				continue;
+			}
+			const Bin *bins = binSet.bins[axis];
+			float rightCost[kBinCount];
+			__m128 min = _mm_set1_ps(FLT_MAX), max = _mm_set1_ps(-FLT_MAX);
+			uint32_t rightCount = 0;
+			for (uint32_t i = kBinCount - 1; i > 0; --i) {
+				min = _mm_min_ps(min, bins[i].min);
+				max = _mm_max_ps(max, bins[i].max);
+				rightCount += bins[i].count;
+				rightCost[i] = rightCount ? halfArea(min, max) * rightCount : FLT_MAX;
+			}
+			min = _mm_set1_ps(FLT_MAX);
+			max = _mm_set1_ps(-FLT_MAX);
+			uint32_t leftCount = 0;
+			for (uint32_t split = 1; split < kBinCount; ++split) {
+				min = _mm_min_ps(min, bins[split - 1].min);
+				max = _mm_max_ps(max, bins[split - 1].max);
+				leftCount += bins[split - 1].count;
+				if (leftCount == 0 || leftCount == count) {
+					continue;
+				}
+				float cost = halfArea(min, max) * leftCount + rightCost[split];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = split;
+				}
+			}
+		}
+	}
+
+	// leaf when splitting does not pay off: traversal costs 1, every block of intersections its cost
+	float area = halfArea(range.min, range.max);
+	float leafCost = (float)((count + _leafBlockWidth - 1) / _leafBlockWidth) * _leafBlockCost;
+	float splitCost = 1.0f + (area > 0.0f ? bestCost / area : (float)count);
+	if (count <= kMaxLeafSize && (bestAxis < 0 || splitCost >= leafCost)) {
+		return;
+	}
+
+	// the partition computes the children's bounds on the way, the bins came from the same arithmetic
+	uint32_t middle;
+	RangeBounds leftRange, rightRange;
+	if (bestAxis >= 0) {
+		leftRange.clear();
+		rightRange.clear();
+		uint32_t i = begin, j = end;
+		while (i < j) {
+			__m128 min = loadMin(_buildBounds[i]);
+			__m128 max = _mm_load_ps(_buildBounds[i].max);
+			__m128 centroid = centroidOf(min, max);
+			alignas(16) int32_t binIndex[4];
+			binIndices(centroid, binIndex);
+			if (std::min<uint32_t>((uint32_t)binIndex[bestAxis], kBinCount - 1) < bestSplit) {
+				leftRange.grow(min, max, centroid);
+				++i;
+			} else {
+				rightRange.grow(min, max, centroid);
+				std::swap(_buildBounds[i], _buildBounds[--j]);
+			}
+		}
+		middle = i;
+	} else {
+		// identical centroids or too deep, split the primitives in half along the widest axis
+		int axis = 0;
+		alignas(16) float extent[4];
+		_mm_store_ps(extent, _mm_sub_ps(range.max, range.min));
+		if (extent[1] > extent[axis]) {
+			axis = 1;
+		}
+		if (extent[2] > extent[axis]) {
+			axis = 2;
+		}
+		middle = begin + count / 2;
+		std::nth_element(_buildBounds.begin() + begin, _buildBounds.begin() + middle, _buildBounds.begin() + end,
+			[&](const BuildBounds& a, const BuildBounds& b) {
+				return a.min[axis] + a.max[axis] < b.min[axis] + b.max[axis];
+			});
+		gatherBounds(begin, middle, leftRange, jobs);
+		gatherBounds(middle, end, rightRange, jobs);
+	}
+
+	uint32_t left = nodeCount.fetch_add(2);
+	uint32_t right = left + 1;
+	current.left = left;
+	current.right = right;
+	current.count = 0;
+	// big subtrees become jobs, the current thread keeps going with the left one
+	if (count >= kParallelTaskSize) {
+		JobCounter counter;
+		jobs.submit([this, right, middle, end, &rightRange, depth, &nodeCount, &jobs]() {
+			buildNode(right, middle, end, rightRange, depth + 1, nodeCount, jobs);
+		}, counter);
+		buildNode(left, begin, middle, leftRange, depth + 1, nodeCount, jobs);
+		jobs.wait(counter);
+	} else {
+		buildNode(left, begin, middle, leftRange, depth + 1, nodeCount, jobs);
+		buildNode(right, middle, end, rightRange, depth + 1, nodeCount, jobs);
+	}
+}
+
+void Bvh::flatten(uint32_t nodeCount) {
+	// depth first, a node's second child index is patched in once the first subtree is placed
+	_nodes.reserve(nodeCount);
+	std::vector<std::pair<uint32_t, uint32_t>> stack;
+	stack.push_back({ 0, ~0u });
+	while (!stack.empty()) {
+		uint32_t buildIndex = stack.back().first;
+		uint32_t patch = stack.back().second;
+		stack.pop_back();
+		uint32_t index = (uint32_t)_nodes.size();
+		if (patch != ~0u) {
+			_nodes[patch].offset = index;
+		}
+		const BuildNode& buildNode = _buildNodes[buildIndex];
+		BvhNode node;
+		node.boundsMin = buildNode.bounds.min;
+		node.boundsMax = buildNode.bounds.max;
+		node.offset = buildNode.count ? buildNode.begin : 0;
+		node.count = buildNode.count;
+		_nodes.push_back(node);
+		if (!buildNode.count) {
+			stack.push_back({ buildNode.right, index });
+			stack.push_back({ buildNode.left, ~0u });
+		}
+	}
+}
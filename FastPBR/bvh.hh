@@ -0,0 +1,190 @@
+#pragma once
+#include "jobs.hh"
+#include "ray.hh"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+struct Aabb {
+	glm::vec3 min = glm::vec3(FLT_MAX);
+	glm::vec3 max = glm::vec3(-FLT_MAX);
+
+	void grow(const glm::vec3& point) { min = glm::min(min, point); max = glm::max(max, point); }
+	void grow(const Aabb& other) { min = glm::min(min, other.min); max = glm::max(max, other.max); }
+	glm::vec3 center() const { return (min + max) * 0.5f; }
+	bool empty() const { return min.x > max.x; }
+	float surfaceArea() const {
+		glm::vec3 extent = glm::max(max - min, glm::vec3(0.0f));
+		return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+	}
+};
+
+// 32 bytes, two per cache line. nodes are stored depth first and the first child of an
+// interior node directly follows it, so only the second child needs an index
+struct alignas(32) BvhNode {
+	glm::vec3 boundsMin;
+	// interior: index of the second child, leaf: first entry in Bvh::primitives()
+	uint32_t offset;
+	glm::vec3 boundsMax;
+	// 0 for interior nodes
+	uint32_t count;
+
+	bool isLeaf() const { return count != 0; }
+};
+
+// slab test, returns the entry distance or FLT_MAX on a miss
+inline float intersectBounds(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::vec3& origin,
+	const glm::vec3& inverseDirection, float tMin, float tMax) {
+	float tx0 = (boundsMin.x - origin.x) * inverseDirection.x, tx1 = (boundsMax.x - origin.x) * inverseDirection.x;
+	float ty0 = (boundsMin.y - origin.y) * inverseDirection.y, ty1 = (boundsMax.y - origin.y) * inverseDirection.y;
+	float tz0 = (boundsMin.z - origin.z) * inverseDirection.z, tz1 = (boundsMax.z - origin.z) * inverseDirection.z;
+	float entry = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), tMin));
+	float exit = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), tMax));
+	return entry <= exit ? entry : FLT_MAX;
+}
+
+// Binary bvh built top down with binned surface area heuristic splits. Centroids of all three
+// axes are binned at once with SSE, the upper levels bin in parallel and subtrees above a size
+// threshold are built as separate jobs. The result is flattened depth first.
+class Bvh
+{
+public:
+	static const uint32_t kBinCount = 16;
+	static const uint32_t kMaxLeafSize = 8;
+	// deeper nodes fall back to median splits, which keeps traversal stacks bounded
+	static const uint32_t kMaxSahDepth = 64;
+	static const uint32_t kStackSize = 128;
+
+	// build() prices a leaf as blocks of width primitives tested together for blockCost intersections
+	// each, for leaves intersected in SIMD blocks. by default every primitive is tested on its own
+	void setLeafBlocks(uint32_t width, float blockCost);
+	void build(const Aabb *primitiveBounds, size_t primitiveCount, JobSystem& jobs = JobSystem::shared());
+	// three corners per triangle
+	void buildTriangles(const glm::vec3 *corners, size_t triangleCount, JobSystem& jobs = JobSystem::shared());
+	// linear bvh for geometry that changes every frame, see lbvh.cc. restructure recovers most of
+	// the sah quality by optimizing small treelets after the build
+	void buildLinear(const Aabb *primitiveBounds, size_t primitiveCount, bool restructure = false,
+		JobSystem& jobs = JobSystem::shared());
+
+	// new bounds for the same primitives keeping the topology, see refit.cc. rotate also swaps a child
+	// with a grandchild in subtrees near the leaves where that lowers the sah cost. returns sahCost()
+	float refit(const Aabb *primitiveBounds, bool rotate = false, JobSystem& jobs = JobSystem::shared());
+
+	const std::vector<BvhNode>& nodes() const { return _nodes; }
+	// primitive indices in leaf order
+	const std::vector<uint32_t>& primitives() const { return _primitives; }
+	bool empty() const { return _nodes.empty(); }
+	// expected cost of a random ray relative to one intersection test, traversal steps count 1
+	float sahCost() const;
+	double lastBuildMilliseconds() const { return _lastBuildMilliseconds; }
+	double lastRefitMilliseconds() const { return _lastRefitMilliseconds; }
+
+	// closest hit, intersectPrimitive(primitive, hit) has to shrink hit.t when it finds something closer
+	template <typename IntersectPrimitive>
+	bool intersect(const Ray& ray, RayHit& hit, IntersectPrimitive&& intersectPrimitive) const;
+
+private:
+	static const uint32_t kParallelBinningSize = 65536;
+	static const uint32_t kParallelTaskSize = 4096;
+	// subtrees up to this size are refit by one job, rotations stay inside them
+	static const uint32_t kRefitNodesPerJob = 4096;
+
+	// partitioned in place so every pass streams through memory, the primitive index rides along
+	struct alignas(16) BuildBounds {
+		float min[3];
+		uint32_t primitive;
+		float max[4];
+	};
+
+	struct RangeBounds;
+
+	struct BuildNode {
+		Aabb bounds;
+		uint32_t left;
+		uint32_t right;
+		uint32_t begin;
+		uint32_t count;
+	};
+
+	struct RefitRange {
+		uint32_t begin;
+		uint32_t end;
+	};
+
+	std::vector<BvhNode> _nodes;
+	std::vector<uint32_t> _primitives;
+	std::vector<BuildBounds> _buildBounds;
+	std::vector<BuildNode> _buildNodes;
+	std::vector<RefitRange> _refitRanges;
+	std::vector<uint32_t> _refitTop;
+	double _lastBuildMilliseconds = 0;
+	double _lastRefitMilliseconds = 0;
+	uint32_t _leafBlockWidth = 1;
+	float _leafBlockCost = 1.0f;
+
+	void gatherBounds(uint32_t begin, uint32_t end, RangeBounds& range, JobSystem& jobs) const;
+	void buildNode(uint32_t node, uint32_t begin, uint32_t end, const RangeBounds& range, uint32_t depth,
+		std::atomic<uint32_t>& nodeCount, JobSystem& jobs);
+	void flatten(uint32_t nodeCount);
+	uint32_t subtreeEnd(uint32_t node) const;
+	void refitNode(uint32_t node, const Aabb *primitiveBounds);
+	double refitRange(const RefitRange& range, const Aabb *primitiveBounds, bool rotate);
+	float rotateChildren(uint32_t node, std::vector<BvhNode>& scratch);
+};
+
+template <typename IntersectPrimitive>
+bool Bvh::intersect(const Ray& ray, RayHit& hit, IntersectPrimitive&& intersectPrimitive) const {
+	if (_nodes.empty()) {
+		return false;
+	}
+	glm::vec3 inverseDirection = 1.0f / ray.direction;
+	uint32_t stack[kStackSize];
+	uint32_t stackSize = 0;
+	uint32_t node = 0;
+	if (intersectBounds(_nodes[0].boundsMin, _nodes[0].boundsMax, ray.origin, inverseDirection, ray.tMin,
+		std::min(ray.tMax, hit.t)) == FLT_MAX) {
+		return false;
+	}
+	bool found = false;
+	while (true) {
+		const BvhNode& current = _nodes[node];
+		if (current.isLeaf()) {
+			for (uint32_t i = current.offset; i < current.offset + current.count; ++i) {
+				found |= intersectPrimitive(_primitives[i], hit);
+			}
+		} else {
+			// closer child first, the other one waits on the stack
+			uint32_t first = node + 1;
+			uint32_t second = current.offset;
+			float tMax = std::min(ray.tMax, hit.t);
+			float firstEntry = intersectBounds(_nodes[first].boundsMin, _nodes[first].boundsMax, ray.origin,
+				inverseDirection, ray.tMin, tMax);
+			float secondEntry = intersectBounds(_nodes[second].boundsMin, _nodes[second].boundsMax, ray.origin,
+				inverseDirection, ray.tMin, tMax);
+			if (secondEntry < firstEntry) {
+				std::swap(first, second);
+				std::swap(firstEntry, secondEntry);
+			}
+			if (firstEntry != FLT_MAX) {
+				if (secondEntry != FLT_MAX) {
+					stack[stackSize++] = second;
+				}
+				node = first;
+				continue;
+			}
+		}
+		// skip stacked nodes that lie behind the closest hit found since they were pushed
+		bool popped = false;
+		while (stackSize > 0 && !popped) {
+			node = stack[--stackSize];
+			popped = intersectBounds(_nodes[node].boundsMin, _nodes[node].boundsMax, ray.origin, inverseDirection,
+				ray.tMin, std::min(ray.tMax, hit.t)) != FLT_MAX;
+		}
+		if (!popped) {
+			return found;
+		}
+	}
+}
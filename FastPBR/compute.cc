@@ -0,0 +1,310 @@
+#include "compute.hh"
+#if defined(FASTPBR_CUDA)
+#include "kernel.h"
+#endif
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(FASTPBR_VULKAN_COMPUTE)
+// computevulkan.cc
+std::unique_ptr<ComputeBackend> createVulkanComputeBackend();
+#endif
+
+static void addCpu(void *const *buffers, const void *, uint32_t, uint32_t begin, uint32_t end) {
+	const int32_t *a = static_cast<const int32_t*>(buffers[0]);
+	const int32_t *b = static_cast<const int32_t*>(buffers[1]);
+	int32_t *c = static_cast<int32_t*>(buffers[2]);
+	for (uint32_t i = begin; i < end; ++i) {
+		c[i] = a[i] + b[i];
+	}
+}
+
+static void saxpyCpu(void *const *buffers, const void *constants, uint32_t, uint32_t begin, uint32_t end) {
+	const float *x = static_cast<const float*>(buffers[0]);
+	float *y = static_cast<float*>(buffers[1]);
+	float alpha = static_cast<const ComputeSaxpyConstants*>(constants)->alpha;
+	for (uint32_t i = begin; i < end; ++i) {
+		y[i] = alpha * x[i] + y[i];
+	}
+}
+
+static void hashCpu(void *const *buffers, const void *constants, uint32_t, uint32_t begin, uint32_t end) {
+	uint32_t *values = static_cast<uint32_t*>(buffers[0]);
+	uint32_t rounds = static_cast<const ComputeHashConstants*>(constants)->rounds;
+	for (uint32_t i = begin; i < end; ++i) {
+		uint32_t value = values[i];
+		for (uint32_t round = 0; round < rounds; ++round) {
+			value = computeHash(value);
+		}
+		values[i] = value;
+	}
+}
+
+#if defined(FASTPBR_CUDA)
+const ComputeKernelSource kComputeAdd = { "add", addCpu, 16384, launchAddCuda, "shaders/compute_add.spv", 256 };
+const ComputeKernelSource kComputeSaxpy = { "saxpy", saxpyCpu, 16384, launchSaxpyCuda, "shaders/compute_saxpy.spv",
+	256 };
+const ComputeKernelSource kComputeHash = { "hash", hashCpu, 1024, launchHashCuda, "shaders/compute_hash.spv", 64 };
+#else
+const ComputeKernelSource kComputeAdd = { "add", addCpu, 16384, nullptr, "shaders/compute_add.spv", 256 };
+const ComputeKernelSource kComputeSaxpy = { "saxpy", saxpyCpu, 16384, nullptr, "shaders/compute_saxpy.spv", 256 };
+const ComputeKernelSource kComputeHash = { "hash", hashCpu, 1024, nullptr, "shaders/compute_hash.spv", 64 };
+#endif
+
+namespace {
+
+// Queues are threads working through their commands in order. Copies run on the queue's thread and
+// kernels as parallelFor from it, so the job system's workers take the kernels of every queue while
+// other queues copy. Events count recordings, one completes when its count of passed recordings
+// catches up with the recordings made when it is waited for.
+class CpuComputeBackend : public ComputeBackend
+{
+public:
+	explicit CpuComputeBackend(JobSystem& jobs) : _jobs(&jobs) {}
+
+	~CpuComputeBackend() override {
+		for (auto& queue : _queues) {
+			{
+				std::lock_guard<std::mutex> lock(queue->mutex);
+				queue->stopping = true;
+			}
+			queue->changed.notify_all();
+			queue->thread.join();
+		}
+	}
+
+	Type type() const override { return Type::Cpu; }
+	const char *name() const override { return "cpu"; }
+
+	void *allocateHost(size_t size) override {
+		void *memory = std::malloc(std::max<size_t>(size, 1));
+		if (!memory) {
+			throw std::runtime_error("failed to allocate host memory!");
+		}
+		return memory;
+	}
+
+	void freeHost(void *memory) override {
+		std::free(memory);
+	}
+
+	ComputeBuffer createBuffer(size_t size) override {
+		_buffers.emplace_back(size);
+		return (ComputeBuffer)_buffers.size() - 1;
+	}
+
+	void destroyBuffer(ComputeBuffer buffer) override {
+		std::vector<uint8_t>().swap(_buffers.at(buffer));
+	}
+
+	ComputeKernel createKernel(const ComputeKernelSource& source) override {
+		if (!source.cpu) {
+			throw std::runtime_error(std::string("compute kernel ") + source.name + " has no cpu form!");
+		}
+		_kernels.push_back(source);
+		return (ComputeKernel)_kernels.size() - 1;
+	}
+
+	ComputeQueue createQueue() override {
+		_queues.emplace_back(new Queue());
+		Queue *queue = _queues.back().get();
+		queue->thread = std::thread([queue]() { runQueue(*queue); });
+		return (ComputeQueue)_queues.size() - 1;
+	}
+
+	ComputeEvent createEvent() override {
+		_events.emplace_back(new Event());
+		return (ComputeEvent)_events.size() - 1;
+	}
+
+	void upload(ComputeQueue queue, ComputeBuffer buffer, size_t offset, const void *source, size_t size) override {
+		uint8_t *target = bufferRange(buffer, offset, size);
+		enqueue(queue, [target, source, size]() { std::memcpy(target, source, size); });
+	}
+
+	void download(ComputeQueue queue, ComputeBuffer buffer, size_t offset, void *target, size_t size) override {
+		const uint8_t *source = bufferRange(buffer, offset, size);
+		enqueue(queue, [target, source, size]() { std::memcpy(target, source, size); });
+	}
+
+	void launch(ComputeQueue queue, ComputeKernel kernel, uint32_t count, const ComputeArguments& arguments) override {
+		// everything the command needs is taken now, the vectors may grow while it waits
+		const ComputeKernelSource& source = _kernels.at(kernel);
+		std::array<void*, ComputeArguments::kMaxBuffers> buffers = {};
+		for (uint32_t i = 0; i < arguments.bufferCount; ++i) {
+			buffers[i] = _buffers.at(arguments.buffers[i]).data();
+		}
+		std::array<uint8_t, ComputeArguments::kMaxConstantBytes> constants;
+		std::memcpy(constants.data(), arguments.constants, constants.size());
+		ComputeCpuKernel body = source.cpu;
+		JobSystem *jobs = _jobs;
+		uint32_t grainSize = source.cpuGrainSize;
+		enqueue(queue, [=]() {
+			jobs->parallelFor(count, grainSize, [&](size_t begin, size_t end) {
+				body(buffers.data(), constants.data(), count, (uint32_t)begin, (uint32_t)end);
+			});
+		});
+	}
+
+	void record(ComputeQueue queue, ComputeEvent event) override {
+		Event *target = _events.at(event).get();
+		uint64_t recording = ++target->recorded;
+		enqueue(queue, [target, recording]() {
+			{
+				std::lock_guard<std::mutex> lock(target->mutex);
+				target->passed = std::max(target->passed, recording);
+			}
+			target->changed.notify_all();
+		});
+	}
+
+	void wait(ComputeQueue queue, ComputeEvent event) override {
+		Event *source = _events.at(event).get();
+		uint64_t recording = source->recorded;
+		enqueue(queue, [source, recording]() {
+			std::unique_lock<std::mutex> lock(source->mutex);
+			source->changed.wait(lock, [&]() { return source->passed >= recording; });
+		});
+	}
+
+	void synchronize(ComputeEvent event) override {
+		Event& source = *_events.at(event);
+		std::unique_lock<std::mutex> lock(source.mutex);
+		source.changed.wait(lock, [&]() { return source.passed >= source.recorded; });
+	}
+
+	bool complete(ComputeEvent event) override {
+		Event& source = *_events.at(event);
+		std::lock_guard<std::mutex> lock(source.mutex);
+		return source.passed >= source.recorded;
+	}
+
+	void finish(ComputeQueue queue) override {
+		Queue& target = *_queues.at(queue);
+		std::unique_lock<std::mutex> lock(target.mutex);
+		target.changed.wait(lock, [&]() { return target.commands.empty() && !target.running; });
+		if (target.error) {
+			std::exception_ptr error = target.error;
+			target.error = nullptr;
+			std::rethrow_exception(error);
+		}
+	}
+
+private:
+	struct Queue {
+		std::thread thread;
+		std::mutex mutex;
+		// signals new commands to the thread and finished ones to finish()
+		std::condition_variable changed;
+		std::deque<std::function<void()>> commands;
+		bool running = false;
+		bool stopping = false;
+		// the first failure since the last finish(), later commands still run
+		std::exception_ptr error;
+	};
+
+	struct Event {
+		// written by the host only
+		uint64_t recorded = 0;
+		std::mutex mutex;
+		std::condition_variable changed;
+		uint64_t passed = 0;
+	};
+
+	JobSystem *_jobs;
+	std::vector<std::vector<uint8_t>> _buffers;
+	std::vector<ComputeKernelSource> _kernels;
+	std::vector<std::unique_ptr<Queue>> _queues;
+	std::vector<std::unique_ptr<Event>> _events;
+
+	uint8_t *bufferRange(ComputeBuffer buffer, size_t offset, size_t size) {
+		std::vector<uint8_t>& memory = _buffers.at(buffer);
+		if (offset > memory.size() || size > memory.size() - offset) {
+			throw std::runtime_error("compute copy out of the buffer's range!");
+		}
+		return memory.data() + offset;
+	}
+
+	void enqueue(ComputeQueue queue, std::function<void()> command) {
+		Queue& target = *_queues.at(queue);
+		{
+			std::lock_guard<std::mutex> lock(target.mutex);
+			target.commands.push_back(std::move(command));
+		}
+		target.changed.notify_all();
+	}
+
+	static void runQueue(Queue& queue) {
+		std::unique_lock<std::mutex> lock(queue.mutex);
+		while (true) {
+			queue.changed.wait(lock, [&]() { return queue.stopping || !queue.commands.empty(); });
+			if (queue.commands.empty()) {
+				return;
+			}
+			std::function<void()> command = std::move(queue.commands.front());
+			queue.commands.pop_front();
+			queue.running = true;
+			lock.unlock();
+			try {
+				command();
+			} catch (...) {
+				lock.lock();
+				if (!queue.error) {
+					queue.error = std::current_exception();
+				}
+				lock.unlock();
+			}
+			lock.lock();
+			queue.running = false;
+			queue.changed.notify_all();
+		}
+	}
+};
+
+}
+
+bool computeBackendBuilt(ComputeBackend::Type type) {
+	switch (type) {
+	case ComputeBackend::Type::Cpu:
+		return true;
+	case ComputeBackend::Type::Cuda:
+#if defined(FASTPBR_CUDA)
+		return true;
+#else
+		return false;
+#endif
+	case ComputeBackend::Type::Vulkan:
+#if defined(FASTPBR_VULKAN_COMPUTE)
+		return true;
+#else
+		return false;
+#endif
+	}
+	return false;
+}
+
+std::unique_ptr<ComputeBackend> createComputeBackend(ComputeBackend::Type type, JobSystem& jobs) {
+	switch (type) {
+	case ComputeBackend::Type::Cpu:
+		return std::unique_ptr<ComputeBackend>(new CpuComputeBackend(jobs));
+#if defined(FASTPBR_CUDA)
+	case ComputeBackend::Type::Cuda:
+		return createCudaComputeBackend();
+#endif
+#if defined(FASTPBR_VULKAN_COMPUTE)
+	case ComputeBackend::Type::Vulkan:
+		return createVulkanComputeBackend();
+#endif
+	default:
+		throw std::runtime_error("compute backend not built in!");
+	}
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include "jobs.hh"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+// functions kernel.cu shares with the host
+#if defined(__CUDACC__)
+#define COMPUTE_FUNCTION __host__ __device__
+#else
+#define COMPUTE_FUNCTION
+#endif
+
+// handles into one backend, from its create functions
+using ComputeBuffer = uint32_t;
+using ComputeKernel = uint32_t;
+using ComputeQueue = uint32_t;
+using ComputeEvent = uint32_t;
+
+// what a launch sees: buffers in binding order and a few bytes of constants, push constants on vulkan
+// and a struct passed by value on cuda
+struct ComputeArguments {
+	static const uint32_t kMaxBuffers = 8;
+	static const uint32_t kMaxConstantBytes = 64;
+
+	ComputeBuffer buffers[kMaxBuffers];
+	uint32_t bufferCount = 0;
+	alignas(16) uint8_t constants[kMaxConstantBytes];
+	uint32_t constantSize = 0;
+
+	ComputeArguments& addBuffer(ComputeBuffer buffer) {
+		if (bufferCount == kMaxBuffers) {
+			throw std::runtime_error("too many compute buffers!");
+		}
+		buffers[bufferCount++] = buffer;
+		return *this;
+	}
+	template <typename Constants>
+	ComputeArguments& setConstants(const Constants& values) {
+		static_assert(sizeof(Constants) <= kMaxConstantBytes, "compute constants too large");
+		std::memcpy(constants, &values, sizeof(Constants));
+		constantSize = sizeof(Constants);
+		return *this;
+	}
+};
+
+// items begin to end of a launch of count items, buffers as host pointers
+using ComputeCpuKernel = void (*)(void *const *buffers, const void *constants, uint32_t count, uint32_t begin,
+	uint32_t end);
+// puts a launch of count items on the cuda stream, buffers as device pointers, see kernel.cu
+using ComputeCudaKernel = void (*)(void *const *buffers, const void *constants, uint32_t count, void *stream);
+
+// One kernel in the forms the backends run, nullptr where it has none. A backend without its form
+// throws from createKernel.
+struct ComputeKernelSource {
+	const char *name;
+	ComputeCpuKernel cpu;
+	// items per job of the cpu backend
+	uint32_t cpuGrainSize;
+	ComputeCudaKernel cuda;
+	// spir-v with a local size of vulkanGroupSize along x: the buffers are storage buffers bound 0, 1, 2...
+	// and the push constants hold the item count and the first item of the dispatch, which is added to
+	// gl_GlobalInvocationID.x, then the constants from byte 16 on
+	const char *spirvPath;
+	uint32_t vulkanGroupSize;
+};
+
+// Buffers, kernels, queues and events of one device, with the same rules on every backend:
+// - work put on a queue runs asynchronously to the host and in order within its queue. Queues run
+//   alongside each other unless an event orders them, so one queue's copies overlap another's kernels
+// - host memory given to upload() or download() belongs to the copy until the host waited for it, by
+//   finish() or by synchronize() on an event recorded after it. allocateHost() memory copies fastest,
+//   it is pinned on cuda
+// - objects live as long as the backend, buffers can go earlier once no queued work uses them
+// Mistakes in calls throw std::runtime_error right away, failures of queued work from finish().
+class ComputeBackend
+{
+public:
+	enum class Type { Cpu, Cuda, Vulkan };
+
+	virtual ~ComputeBackend() = default;
+
+	virtual Type type() const = 0;
+	// the device it runs on
+	virtual const char *name() const = 0;
+
+	virtual void *allocateHost(size_t size) = 0;
+	virtual void freeHost(void *memory) = 0;
+	virtual ComputeBuffer createBuffer(size_t size) = 0;
+	virtual void destroyBuffer(ComputeBuffer buffer) = 0;
+	virtual ComputeKernel createKernel(const ComputeKernelSource& source) = 0;
+	virtual ComputeQueue createQueue() = 0;
+	virtual ComputeEvent createEvent() = 0;
+
+	virtual void upload(ComputeQueue queue, ComputeBuffer buffer, size_t offset, const void *source, size_t size) = 0;
+	virtual void download(ComputeQueue queue, ComputeBuffer buffer, size_t offset, void *target, size_t size) = 0;
+	virtual void launch(ComputeQueue queue, ComputeKernel kernel, uint32_t count,
+		const ComputeArguments& arguments) = 0;
+	// the event completes once the work put on the queue so far is done. recording it again moves it on
+	virtual void record(ComputeQueue queue, ComputeEvent event) = 0;
+	// work put on the queue from now on starts after the event's last recording completed
+	virtual void wait(ComputeQueue queue, ComputeEvent event) = 0;
+	// the host waits for the event's last recording, an event never recorded is complete
+	virtual void synchronize(ComputeEvent event) = 0;
+	virtual bool complete(ComputeEvent event) = 0;
+	// the host waits for everything on the queue
+	virtual void finish(ComputeQueue queue) = 0;
+};
+
+// whether the binary has the backend, the cpu one always. cuda needs FASTPBR_CUDA and kernel.cu, the
+// project leaves it off until the cuda kernels have run on a device. vulkan needs FASTPBR_VULKAN_COMPUTE
+bool computeBackendBuilt(ComputeBackend::Type type);
+// throws when the backend is not built in or finds no device. the cpu backend runs kernels on jobs, which
+// have to outlive it
+std::unique_ptr<ComputeBackend> createComputeBackend(ComputeBackend::Type type,
+	JobSystem& jobs = JobSystem::shared());
+
+// Kernels with a form for every backend, the spir-v in shaders/compute_*.comp.
+// c = a + b over int32: buffers a, b, c
+extern const ComputeKernelSource kComputeAdd;
+// y = alpha x + y over float: buffers x, y, constants ComputeSaxpyConstants
+extern const ComputeKernelSource kComputeSaxpy;
+// every uint32 value through rounds of the pcg hash, arithmetic without memory traffic: buffer values,
+// constants ComputeHashConstants
+extern const ComputeKernelSource kComputeHash;
+
+struct ComputeSaxpyConstants {
+	float alpha;
+};
+
+struct ComputeHashConstants {
+	uint32_t rounds;
+};
+
+// the hash of kComputeHash, pcg of Jarzynski and Olano
+COMPUTE_FUNCTION inline uint32_t computeHash(uint32_t value) {
+	uint32_t state = value * 747796405u + 2891336453u;
+	uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
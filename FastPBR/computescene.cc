@@ -0,0 +1,148 @@
+#include "computescene.hh"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+void ComputeScene::build(const SceneFile& scene, JobSystem& jobs) {
+	_materials.clear();
+	for (const SceneMaterial& material : scene.materials()) {
+		_materials.push_back({ material.baseColor, material.emissive,
+			glm::vec4(material.metallic, material.roughness, 0.0f, 0.0f) });
+	}
+	// nodes without a material get a white one, like the cpu path tracer's
+	uint32_t fallbackMaterial = (uint32_t)_materials.size();
+	_materials.push_back({ glm::vec4(1.0f), glm::vec4(0.0f), glm::vec4(0.0f, 1.0f, 0.0f, 0.0f) });
+
+	auto vertices = scene.vertices();
+	auto indices = scene.indices();
+	std::vector<glm::vec3> corners;
+	std::vector<uint32_t> triangleMaterials;
+	for (const SceneNode& node : scene.nodes()) {
+		if (node.mesh == kSceneNone) {
+			continue;
+		}
+		const MeshLod& lod = scene.lods()[scene.meshes()[node.mesh].firstLod];
+		for (uint32_t i = 0; i < lod.indexCount; ++i) {
+			corners.push_back(glm::vec3(node.world * glm::vec4(vertices[indices[lod.indexOffset + i]].pos, 1.0f)));
+		}
+		triangleMaterials.insert(triangleMaterials.end(), lod.indexCount / 3,
+			node.material == kSceneNone ? fallbackMaterial : node.material);
+	}
+	_bvh.buildTriangles(corners.data(), corners.size() / 3, jobs);
+
+	// a walk stacks at most one sibling per level above the current node, children follow their parent
+	const std::vector<BvhNode>& nodes = _bvh.nodes();
+	std::vector<uint32_t> depths(nodes.size(), 0);
+	_stackSize = 0;
+	for (size_t i = 0; i < nodes.size(); ++i) {
+		if (nodes[i].isLeaf()) {
+			_stackSize = std::max(_stackSize, depths[i]);
+		} else {
+			depths[i + 1] = depths[nodes[i].offset] = depths[i] + 1;
+		}
+	}
+	if (_stackSize > kMaxStackSize) {
+		throw std::runtime_error("scene bvh is too deep to trace!");
+	}
+
+	const std::vector<uint32_t>& primitives = _bvh.primitives();
+	_triangles.resize(primitives.size());
+	for (size_t i = 0; i < primitives.size(); ++i) {
+		const glm::vec3 *triangle = &corners[(size_t)primitives[i] * 3];
+		float material;
+		std::memcpy(&material, &triangleMaterials[primitives[i]], sizeof(material));
+		_triangles[i].corner = glm::vec4(triangle[0], material);
+		_triangles[i].edge1 = glm::vec4(triangle[1] - triangle[0], 0.0f);
+		_triangles[i].edge2 = glm::vec4(triangle[2] - triangle[0], 0.0f);
+	}
+}
+
+uint32_t ComputeScene::material(const Triangle& triangle) {
+	uint32_t material;
+	std::memcpy(&material, &triangle.corner.w, sizeof(material));
+	return material;
+}
+
+// Moller-Trumbore over the stored edges, intersectTriangle's test
+static bool intersectStored(const Ray& ray, const ComputeScene::Triangle& triangle, uint32_t index, RayHit& hit) {
+	glm::vec3 edge1(triangle.edge1), edge2(triangle.edge2);
+	glm::vec3 p = glm::cross(ray.direction, edge2);
+	float determinant = glm::dot(edge1, p);
+	if (determinant == 0.0f) {
+		return false;
+	}
+	float inverseDeterminant = 1.0f / determinant;
+	glm::vec3 s = ray.origin - glm::vec3(triangle.corner);
+	float u = glm::dot(s, p) * inverseDeterminant;
+	if (u < 0.0f || u > 1.0f) {
+		return false;
+	}
+	glm::vec3 q = glm::cross(s, edge1);
+	float v = glm::dot(ray.direction, q) * inverseDeterminant;
+	if (v < 0.0f || u + v > 1.0f) {
+		return false;
+	}
+	float t = glm::dot(edge2, q) * inverseDeterminant;
+	if (t < ray.tMin || t > ray.tMax || t >= hit.t) {
+		return false;
+	}
+	hit.t = t;
+	hit.u = u;
+	hit.v = v;
+	hit.triangle = index;
+	return true;
+}
+
+bool ComputeScene::intersect(const Ray& ray, RayHit& hit, uint32_t& stackDepth) const {
+	const std::vector<BvhNode>& nodes = _bvh.nodes();
+	stackDepth = 0;
+	if (nodes.empty()) {
+		return false;
+	}
+	glm::vec3 inverseDirection = 1.0f / ray.direction;
+	uint32_t stack[kMaxStackSize];
+	uint32_t stackSize = 0;
+	uint32_t node = 0;
+	if (intersectBounds(nodes[0].boundsMin, nodes[0].boundsMax, ray.origin, inverseDirection, ray.tMin,
+		std::min(ray.tMax, hit.t)) == FLT_MAX) {
+		return false;
+	}
+	bool found = false;
+	while (true) {
+		const BvhNode& current = nodes[node];
+		if (current.isLeaf()) {
+			for (uint32_t i = current.offset; i < current.offset + current.count; ++i) {
+				found |= intersectStored(ray, _triangles[i], i, hit);
+			}
+		} else {
+			uint32_t first = node + 1;
+			uint32_t second = current.offset;
+			float tMax = std::min(ray.tMax, hit.t);
+			float firstEntry = intersectBounds(nodes[first].boundsMin, nodes[first].boundsMax, ray.origin,
+				inverseDirection, ray.tMin, tMax);
+			float secondEntry = intersectBounds(nodes[second].boundsMin, nodes[second].boundsMax, ray.origin,
+				inverseDirection, ray.tMin, tMax);
+			if (secondEntry < firstEntry) {
+				std::swap(first, second);
+				std::swap(firstEntry, secondEntry);
+			}
+			if (firstEntry != FLT_MAX) {
+				if (secondEntry != FLT_MAX) {
+					stack[stackSize++] = second;
+					stackDepth = std::max(stackDepth, stackSize);
+				}
+				node = first;
+				continue;
+			}
+		}
+		bool popped = false;
+		while (stackSize > 0 && !popped) {
+			node = stack[--stackSize];
+			popped = intersectBounds(nodes[node].boundsMin, nodes[node].boundsMax, ray.origin, inverseDirection,
+				ray.tMin, std::min(ray.tMax, hit.t)) != FLT_MAX;
+		}
+		if (!popped) {
+			return found;
+		}
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "bvh.hh"
+#include "ray.hh"
+#include "scene.hh"
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+// The scene flattened for shaders/pathtrace.comp: every instance's lod 0 in world space under one bvh,
+// its nodes as Bvh builds them and the triangles reordered to leaf order, so a leaf's offset indexes the
+// triangles directly. The structs are the shader's std430 layouts and upload as they are.
+class ComputeScene
+{
+public:
+	// deepest bvh the cpu walk takes, build() throws on a deeper one
+	static const uint32_t kMaxStackSize = Bvh::kStackSize;
+
+	// the first corner and both edges, the material index in the first corner's w as float bits
+	struct Triangle {
+		glm::vec4 corner;
+		glm::vec4 edge1;
+		glm::vec4 edge2;
+	};
+
+	// base color textures are left out, the factors alone
+	struct Material {
+		glm::vec4 baseColor;
+		glm::vec4 emissive;
+		// metallic, roughness
+		glm::vec4 parameters;
+	};
+
+	void build(const SceneFile& scene, JobSystem& jobs = JobSystem::shared());
+
+	const std::vector<BvhNode>& nodes() const { return _bvh.nodes(); }
+	const std::vector<Triangle>& triangles() const { return _triangles; }
+	const std::vector<Material>& materials() const { return _materials; }
+	static uint32_t material(const Triangle& triangle);
+	// traversal stack entries a walk can need, the depth of the deepest leaf. the launcher sizes the
+	// shader's stack with it
+	uint32_t stackSize() const { return _stackSize; }
+
+	// the shader's traversal and triangle test, to check the flattened layout on the cpu. hit.triangle is
+	// an index into triangles(). stackDepth is the deepest the stack got, never above stackSize()
+	bool intersect(const Ray& ray, RayHit& hit, uint32_t& stackDepth) const;
+
+private:
+	Bvh _bvh;
+	std::vector<Triangle> _triangles;
+	std::vector<Material> _materials;
+	uint32_t _stackSize = 0;
+};
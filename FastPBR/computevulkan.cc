@@ -0,0 +1,517 @@
+#if defined(FASTPBR_VULKAN_COMPUTE)
+#include "compute.hh"
+#include <vulkan/vulkan.hpp>
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// the push constants of every kernel, see ComputeKernelSource::spirvPath
+struct VulkanComputeConstants {
+	uint32_t count;
+	// the first item of this dispatch, launches above the device's group count limit take several
+	uint32_t base;
+	uint32_t padding[2];
+	uint8_t constants[ComputeArguments::kMaxConstantBytes];
+};
+
+static std::vector<char> readSpirv(const char *path) {
+	std::ifstream file(path, std::ios::ate | std::ios::binary);
+	if (!file.is_open()) {
+		throw std::runtime_error(std::string("failed to open ") + path + "!");
+	}
+	std::vector<char> code((size_t)file.tellg());
+	file.seekg(0);
+	file.read(code.data(), code.size());
+	return code;
+}
+
+// All queues record into command buffers of their own but submit to the one vulkan queue of the device,
+// every command buffer starting with a barrier on what was submitted before it. Work runs in submission
+// order then: waits on events are kept by record() submitting right away, and copies and kernels of
+// different queues do not overlap on the device, only with the host. Uploads are staged when they are
+// put on the queue, downloads copied to their target when the host waits for them.
+class VulkanComputeBackend : public ComputeBackend
+{
+public:
+	VulkanComputeBackend() {
+		vk::ApplicationInfo appInfo;
+		appInfo.pApplicationName = "FastPBR compute";
+		appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+		appInfo.pEngineName = "No Engine";
+		appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+		appInfo.apiVersion = VK_API_VERSION_1_0;
+		vk::InstanceCreateInfo instanceCreateInfo;
+		instanceCreateInfo.pApplicationInfo = &appInfo;
+		_instance = vk::createInstance(instanceCreateInfo);
+
+		// a discrete gpu when there is one, the launcher's order
+		std::vector<vk::PhysicalDevice> physicalDevices = _instance.enumeratePhysicalDevices();
+		std::stable_partition(physicalDevices.begin(), physicalDevices.end(), [](vk::PhysicalDevice device) {
+			return device.getProperties().deviceType == vk::PhysicalDeviceType::eDiscreteGpu;
+		});
+		for (vk::PhysicalDevice device : physicalDevices) {
+			std::vector<vk::QueueFamilyProperties> families = device.getQueueFamilyProperties();
+			for (uint32_t i = 0; i < families.size(); ++i) {
+				if (families[i].queueCount > 0 && (families[i].queueFlags & vk::QueueFlagBits::eCompute)) {
+					_gpu = device;
+					_familyIndex = i;
+					break;
+				}
+			}
+			if (_gpu) {
+				break;
+			}
+		}
+		if (!_gpu) {
+			_instance.destroy();
+			throw std::runtime_error("failed to find a vulkan device with compute queues!");
+		}
+		vk::PhysicalDeviceProperties properties = _gpu.getProperties();
+		_name = properties.deviceName;
+		_maxGroupCount = properties.limits.maxComputeWorkGroupCount[0];
+		_memoryProperties = _gpu.getMemoryProperties();
+
+		float queuePriority = 1.0f;
+		vk::DeviceQueueCreateInfo queueCreateInfo;
+		queueCreateInfo.queueFamilyIndex = _familyIndex;
+		queueCreateInfo.queueCount = 1;
+		queueCreateInfo.pQueuePriorities = &queuePriority;
+		vk::DeviceCreateInfo deviceCreateInfo;
+		deviceCreateInfo.queueCreateInfoCount = 1;
+		deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
+		_device = _gpu.createDevice(deviceCreateInfo);
+		_queue = _device.getQueue(_familyIndex, 0);
+
+		vk::CommandPoolCreateInfo poolCreateInfo;
+		poolCreateInfo.queueFamilyIndex = _familyIndex;
+		poolCreateInfo.flags = vk::CommandPoolCreateFlagBits::eTransient;
+		_commandPool = _device.createCommandPool(poolCreateInfo);
+
+		std::array<vk::DescriptorSetLayoutBinding, ComputeArguments::kMaxBuffers> bindings;
+		for (uint32_t binding = 0; binding < bindings.size(); ++binding) {
+			bindings[binding].binding = binding;
+			bindings[binding].descriptorType = vk::DescriptorType::eStorageBuffer;
+			bindings[binding].descriptorCount = 1;
+			bindings[binding].stageFlags = vk::ShaderStageFlagBits::eCompute;
+		}
+		vk::DescriptorSetLayoutCreateInfo layoutCreateInfo;
+		layoutCreateInfo.bindingCount = bindings.size();
+		layoutCreateInfo.pBindings = bindings.data();
+		_descriptorSetLayout = _device.createDescriptorSetLayout(layoutCreateInfo);
+
+		vk::PushConstantRange pushConstantRange;
+		pushConstantRange.stageFlags = vk::ShaderStageFlagBits::eCompute;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(VulkanComputeConstants);
+		vk::PipelineLayoutCreateInfo pipelineLayoutCreateInfo;
+		pipelineLayoutCreateInfo.setLayoutCount = 1;
+		pipelineLayoutCreateInfo.pSetLayouts = &_descriptorSetLayout;
+		pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+		pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+		_pipelineLayout = _device.createPipelineLayout(pipelineLayoutCreateInfo);
+	}
+
+	~VulkanComputeBackend() override {
+		_device.waitIdle();
+		for (Queue& queue : _queues) {
+			release(queue.recording);
+		}
+		while (!_submissions.empty()) {
+			release(_submissions.front().batch);
+			_device.destroyFence(_submissions.front().fence);
+			_submissions.pop_front();
+		}
+		for (Buffer& buffer : _buffers) {
+			destroy(buffer);
+		}
+		for (const Kernel& kernel : _kernels) {
+			_device.destroyPipeline(kernel.pipeline);
+		}
+		_device.destroyPipelineLayout(_pipelineLayout);
+		_device.destroyDescriptorSetLayout(_descriptorSetLayout);
+		_device.destroyCommandPool(_commandPool);
+		_device.destroy();
+		_instance.destroy();
+	}
+
+	Type type() const override { return Type::Vulkan; }
+	const char *name() const override { return _name.c_str(); }
+
+	// uploads are staged when queued and downloads retired by the host, so plain memory copies as fast
+	void *allocateHost(size_t size) override {
+		void *memory = std::malloc(std::max<size_t>(size, 1));
+		if (!memory) {
+			throw std::runtime_error("failed to allocate host memory!");
+		}
+		return memory;
+	}
+
+	void freeHost(void *memory) override {
+		std::free(memory);
+	}
+
+	ComputeBuffer createBuffer(size_t size) override {
+		_buffers.push_back(createBuffer(size, vk::BufferUsageFlagBits::eStorageBuffer
+			| vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst,
+			vk::MemoryPropertyFlagBits::eDeviceLocal));
+		return (ComputeBuffer)_buffers.size() - 1;
+	}
+
+	void destroyBuffer(ComputeBuffer buffer) override {
+		destroy(_buffers.at(buffer));
+	}
+
+	ComputeKernel createKernel(const ComputeKernelSource& source) override {
+		if (!source.spirvPath) {
+			throw std::runtime_error(std::string("compute kernel ") + source.name + " has no spir-v form!");
+		}
+		std::vector<char> code = readSpirv(source.spirvPath);
+		vk::ShaderModuleCreateInfo moduleCreateInfo;
+		moduleCreateInfo.codeSize = code.size();
+		moduleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+		vk::ShaderModule module = _device.createShaderModule(moduleCreateInfo);
+
+		vk::ComputePipelineCreateInfo pipelineCreateInfo;
+		pipelineCreateInfo.stage.stage = vk::ShaderStageFlagBits::eCompute;
+		pipelineCreateInfo.stage.module = module;
+		pipelineCreateInfo.stage.pName = "main";
+		pipelineCreateInfo.layout = _pipelineLayout;
+		Kernel kernel;
+		kernel.pipeline = _device.createComputePipelines(nullptr, pipelineCreateInfo)[0];
+		kernel.groupSize = source.vulkanGroupSize;
+		_device.destroyShaderModule(module);
+		_kernels.push_back(kernel);
+		return (ComputeKernel)_kernels.size() - 1;
+	}
+
+	ComputeQueue createQueue() override {
+		_queues.emplace_back();
+		return (ComputeQueue)_queues.size() - 1;
+	}
+
+	ComputeEvent createEvent() override {
+		_events.push_back(0);
+		return (ComputeEvent)_events.size() - 1;
+	}
+
+	void upload(ComputeQueue queue, ComputeBuffer buffer, size_t offset, const void *source, size_t size) override {
+		const Buffer& target = bufferRange(buffer, offset, size);
+		Batch& batch = recording(queue);
+		Buffer staging = createStaging(size);
+		batch.staging.push_back(staging);
+		std::memcpy(staging.mapped, source, size);
+		vk::BufferCopy region;
+		region.srcOffset = 0;
+		region.dstOffset = offset;
+		region.size = size;
+		batch.commandBuffer.copyBuffer(staging.buffer, target.buffer, region);
+		barrier(batch.commandBuffer);
+	}
+
+	void download(ComputeQueue queue, ComputeBuffer buffer, size_t offset, void *target, size_t size) override {
+		const Buffer& source = bufferRange(buffer, offset, size);
+		Batch& batch = recording(queue);
+		Buffer staging = createStaging(size);
+		batch.staging.push_back(staging);
+		batch.downloads.push_back({ target, staging.mapped, size });
+		vk::BufferCopy region;
+		region.srcOffset = offset;
+		region.dstOffset = 0;
+		region.size = size;
+		batch.commandBuffer.copyBuffer(source.buffer, staging.buffer, region);
+		barrier(batch.commandBuffer);
+	}
+
+	void launch(ComputeQueue queue, ComputeKernel kernel, uint32_t count, const ComputeArguments& arguments) override {
+		const Kernel& source = _kernels.at(kernel);
+		std::array<vk::DescriptorBufferInfo, ComputeArguments::kMaxBuffers> bufferInfos;
+		for (uint32_t i = 0; i < arguments.bufferCount; ++i) {
+			bufferInfos[i].buffer = _buffers.at(arguments.buffers[i]).buffer;
+			bufferInfos[i].offset = 0;
+			bufferInfos[i].range = VK_WHOLE_SIZE;
+		}
+		if (count == 0) {
+			return;
+		}
+		Batch& batch = recording(queue);
+
+		vk::DescriptorPoolSize poolSize;
+		poolSize.type = vk::DescriptorType::eStorageBuffer;
+		poolSize.descriptorCount = ComputeArguments::kMaxBuffers;
+		vk::DescriptorPoolCreateInfo poolCreateInfo;
+		poolCreateInfo.poolSizeCount = 1;
+		poolCreateInfo.pPoolSizes = &poolSize;
+		poolCreateInfo.maxSets = 1;
+		batch.descriptorPools.push_back(_device.createDescriptorPool(poolCreateInfo));
+		vk::DescriptorSetAllocateInfo setAllocateInfo;
+		setAllocateInfo.descriptorPool = batch.descriptorPools.back();
+		setAllocateInfo.descriptorSetCount = 1;
+		setAllocateInfo.pSetLayouts = &_descriptorSetLayout;
+		vk::DescriptorSet descriptorSet = _device.allocateDescriptorSets(setAllocateInfo)[0];
+
+		std::array<vk::WriteDescriptorSet, ComputeArguments::kMaxBuffers> descriptorWrites;
+		for (uint32_t binding = 0; binding < arguments.bufferCount; ++binding) {
+			descriptorWrites[binding].dstSet = descriptorSet;
+			descriptorWrites[binding].dstBinding = binding;
+			descriptorWrites[binding].dstArrayElement = 0;
+			descriptorWrites[binding].descriptorCount = 1;
+			descriptorWrites[binding].descriptorType = vk::DescriptorType::eStorageBuffer;
+			descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+		}
+		_device.updateDescriptorSets(arguments.bufferCount, descriptorWrites.data(), 0, nullptr);
+
+		batch.commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, source.pipeline);
+		batch.commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, _pipelineLayout, 0, descriptorSet,
+			nullptr);
+		VulkanComputeConstants constants = {};
+		constants.count = count;
+		std::memcpy(constants.constants, arguments.constants, sizeof(constants.constants));
+		uint32_t groups = (uint32_t)(((uint64_t)count + source.groupSize - 1) / source.groupSize);
+		for (uint32_t group = 0; group < groups; group += _maxGroupCount) {
+			constants.base = group * source.groupSize;
+			batch.commandBuffer.pushConstants(_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+				sizeof(constants), &constants);
+			batch.commandBuffer.dispatch(std::min(groups - group, _maxGroupCount), 1, 1);
+		}
+		barrier(batch.commandBuffer);
+	}
+
+	void record(ComputeQueue queue, ComputeEvent event) override {
+		_events.at(event) = submit(queue);
+	}
+
+	// the event's recording was submitted by record(), the barrier at the start of the queue's next command
+	// buffer already waits for it
+	void wait(ComputeQueue queue, ComputeEvent event) override {
+		if (queue >= _queues.size() || event >= _events.size()) {
+			throw std::runtime_error("unknown compute queue or event!");
+		}
+	}
+
+	void synchronize(ComputeEvent event) override {
+		retire(_events.at(event), true);
+	}
+
+	bool complete(ComputeEvent event) override {
+		uint64_t submission = _events.at(event);
+		retire(submission, false);
+		return _retired >= submission;
+	}
+
+	void finish(ComputeQueue queue) override {
+		retire(submit(queue), true);
+	}
+
+private:
+	struct Buffer {
+		vk::Buffer buffer;
+		vk::DeviceMemory memory;
+		size_t size = 0;
+		// staging buffers stay mapped
+		void *mapped = nullptr;
+	};
+
+	struct Download {
+		void *target;
+		const void *source;
+		size_t size;
+	};
+
+	// the commands of one submission and what they need until it completes
+	struct Batch {
+		vk::CommandBuffer commandBuffer;
+		std::vector<Buffer> staging;
+		std::vector<vk::DescriptorPool> descriptorPools;
+		std::vector<Download> downloads;
+	};
+
+	struct Queue {
+		// the batch being recorded, no command buffer when nothing was put on the queue since it was submitted
+		Batch recording;
+	};
+
+	struct Submission {
+		uint64_t number;
+		vk::Fence fence;
+		Batch batch;
+	};
+
+	struct Kernel {
+		vk::Pipeline pipeline;
+		uint32_t groupSize;
+	};
+
+	vk::Instance _instance;
+	vk::PhysicalDevice _gpu;
+	vk::PhysicalDeviceMemoryProperties _memoryProperties;
+	uint32_t _familyIndex = 0;
+	uint32_t _maxGroupCount = 65535;
+	std::string _name;
+	vk::Device _device;
+	vk::Queue _queue;
+	vk::CommandPool _commandPool;
+	vk::DescriptorSetLayout _descriptorSetLayout;
+	vk::PipelineLayout _pipelineLayout;
+
+	std::vector<Buffer> _buffers;
+	std::vector<Kernel> _kernels;
+	std::vector<Queue> _queues;
+	// the submission an event was last recorded with, 0 for none
+	std::vector<uint64_t> _events;
+	// in submission order, a fence signals only once everything submitted before it completed
+	std::deque<Submission> _submissions;
+	uint64_t _submitted = 0;
+	uint64_t _retired = 0;
+
+	uint32_t findMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags properties) const {
+		for (uint32_t i = 0; i < _memoryProperties.memoryTypeCount; ++i) {
+			bool isTypeMatch = typeFilter & (1 << i);
+			bool hasProperties = (_memoryProperties.memoryTypes[i].propertyFlags & properties) == properties;
+			if (isTypeMatch && hasProperties) {
+				return i;
+			}
+		}
+		throw std::runtime_error("failed to find suitable memory type!");
+	}
+
+	Buffer createBuffer(size_t size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties) {
+		Buffer buffer;
+		buffer.size = size;
+		vk::BufferCreateInfo bufferInfo;
+		bufferInfo.size = std::max<size_t>(size, 4);
+		bufferInfo.usage = usage;
+		bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+		buffer.buffer = _device.createBuffer(bufferInfo);
+
+		vk::MemoryRequirements memoryRequirements = _device.getBufferMemoryRequirements(buffer.buffer);
+		vk::MemoryAllocateInfo memoryAllocateInfo;
+		memoryAllocateInfo.allocationSize = memoryRequirements.size;
+		memoryAllocateInfo.memoryTypeIndex = findMemoryType(memoryRequirements.memoryTypeBits, properties);
+		buffer.memory = _device.allocateMemory(memoryAllocateInfo);
+		_device.bindBufferMemory(buffer.buffer, buffer.memory, 0);
+		return buffer;
+	}
+
+	Buffer createStaging(size_t size) {
+		Buffer staging = createBuffer(size, vk::BufferUsageFlagBits::eTransferSrc
+			| vk::BufferUsageFlagBits::eTransferDst,
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+		staging.mapped = _device.mapMemory(staging.memory, 0, VK_WHOLE_SIZE, {});
+		return staging;
+	}
+
+	void destroy(Buffer& buffer) {
+		if (buffer.buffer) {
+			_device.destroyBuffer(buffer.buffer);
+			_device.freeMemory(buffer.memory);
+		}
+		buffer = Buffer();
+	}
+
+	const Buffer& bufferRange(ComputeBuffer buffer, size_t offset, size_t size) {
+		const Buffer& memory = _buffers.at(buffer);
+		if (offset > memory.size || size > memory.size - offset) {
+			throw std::runtime_error("compute copy out of the buffer's range!");
+		}
+		return memory;
+	}
+
+	// copies and dispatches wait for everything before them, in this command buffer and submitted earlier
+	static void barrier(vk::CommandBuffer commandBuffer) {
+		vk::MemoryBarrier memoryBarrier;
+		memoryBarrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite;
+		memoryBarrier.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite
+			| vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite;
+		auto stages = vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer;
+		commandBuffer.pipelineBarrier(stages, stages, {}, memoryBarrier, nullptr, nullptr);
+	}
+
+	Batch& recording(ComputeQueue queue) {
+		Batch& batch = _queues.at(queue).recording;
+		if (!batch.commandBuffer) {
+			vk::CommandBufferAllocateInfo allocateInfo;
+			allocateInfo.level = vk::CommandBufferLevel::ePrimary;
+			allocateInfo.commandPool = _commandPool;
+			allocateInfo.commandBufferCount = 1;
+			batch.commandBuffer = _device.allocateCommandBuffers(allocateInfo)[0];
+			vk::CommandBufferBeginInfo beginInfo;
+			beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+			batch.commandBuffer.begin(beginInfo);
+			barrier(batch.commandBuffer);
+		}
+		return batch;
+	}
+
+	// submits what the queue recorded, nothing at all still gets a fence for events and finish()
+	uint64_t submit(ComputeQueue queue) {
+		Batch& batch = _queues.at(queue).recording;
+		vk::SubmitInfo submitInfo;
+		if (batch.commandBuffer) {
+			if (!batch.downloads.empty()) {
+				vk::MemoryBarrier hostBarrier;
+				hostBarrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+				hostBarrier.dstAccessMask = vk::AccessFlagBits::eHostRead;
+				batch.commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+					vk::PipelineStageFlagBits::eHost, {}, hostBarrier, nullptr, nullptr);
+			}
+			batch.commandBuffer.end();
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &batch.commandBuffer;
+		}
+		Submission submission;
+		submission.number = ++_submitted;
+		submission.fence = _device.createFence(vk::FenceCreateInfo());
+		_queue.submit(submitInfo, submission.fence);
+		submission.batch = std::move(batch);
+		batch = Batch();
+		_submissions.push_back(std::move(submission));
+		return _submitted;
+	}
+
+	// retires the submissions up to number that completed, waiting for them when asked to
+	void retire(uint64_t number, bool wait) {
+		while (!_submissions.empty() && _submissions.front().number <= number) {
+			Submission& submission = _submissions.front();
+			if (wait) {
+				if (_device.waitForFences(submission.fence, true, UINT64_MAX) != vk::Result::eSuccess) {
+					throw std::runtime_error("failed to wait for a compute submission!");
+				}
+			} else if (_device.getFenceStatus(submission.fence) != vk::Result::eSuccess) {
+				return;
+			}
+			for (const Download& download : submission.batch.downloads) {
+				std::memcpy(download.target, download.source, download.size);
+			}
+			release(submission.batch);
+			_device.destroyFence(submission.fence);
+			_retired = submission.number;
+			_submissions.pop_front();
+		}
+	}
+
+	void release(Batch& batch) {
+		for (Buffer& staging : batch.staging) {
+			destroy(staging);
+		}
+		for (vk::DescriptorPool pool : batch.descriptorPools) {
+			_device.destroyDescriptorPool(pool);
+		}
+		if (batch.commandBuffer) {
+			_device.freeCommandBuffers(_commandPool, batch.commandBuffer);
+		}
+		batch = Batch();
+	}
+};
+
+}
+
+std::unique_ptr<ComputeBackend> createVulkanComputeBackend() {
+	return std::unique_ptr<ComputeBackend>(new VulkanComputeBackend());
+}
+#endif
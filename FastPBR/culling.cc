@@ -0,0 +1,164 @@
+#include "culling.hh"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static inline uint32_t lowestSetBit(uint32_t mask) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+Frustum Frustum::fromMatrix(const glm::mat4& viewProjection) {
+	// Gribb/Hartmann, glm is column major so row i is m[0][i]..m[3][i]
+	auto row = [&](int i) {
+		return glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+	};
+	Frustum frustum;
+	frustum.planes[0] = row(3) + row(0);	// left
+	frustum.planes[1] = row(3) - row(0);	// right
+	frustum.planes[2] = row(3) + row(1);	// bottom
+	frustum.planes[3] = row(3) - row(1);	// top
+	frustum.planes[4] = row(3) + row(2);	// near
+	frustum.planes[5] = row(3) - row(2);	// far
+	for (auto& plane : frustum.planes) {
+		plane /= glm::length(glm::vec3(plane));
+	}
+	return frustum;
+}
+
+uint32_t CullingSystem::addObject(const glm::vec3& center, float radius, uint32_t drawId) {
+	uint32_t object = (uint32_t)_objectCount++;
+	size_t paddedCount = (_objectCount + kLaneCount - 1) / kLaneCount * kLaneCount;
+	if (paddedCount > _radius.size()) {
+		_centerX.resize(paddedCount, 0.0f);
+		_centerY.resize(paddedCount, 0.0f);
+		_centerZ.resize(paddedCount, 0.0f);
+		_radius.resize(paddedCount, -FLT_MAX);
+		_drawIds.resize(paddedCount, 0);
+	}
+	_drawIds[object] = drawId;
+	setBounds(object, center, radius);
+	return object;
+}
+
+void CullingSystem::setBounds(uint32_t object, const glm::vec3& center, float radius) {
+	_centerX[object] = center.x;
+	_centerY[object] = center.y;
+	_centerZ[object] = center.z;
+	_radius[object] = radius;
+}
+
+void CullingSystem::clear() {
+	_objectCount = 0;
+	_centerX.clear();
+	_centerY.clear();
+	_centerZ.clear();
+	_radius.clear();
+	_drawIds.clear();
+	_drawList.clear();
+}
+
+size_t CullingSystem::size() const {
+	return _objectCount;
+}
+
+const std::vector<uint32_t>& CullingSystem::cull(const glm::mat4& viewProjection, JobSystem& jobs) {
+	auto startTime = std::chrono::high_resolution_clock::now();
+	Frustum frustum = Frustum::fromMatrix(viewProjection);
+
+	// every job fills its own list, concatenating them keeps the draw order stable
+	size_t paddedCount = _radius.size();
+	size_t jobCount = (paddedCount + kObjectsPerJob - 1) / kObjectsPerJob;
+	_jobDrawLists.resize(jobCount);
+	jobs.parallelFor(jobCount, 1, [&](size_t begin, size_t end) {
+		for (size_t job = begin; job < end; ++job) {
+			_jobDrawLists[job].clear();
+			cullRange(frustum, job * kObjectsPerJob, std::min(paddedCount, (job + 1) * kObjectsPerJob),
+				_jobDrawLists[job]);
+		}
+	});
+
+	_drawList.clear();
+	for (const auto& jobDrawList : _jobDrawLists) {
+		_drawList.insert(_drawList.end(), jobDrawList.begin(), jobDrawList.end());
+	}
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	_lastCullMilliseconds = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+	return _drawList;
+}
+
+const std::vector<uint32_t>& CullingSystem::drawList() const {
+	return _drawList;
+}
+
+double CullingSystem::lastCullMilliseconds() const {
+	return _lastCullMilliseconds;
+}
+
+void CullingSystem::cullRange(const Frustum& frustum, size_t begin, size_t end,
+	std::vector<uint32_t>& visible) const {
+	// a sphere survives when dot(plane, center) + w >= -radius for all six planes
+#if defined(__AVX__)
+	__m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (int p = 0; p < 6; ++p) {
+		planeX[p] = _mm256_set1_ps(frustum.planes[p].x);
+		planeY[p] = _mm256_set1_ps(frustum.planes[p].y);
+		planeZ[p] = _mm256_set1_ps(frustum.planes[p].z);
+		planeW[p] = _mm256_set1_ps(frustum.planes[p].w);
+	}
+	const __m256 signMask = _mm256_set1_ps(-0.0f);
+	for (size_t i = begin; i < end; i += 8) {
+		__m256 x = _mm256_loadu_ps(&_centerX[i]);
+		__m256 y = _mm256_loadu_ps(&_centerY[i]);
+		__m256 z = _mm256_loadu_ps(&_centerZ[i]);
+		__m256 negativeRadius = _mm256_xor_ps(_mm256_loadu_ps(&_radius[i]), signMask);
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int p = 0; p < 6; ++p) {
+			__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planeX[p], x), _mm256_mul_ps(planeY[p], y)),
+				_mm256_add_ps(_mm256_mul_ps(planeZ[p], z), planeW[p]));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+		}
+		uint32_t mask = (uint32_t)_mm256_movemask_ps(inside);
+		while (mask) {
+			visible.push_back(_drawIds[i + lowestSetBit(mask)]);
+			mask &= mask - 1;
+		}
+	}
+#else
+	__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (int p = 0; p < 6; ++p) {
+		planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+		planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+		planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+		planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+	}
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	for (size_t i = begin; i < end; i += 4) {
+		__m128 x = _mm_loadu_ps(&_centerX[i]);
+		__m128 y = _mm_loadu_ps(&_centerY[i]);
+		__m128 z = _mm_loadu_ps(&_centerZ[i]);
+		__m128 negativeRadius = _mm_xor_ps(_mm_loadu_ps(&_radius[i]), signMask);
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int p = 0; p < 6; ++p) {
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)),
+				_mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+		}
+		uint32_t mask = (uint32_t)_mm_movemask_ps(inside);
+		while (mask) {
+			visible.push_back(_drawIds[i + lowestSetBit(mask)]);
+			mask &= mask - 1;
+		}
+	}
+#endif
+}
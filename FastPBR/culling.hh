@@ -0,0 +1,46 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include "jobs.hh"
+
+struct Frustum {
+	// xyz is the inward facing normal, w the distance, planes are normalized
+	glm::vec4 planes[6];
+
+	// viewProjection is proj * view with the -1..1 clip depth glm::perspective produces
+	static Frustum fromMatrix(const glm::mat4& viewProjection);
+};
+
+// CPU visibility for the submission path, bounds are world space spheres kept as SoA arrays
+// so 4 (SSE) or 8 (AVX) objects are tested against a plane per instruction
+class CullingSystem
+{
+public:
+	uint32_t addObject(const glm::vec3& center, float radius, uint32_t drawId);
+	void setBounds(uint32_t object, const glm::vec3& center, float radius);
+	void clear();
+	size_t size() const;
+
+	// rebuilds the draw list, drawIds of visible objects in insertion order
+	const std::vector<uint32_t>& cull(const glm::mat4& viewProjection, JobSystem& jobs = JobSystem::shared());
+	const std::vector<uint32_t>& drawList() const;
+	double lastCullMilliseconds() const;
+
+private:
+	static const size_t kLaneCount = 8;
+	static const size_t kObjectsPerJob = 16384;
+
+	size_t _objectCount = 0;
+	// padded to kLaneCount, padding has a negative radius so it never passes
+	std::vector<float> _centerX;
+	std::vector<float> _centerY;
+	std::vector<float> _centerZ;
+	std::vector<float> _radius;
+	std::vector<uint32_t> _drawIds;
+	std::vector<uint32_t> _drawList;
+	std::vector<std::vector<uint32_t>> _jobDrawLists;
+	double _lastCullMilliseconds = 0;
+
+	void cullRange(const Frustum& frustum, size_t begin, size_t end, std::vector<uint32_t>& visible) const;
+};
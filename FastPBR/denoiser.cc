@@ -0,0 +1,408 @@
+#include "denoiser.hh"
+#include "lanes.hh"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+// SVGF's edge stopping parameters: luminance against its standard deviation, depth against its change
+// over the tap's distance and the normals' cosine to the power 128, 2^7
+static const float kPhiLuminance = 4.0f;
+static const float kPhiDepth = 1.0f;
+static const int kNormalSquarings = 7;
+// the previous frame saw the same surface when its normal is within this cosine and its position this
+// close to the tangent plane, relative to the depth
+static const float kReprojectionCosine = 0.9f;
+static const float kReprojectionDistance = 0.01f;
+// rows per job of every pass
+static const size_t kRowGrain = 4;
+static const float kKernel[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+static float luminance(const glm::vec3& color) {
+	return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+}
+
+static Float8 luminance(Float8 red, Float8 green, Float8 blue) {
+	return red * 0.2126f + green * 0.7152f + blue * 0.0722f;
+}
+
+// e^-a for a >= 0: a Taylor polynomial of -a / 64 squared six times, within about 1e-4 relative up to
+// e^-20, which higher arguments stay at. their taps weigh next to nothing either way
+static Float8 expNegative(Float8 a) {
+	Float8 x = min(a, 20.0f) * (-1.0f / 64.0f);
+	Float8 y = 1.0f + x * (1.0f + x * (1.0f / 2.0f + x * (1.0f / 6.0f + x * (1.0f / 24.0f + x * (1.0f / 120.0f)))));
+	for (int i = 0; i < 6; ++i) {
+		y = y * y;
+	}
+	return y;
+}
+
+static Float8 normalWeight(Float8 cosine) {
+	Float8 y = max(cosine, 0.0f);
+	for (int i = 0; i < kNormalSquarings; ++i) {
+		y = y * y;
+	}
+	return y;
+}
+
+void Denoiser::Illumination::resize(size_t size) {
+	red.assign(size, 0.0f);
+	green.assign(size, 0.0f);
+	blue.assign(size, 0.0f);
+	luminance.assign(size, 0.0f);
+	variance.assign(size, 0.0f);
+}
+
+void Denoiser::setJobSystem(JobSystem& jobs) {
+	_jobs = &jobs;
+}
+
+void Denoiser::setIterations(uint32_t iterations) {
+	_iterations = std::min(iterations, kMaxIterations);
+}
+
+void Denoiser::setTemporalAlpha(float colorAlpha, float momentsAlpha) {
+	_colorAlpha = colorAlpha;
+	_momentsAlpha = momentsAlpha;
+}
+
+void Denoiser::setTemporal(bool temporal) {
+	_temporal = temporal;
+	_hasHistory = false;
+}
+
+void Denoiser::reset() {
+	_hasHistory = false;
+}
+
+void Denoiser::resize(uint32_t width, uint32_t height) {
+	_width = width;
+	_height = height;
+	_stride = (width + 7) / 8 * 8 + 2 * kBorder;
+	size_t size = _stride * (height + 2 * kBorder);
+	for (Plane *plane : { &_depths, &_depthWidths, &_historyLengths, &_centerVariance, &_previousLengths }) {
+		plane->assign(size, 0.0f);
+	}
+	for (int i = 0; i < 3; ++i) {
+		for (Plane *plane : { &_normals[i], &_positions[i], &_previousColors[i], &_previousNormals[i],
+			&_previousPositions[i] }) {
+			plane->assign(size, 0.0f);
+		}
+	}
+	for (int i = 0; i < 2; ++i) {
+		_filtered[i].resize(size);
+		_moments[i].assign(size, 0.0f);
+		_previousMoments[i].assign(size, 0.0f);
+	}
+	_hasHistory = false;
+}
+
+void Denoiser::denoise(const UniformBufferObject& frame, const HdrImage& color, const FeatureBuffers& features,
+	HdrImage& output) {
+	if (color.width != _width || color.height != _height) {
+		resize(color.width, color.height);
+	}
+	if (output.width != _width || output.height != _height) {
+		output.resize(_width, _height);
+	}
+	glm::mat4 viewProjection = frame.invert * frame.proj * frame.view;
+	prepare(glm::inverse(viewProjection), color, features);
+	reproject(features);
+	estimateSpatialVariance();
+	for (uint32_t iteration = 0; iteration < _iterations; ++iteration) {
+		const Illumination& source = _filtered[iteration % 2];
+		filterVariance(source);
+		filterIteration(source, _filtered[(iteration + 1) % 2], 1u << iteration);
+		if (iteration == 0) {
+			_previousColors[0] = _filtered[1].red;
+			_previousColors[1] = _filtered[1].green;
+			_previousColors[2] = _filtered[1].blue;
+		}
+	}
+	if (_iterations == 0) {
+		_previousColors[0] = _filtered[0].red;
+		_previousColors[1] = _filtered[0].green;
+		_previousColors[2] = _filtered[0].blue;
+	}
+
+	// the albedo goes back on, misses show the render as it was
+	const Illumination& result = _filtered[_iterations % 2];
+	_jobs->parallelFor(_height, kRowGrain, [&](size_t begin, size_t end) {
+		for (size_t y = begin; y < end; ++y) {
+			for (uint32_t x = 0; x < _width; ++x) {
+				size_t i = y * _width + x, p = planeIndex((int)x, (int)y);
+				output.pixels[i] = _depths[p] > 0.0f ? glm::vec3(result.red[p], result.green[p], result.blue[p])
+					* features.albedo[i] : color.pixels[i];
+			}
+		}
+	});
+
+	for (int i = 0; i < 3; ++i) {
+		std::swap(_normals[i], _previousNormals[i]);
+		std::swap(_positions[i], _previousPositions[i]);
+	}
+	for (int i = 0; i < 2; ++i) {
+		std::swap(_moments[i], _previousMoments[i]);
+	}
+	std::swap(_historyLengths, _previousLengths);
+	_previousViewProjection = viewProjection;
+	_hasHistory = _temporal;
+}
+
+void Denoiser::prepare(const glm::mat4& inverseViewProjection, const HdrImage& color,
+	const FeatureBuffers& features) {
+	// this frame's illumination goes to the second set until reprojection averages it into the first
+	Illumination& current = _filtered[1];
+	_jobs->parallelFor(_height, kRowGrain, [&](size_t begin, size_t end) {
+		for (size_t y = begin; y < end; ++y) {
+			for (uint32_t x = 0; x < _width; ++x) {
+				size_t i = y * _width + x, p = planeIndex((int)x, (int)y);
+				glm::vec3 illumination = color.pixels[i] / glm::max(features.albedo[i], glm::vec3(1e-3f));
+				current.red[p] = illumination.r;
+				current.green[p] = illumination.g;
+				current.blue[p] = illumination.b;
+				bool hit = features.depths[i] != std::numeric_limits<float>::infinity()
+					&& features.normals[i] != glm::vec3(0.0f);
+				_depths[p] = hit ? std::max(features.depths[i], 1e-6f) : 0.0f;
+				glm::vec3 position(0.0f);
+				if (hit) {
+					// along the pixel center's camera ray, where the path tracer measured the depth
+					glm::vec2 ndc((x + 0.5f) / _width * 2.0f - 1.0f, (y + 0.5f) / _height * 2.0f - 1.0f);
+					glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndc, 0.0f, 1.0f);
+					glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+					glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+					position = origin + glm::normalize(glm::vec3(farPoint) / farPoint.w - origin) * _depths[p];
+				}
+				for (int k = 0; k < 3; ++k) {
+					_normals[k][p] = hit ? features.normals[i][k] : 0.0f;
+					_positions[k][p] = position[k];
+				}
+			}
+		}
+	});
+}
+
+void Denoiser::reproject(const FeatureBuffers& features) {
+	const Illumination& current = _filtered[1];
+	Illumination& integrated = _filtered[0];
+	const float infinity = std::numeric_limits<float>::infinity();
+	std::atomic<uint64_t> hitCount{ 0 }, reprojectedCount{ 0 };
+	_jobs->parallelFor(_height, kRowGrain, [&](size_t begin, size_t end) {
+		uint64_t jobHits = 0, jobReprojected = 0;
+		for (size_t y = begin; y < end; ++y) {
+			const size_t row = planeIndex(0, (int)y);
+			// depth change per pixel on the flatter side of each axis, so silhouettes do not count
+			for (uint32_t x = 0; x < _width; x += 8) {
+				const float *depths = &_depths[row + x];
+				Float8 depth = Float8::load(depths);
+				Float8 width(0.0f);
+				for (size_t offset : { (size_t)1, _stride }) {
+					Float8 before = Float8::load(depths - offset), after = Float8::load(depths + offset);
+					Float8 change = min(mix(Float8(infinity), abs(before - depth), before > 0.0f),
+						mix(Float8(infinity), abs(after - depth), after > 0.0f));
+					width = width + mix(Float8(0.0f), change, change < infinity);
+				}
+				width.store(&_depthWidths[row + x]);
+			}
+
+			for (uint32_t x = 0; x < _width; ++x) {
+				size_t i = y * _width + x, p = row + x;
+				float depth = _depths[p];
+				glm::vec3 illumination(current.red[p], current.green[p], current.blue[p]);
+				float firstMoment = features.luminances[i];
+				glm::vec2 moments(firstMoment, firstMoment * firstMoment + features.variances[i]);
+				// the previous frame's pixels around where this surface point was, bilinearly weighed and
+				// kept where they saw the same surface
+				glm::vec3 historyColor(0.0f);
+				glm::vec2 historyMoments(0.0f);
+				float historyLength = 0.0f, weightSum = 0.0f;
+				if (_hasHistory && depth > 0.0f) {
+					++jobHits;
+					glm::vec3 position(_positions[0][p], _positions[1][p], _positions[2][p]);
+					glm::vec3 normal(_normals[0][p], _normals[1][p], _normals[2][p]);
+					glm::vec4 clip = _previousViewProjection * glm::vec4(position, 1.0f);
+					glm::vec2 pixel = (glm::vec2(clip) / clip.w * 0.5f + 0.5f) * glm::vec2(_width, _height) - 0.5f;
+					glm::vec2 corner = glm::floor(pixel), fraction = pixel - corner;
+					// corners a pixel off the image read the border, which saw nothing
+					bool inside = clip.w > 0.0f && corner.x >= -1.0f && corner.x < (float)_width
+						&& corner.y >= -1.0f && corner.y < (float)_height;
+					for (int k = 0; inside && k < 4; ++k) {
+						size_t j = planeIndex((int)corner.x + (k & 1), (int)corner.y + (k >> 1));
+						glm::vec3 previousNormal(_previousNormals[0][j], _previousNormals[1][j],
+							_previousNormals[2][j]);
+						glm::vec3 previousPosition(_previousPositions[0][j], _previousPositions[1][j],
+							_previousPositions[2][j]);
+						float planeDistance = std::fabs(glm::dot(previousPosition - position, normal));
+						if (glm::dot(normal, previousNormal) < kReprojectionCosine
+							|| planeDistance > kReprojectionDistance * depth) {
+							continue;
+						}
+						float weight = ((k & 1) ? fraction.x : 1.0f - fraction.x)
+							* ((k >> 1) ? fraction.y : 1.0f - fraction.y);
+						historyColor += weight * glm::vec3(_previousColors[0][j], _previousColors[1][j],
+							_previousColors[2][j]);
+						historyMoments += weight * glm::vec2(_previousMoments[0][j], _previousMoments[1][j]);
+						historyLength += weight * _previousLengths[j];
+						weightSum += weight;
+					}
+				}
+				float length = 1.0f;
+				if (weightSum > 1e-4f) {
+					++jobReprojected;
+					historyColor /= weightSum;
+					historyMoments /= weightSum;
+					length = std::min((float)kHistoryLimit, std::floor(historyLength / weightSum + 0.5f) + 1.0f);
+					// a plain mean until the history is long enough for the exponential average
+					illumination = glm::mix(historyColor, illumination, std::max(_colorAlpha, 1.0f / length));
+					moments = glm::mix(historyMoments, moments, std::max(_momentsAlpha, 1.0f / length));
+				}
+				integrated.red[p] = illumination.r;
+				integrated.green[p] = illumination.g;
+				integrated.blue[p] = illumination.b;
+				integrated.luminance[p] = luminance(illumination);
+				integrated.variance[p] = std::max(0.0f, moments.y - moments.x * moments.x);
+				_moments[0][p] = moments.x;
+				_moments[1][p] = moments.y;
+				_historyLengths[p] = depth > 0.0f ? length : 0.0f;
+			}
+		}
+		hitCount += jobHits;
+		reprojectedCount += jobReprojected;
+	});
+	_lastReprojectedFraction = hitCount.load() > 0 ? (float)reprojectedCount.load() / hitCount.load() : 0.0f;
+}
+
+void Denoiser::estimateSpatialVariance() {
+	// pixels of a short history take the variance of their neighbours' moments over 7x7, weighed by depth and
+	// normal, and scaled up while the history is shortest like SVGF does
+	Illumination& integrated = _filtered[0];
+	_jobs->parallelFor(_height, kRowGrain, [&](size_t begin, size_t end) {
+		for (size_t y = begin; y < end; ++y) {
+			for (uint32_t x = 0; x < _width; x += 8) {
+				const size_t p = planeIndex((int)x, (int)y);
+				Float8 length = Float8::load(&_historyLengths[p]);
+				Float8 depth = Float8::load(&_depths[p]);
+				Mask8 shortHistory = length < (float)kSpatialVarianceFrames && depth > 0.0f;
+				if (!any(shortHistory)) {
+					continue;
+				}
+				Float8 normalX = Float8::load(&_normals[0][p]);
+				Float8 normalY = Float8::load(&_normals[1][p]);
+				Float8 normalZ = Float8::load(&_normals[2][p]);
+				Float8 depthScale = 1.0f / (max(Float8::load(&_depthWidths[p]), 1e-8f) * kPhiDepth);
+				Float8 weightSum(0.0f), firstMoment(0.0f), secondMoment(0.0f);
+				for (int dy = -3; dy <= 3; ++dy) {
+					for (int dx = -3; dx <= 3; ++dx) {
+						const size_t q = p + dy * (ptrdiff_t)_stride + dx;
+						Float8 cosine = normalX * Float8::load(&_normals[0][q])
+							+ normalY * Float8::load(&_normals[1][q]) + normalZ * Float8::load(&_normals[2][q]);
+						float distance = std::max(std::sqrt((float)(dx * dx + dy * dy)), 1.0f);
+						Float8 depthTerm = abs(depth - Float8::load(&_depths[q])) * depthScale * (1.0f / distance);
+						Float8 weight = normalWeight(cosine) * expNegative(depthTerm);
+						weightSum = weightSum + weight;
+						firstMoment = firstMoment + weight * Float8::load(&_moments[0][q]);
+						secondMoment = secondMoment + weight * Float8::load(&_moments[1][q]);
+					}
+				}
+				weightSum = max(weightSum, 1e-10f);
+				firstMoment = firstMoment / weightSum;
+				Float8 variance = max(secondMoment / weightSum - firstMoment * firstMoment, 0.0f)
+					* (4.0f / max(length, 1.0f));
+				mix(Float8::load(&integrated.variance[p]), variance, shortHistory).store(&integrated.variance[p]);
+			}
+		}
+	});
+}
+
+void Denoiser::filterVariance(const Illumination& source) {
+	// 3x3 gaussian over the hits around, a single pixel's estimate is too noisy to go by
+	_jobs->parallelFor(_height, kRowGrain, [&](size_t begin, size_t end) {
+		for (size_t y = begin; y < end; ++y) {
+			for (uint32_t x = 0; x < _width; x += 8) {
+				const size_t p = planeIndex((int)x, (int)y);
+				Float8 sum(0.0f), weightSum(0.0f);
+				for (int dy = -1; dy <= 1; ++dy) {
+					for (int dx = -1; dx <= 1; ++dx) {
+						const size_t q = p + dy * (ptrdiff_t)_stride + dx;
+						Float8 weight = mix(Float8(0.0f), Float8(kKernel[std::abs(dx) + 1] * kKernel[std::abs(dy) + 1]),
+							Float8::load(&_depths[q]) > 0.0f);
+						sum = sum + weight * Float8::load(&source.variance[q]);
+						weightSum = weightSum + weight;
+					}
+				}
+				(sum / max(weightSum, 1e-10f)).store(&_centerVariance[p]);
+			}
+		}
+	});
+}
+
+void Denoiser::filterIteration(const Illumination& source, Illumination& target, uint32_t step) {
+	// the 25 taps of this step, their kernel weight and the depth change they allow per unit of depth width
+	struct Tap {
+		ptrdiff_t offset;
+		float kernel;
+		float depthScale;
+	};
+	Tap taps[25];
+	for (int dy = -2, t = 0; dy <= 2; ++dy) {
+		for (int dx = -2; dx <= 2; ++dx, ++t) {
+			float distance = std::max(std::sqrt((float)(dx * dx + dy * dy)), 1.0f);
+			taps[t] = { (dy * (ptrdiff_t)_stride + dx) * (ptrdiff_t)step, kKernel[std::abs(dx)] * kKernel[std::abs(dy)],
+				1.0f / (kPhiDepth * (float)step * distance) };
+		}
+	}
+	_jobs->parallelFor(_height, kRowGrain, [&](size_t begin, size_t end) {
+		for (size_t y = begin; y < end; ++y) {
+			for (uint32_t x = 0; x < _width; x += 8) {
+				const size_t p = planeIndex((int)x, (int)y);
+				Float8 red = Float8::load(&source.red[p]);
+				Float8 green = Float8::load(&source.green[p]);
+				Float8 blue = Float8::load(&source.blue[p]);
+				Float8 centerLuminance = Float8::load(&source.luminance[p]);
+				Float8 variance = Float8::load(&source.variance[p]);
+				Float8 depth = Float8::load(&_depths[p]);
+				Mask8 hit = depth > 0.0f;
+				if (!any(hit)) {
+					red.store(&target.red[p]);
+					green.store(&target.green[p]);
+					blue.store(&target.blue[p]);
+					centerLuminance.store(&target.luminance[p]);
+					variance.store(&target.variance[p]);
+					continue;
+				}
+				Float8 normalX = Float8::load(&_normals[0][p]);
+				Float8 normalY = Float8::load(&_normals[1][p]);
+				Float8 normalZ = Float8::load(&_normals[2][p]);
+				Float8 luminanceScale = 1.0f / (kPhiLuminance * sqrt(max(Float8::load(&_centerVariance[p]), 0.0f))
+					+ 1e-10f);
+				Float8 inverseDepthWidth = 1.0f / max(Float8::load(&_depthWidths[p]), 1e-8f);
+				Float8 weightSum(0.0f), sumRed(0.0f), sumGreen(0.0f), sumBlue(0.0f), sumVariance(0.0f);
+				// taps past the image read the border, whose normals of 0 weigh nothing
+				for (const Tap& tap : taps) {
+					const size_t q = p + tap.offset;
+					Float8 cosine = normalX * Float8::load(&_normals[0][q])
+						+ normalY * Float8::load(&_normals[1][q]) + normalZ * Float8::load(&_normals[2][q]);
+					// depth against how much it changes over the tap's distance in pixels
+					Float8 depthTerm = abs(depth - Float8::load(&_depths[q])) * (inverseDepthWidth * tap.depthScale);
+					Float8 luminanceTerm = abs(centerLuminance - Float8::load(&source.luminance[q])) * luminanceScale;
+					Float8 weight = normalWeight(cosine) * expNegative(depthTerm + luminanceTerm) * tap.kernel;
+					weightSum = weightSum + weight;
+					sumRed = sumRed + weight * Float8::load(&source.red[q]);
+					sumGreen = sumGreen + weight * Float8::load(&source.green[q]);
+					sumBlue = sumBlue + weight * Float8::load(&source.blue[q]);
+					sumVariance = sumVariance + weight * weight * Float8::load(&source.variance[q]);
+				}
+				Float8 inverseSum = 1.0f / max(weightSum, 1e-10f);
+				red = mix(red, sumRed * inverseSum, hit);
+				green = mix(green, sumGreen * inverseSum, hit);
+				blue = mix(blue, sumBlue * inverseSum, hit);
+				red.store(&target.red[p]);
+				green.store(&target.green[p]);
+				blue.store(&target.blue[p]);
+				mix(centerLuminance, luminance(red, green, blue), hit).store(&target.luminance[p]);
+				mix(variance, sumVariance * inverseSum * inverseSum, hit).store(&target.variance[p]);
+			}
+		}
+	});
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include "jobs.hh"
+#include "renderer.hh"
+#include <cstdint>
+#include <vector>
+
+// Spatiotemporal variance guided filtering after Schied et al., "Spatiotemporal Variance-Guided Filtering"
+// (SVGF), for the few samples per pixel an interactive path tracer affords. A frame is divided by its
+// albedo, so the filter only blurs the illumination and texture detail comes back unblurred at the end:
+//   reproject  every pixel's first hit goes through the previous camera, and where the previous frame saw
+//              the same surface there the illumination and its luminance moments join a running average
+//   variance   from the averaged moments, or from the neighbours' moments while a pixel's history is short
+//   a-trous    iterations of a 5x5 B3 spline kernel with holes of 1, 2, 4... pixels, each tap weighed by
+//              how well depth, normal and luminance match the center, the luminance scaled by the center's
+//              standard deviation so noisy pixels blur more. The first iteration's result is the history
+// Passes run eight neighbouring pixels of a row at once over planes of floats, rows spread over the jobs.
+class Denoiser
+{
+public:
+	// frames a pixel's average spans at most, older ones fade at the temporal alpha
+	static const uint32_t kHistoryLimit = 32;
+	// pixels with fewer frames of history estimate their variance from their neighbours
+	static const uint32_t kSpatialVarianceFrames = 4;
+	// a-trous iterations at most, the planes' border is as wide as the widest kernel reaches
+	static const uint32_t kMaxIterations = 6;
+
+	// jobs of denoise(), the shared job system by default. it has to outlive the denoiser's use of it
+	void setJobSystem(JobSystem& jobs);
+	// a-trous iterations, 5 by default for a 61 pixel wide kernel, up to kMaxIterations
+	void setIterations(uint32_t iterations);
+	uint32_t iterations() const { return _iterations; }
+	// weight of the new frame in the running averages of illumination and moments, 0.2 by default
+	void setTemporalAlpha(float colorAlpha, float momentsAlpha);
+	// without, every frame is filtered on its own
+	void setTemporal(bool temporal);
+	// the next frame starts without history, for cuts and scene changes
+	void reset();
+
+	// filters a render with the features and camera it was rendered with, output may be color
+	void denoise(const UniformBufferObject& frame, const HdrImage& color, const FeatureBuffers& features,
+		HdrImage& output);
+
+	// share of the last frame's hit pixels that found their history
+	float lastReprojectedFraction() const { return _lastReprojectedFraction; }
+
+private:
+	// one float per pixel, so eight pixels of a row load together. rows are padded to whole lanes and every
+	// plane has a border of kBorder pixels that stays 0, where taps and reprojection past the edges land
+	using Plane = std::vector<float>;
+	static const uint32_t kBorder = 2 * (1u << (kMaxIterations - 1)) + 8;
+
+	struct Illumination {
+		Plane red;
+		Plane green;
+		Plane blue;
+		// of red, green and blue, every tap of the next iteration compares it
+		Plane luminance;
+		Plane variance;
+
+		void resize(size_t size);
+	};
+
+	JobSystem *_jobs = &JobSystem::shared();
+	uint32_t _iterations = 5;
+	float _colorAlpha = 0.2f;
+	float _momentsAlpha = 0.2f;
+	bool _temporal = true;
+	float _lastReprojectedFraction = 0.0f;
+	uint32_t _width = 0;
+	uint32_t _height = 0;
+	size_t _stride = 0;
+
+	// this frame's features, depth 0 where nothing was hit, and the depth change to the next pixel
+	Plane _depths;
+	Plane _depthWidths;
+	Plane _normals[3];
+	Plane _positions[3];
+	// averaged over the history, the a-trous iterations ping pong between the two
+	Illumination _filtered[2];
+	Plane _moments[2];
+	Plane _historyLengths;
+	// the variance every tap's luminance weight uses, blurred over 3x3
+	Plane _centerVariance;
+
+	// the previous frame's, valid while _hasHistory
+	bool _hasHistory = false;
+	glm::mat4 _previousViewProjection = glm::mat4(1.0f);
+	Plane _previousColors[3];
+	Plane _previousMoments[2];
+	Plane _previousLengths;
+	Plane _previousNormals[3];
+	Plane _previousPositions[3];
+
+	size_t planeIndex(int x, int y) const { return (size_t)(y + (int)kBorder) * _stride + (size_t)(x + (int)kBorder); }
+	void resize(uint32_t width, uint32_t height);
+	void prepare(const glm::mat4& inverseViewProjection, const HdrImage& color, const FeatureBuffers& features);
+	void reproject(const FeatureBuffers& features);
+	void estimateSpatialVariance();
+	void filterVariance(const Illumination& source);
+	void filterIteration(const Illumination& source, Illumination& target, uint32_t step);
+};
@@ -0,0 +1,232 @@
+#include "display.hh"
+#include "lanes.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// rows per job of a full resolve
+static const size_t kRowGrain = 8;
+// AgX's log2 encoding spans these exposures around middle gray
+static const float kAgxMinimumEv = -12.47393f;
+static const float kAgxMaximumEv = 4.026069f;
+
+// row major, applied to rgb column vectors
+static const float kAcesInput[3][3] = {
+	{ 0.59719f, 0.35458f, 0.04823f },
+	{ 0.07600f, 0.90834f, 0.01566f },
+	{ 0.02840f, 0.13383f, 0.83777f },
+};
+static const float kAcesOutput[3][3] = {
+	{ 1.60475f, -0.53108f, -0.07367f },
+	{ -0.10208f, 1.10813f, -0.00605f },
+	{ -0.00327f, -0.07276f, 1.07602f },
+};
+static const float kAgxInset[3][3] = {
+	{ 0.842479062253094f, 0.0784335999999992f, 0.0792237451477643f },
+	{ 0.0423282422610123f, 0.878468636469772f, 0.0791661274605434f },
+	{ 0.0423756549057051f, 0.0784336f, 0.879142973793104f },
+};
+static const float kAgxOutset[3][3] = {
+	{ 1.19687900512017f, -0.0980208811401368f, -0.0990297440797205f },
+	{ -0.0528968517574562f, 1.15190312990417f, -0.0989611768448433f },
+	{ -0.0529716355144438f, -0.0980434501171241f, 1.15107367264116f },
+};
+
+// the same formulas for glm::vec3 and Vec3x8, only log2, pow and clamping differ
+template <typename Vector>
+static Vector multiply(const float matrix[3][3], const Vector& v) {
+	return Vector(v.x * matrix[0][0] + v.y * matrix[0][1] + v.z * matrix[0][2],
+		v.x * matrix[1][0] + v.y * matrix[1][1] + v.z * matrix[1][2],
+		v.x * matrix[2][0] + v.y * matrix[2][1] + v.z * matrix[2][2]);
+}
+
+template <typename Value>
+static Value acesCurve(Value v) {
+	Value a = v * (v + 0.0245786f) - 0.000090537f;
+	Value b = v * (v * 0.983729f + 0.4329510f) + 0.238081f;
+	return a / b;
+}
+
+template <typename Value>
+static Value agxContrast(Value x) {
+	Value x2 = x * x, x4 = x2 * x2;
+	return x4 * x2 * 15.5f - x4 * x * 40.14f + x4 * 31.96f - x2 * x * 6.868f + x2 * 0.4298f + x * 0.1191f - 0.00232f;
+}
+
+// log2 for x > 0 within about 2e-5: the exponent plus the atanh series of the mantissa in [1, 2)
+static Float8 log2Lanes(Float8 x) {
+	Float8 exponent, mantissa;
+#if defined(__AVX2__)
+	__m256i bits = _mm256_castps_si256(x.v);
+	exponent = Float8(_mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127))));
+	mantissa = Float8(_mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)),
+		_mm256_set1_epi32(0x3f800000))));
+#else
+	float values[8], exponents[8], mantissas[8];
+	x.store(values);
+	for (int lane = 0; lane < 8; ++lane) {
+		int e;
+		mantissas[lane] = 2.0f * std::frexp(values[lane], &e);
+		exponents[lane] = (float)(e - 1);
+	}
+	exponent = Float8::load(exponents);
+	mantissa = Float8::load(mantissas);
+#endif
+	Float8 t = (mantissa - 1.0f) / (mantissa + 1.0f), t2 = t * t;
+	return exponent + t * (2.8853901f + t2 * (0.9617967f + t2 * (0.5770780f + t2 * 0.4121986f)));
+}
+
+// 2^x within about 2e-5 relative: the Taylor polynomial of the fraction times the whole power from the bits
+static Float8 exp2Lanes(Float8 x) {
+	x = clamp(x, -126.0f, 126.0f);
+	Float8 whole = floor(x), f = x - whole;
+	Float8 fraction = 1.0f + f * (0.6931472f + f * (0.2402265f + f * (0.05550411f + f * (0.009618129f
+		+ f * (0.001333355f + f * 0.0001540353f)))));
+#if defined(__AVX2__)
+	Float8 scale(_mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(whole.v),
+		_mm256_set1_epi32(127)), 23)));
+#else
+	float wholes[8], scales[8];
+	whole.store(wholes);
+	for (int lane = 0; lane < 8; ++lane) {
+		scales[lane] = std::ldexp(1.0f, (int)wholes[lane]);
+	}
+	Float8 scale = Float8::load(scales);
+#endif
+	return fraction * scale;
+}
+
+static Float8 encodeSrgb(Float8 linear) {
+	Float8 x = clamp(linear, 0.0f, 1.0f);
+	Float8 curve = exp2Lanes(log2Lanes(max(x, 1e-30f)) * (1.0f / 2.4f)) * 1.055f - 0.055f;
+	return mix(x * 12.92f, curve, x > 0.0031308f);
+}
+
+static float encodeSrgb(float linear) {
+	float x = std::min(std::max(linear, 0.0f), 1.0f);
+	return x > 0.0031308f ? 1.055f * std::pow(x, 1.0f / 2.4f) - 0.055f : x * 12.92f;
+}
+
+void DisplayResolver::setJobSystem(JobSystem& jobs) {
+	_jobs = &jobs;
+}
+
+void DisplayResolver::setTonemap(Tonemap tonemap) {
+	_tonemap = tonemap;
+}
+
+void DisplayResolver::setExposure(float exposure) {
+	_exposure = exposure;
+}
+
+uint32_t DisplayResolver::resolvePixel(const glm::vec3& radiance) const {
+	glm::vec3 color = glm::max(radiance * _exposure, glm::vec3(0.0f));
+	if (_tonemap == Tonemap::Aces) {
+		color = multiply(kAcesInput, color);
+		color = glm::vec3(acesCurve(color.x), acesCurve(color.y), acesCurve(color.z));
+		color = multiply(kAcesOutput, color);
+	} else {
+		color = multiply(kAgxInset, color);
+		for (int i = 0; i < 3; ++i) {
+			float ev = std::min(std::max(std::log2(std::max(color[i], 1e-10f)), kAgxMinimumEv), kAgxMaximumEv);
+			color[i] = agxContrast((ev - kAgxMinimumEv) / (kAgxMaximumEv - kAgxMinimumEv));
+		}
+		// the curve's output is display encoded, back to linear for the sRGB transfer function
+		color = multiply(kAgxOutset, color);
+		for (int i = 0; i < 3; ++i) {
+			color[i] = std::pow(std::max(color[i], 0.0f), 2.2f);
+		}
+	}
+	uint32_t texel = 0xff000000u;
+	for (int i = 0; i < 3; ++i) {
+		texel |= (uint32_t)std::lround(encodeSrgb(color[i]) * 255.0f) << (8 * i);
+	}
+	return texel;
+}
+
+void DisplayResolver::resolveRow(const HdrImage& image, uint32_t y, uint32_t x0, uint32_t x1,
+	uint8_t *texels) const {
+	const glm::vec3 *row = &image.pixels[(size_t)y * image.width];
+	uint32_t *outputs = reinterpret_cast<uint32_t*>(texels) + (size_t)y * image.width;
+	for (uint32_t x = x0; x < x1; x += 8) {
+		uint32_t count = std::min(8u, x1 - x);
+		glm::vec3 padded[8];
+		const glm::vec3 *pixels = row + x;
+		if (count < 8) {
+			std::fill(std::copy(pixels, pixels + count, padded), padded + 8, glm::vec3(0.0f));
+			pixels = padded;
+		}
+		Vec3x8 color = Vec3x8::gather(pixels) * Float8(_exposure);
+		color = max(color, Vec3x8(0.0f));
+		if (_tonemap == Tonemap::Aces) {
+			color = multiply(kAcesInput, color);
+			color = Vec3x8(acesCurve(color.x), acesCurve(color.y), acesCurve(color.z));
+			color = multiply(kAcesOutput, color);
+		} else {
+			color = multiply(kAgxInset, color);
+			Float8 *channels[3] = { &color.x, &color.y, &color.z };
+			for (Float8 *channel : channels) {
+				Float8 ev = clamp(log2Lanes(max(*channel, 1e-10f)), kAgxMinimumEv, kAgxMaximumEv);
+				*channel = agxContrast((ev - kAgxMinimumEv) * (1.0f / (kAgxMaximumEv - kAgxMinimumEv)));
+			}
+			color = multiply(kAgxOutset, color);
+			for (Float8 *channel : channels) {
+				*channel = exp2Lanes(log2Lanes(max(*channel, 1e-30f)) * 2.2f);
+			}
+		}
+		Float8 red = encodeSrgb(color.x) * 255.0f + 0.5f;
+		Float8 green = encodeSrgb(color.y) * 255.0f + 0.5f;
+		Float8 blue = encodeSrgb(color.z) * 255.0f + 0.5f;
+		uint32_t packed[8];
+#if defined(__AVX2__)
+		// truncation after adding a half rounds like lround for the positive codes
+		__m256i texel = _mm256_or_si256(_mm256_cvttps_epi32(red.v), _mm256_set1_epi32((int)0xff000000u));
+		texel = _mm256_or_si256(texel, _mm256_slli_epi32(_mm256_cvttps_epi32(green.v), 8));
+		texel = _mm256_or_si256(texel, _mm256_slli_epi32(_mm256_cvttps_epi32(blue.v), 16));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(packed), texel);
+#else
+		float channels[3][8];
+		red.store(channels[0]);
+		green.store(channels[1]);
+		blue.store(channels[2]);
+		for (int lane = 0; lane < 8; ++lane) {
+			packed[lane] = 0xff000000u | (uint32_t)channels[0][lane] | (uint32_t)channels[1][lane] << 8
+				| (uint32_t)channels[2][lane] << 16;
+		}
+#endif
+		std::memcpy(outputs + x, packed, count * sizeof(uint32_t));
+	}
+}
+
+void DisplayResolver::resolve(const HdrImage& image, uint8_t *texels) const {
+	_jobs->parallelFor(image.height, kRowGrain, [&](size_t begin, size_t end) {
+		for (size_t y = begin; y < end; ++y) {
+			resolveRow(image, (uint32_t)y, 0, image.width, texels);
+		}
+	});
+}
+
+uint32_t DisplayResolver::resolve(const ProgressiveRenderer& progressive, uint8_t *texels, uint64_t& update) const {
+	const HdrImage& image = progressive.image();
+	std::vector<uint32_t> tiles;
+	for (uint32_t tile = 0; tile < progressive.tileCount(); ++tile) {
+		if (update == 0 || progressive.tileUpdate(tile) > update) {
+			tiles.push_back(tile);
+		}
+	}
+	const uint32_t tilesX = progressive.tilesX(), tileSize = PathTracer::kTileSize;
+	_jobs->parallelFor(tiles.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			uint32_t x0 = tiles[i] % tilesX * tileSize, y0 = tiles[i] / tilesX * tileSize;
+			uint32_t x1 = std::min(x0 + tileSize, image.width), y1 = std::min(y0 + tileSize, image.height);
+			for (uint32_t y = y0; y < y1; ++y) {
+				resolveRow(image, y, x0, x1, texels);
+			}
+		}
+	});
+	update = progressive.updateCount();
+	return (uint32_t)tiles.size();
+}
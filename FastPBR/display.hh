@@ -0,0 +1,43 @@
+#pragma once
+#include "jobs.hh"
+#include "progressive.hh"
+#include "renderer.hh"
+#include <cstdint>
+
+// Turns linear renders into what the screen shows: an exposure, a filmic tonemap and the sRGB transfer
+// function, packed into RGBA8 texels with rows top to bottom like an R8G8B8A8Unorm texture the launcher
+// uploads. Eight pixels go through at once, the logarithms and powers by their float bits.
+// A progressive renderer's running mean resolves tile by tile, only the tiles that took passes since the
+// texels last showed it, so converged tiles of adaptive sampling cost nothing.
+class DisplayResolver
+{
+public:
+	// ACES is Hill's fit of the RRT and ODT, AgX Sobotka's with Wrensch's polynomial for the contrast curve
+	enum class Tonemap { Aces, AgX };
+
+	// jobs of resolve(), the shared job system by default. it has to outlive the resolver's use of it
+	void setJobSystem(JobSystem& jobs);
+	// texels resolved before a change of either need resolving anew
+	void setTonemap(Tonemap tonemap);
+	Tonemap tonemap() const { return _tonemap; }
+	// radiance is scaled by this before the tonemap, 1 by default
+	void setExposure(float exposure);
+	float exposure() const { return _exposure; }
+
+	// every pixel, width * 4 bytes a row
+	void resolve(const HdrImage& image, uint8_t *texels) const;
+	// the tiles of the progressive renderer's image that changed after update, then update is its
+	// updateCount(). 0 resolves every tile. Returns the tiles resolved
+	uint32_t resolve(const ProgressiveRenderer& progressive, uint8_t *texels, uint64_t& update) const;
+
+	// one pixel by the standard library's log2 and pow, the reference the lanes match within a code
+	uint32_t resolvePixel(const glm::vec3& radiance) const;
+
+private:
+	JobSystem *_jobs = &JobSystem::shared();
+	Tonemap _tonemap = Tonemap::Aces;
+	float _exposure = 1.0f;
+
+	// pixels x0 to x1 of row y
+	void resolveRow(const HdrImage& image, uint32_t y, uint32_t x0, uint32_t x1, uint8_t *texels) const;
+};
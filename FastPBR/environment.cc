@@ -0,0 +1,154 @@
+#include "environment.hh"
+#include <stb/stb_image.h>
+#include <glm/gtc/constants.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+void EnvironmentMap::load(const std::string& filename, JobSystem& jobs) {
+	int width, height, channels;
+	float *pixels = stbi_loadf(filename.c_str(), &width, &height, &channels, STBI_rgb);
+	if (!pixels) {
+		throw std::runtime_error("failed to load environment map!");
+	}
+	HdrImage image;
+	image.resize((uint32_t)width, (uint32_t)height);
+	for (size_t i = 0; i < image.pixels.size(); ++i) {
+		image.pixels[i] = glm::vec3(pixels[i * 3], pixels[i * 3 + 1], pixels[i * 3 + 2]);
+	}
+	stbi_image_free(pixels);
+	setImage(image, jobs);
+}
+
+void EnvironmentMap::setImage(const HdrImage& image, JobSystem& jobs) {
+	auto startTime = std::chrono::high_resolution_clock::now();
+	_image = image;
+	const uint32_t width = _image.width, height = _image.height;
+	_columns.resize((size_t)width * height);
+	_texelProbabilities.resize((size_t)width * height);
+	std::vector<float> rowWeights(height);
+
+	// every row builds its own table from luminance times the sin theta of its solid angle
+	jobs.parallelFor(height, 16, [&](size_t begin, size_t end) {
+		std::vector<float> weights(width);
+		for (size_t y = begin; y < end; ++y) {
+			float sinTheta = std::sin(glm::pi<float>() * (y + 0.5f) / height);
+			float rowWeight = 0;
+			for (uint32_t x = 0; x < width; ++x) {
+				glm::vec3 color = glm::max(_image.at(x, (uint32_t)y), glm::vec3(0.0f));
+				weights[x] = (0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b) * sinTheta;
+				rowWeight += weights[x];
+			}
+			buildAliasTable(weights.data(), width, &_columns[y * width]);
+			for (uint32_t x = 0; x < width; ++x) {
+				_texelProbabilities[y * width + x] = rowWeight > 0.0f ? weights[x] / rowWeight : 1.0f / width;
+			}
+			rowWeights[y] = rowWeight;
+		}
+	});
+	_rows.resize(height);
+	buildAliasTable(rowWeights.data(), height, _rows.data());
+
+	double total = 0;
+	for (float weight : rowWeights) {
+		total += weight;
+	}
+	jobs.parallelFor(height, 16, [&](size_t begin, size_t end) {
+		for (size_t y = begin; y < end; ++y) {
+			float rowProbability = total > 0.0 ? (float)(rowWeights[y] / total) : 1.0f / height;
+			for (uint32_t x = 0; x < width; ++x) {
+				_texelProbabilities[y * width + x] *= rowProbability;
+			}
+		}
+	});
+	auto endTime = std::chrono::high_resolution_clock::now();
+	_lastBuildMilliseconds = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+}
+
+void EnvironmentMap::buildAliasTable(const float *weights, uint32_t count, AliasBin *bins) {
+	double total = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		total += weights[i];
+	}
+	if (!(total > 0.0)) {
+		for (uint32_t i = 0; i < count; ++i) {
+			bins[i] = { 1.0f, i };
+		}
+		return;
+	}
+	// scaled so the average bin holds exactly one, bins below it get topped up by ones above
+	std::vector<double> scaled(count);
+	std::vector<uint32_t> small, large;
+	for (uint32_t i = 0; i < count; ++i) {
+		scaled[i] = weights[i] * count / total;
+		(scaled[i] < 1.0 ? small : large).push_back(i);
+	}
+	while (!small.empty() && !large.empty()) {
+		uint32_t less = small.back(), more = large.back();
+		small.pop_back();
+		bins[less] = { (float)scaled[less], more };
+		scaled[more] -= 1.0 - scaled[less];
+		if (scaled[more] < 1.0) {
+			large.pop_back();
+			small.push_back(more);
+		}
+	}
+	// what is left is one up to rounding
+	for (uint32_t i : small) {
+		bins[i] = { 1.0f, i };
+	}
+	for (uint32_t i : large) {
+		bins[i] = { 1.0f, i };
+	}
+}
+
+uint32_t EnvironmentMap::sampleAliasTable(const AliasBin *bins, uint32_t count, float& u) {
+	float scaled = u * count;
+	uint32_t bin = std::min((uint32_t)scaled, count - 1);
+	float coin = scaled - bin;
+	const AliasBin& entry = bins[bin];
+	// kept below one, rounding could otherwise push the jittered direction into the next texel
+	const float kOneBelow = 0.99999994f;
+	if (coin < entry.probability) {
+		u = std::min(coin / entry.probability, kOneBelow);
+		return bin;
+	}
+	u = std::min((coin - entry.probability) / (1.0f - entry.probability), kOneBelow);
+	return entry.alias;
+}
+
+uint32_t EnvironmentMap::texelIndex(const glm::vec3& direction) const {
+	float phi = std::atan2(direction.z, direction.x);
+	float u = phi * glm::one_over_two_pi<float>() + (phi < 0.0f ? 1.0f : 0.0f);
+	float v = std::acos(glm::clamp(direction.y, -1.0f, 1.0f)) * glm::one_over_pi<float>();
+	uint32_t x = std::min((uint32_t)(u * _image.width), _image.width - 1);
+	uint32_t y = std::min((uint32_t)(v * _image.height), _image.height - 1);
+	return y * _image.width + x;
+}
+
+glm::vec3 EnvironmentMap::radiance(const glm::vec3& direction) const {
+	return _image.pixels[texelIndex(direction)];
+}
+
+glm::vec3 EnvironmentMap::sample(glm::vec2 u, float& pdf) const {
+	const uint32_t width = _image.width, height = _image.height;
+	uint32_t y = sampleAliasTable(_rows.data(), height, u.y);
+	uint32_t x = sampleAliasTable(&_columns[(size_t)y * width], width, u.x);
+	// uniform within the texel, which maps to solid angle with a factor of 2 pi^2 sin theta
+	float phi = (x + u.x) / width * glm::two_pi<float>();
+	float theta = (y + u.y) / height * glm::pi<float>();
+	float sinTheta = std::sin(theta);
+	pdf = sinTheta > 0.0f ? _texelProbabilities[(size_t)y * width + x] * width * height
+		/ (2.0f * glm::pi<float>() * glm::pi<float>() * sinTheta) : 0.0f;
+	return glm::vec3(sinTheta * std::cos(phi), std::cos(theta), sinTheta * std::sin(phi));
+}
+
+float EnvironmentMap::pdf(const glm::vec3& direction) const {
+	float sinTheta = std::sqrt(std::max(0.0f, 1.0f - direction.y * direction.y));
+	if (!(sinTheta > 0.0f)) {
+		return 0.0f;
+	}
+	return _texelProbabilities[texelIndex(direction)] * _image.width * _image.height
+		/ (2.0f * glm::pi<float>() * glm::pi<float>() * sinTheta);
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "jobs.hh"
+#include "renderer.hh"
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Equirectangular radiance around the scene, +y up, u turning from +x toward +z and v from the top.
+// Directions are importance sampled by texel luminance times sin theta through two levels of alias
+// tables, a marginal one over rows and one per row, so a sample costs two lookups whatever the size
+// and the rows are built in parallel.
+class EnvironmentMap
+{
+public:
+	// radiance .hdr or anything else stbi_loadf reads
+	void load(const std::string& filename, JobSystem& jobs = JobSystem::shared());
+	void setImage(const HdrImage& image, JobSystem& jobs = JobSystem::shared());
+
+	bool empty() const { return _image.pixels.empty(); }
+	const HdrImage& image() const { return _image; }
+	// constant over each texel, the same function the sampling distribution is built from
+	glm::vec3 radiance(const glm::vec3& direction) const;
+	// direction from two uniform numbers, with its pdf over solid angle
+	glm::vec3 sample(glm::vec2 u, float& pdf) const;
+	float pdf(const glm::vec3& direction) const;
+	double lastBuildMilliseconds() const { return _lastBuildMilliseconds; }
+
+private:
+	// Walker's alias method, bin i keeps its own index with the probability and gives the rest to alias
+	struct AliasBin {
+		float probability;
+		uint32_t alias;
+	};
+
+	// Vose's construction, linear in count
+	static void buildAliasTable(const float *weights, uint32_t count, AliasBin *bins);
+	// picks a bin with u and rescales u to a fresh uniform number within the choice
+	static uint32_t sampleAliasTable(const AliasBin *bins, uint32_t count, float& u);
+
+	uint32_t texelIndex(const glm::vec3& direction) const;
+
+	HdrImage _image;
+	std::vector<AliasBin> _rows;
+	// width bins per row
+	std::vector<AliasBin> _columns;
+	// sampling probability of every texel
+	std::vector<float> _texelProbabilities;
+	double _lastBuildMilliseconds = 0;
+};
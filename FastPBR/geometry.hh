@@ -17,4 +17,30 @@ struct UniformBufferObject {
 	glm::mat4 model;
 	glm::mat4 view;
 	glm::mat4 proj;
+};
+
+// push constants of shaders/basic.frag, positions and directions in world space
+struct MaterialConstants {
+	glm::vec4 baseColor;
+	glm::vec4 emissive;
+	// metallic, roughness
+	glm::vec4 parameters;
+	glm::vec4 cameraPosition;
+	// toward the light, w is its intensity
+	glm::vec4 lightDirection;
+};
+
+// push constants of shaders/cluster_cull.comp, everything in object space
+struct ClusterCullConstants {
+	glm::vec4 planes[6];
+	glm::vec4 cameraPosition;
+	// meshlet count and first meshlet of the selected lod
+	glm::uvec4 meshletRange;
+};
+
+// push constants of shaders/pathtrace.comp
+struct PathTraceConstants {
+	glm::mat4 inverseViewProjection;
+	// width, height, pass, max bounces
+	glm::uvec4 frame;
 };
\ No newline at end of file
@@ -0,0 +1,174 @@
+#include "jobs.hh"
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+// the slot of the running thread within the job system it works for
+thread_local const JobSystem *tlsJobSystem = nullptr;
+thread_local uint32_t tlsSlot = 0;
+// jobs waiting on nested jobs run them inside their own time, only the outermost job is timed
+thread_local uint32_t tlsJobDepth = 0;
+
+}
+
+JobSystem::JobSystem(uint32_t threadCount) {
+	if (threadCount == 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+	for (uint32_t i = 0; i < threadCount; ++i) {
+		_slots.emplace_back(new Slot());
+	}
+	// the thread calling wait() or parallelFor() is the last worker
+	for (uint32_t i = 1; i < threadCount; ++i) {
+		_workers.emplace_back(&JobSystem::workerLoop, this, i);
+	}
+}
+
+JobSystem::~JobSystem() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_wake.notify_all();
+	for (auto& worker : _workers) {
+		worker.join();
+	}
+}
+
+JobSystem& JobSystem::shared() {
+	static JobSystem jobSystem;
+	return jobSystem;
+}
+
+uint32_t JobSystem::threadCount() const {
+	return (uint32_t)_workers.size() + 1;
+}
+
+void JobSystem::submit(Job job, JobCounter& counter) {
+	counter.pending.fetch_add(1);
+	// workers keep their own jobs close, everything else is spread out
+	uint32_t slot = currentSlot();
+	if (slot == 0) {
+		slot = _nextSlot.fetch_add(1) % threadCount();
+	}
+	{
+		std::lock_guard<std::mutex> lock(_slots[slot]->mutex);
+		_slots[slot]->jobs.push_back({ std::move(job), &counter });
+	}
+	_queued.fetch_add(1);
+	// sleeping workers check _queued under the mutex, taking it here means none of them misses this job
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+	}
+	_wake.notify_one();
+}
+
+void JobSystem::wait(JobCounter& counter) {
+	uint32_t slot = currentSlot();
+	while (counter.pending.load() > 0) {
+		if (!tryRunJob(slot)) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+void JobSystem::parallelFor(size_t count, size_t grainSize, const RangeJob& body) {
+	if (count == 0) {
+		return;
+	}
+	grainSize = std::max<size_t>(1, grainSize);
+	// a few chunks per thread so uneven chunks still balance out
+	size_t chunkSize = std::max(grainSize, count / (threadCount() * 4));
+	if (chunkSize >= count) {
+		body(0, count);
+		return;
+	}
+
+	JobCounter counter;
+	for (size_t begin = 0; begin < count; begin += chunkSize) {
+		size_t end = std::min(count, begin + chunkSize);
+		submit([&body, begin, end]() { body(begin, end); }, counter);
+	}
+	wait(counter);
+}
+
+std::vector<JobSystem::ThreadStats> JobSystem::threadStats() const {
+	std::vector<ThreadStats> stats;
+	for (const auto& slot : _slots) {
+		stats.push_back({ slot->jobCount.load(), slot->stealCount.load(), slot->busyNanoseconds.load() / 1e6 });
+	}
+	return stats;
+}
+
+void JobSystem::resetThreadStats() {
+	for (auto& slot : _slots) {
+		slot->jobCount = 0;
+		slot->stealCount = 0;
+		slot->busyNanoseconds = 0;
+	}
+}
+
+uint32_t JobSystem::currentSlot() const {
+	// threads of other job systems count as outside callers
+	return tlsJobSystem == this ? tlsSlot : 0;
+}
+
+bool JobSystem::tryRunJob(uint32_t slot) {
+	QueuedJob queued;
+	bool found = false;
+	{
+		Slot& own = *_slots[slot];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.jobs.empty()) {
+			queued = std::move(own.jobs.back());
+			own.jobs.pop_back();
+			found = true;
+		}
+	}
+	// the victims are visited from the next slot on, so thieves don't all line up at the same one
+	for (uint32_t i = 1; i < threadCount() && !found; ++i) {
+		Slot& victim = *_slots[(slot + i) % threadCount()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.jobs.empty()) {
+			queued = std::move(victim.jobs.front());
+			victim.jobs.pop_front();
+			found = true;
+			_slots[slot]->stealCount.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	if (!found) {
+		return false;
+	}
+	_queued.fetch_sub(1);
+
+	auto startTime = std::chrono::high_resolution_clock::now();
+	++tlsJobDepth;
+	queued.job();
+	--tlsJobDepth;
+	Slot& own = *_slots[slot];
+	own.jobCount.fetch_add(1, std::memory_order_relaxed);
+	if (tlsJobDepth == 0) {
+		auto endTime = std::chrono::high_resolution_clock::now();
+		own.busyNanoseconds.fetch_add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			endTime - startTime).count(), std::memory_order_relaxed);
+	}
+	queued.counter->pending.fetch_sub(1);
+	return true;
+}
+
+void JobSystem::workerLoop(uint32_t slot) {
+	tlsJobSystem = this;
+	tlsSlot = slot;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [this]() { return _stopping || _queued.load() > 0; });
+			if (_stopping && _queued.load() == 0) {
+				return;
+			}
+		}
+		while (tryRunJob(slot)) {
+		}
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// counts outstanding jobs of one batch, wait on it with JobSystem::wait
+struct JobCounter {
+	std::atomic<uint32_t> pending{ 0 };
+};
+
+// Work stealing: every thread owns a deque, runs its own jobs newest first and steals the oldest job
+// of another thread when it runs dry. Jobs submitted from outside the workers, like parallelFor's
+// chunks, are dealt round robin over the deques. Slot 0 is the thread calling wait() or
+// parallelFor(), the workers are slots 1 and up.
+class JobSystem
+{
+public:
+	using Job = std::function<void()>;
+	using RangeJob = std::function<void(size_t begin, size_t end)>;
+
+	struct ThreadStats {
+		uint64_t jobs;
+		// jobs taken from another thread's deque
+		uint64_t steals;
+		double busyMilliseconds;
+	};
+
+	// threadCount includes the calling thread, 0 picks one per hardware thread
+	explicit JobSystem(uint32_t threadCount = 0);
+	~JobSystem();
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	static JobSystem& shared();
+
+	uint32_t threadCount() const;
+	void submit(Job job, JobCounter& counter);
+	// the waiting thread keeps running queued jobs, so nested submits can't deadlock
+	void wait(JobCounter& counter);
+	// splits [0, count) into chunks of at least grainSize and blocks until all ran
+	void parallelFor(size_t count, size_t grainSize, const RangeJob& body);
+
+	// per slot since the last reset, utilization is busy time over the wall time measured outside
+	std::vector<ThreadStats> threadStats() const;
+	void resetThreadStats();
+
+private:
+	struct QueuedJob {
+		Job job;
+		JobCounter *counter;
+	};
+
+	// one cache line per slot so owners and thieves of different slots don't share lines
+	struct alignas(64) Slot {
+		std::mutex mutex;
+		std::deque<QueuedJob> jobs;
+		std::atomic<uint64_t> jobCount{ 0 };
+		std::atomic<uint64_t> stealCount{ 0 };
+		std::atomic<uint64_t> busyNanoseconds{ 0 };
+	};
+
+	std::vector<std::thread> _workers;
+	std::vector<std::unique_ptr<Slot>> _slots;
+	// may dip below zero for a moment when a job is taken before its submit counted it
+	std::atomic<int32_t> _queued{ 0 };
+	std::atomic<uint32_t> _nextSlot{ 0 };
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::atomic<bool> _stopping{ false };
+
+	uint32_t currentSlot() const;
+	bool tryRunJob(uint32_t slot);
+	void workerLoop(uint32_t slot);
+};
@@ -1,122 +1,213 @@
-
 #include "cuda_runtime.h"
 #include "device_launch_parameters.h"
 
-#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
 #include "kernel.h"
 
-cudaError_t addWithCuda(int *c, const int *a, const int *b, unsigned int size);
+static const uint32_t kBlockSize = 256;
 
-__global__ void addKernel(int *c, const int *a, const int *b)
-{
-    int i = threadIdx.x;
-    c[i] = a[i] + b[i];
+static void check(cudaError_t status, const char *call) {
+	if (status != cudaSuccess) {
+		throw std::runtime_error(std::string(call) + " failed: " + cudaGetErrorString(status) + "!");
+	}
 }
 
-int adder()
-{
-    const int arraySize = 5;
-    const int a[arraySize] = { 1, 2, 3, 4, 5 };
-    const int b[arraySize] = { 10, 20, 30, 40, 50 };
-    int c[arraySize] = { 0 };
-
-    // Add vectors in parallel.
-    cudaError_t cudaStatus = addWithCuda(c, a, b, arraySize);
-    if (cudaStatus != cudaSuccess) {
-        fprintf(stderr, "addWithCuda failed!");
-        return 1;
-    }
-
-    printf("{1,2,3,4,5} + {10,20,30,40,50} = {%d,%d,%d,%d,%d}\n",
-        c[0], c[1], c[2], c[3], c[4]);
-
-    // cudaDeviceReset must be called before exiting in order for profiling and
-    // tracing tools such as Nsight and Visual Profiler to show complete traces.
-    cudaStatus = cudaDeviceReset();
-    if (cudaStatus != cudaSuccess) {
-        fprintf(stderr, "cudaDeviceReset failed!");
-        return 1;
-    }
-
-    return 0;
+__global__ void addKernel(int32_t *c, const int32_t *a, const int32_t *b, uint32_t count) {
+	uint32_t i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i < count) {
+		c[i] = a[i] + b[i];
+	}
+}
+
+__global__ void saxpyKernel(const float *x, float *y, ComputeSaxpyConstants constants, uint32_t count) {
+	uint32_t i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i < count) {
+		y[i] = constants.alpha * x[i] + y[i];
+	}
 }
 
-// Helper function for using CUDA to add vectors in parallel.
-cudaError_t addWithCuda(int *c, const int *a, const int *b, unsigned int size)
+__global__ void hashKernel(uint32_t *values, ComputeHashConstants constants, uint32_t count) {
+	uint32_t i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i < count) {
+		uint32_t value = values[i];
+		for (uint32_t round = 0; round < constants.rounds; ++round) {
+			value = computeHash(value);
+		}
+		values[i] = value;
+	}
+}
+
+static uint32_t blocks(uint32_t count) {
+	return (count + kBlockSize - 1) / kBlockSize;
+}
+
+void launchAddCuda(void *const *buffers, const void *constants, uint32_t count, void *stream) {
+	addKernel<<<blocks(count), kBlockSize, 0, (cudaStream_t)stream>>>(static_cast<int32_t*>(buffers[2]),
+		static_cast<const int32_t*>(buffers[0]), static_cast<const int32_t*>(buffers[1]), count);
+}
+
+void launchSaxpyCuda(void *const *buffers, const void *constants, uint32_t count, void *stream) {
+	saxpyKernel<<<blocks(count), kBlockSize, 0, (cudaStream_t)stream>>>(static_cast<const float*>(buffers[0]),
+		static_cast<float*>(buffers[1]), *static_cast<const ComputeSaxpyConstants*>(constants), count);
+}
+
+void launchHashCuda(void *const *buffers, const void *constants, uint32_t count, void *stream) {
+	hashKernel<<<blocks(count), kBlockSize, 0, (cudaStream_t)stream>>>(static_cast<uint32_t*>(buffers[0]),
+		*static_cast<const ComputeHashConstants*>(constants), count);
+}
+
+namespace {
+
+// Queues are non-blocking streams and events cuda events, so the rules of compute.hh are cuda's own.
+// Copies only run asynchronously to the host and alongside kernels from pinned memory, allocateHost()'s.
+class CudaComputeBackend : public ComputeBackend
 {
-    int *dev_a = 0;
-    int *dev_b = 0;
-    int *dev_c = 0;
-    cudaError_t cudaStatus;
-
-    // Choose which GPU to run on, change this on a multi-GPU system.
-    cudaStatus = cudaSetDevice(0);
-    if (cudaStatus != cudaSuccess) {
-        fprintf(stderr, "cudaSetDevice failed!  Do you have a CUDA-capable GPU installed?");
-        goto Error;
-    }
-
-    // Allocate GPU buffers for three vectors (two input, one output)    .
-    cudaStatus = cudaMalloc((void**)&dev_c, size * sizeof(int));
-    if (cudaStatus != cudaSuccess) {
-        fprintf(stderr, "cudaMalloc failed!");
-        goto Error;
-    }
-
-    cudaStatus = cudaMalloc((void**)&dev_a, size * sizeof(int));
-    if (cudaStatus != cudaSuccess) {
-        fprintf(stderr, "cudaMalloc failed!");
-        goto Error;
-    }
-
-    cudaStatus = cudaMalloc((void**)&dev_b, size * sizeof(int));
-    if (cudaStatus != cudaSuccess) {
-        fprintf(stderr, "cudaMalloc failed!");
-        goto Error;
-    }
-
-    // Copy input vectors from host memory to GPU buffers.
-    cudaStatus = cudaMemcpy(dev_a, a, size * sizeof(int), cudaMemcpyHostToDevice);
-    if (cudaStatus != cudaSuccess) {
-        fprintf(stderr, "cudaMemcpy failed!");
-        goto Error;
-    }
-
-    cudaStatus = cudaMemcpy(dev_b, b, size * sizeof(int), cudaMemcpyHostToDevice);
-    if (cudaStatus != cudaSuccess) {
-        fprintf(stderr, "cudaMemcpy failed!");
-        goto Error;
-    }
-
-    // Launch a kernel on the GPU with one thread for each element.
-    addKernel<<<1, size>>>(dev_c, dev_a, dev_b);
-
-    // Check for any errors launching the kernel
-    cudaStatus = cudaGetLastError();
-    if (cudaStatus != cudaSuccess) {
-        fprintf(stderr, "addKernel launch failed: %s\n", cudaGetErrorString(cudaStatus));
-        goto Error;
-    }
-    
-    // cudaDeviceSynchronize waits for the kernel to finish, and returns
-    // any errors encountered during the launch.
-    cudaStatus = cudaDeviceSynchronize();
-    if (cudaStatus != cudaSuccess) {
-        fprintf(stderr, "cudaDeviceSynchronize returned error code %d after launching addKernel!\n", cudaStatus);
-        goto Error;
-    }
-
-    // Copy output vector from GPU buffer to host memory.
-    cudaStatus = cudaMemcpy(c, dev_c, size * sizeof(int), cudaMemcpyDeviceToHost);
-    if (cudaStatus != cudaSuccess) {
-        fprintf(stderr, "cudaMemcpy failed!");
-        goto Error;
-    }
-
-Error:
-    cudaFree(dev_c);
-    cudaFree(dev_a);
-    cudaFree(dev_b);
-    
-    return cudaStatus;
+public:
+	CudaComputeBackend() {
+		int devices = 0;
+		check(cudaGetDeviceCount(&devices), "cudaGetDeviceCount");
+		if (devices == 0) {
+			throw std::runtime_error("failed to find a cuda device!");
+		}
+		check(cudaSetDevice(0), "cudaSetDevice");
+		cudaDeviceProp properties;
+		check(cudaGetDeviceProperties(&properties, 0), "cudaGetDeviceProperties");
+		_name = properties.name;
+	}
+
+	~CudaComputeBackend() override {
+		cudaDeviceSynchronize();
+		for (cudaEvent_t event : _events) {
+			cudaEventDestroy(event);
+		}
+		for (cudaStream_t stream : _streams) {
+			cudaStreamDestroy(stream);
+		}
+		for (const Buffer& buffer : _buffers) {
+			cudaFree(buffer.memory);
+		}
+	}
+
+	Type type() const override { return Type::Cuda; }
+	const char *name() const override { return _name.c_str(); }
+
+	void *allocateHost(size_t size) override {
+		void *memory = nullptr;
+		check(cudaMallocHost(&memory, size), "cudaMallocHost");
+		return memory;
+	}
+
+	void freeHost(void *memory) override {
+		check(cudaFreeHost(memory), "cudaFreeHost");
+	}
+
+	ComputeBuffer createBuffer(size_t size) override {
+		Buffer buffer = { nullptr, size };
+		check(cudaMalloc(&buffer.memory, std::max<size_t>(size, 1)), "cudaMalloc");
+		_buffers.push_back(buffer);
+		return (ComputeBuffer)_buffers.size() - 1;
+	}
+
+	void destroyBuffer(ComputeBuffer buffer) override {
+		Buffer& target = _buffers.at(buffer);
+		check(cudaFree(target.memory), "cudaFree");
+		target = { nullptr, 0 };
+	}
+
+	ComputeKernel createKernel(const ComputeKernelSource& source) override {
+		if (!source.cuda) {
+			throw std::runtime_error(std::string("compute kernel ") + source.name + " has no cuda form!");
+		}
+		_kernels.push_back(source.cuda);
+		return (ComputeKernel)_kernels.size() - 1;
+	}
+
+	ComputeQueue createQueue() override {
+		cudaStream_t stream;
+		check(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking), "cudaStreamCreateWithFlags");
+		_streams.push_back(stream);
+		return (ComputeQueue)_streams.size() - 1;
+	}
+
+	ComputeEvent createEvent() override {
+		cudaEvent_t event;
+		check(cudaEventCreateWithFlags(&event, cudaEventDisableTiming), "cudaEventCreateWithFlags");
+		_events.push_back(event);
+		return (ComputeEvent)_events.size() - 1;
+	}
+
+	void upload(ComputeQueue queue, ComputeBuffer buffer, size_t offset, const void *source, size_t size) override {
+		check(cudaMemcpyAsync(bufferRange(buffer, offset, size), source, size, cudaMemcpyHostToDevice,
+			_streams.at(queue)), "cudaMemcpyAsync");
+	}
+
+	void download(ComputeQueue queue, ComputeBuffer buffer, size_t offset, void *target, size_t size) override {
+		check(cudaMemcpyAsync(target, bufferRange(buffer, offset, size), size, cudaMemcpyDeviceToHost,
+			_streams.at(queue)), "cudaMemcpyAsync");
+	}
+
+	void launch(ComputeQueue queue, ComputeKernel kernel, uint32_t count, const ComputeArguments& arguments) override {
+		if (count == 0) {
+			return;
+		}
+		void *buffers[ComputeArguments::kMaxBuffers] = {};
+		for (uint32_t i = 0; i < arguments.bufferCount; ++i) {
+			buffers[i] = _buffers.at(arguments.buffers[i]).memory;
+		}
+		_kernels.at(kernel)(buffers, arguments.constants, count, _streams.at(queue));
+		check(cudaGetLastError(), "kernel launch");
+	}
+
+	void record(ComputeQueue queue, ComputeEvent event) override {
+		check(cudaEventRecord(_events.at(event), _streams.at(queue)), "cudaEventRecord");
+	}
+
+	void wait(ComputeQueue queue, ComputeEvent event) override {
+		check(cudaStreamWaitEvent(_streams.at(queue), _events.at(event), 0), "cudaStreamWaitEvent");
+	}
+
+	void synchronize(ComputeEvent event) override {
+		check(cudaEventSynchronize(_events.at(event)), "cudaEventSynchronize");
+	}
+
+	bool complete(ComputeEvent event) override {
+		cudaError_t status = cudaEventQuery(_events.at(event));
+		if (status == cudaErrorNotReady) {
+			return false;
+		}
+		check(status, "cudaEventQuery");
+		return true;
+	}
+
+	void finish(ComputeQueue queue) override {
+		check(cudaStreamSynchronize(_streams.at(queue)), "cudaStreamSynchronize");
+	}
+
+private:
+	struct Buffer {
+		void *memory;
+		size_t size;
+	};
+
+	std::string _name;
+	std::vector<Buffer> _buffers;
+	std::vector<ComputeCudaKernel> _kernels;
+	std::vector<cudaStream_t> _streams;
+	std::vector<cudaEvent_t> _events;
+
+	uint8_t *bufferRange(ComputeBuffer buffer, size_t offset, size_t size) {
+		const Buffer& memory = _buffers.at(buffer);
+		if (offset > memory.size || size > memory.size - offset) {
+			throw std::runtime_error("compute copy out of the buffer's range!");
+		}
+		return static_cast<uint8_t*>(memory.memory) + offset;
+	}
+};
+
+}
+
+std::unique_ptr<ComputeBackend> createCudaComputeBackend() {
+	return std::unique_ptr<ComputeBackend>(new CudaComputeBackend());
 }
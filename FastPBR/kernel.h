@@ -1,2 +1,10 @@
 #pragma once
-int adder();
\ No newline at end of file
+#include "compute.hh"
+
+// the cuda backend of compute.hh, built with FASTPBR_CUDA
+std::unique_ptr<ComputeBackend> createCudaComputeBackend();
+
+// the cuda forms of compute.hh's kernels, see ComputeCudaKernel
+void launchAddCuda(void *const *buffers, const void *constants, uint32_t count, void *stream);
+void launchSaxpyCuda(void *const *buffers, const void *constants, uint32_t count, void *stream);
+void launchHashCuda(void *const *buffers, const void *constants, uint32_t count, void *stream);
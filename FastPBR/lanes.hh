@@ -0,0 +1,214 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cmath>
+#include <cstdint>
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// Eight floats worked on together, with the operators and GLSL built ins that shared shader sources
+// need to run over lanes instead of scalars, see bsdf.hh. AVX when the build has it, otherwise plain
+// loops over the lanes.
+
+#if defined(__AVX__)
+
+struct Mask8 {
+	__m256 v;
+};
+
+struct Float8 {
+	__m256 v;
+
+	Float8() : v(_mm256_setzero_ps()) {}
+	Float8(float value) : v(_mm256_set1_ps(value)) {}
+	explicit Float8(__m256 value) : v(value) {}
+
+	static Float8 load(const float *values) { return Float8(_mm256_loadu_ps(values)); }
+	void store(float *values) const { _mm256_storeu_ps(values, v); }
+};
+
+inline Float8 operator+(Float8 a, Float8 b) { return Float8(_mm256_add_ps(a.v, b.v)); }
+inline Float8 operator-(Float8 a, Float8 b) { return Float8(_mm256_sub_ps(a.v, b.v)); }
+inline Float8 operator*(Float8 a, Float8 b) { return Float8(_mm256_mul_ps(a.v, b.v)); }
+inline Float8 operator/(Float8 a, Float8 b) { return Float8(_mm256_div_ps(a.v, b.v)); }
+inline Float8 operator-(Float8 a) { return Float8(_mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f))); }
+inline Mask8 operator<(Float8 a, Float8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+inline Mask8 operator<=(Float8 a, Float8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+inline Mask8 operator>(Float8 a, Float8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+inline Mask8 operator>=(Float8 a, Float8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+inline Mask8 operator&&(Mask8 a, Mask8 b) { return { _mm256_and_ps(a.v, b.v) }; }
+inline Mask8 operator||(Mask8 a, Mask8 b) { return { _mm256_or_ps(a.v, b.v) }; }
+
+inline Float8 sqrt(Float8 a) { return Float8(_mm256_sqrt_ps(a.v)); }
+// a full division, the rsqrt estimate alone is too coarse for normalizing
+inline Float8 inversesqrt(Float8 a) { return Float8(_mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(a.v))); }
+inline Float8 min(Float8 a, Float8 b) { return Float8(_mm256_min_ps(a.v, b.v)); }
+inline Float8 max(Float8 a, Float8 b) { return Float8(_mm256_max_ps(a.v, b.v)); }
+inline Float8 abs(Float8 a) { return Float8(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)); }
+inline Float8 floor(Float8 a) { return Float8(_mm256_floor_ps(a.v)); }
+// b where the mask is set, a elsewhere, like GLSL's mix with a bool
+inline Float8 mix(Float8 a, Float8 b, Mask8 mask) { return Float8(_mm256_blendv_ps(a.v, b.v, mask.v)); }
+inline bool any(Mask8 mask) { return _mm256_movemask_ps(mask.v) != 0; }
+
+#else
+
+struct Mask8 {
+	bool v[8];
+};
+
+struct Float8 {
+	float v[8];
+
+	Float8() : v() {}
+	Float8(float value) {
+		for (float& lane : v) {
+			lane = value;
+		}
+	}
+
+	static Float8 load(const float *values) {
+		Float8 result;
+		for (int i = 0; i < 8; ++i) {
+			result.v[i] = values[i];
+		}
+		return result;
+	}
+	void store(float *values) const {
+		for (int i = 0; i < 8; ++i) {
+			values[i] = v[i];
+		}
+	}
+};
+
+template <typename Function>
+inline Float8 mapLanes(Float8 a, Float8 b, Function function) {
+	Float8 result;
+	for (int i = 0; i < 8; ++i) {
+		result.v[i] = function(a.v[i], b.v[i]);
+	}
+	return result;
+}
+
+template <typename Function>
+inline Mask8 compareLanes(Float8 a, Float8 b, Function function) {
+	Mask8 result;
+	for (int i = 0; i < 8; ++i) {
+		result.v[i] = function(a.v[i], b.v[i]);
+	}
+	return result;
+}
+
+inline Float8 operator+(Float8 a, Float8 b) { return mapLanes(a, b, [](float x, float y) { return x + y; }); }
+inline Float8 operator-(Float8 a, Float8 b) { return mapLanes(a, b, [](float x, float y) { return x - y; }); }
+inline Float8 operator*(Float8 a, Float8 b) { return mapLanes(a, b, [](float x, float y) { return x * y; }); }
+inline Float8 operator/(Float8 a, Float8 b) { return mapLanes(a, b, [](float x, float y) { return x / y; }); }
+inline Float8 operator-(Float8 a) { return mapLanes(a, a, [](float x, float) { return -x; }); }
+inline Mask8 operator<(Float8 a, Float8 b) { return compareLanes(a, b, [](float x, float y) { return x < y; }); }
+inline Mask8 operator<=(Float8 a, Float8 b) { return compareLanes(a, b, [](float x, float y) { return x <= y; }); }
+inline Mask8 operator>(Float8 a, Float8 b) { return compareLanes(a, b, [](float x, float y) { return x > y; }); }
+inline Mask8 operator>=(Float8 a, Float8 b) { return compareLanes(a, b, [](float x, float y) { return x >= y; }); }
+inline Mask8 operator&&(Mask8 a, Mask8 b) {
+	for (int i = 0; i < 8; ++i) {
+		a.v[i] = a.v[i] && b.v[i];
+	}
+	return a;
+}
+inline Mask8 operator||(Mask8 a, Mask8 b) {
+	for (int i = 0; i < 8; ++i) {
+		a.v[i] = a.v[i] || b.v[i];
+	}
+	return a;
+}
+
+inline Float8 sqrt(Float8 a) { return mapLanes(a, a, [](float x, float) { return std::sqrt(x); }); }
+inline Float8 inversesqrt(Float8 a) { return mapLanes(a, a, [](float x, float) { return 1.0f / std::sqrt(x); }); }
+inline Float8 min(Float8 a, Float8 b) { return mapLanes(a, b, [](float x, float y) { return y < x ? y : x; }); }
+inline Float8 max(Float8 a, Float8 b) { return mapLanes(a, b, [](float x, float y) { return x < y ? y : x; }); }
+inline Float8 abs(Float8 a) { return mapLanes(a, a, [](float x, float) { return std::fabs(x); }); }
+inline Float8 floor(Float8 a) { return mapLanes(a, a, [](float x, float) { return std::floor(x); }); }
+inline Float8 mix(Float8 a, Float8 b, Mask8 mask) {
+	for (int i = 0; i < 8; ++i) {
+		a.v[i] = mask.v[i] ? b.v[i] : a.v[i];
+	}
+	return a;
+}
+inline bool any(Mask8 mask) {
+	bool result = false;
+	for (bool lane : mask.v) {
+		result |= lane;
+	}
+	return result;
+}
+
+#endif
+
+inline Float8 clamp(Float8 a, Float8 low, Float8 high) { return min(max(a, low), high); }
+inline Float8 mix(Float8 a, Float8 b, Float8 t) { return a + (b - a) * t; }
+
+// odd polynomial on [-pi/2, pi/2] after folding, about 1e-7 absolute error
+inline Float8 sin(Float8 a) {
+	const float kTwoPi = 6.28318530718f, kPi = 3.14159265359f, kHalfPi = 1.57079632679f;
+	Float8 x = a - floor(a * (1.0f / kTwoPi) + 0.5f) * kTwoPi;
+	x = mix(x, kPi - x, x > kHalfPi);
+	x = mix(x, -kPi - x, x < -kHalfPi);
+	Float8 x2 = x * x;
+	return x * (1.0f + x2 * (-1.0f / 6.0f + x2 * (1.0f / 120.0f + x2 * (-1.0f / 5040.0f + x2 * (1.0f / 362880.0f
+		+ x2 * (-1.0f / 39916800.0f))))));
+}
+
+inline Float8 cos(Float8 a) { return sin(a + 1.57079632679f); }
+
+// the value of one lane, for scalar follow up work
+inline float lane(Float8 a, int i) {
+	float values[8];
+	a.store(values);
+	return values[i];
+}
+
+struct Vec3x8 {
+	Float8 x, y, z;
+
+	Vec3x8() {}
+	Vec3x8(Float8 value) : x(value), y(value), z(value) {}
+	Vec3x8(Float8 x, Float8 y, Float8 z) : x(x), y(y), z(z) {}
+
+	// lane i holds vectors[i]
+	static Vec3x8 gather(const glm::vec3 *vectors) {
+		float lanes[3][8];
+		for (int i = 0; i < 8; ++i) {
+			lanes[0][i] = vectors[i].x;
+			lanes[1][i] = vectors[i].y;
+			lanes[2][i] = vectors[i].z;
+		}
+		return Vec3x8(Float8::load(lanes[0]), Float8::load(lanes[1]), Float8::load(lanes[2]));
+	}
+	void scatter(glm::vec3 *vectors) const {
+		float lanes[3][8];
+		x.store(lanes[0]);
+		y.store(lanes[1]);
+		z.store(lanes[2]);
+		for (int i = 0; i < 8; ++i) {
+			vectors[i] = glm::vec3(lanes[0][i], lanes[1][i], lanes[2][i]);
+		}
+	}
+};
+
+inline Vec3x8 operator+(const Vec3x8& a, const Vec3x8& b) { return Vec3x8(a.x + b.x, a.y + b.y, a.z + b.z); }
+inline Vec3x8 operator-(const Vec3x8& a, const Vec3x8& b) { return Vec3x8(a.x - b.x, a.y - b.y, a.z - b.z); }
+inline Vec3x8 operator*(const Vec3x8& a, const Vec3x8& b) { return Vec3x8(a.x * b.x, a.y * b.y, a.z * b.z); }
+inline Vec3x8 operator/(const Vec3x8& a, const Vec3x8& b) { return Vec3x8(a.x / b.x, a.y / b.y, a.z / b.z); }
+inline Vec3x8 operator*(const Vec3x8& a, Float8 b) { return Vec3x8(a.x * b, a.y * b, a.z * b); }
+inline Vec3x8 operator*(Float8 a, const Vec3x8& b) { return Vec3x8(a * b.x, a * b.y, a * b.z); }
+inline Vec3x8 operator/(const Vec3x8& a, Float8 b) { return a * (1.0f / b); }
+inline Vec3x8 operator-(const Vec3x8& a) { return Vec3x8(-a.x, -a.y, -a.z); }
+
+inline Float8 dot(const Vec3x8& a, const Vec3x8& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline Vec3x8 normalize(const Vec3x8& a) { return a * inversesqrt(dot(a, a)); }
+inline Vec3x8 cross(const Vec3x8& a, const Vec3x8& b) {
+	return Vec3x8(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+inline Vec3x8 max(const Vec3x8& a, const Vec3x8& b) { return Vec3x8(max(a.x, b.x), max(a.y, b.y), max(a.z, b.z)); }
+inline Vec3x8 mix(const Vec3x8& a, const Vec3x8& b, Float8 t) { return a + (b - a) * t; }
+inline Vec3x8 mix(const Vec3x8& a, const Vec3x8& b, Mask8 mask) {
+	return Vec3x8(mix(a.x, b.x, mask), mix(a.y, b.y, mask), mix(a.z, b.z, mask));
+}
@@ -1,18 +1,42 @@
 #include "launcher.hh"
-#include "kernel.h"
+#include "benchmark.hh"
+#include "computescene.hh"
+#include "renderer.hh"
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 
-int main() {
-	Launcher app = Launcher(1280, 720);
+int main(int argc, char **argv) {
+	if (argc >= 3 && std::strcmp(argv[1], "--bench") == 0) {
+		return runBenchmark(argv[2], argc >= 4 ? std::strtoull(argv[3], nullptr, 10) : 0);
+	}
+	if (argc >= 4 && std::strcmp(argv[1], "--render") == 0) {
+		return renderReference(argv[2], argv[3], argc >= 5 ? (uint32_t)std::strtoul(argv[4], nullptr, 10) : 0,
+			argc >= 6 ? argv[5] : nullptr);
+	}
+	if (argc >= 2 && std::strcmp(argv[1], "--trace") == 0) {
+		Launcher app = Launcher(1280, 720, argc >= 3 ? argv[2] : "", Launcher::View::PathTraced);
+		app.launch();
+		return 0;
+	}
+	if (argc >= 2 && std::strcmp(argv[1], "--gpu-trace") == 0) {
+		Launcher app = Launcher(1280, 720, argc >= 3 ? argv[2] : "", Launcher::View::ComputePathTraced);
+		app.launch();
+		return 0;
+	}
+	Launcher app = Launcher(1280, 720, argc >= 2 ? argv[1] : "");
 	app.launch();
 	return 0;
 }
 
-Launcher::Launcher(int width, int height) {
+Launcher::Launcher(int width, int height, const std::string& scenePath, View view) {
 	_size.width = width;
 	_size.height = height;
+	_scenePath = scenePath;
+	_view = view;
 }
 
 void Launcher::launch() {
@@ -91,12 +115,16 @@ int Launcher::initializeVulkan() {
 	queueCreateInfo[1].queueFamilyIndex = _presentFamilyIndex;
 	queueCreateInfo[1].queueCount = 1;
 	queueCreateInfo[1].pQueuePriorities = &queuePriority;
+	// a family can only be asked for once, software devices like lavapipe have a single one for everything
+	if (_presentFamilyIndex == _graphicsFamilyIndex) {
+		queueCreateInfo.pop_back();
+	}
 	vk::PhysicalDeviceFeatures deviceFeatures = {};
 	deviceFeatures.samplerAnisotropy = true;
 
 	vk::DeviceCreateInfo deviceCreateInfo = {};
 	deviceCreateInfo.pQueueCreateInfos = queueCreateInfo.data();
-	deviceCreateInfo.queueCreateInfoCount = 2;
+	deviceCreateInfo.queueCreateInfoCount = (uint32_t)queueCreateInfo.size();
 	deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
 	deviceCreateInfo.enabledExtensionCount = _deviceExtensions.size();
 	deviceCreateInfo.ppEnabledExtensionNames = _deviceExtensions.data();
@@ -113,16 +141,32 @@ int Launcher::initializeVulkan() {
 	createRenderPass();
 	createDescriptorSetLayout();
 	createGraphicsPipeline();
+	if (_view != View::Rasterized) {
+		createDisplayPipeline();
+	}
+	createClusterCullPipeline();
 	createFramebuffers();
 	createCommandPool();
-	loadToTextureImage();
+	loadScene();
+	if (_view == View::PathTraced) {
+		createDisplayTexture();
+	} else if (_view == View::ComputePathTraced) {
+		createPathTraceResources();
+		createPathTracePipeline();
+	} else {
+		loadToTextureImage();
+	}
 	createTextureImageView();
 	createTextureSampler();
 	createVertexBuffer();
-	createIndexBuffer();
+	createClusterBuffers();
 	createUniformBuffers();
 	createDescriptorPool();
 	createDescriptorSets();
+	createClusterDescriptorSets();
+	if (_view == View::ComputePathTraced) {
+		createPathTraceDescriptorSet();
+	}
 	createCommandBuffers();
 	createSyncObjects();
 	return 0;
@@ -144,39 +188,46 @@ void Launcher::recreateSwapchain() {
 	createImageViews();
 	createRenderPass();
 	createGraphicsPipeline();
+	if (_view != View::Rasterized) {
+		createDisplayPipeline();
+	}
 	createFramebuffers();
 	createCommandBuffers();
 }
 
 vk::PhysicalDevice Launcher::pickPhysicalDevice(std::vector<vk::PhysicalDevice> physicalDevices) {
+	// discrete gpus first, then anything else that can present, down to software devices like lavapipe
+	// and SwiftShader that run the compute path tracer on machines without a gpu
+	std::stable_partition(physicalDevices.begin(), physicalDevices.end(), [](const vk::PhysicalDevice& device) {
+		return device.getProperties().deviceType == vk::PhysicalDeviceType::eDiscreteGpu;
+	});
 	for (const auto& device : physicalDevices) {
 		// if device is suitable, return 
-		auto deviceProperties = device.getProperties();
-		if (deviceProperties.deviceType == vk::PhysicalDeviceType::eDiscreteGpu) {
-			auto features = device.getFeatures();
-			// check if right queue families or whatever
-			uint32_t i = 0;
-			auto familyProperties = device.getQueueFamilyProperties();
-			for (const auto& queueFamily : familyProperties) {
-				bool foundGraphicsFamily = false;
-				bool foundPresentFamily = false;
-				if (queueFamily.queueCount > 0) {
-					if (queueFamily.queueFlags & vk::QueueFlagBits::eGraphics) {
-						// device has queue family with graphics queues
-						// or whatever
-						_graphicsFamilyIndex = i;
-						foundGraphicsFamily = true;
-					}
-					if (device.getSurfaceSupportKHR(i, _surface)) {
-						_presentFamilyIndex = i;
-						foundPresentFamily = true;
-					}
-					if (foundGraphicsFamily && foundPresentFamily 
-						&& deviceSupportsExtensions(device) && features.samplerAnisotropy) {
-						return device;
-					}
-					i++;
+		auto features = device.getFeatures();
+		// check if right queue families or whatever
+		uint32_t i = 0;
+		auto familyProperties = device.getQueueFamilyProperties();
+		for (const auto& queueFamily : familyProperties) {
+			bool foundGraphicsFamily = false;
+			bool foundPresentFamily = false;
+			if (queueFamily.queueCount > 0) {
+				// the cull and path trace dispatches go to the graphics queue as well
+				if ((queueFamily.queueFlags & vk::QueueFlagBits::eGraphics)
+					&& (queueFamily.queueFlags & vk::QueueFlagBits::eCompute)) {
+					// device has queue family with graphics queues
+					// or whatever
+					_graphicsFamilyIndex = i;
+					foundGraphicsFamily = true;
+				}
+				if (device.getSurfaceSupportKHR(i, _surface)) {
+					_presentFamilyIndex = i;
+					foundPresentFamily = true;
 				}
+				if (foundGraphicsFamily && foundPresentFamily 
+					&& deviceSupportsExtensions(device) && features.samplerAnisotropy) {
+					return device;
+				}
+				i++;
 			}
 		}
 	}
@@ -347,8 +398,10 @@ void Launcher::createDescriptorSets() {
 		bufferInfo.offset = 0; 
 		bufferInfo.range = sizeof(UniformBufferObject);
 
+		// the compute path tracer writes the image as storage and leaves it in the general layout
 		vk::DescriptorImageInfo descriptorImageInfo;
-		descriptorImageInfo.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+		descriptorImageInfo.imageLayout = _view == View::ComputePathTraced ? vk::ImageLayout::eGeneral
+			: vk::ImageLayout::eShaderReadOnlyOptimal;
 		descriptorImageInfo.imageView = _textureImageView;
 		descriptorImageInfo.sampler = _textureSampler;
 
@@ -477,10 +530,17 @@ void Launcher::createGraphicsPipeline() {
 	colorBlending.attachmentCount = 1;
 	colorBlending.pAttachments = &colorBlendAttachment;
 
-	// pipeline layout
+	// pipeline layout, the material goes in as push constants of the fragment shader
+	vk::PushConstantRange materialConstantRange;
+	materialConstantRange.stageFlags = vk::ShaderStageFlagBits::eFragment;
+	materialConstantRange.offset = 0;
+	materialConstantRange.size = sizeof(MaterialConstants);
+
 	vk::PipelineLayoutCreateInfo pipelineLayoutCreateInfo;
 	pipelineLayoutCreateInfo.setLayoutCount = 1;
 	pipelineLayoutCreateInfo.pSetLayouts = &_descriptorSetLayout;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &materialConstantRange;
 	_pipelineLayout = _device.createPipelineLayout(pipelineLayoutCreateInfo);
 
 	// create graphics pipeline
@@ -510,6 +570,83 @@ void Launcher::createGraphicsPipeline() {
 	_device.destroyShaderModule(fragShaderModule);
 }
 
+void Launcher::createDisplayPipeline() {
+	// one triangle over the screen that samples the texture, no vertex buffer and the graphics pipeline's layout
+	auto vertShaderCode = readFile("shaders/display_vert.spv");
+	auto fragShaderCode = readFile("shaders/display_frag.spv");
+
+	vk::ShaderModule vertShaderModule = createShaderModule(vertShaderCode);
+	vk::ShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+
+	vk::PipelineShaderStageCreateInfo shaderStages[2];
+	shaderStages[0].stage = vk::ShaderStageFlagBits::eVertex;
+	shaderStages[0].module = vertShaderModule;
+	shaderStages[0].pName = "main";
+	shaderStages[1].stage = vk::ShaderStageFlagBits::eFragment;
+	shaderStages[1].module = fragShaderModule;
+	shaderStages[1].pName = "main";
+
+	vk::PipelineVertexInputStateCreateInfo vertexInputInfo;
+
+	vk::PipelineInputAssemblyStateCreateInfo inputAssembly;
+	inputAssembly.topology = vk::PrimitiveTopology::eTriangleList;
+	inputAssembly.setPrimitiveRestartEnable(false);
+
+	vk::Viewport viewport;
+	viewport.x = 0;
+	viewport.y = 0;
+	viewport.width = _swapchainExtent.width;
+	viewport.height = _swapchainExtent.height;
+	viewport.minDepth = 0;
+	viewport.maxDepth = 1;
+
+	vk::Rect2D scissor;
+	scissor.offset = { 0, 0 };
+	scissor.extent = _swapchainExtent;
+
+	vk::PipelineViewportStateCreateInfo viewportState;
+	viewportState.viewportCount = 1;
+	viewportState.pViewports = &viewport;
+	viewportState.scissorCount = 1;
+	viewportState.pScissors = &scissor;
+
+	vk::PipelineRasterizationStateCreateInfo rasterizer;
+	rasterizer.polygonMode = vk::PolygonMode::eFill;
+	rasterizer.lineWidth = 1.0f;
+	rasterizer.cullMode = vk::CullModeFlagBits::eNone;
+	rasterizer.frontFace = vk::FrontFace::eCounterClockwise;
+
+	vk::PipelineMultisampleStateCreateInfo multisampling;
+	multisampling.rasterizationSamples = vk::SampleCountFlagBits::e1;
+
+	vk::PipelineColorBlendAttachmentState colorBlendAttachment;
+	colorBlendAttachment.colorWriteMask = vk::ColorComponentFlagBits::eR
+		| vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB
+		| vk::ColorComponentFlagBits::eA;
+	colorBlendAttachment.blendEnable = false;
+
+	vk::PipelineColorBlendStateCreateInfo colorBlending;
+	colorBlending.attachmentCount = 1;
+	colorBlending.pAttachments = &colorBlendAttachment;
+
+	vk::GraphicsPipelineCreateInfo graphicsPipelineCreateInfo;
+	graphicsPipelineCreateInfo.stageCount = 2;
+	graphicsPipelineCreateInfo.pStages = shaderStages;
+	graphicsPipelineCreateInfo.pVertexInputState = &vertexInputInfo;
+	graphicsPipelineCreateInfo.pInputAssemblyState = &inputAssembly;
+	graphicsPipelineCreateInfo.pViewportState = &viewportState;
+	graphicsPipelineCreateInfo.pRasterizationState = &rasterizer;
+	graphicsPipelineCreateInfo.pMultisampleState = &multisampling;
+	graphicsPipelineCreateInfo.pColorBlendState = &colorBlending;
+	graphicsPipelineCreateInfo.layout = _pipelineLayout;
+	graphicsPipelineCreateInfo.renderPass = _renderPass;
+	graphicsPipelineCreateInfo.subpass = 0;
+
+	_displayPipeline = _device.createGraphicsPipelines(_pipelineCache, graphicsPipelineCreateInfo)[0];
+	_device.destroyShaderModule(vertShaderModule);
+	_device.destroyShaderModule(fragShaderModule);
+}
+
 void Launcher::createRenderPass() {
 	vk::AttachmentDescription colorAttachment;
 	colorAttachment.format = _swapchainImageFormat;
@@ -573,6 +710,8 @@ void Launcher::createCommandPool() {
 
 	vk::CommandPoolCreateInfo poolCreateInfo;
 	poolCreateInfo.queueFamilyIndex = _graphicsFamilyIndex;
+	// command buffers are re-recorded every frame from the culled draw list
+	poolCreateInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
 	_commandPool = _device.createCommandPool(poolCreateInfo);
 }
 
@@ -585,40 +724,84 @@ void Launcher::createCommandBuffers() {
 	commandBufferAllocateInfo.commandBufferCount = (uint32_t) _commandBuffers.size();
 
 	_commandBuffers = _device.allocateCommandBuffers(commandBufferAllocateInfo);
+	_imagesInFlight.assign(_commandBuffers.size(), nullptr);
+}
 
-	for (size_t i = 0; i < _commandBuffers.size(); ++i) {
-		vk::CommandBufferBeginInfo commandBufferBeginInfo;
-		commandBufferBeginInfo.flags = vk::CommandBufferUsageFlagBits::eSimultaneousUse;
-
-		_commandBuffers[i].begin(commandBufferBeginInfo);
-
-		vk::RenderPassBeginInfo renderPassBeginInfo;
-		renderPassBeginInfo.renderPass = _renderPass;
-		renderPassBeginInfo.framebuffer = _swapchainFramebuffers[i];
-		renderPassBeginInfo.renderArea.offset = { 0, 0 };
-		renderPassBeginInfo.renderArea.extent = _swapchainExtent;
+void Launcher::recordCommandBuffer(uint32_t imageIndex) {
+	vk::CommandBuffer commandBuffer = _commandBuffers[imageIndex];
+	commandBuffer.reset({});
 
-		vk::ClearValue clearColor;
-		clearColor.color.setFloat32({ 0, 0, 0, 1 });
-		renderPassBeginInfo.clearValueCount = 1;
-		renderPassBeginInfo.pClearValues = &clearColor;
+	vk::CommandBufferBeginInfo commandBufferBeginInfo;
+	commandBufferBeginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
 
-		_commandBuffers[i].beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eInline);
+	commandBuffer.begin(commandBufferBeginInfo);
 
-		_commandBuffers[i].bindPipeline(vk::PipelineBindPoint::eGraphics, _graphicsPipeline);
+	if (_view == View::PathTraced) {
+		recordDisplayUpload(commandBuffer);
+	} else if (_view == View::ComputePathTraced) {
+		recordPathTrace(commandBuffer);
+	}
 
-		std::vector<vk::Buffer> vertexBuffers = { _vertexBuffer };
-		std::vector<vk::DeviceSize> offsets = { 0 };
-		_commandBuffers[i].bindVertexBuffers(0, vertexBuffers, offsets);
+	// the quad is the only object, so its draw id is the whole draw list
+	const auto& drawList = _culling.drawList();
+	if (_view == View::Rasterized && !drawList.empty()) {
+		recordClusterCull(commandBuffer, imageIndex, drawList[0]);
+	}
 
-		_commandBuffers[i].bindIndexBuffer(_indexBuffer, 0, vk::IndexType::eUint16);
-		_commandBuffers[i].bindDescriptorSets(vk::PipelineBindPoint::eGraphics, _pipelineLayout, 0, _descriptorSets[i],
-			nullptr);
-		_commandBuffers[i].drawIndexed(_indices.size(), 1, 0, 0, 0);
+	vk::RenderPassBeginInfo renderPassBeginInfo;
+	renderPassBeginInfo.renderPass = _renderPass;
+	renderPassBeginInfo.framebuffer = _swapchainFramebuffers[imageIndex];
+	renderPassBeginInfo.renderArea.offset = { 0, 0 };
+	renderPassBeginInfo.renderArea.extent = _swapchainExtent;
+
+	vk::ClearValue clearColor;
+	clearColor.color.setFloat32({ 0, 0, 0, 1 });
+	renderPassBeginInfo.clearValueCount = 1;
+	renderPassBeginInfo.pClearValues = &clearColor;
+
+	commandBuffer.beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eInline);
+
+	if (_view != View::Rasterized) {
+		commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, _displayPipeline);
+		commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, _pipelineLayout, 0,
+			_descriptorSets[imageIndex], nullptr);
+		commandBuffer.draw(3, 1, 0, 0);
+		commandBuffer.endRenderPass();
+		commandBuffer.end();
+		return;
+	}
 
-		_commandBuffers[i].endRenderPass();
-		_commandBuffers[i].end();
+	commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, _graphicsPipeline);
+
+	std::vector<vk::Buffer> vertexBuffers = { _vertexBuffer };
+	std::vector<vk::DeviceSize> offsets = { 0 };
+	commandBuffer.bindVertexBuffers(0, vertexBuffers, offsets);
+
+	// surviving triangles of the cluster pass, the draw id goes in as the instance index
+	commandBuffer.bindIndexBuffer(_clusterIndexBuffers[imageIndex], 0, vk::IndexType::eUint32);
+	commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, _pipelineLayout, 0, _descriptorSets[imageIndex],
+		nullptr);
+
+	// the drawn node's material, white and fully rough without one
+	const SceneNode& node = _scene.nodes()[_drawNode];
+	MaterialConstants material = {};
+	material.baseColor = glm::vec4(1.0f);
+	material.parameters = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+	if (node.material != kSceneNone) {
+		const SceneMaterial& sceneMaterial = _scene.materials()[node.material];
+		material.baseColor = sceneMaterial.baseColor;
+		material.emissive = sceneMaterial.emissive;
+		material.parameters = glm::vec4(sceneMaterial.metallic, sceneMaterial.roughness, 0.0f, 0.0f);
+	}
+	material.cameraPosition = glm::vec4(_cameraPosition, 1.0f);
+	material.lightDirection = glm::vec4(glm::normalize(glm::vec3(0.4f, 0.8f, 0.45f)), 3.0f);
+	commandBuffer.pushConstants(_pipelineLayout, vk::ShaderStageFlagBits::eFragment, 0, sizeof(material), &material);
+	if (!drawList.empty()) {
+		commandBuffer.drawIndexedIndirect(_clusterDrawBuffers[imageIndex], 0, 1, sizeof(vk::DrawIndexedIndirectCommand));
 	}
+
+	commandBuffer.endRenderPass();
+	commandBuffer.end();
 }
 
 vk::CommandBuffer Launcher::beginSingleTimeCommands() {
@@ -652,7 +835,12 @@ void Launcher::endSingleTimeCommands(vk::CommandBuffer commandBuffer) {
 
 void Launcher::loadToTextureImage() {
 	int textureWidth, textureHeight, textureChannels;
-	stbi_uc* pixels = stbi_load("textures/chicks.jpg", &textureWidth, &textureHeight, &textureChannels,
+	const SceneNode& node = _scene.nodes()[_drawNode];
+	const char *texturePath = "textures/chicks.jpg";
+	if (node.material != kSceneNone && _scene.materials()[node.material].baseColorTexture != kSceneNone) {
+		texturePath = _scene.texturePath(_scene.materials()[node.material].baseColorTexture);
+	}
+	stbi_uc* pixels = stbi_load(texturePath, &textureWidth, &textureHeight, &textureChannels,
 		STBI_rgb_alpha);
 	vk::DeviceSize imageSize = textureWidth * textureHeight * 4;
 
@@ -750,6 +938,12 @@ void Launcher::transitionImageLayout(vk::Image image, vk::Format format, vk::Ima
 
 		sourceStage = vk::PipelineStageFlagBits::eTransfer;
 		destinationStage = vk::PipelineStageFlagBits::eFragmentShader;
+	} else if (oldLayout == vk::ImageLayout::eUndefined && newLayout == vk::ImageLayout::eGeneral) {
+		imageMemoryBarrier.srcAccessMask = {};
+		imageMemoryBarrier.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+
+		sourceStage = vk::PipelineStageFlagBits::eTopOfPipe;
+		destinationStage = vk::PipelineStageFlagBits::eComputeShader;
 	} else {
 		throw std::invalid_argument("unsupported layout transition!");
 	}
@@ -819,6 +1013,244 @@ void Launcher::createTextureSampler() {
 	_textureSampler = _device.createSampler(samplerCreateInfo);
 }
 
+void Launcher::createDisplayTexture() {
+	// the path tracer renders at the window's size from the rasterizer's camera
+	_displayWidth = _swapchainExtent.width;
+	_displayHeight = _swapchainExtent.height;
+	_pathTracer = std::make_unique<PathTracer>();
+	_pathTracer->setScene(_scene);
+	_pathTracer->setSamplesPerPixel(1);
+	_progressive = std::make_unique<ProgressiveRenderer>(*_pathTracer);
+	_progressive->restart(defaultFrame(_displayWidth / (float)_displayHeight), _displayWidth, _displayHeight);
+
+	vk::Format format = vk::Format::eR8G8B8A8Unorm;
+	createImage(_displayWidth, _displayHeight, format, vk::ImageTiling::eOptimal,
+		vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
+		vk::MemoryPropertyFlagBits::eDeviceLocal, _textureImage, _textureImageMemory);
+	// every frame uploads before it samples, so the contents until then do not matter, only the layout
+	transitionImageLayout(_textureImage, format, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal);
+	transitionImageLayout(_textureImage, format, vk::ImageLayout::eTransferDstOptimal,
+		vk::ImageLayout::eShaderReadOnlyOptimal);
+
+	// one per frame in flight, mapped once, so a frame resolves into its buffer while the one before copies
+	vk::DeviceSize size = (vk::DeviceSize)_displayWidth * _displayHeight * 4;
+	_displayStagingBuffers.resize(kMaxFramesInFlight);
+	_displayStagingBufferMemories.resize(kMaxFramesInFlight);
+	_displayStagingTexels.resize(kMaxFramesInFlight);
+	_displayUpdates.assign(kMaxFramesInFlight, 0);
+	for (int i = 0; i < kMaxFramesInFlight; ++i) {
+		createBuffer(size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible
+			| vk::MemoryPropertyFlagBits::eHostCoherent, _displayStagingBuffers[i], _displayStagingBufferMemories[i]);
+		_displayStagingTexels[i] = static_cast<uint8_t*>(_device.mapMemory(_displayStagingBufferMemories[i], 0, size,
+			{}));
+	}
+}
+
+void Launcher::recordDisplayUpload(vk::CommandBuffer commandBuffer) {
+	// earlier frames' fragment shaders are done with the texture before the copy writes it, the copy is
+	// done before this frame's fragment shader reads it
+	vk::ImageMemoryBarrier imageMemoryBarrier;
+	imageMemoryBarrier.oldLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+	imageMemoryBarrier.newLayout = vk::ImageLayout::eTransferDstOptimal;
+	imageMemoryBarrier.srcAccessMask = vk::AccessFlagBits::eShaderRead;
+	imageMemoryBarrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+	imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageMemoryBarrier.image = _textureImage;
+	imageMemoryBarrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+	imageMemoryBarrier.subresourceRange.baseMipLevel = 0;
+	imageMemoryBarrier.subresourceRange.levelCount = 1;
+	imageMemoryBarrier.subresourceRange.baseArrayLayer = 0;
+	imageMemoryBarrier.subresourceRange.layerCount = 1;
+	commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eFragmentShader, vk::PipelineStageFlagBits::eTransfer,
+		{}, nullptr, nullptr, imageMemoryBarrier);
+
+	vk::BufferImageCopy region;
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageOffset = { 0, 0, 0 };
+	region.imageExtent = { _displayWidth, _displayHeight, 1 };
+	commandBuffer.copyBufferToImage(_displayStagingBuffers[_currentFrame], _textureImage,
+		vk::ImageLayout::eTransferDstOptimal, region);
+
+	imageMemoryBarrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+	imageMemoryBarrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+	imageMemoryBarrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+	imageMemoryBarrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+	commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader,
+		{}, nullptr, nullptr, imageMemoryBarrier);
+}
+
+void Launcher::createPathTracePipeline() {
+	// the scene's nodes, triangles and materials, then the accumulation and display images
+	std::array<vk::DescriptorSetLayoutBinding, 5> bindings;
+	for (uint32_t i = 0; i < bindings.size(); ++i) {
+		bindings[i].binding = i;
+		bindings[i].descriptorType = i < 3 ? vk::DescriptorType::eStorageBuffer : vk::DescriptorType::eStorageImage;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = vk::ShaderStageFlagBits::eCompute;
+	}
+
+	vk::DescriptorSetLayoutCreateInfo layoutCreateInfo;
+	layoutCreateInfo.bindingCount = bindings.size();
+	layoutCreateInfo.pBindings = bindings.data();
+	_traceDescriptorSetLayout = _device.createDescriptorSetLayout(layoutCreateInfo);
+
+	vk::PushConstantRange pushConstantRange;
+	pushConstantRange.stageFlags = vk::ShaderStageFlagBits::eCompute;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(PathTraceConstants);
+
+	vk::PipelineLayoutCreateInfo pipelineLayoutCreateInfo;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &_traceDescriptorSetLayout;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+	_tracePipelineLayout = _device.createPipelineLayout(pipelineLayoutCreateInfo);
+
+	auto computeShaderCode = readFile("shaders/pathtrace.spv");
+	vk::ShaderModule computeShaderModule = createShaderModule(computeShaderCode);
+
+	vk::ComputePipelineCreateInfo computePipelineCreateInfo;
+	computePipelineCreateInfo.stage.stage = vk::ShaderStageFlagBits::eCompute;
+	computePipelineCreateInfo.stage.module = computeShaderModule;
+	computePipelineCreateInfo.stage.pName = "main";
+	vk::SpecializationMapEntry stackSizeEntry(0, 0, sizeof(_traceStackSize));
+	vk::SpecializationInfo specializationInfo(1, &stackSizeEntry, sizeof(_traceStackSize), &_traceStackSize);
+	computePipelineCreateInfo.stage.pSpecializationInfo = &specializationInfo;
+	computePipelineCreateInfo.layout = _tracePipelineLayout;
+
+	_tracePipeline = _device.createComputePipelines(_pipelineCache, computePipelineCreateInfo)[0];
+	_device.destroyShaderModule(computeShaderModule);
+}
+
+void Launcher::createPathTraceResources() {
+	// traced at the window's size from the rasterizer's camera, like the cpu path traced view
+	_displayWidth = _swapchainExtent.width;
+	_displayHeight = _swapchainExtent.height;
+	_tracePass = 0;
+
+	ComputeScene computeScene;
+	computeScene.build(_scene);
+	_traceStackSize = std::max(computeScene.stackSize(), 1u);
+	auto storage = vk::BufferUsageFlagBits::eStorageBuffer;
+	createDeviceLocalBuffer(computeScene.nodes().data(), sizeof(BvhNode) * computeScene.nodes().size(), storage,
+		_traceNodeBuffer, _traceNodeBufferMemory);
+	createDeviceLocalBuffer(computeScene.triangles().data(),
+		sizeof(ComputeScene::Triangle) * computeScene.triangles().size(), storage, _traceTriangleBuffer,
+		_traceTriangleBufferMemory);
+	createDeviceLocalBuffer(computeScene.materials().data(),
+		sizeof(ComputeScene::Material) * computeScene.materials().size(), storage, _traceMaterialBuffer,
+		_traceMaterialBufferMemory);
+
+	// the first pass writes every pixel of both before anything reads them
+	createImage(_displayWidth, _displayHeight, vk::Format::eR32G32B32A32Sfloat, vk::ImageTiling::eOptimal,
+		vk::ImageUsageFlagBits::eStorage, vk::MemoryPropertyFlagBits::eDeviceLocal, _accumulationImage,
+		_accumulationImageMemory);
+	transitionImageLayout(_accumulationImage, vk::Format::eR32G32B32A32Sfloat, vk::ImageLayout::eUndefined,
+		vk::ImageLayout::eGeneral);
+	createImage(_displayWidth, _displayHeight, vk::Format::eR8G8B8A8Unorm, vk::ImageTiling::eOptimal,
+		vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled, vk::MemoryPropertyFlagBits::eDeviceLocal,
+		_textureImage, _textureImageMemory);
+	transitionImageLayout(_textureImage, vk::Format::eR8G8B8A8Unorm, vk::ImageLayout::eUndefined,
+		vk::ImageLayout::eGeneral);
+
+	vk::ImageViewCreateInfo viewInfo;
+	viewInfo.image = _accumulationImage;
+	viewInfo.viewType = vk::ImageViewType::e2D;
+	viewInfo.format = vk::Format::eR32G32B32A32Sfloat;
+	viewInfo.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+	viewInfo.subresourceRange.baseMipLevel = 0;
+	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = 1;
+	_accumulationImageView = _device.createImageView(viewInfo);
+}
+
+void Launcher::createPathTraceDescriptorSet() {
+	std::array<vk::DescriptorPoolSize, 2> poolSizes;
+	poolSizes[0].type = vk::DescriptorType::eStorageBuffer;
+	poolSizes[0].descriptorCount = 3;
+	poolSizes[1].type = vk::DescriptorType::eStorageImage;
+	poolSizes[1].descriptorCount = 2;
+
+	vk::DescriptorPoolCreateInfo poolCreateInfo;
+	poolCreateInfo.poolSizeCount = poolSizes.size();
+	poolCreateInfo.pPoolSizes = poolSizes.data();
+	poolCreateInfo.maxSets = 1;
+	_traceDescriptorPool = _device.createDescriptorPool(poolCreateInfo);
+
+	// one set for every frame, the barriers in recordPathTrace keep the passes in order
+	vk::DescriptorSetAllocateInfo descriptorSetAllocateInfo;
+	descriptorSetAllocateInfo.descriptorPool = _traceDescriptorPool;
+	descriptorSetAllocateInfo.descriptorSetCount = 1;
+	descriptorSetAllocateInfo.pSetLayouts = &_traceDescriptorSetLayout;
+	_traceDescriptorSet = _device.allocateDescriptorSets(descriptorSetAllocateInfo)[0];
+
+	std::array<vk::DescriptorBufferInfo, 3> bufferInfos;
+	bufferInfos[0].buffer = _traceNodeBuffer;
+	bufferInfos[1].buffer = _traceTriangleBuffer;
+	bufferInfos[2].buffer = _traceMaterialBuffer;
+	std::array<vk::DescriptorImageInfo, 2> imageInfos;
+	imageInfos[0].imageView = _accumulationImageView;
+	imageInfos[1].imageView = _textureImageView;
+
+	std::array<vk::WriteDescriptorSet, 5> descriptorWrites;
+	for (uint32_t binding = 0; binding < descriptorWrites.size(); ++binding) {
+		descriptorWrites[binding].dstSet = _traceDescriptorSet;
+		descriptorWrites[binding].dstBinding = binding;
+		descriptorWrites[binding].dstArrayElement = 0;
+		descriptorWrites[binding].descriptorCount = 1;
+		if (binding < 3) {
+			bufferInfos[binding].offset = 0;
+			bufferInfos[binding].range = VK_WHOLE_SIZE;
+			descriptorWrites[binding].descriptorType = vk::DescriptorType::eStorageBuffer;
+			descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+		} else {
+			imageInfos[binding - 3].imageLayout = vk::ImageLayout::eGeneral;
+			descriptorWrites[binding].descriptorType = vk::DescriptorType::eStorageImage;
+			descriptorWrites[binding].pImageInfo = &imageInfos[binding - 3];
+		}
+	}
+	_device.updateDescriptorSets(descriptorWrites, nullptr);
+}
+
+void Launcher::recordPathTrace(vk::CommandBuffer commandBuffer) {
+	// the previous pass is done with the accumulation image and the previous frame's fragment shader with the
+	// display image before this pass touches either. frames in flight go through the one queue, so the
+	// barrier orders them too
+	vk::MemoryBarrier passBarrier;
+	passBarrier.srcAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+	passBarrier.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+	commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader
+		| vk::PipelineStageFlagBits::eFragmentShader, vk::PipelineStageFlagBits::eComputeShader, {}, passBarrier,
+		nullptr, nullptr);
+
+	PathTraceConstants constants;
+	UniformBufferObject frame = defaultFrame(_displayWidth / (float)_displayHeight);
+	constants.inverseViewProjection = glm::inverse(frame.invert * frame.proj * frame.view);
+	// as many bounces as the cpu path tracer takes by default
+	constants.frame = glm::uvec4(_displayWidth, _displayHeight, _tracePass++, 4);
+
+	commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, _tracePipeline);
+	commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, _tracePipelineLayout, 0, _traceDescriptorSet,
+		nullptr);
+	commandBuffer.pushConstants(_tracePipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(constants),
+		&constants);
+	commandBuffer.dispatch((_displayWidth + 7) / 8, (_displayHeight + 7) / 8, 1);
+
+	vk::MemoryBarrier displayBarrier;
+	displayBarrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+	displayBarrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+	commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+		vk::PipelineStageFlagBits::eFragmentShader, {}, displayBarrier, nullptr, nullptr);
+}
+
 vk::ShaderModule Launcher::createShaderModule(const std::vector<char>& code) {
 	vk::ShaderModuleCreateInfo createInfo;
 
@@ -869,64 +1301,269 @@ void Launcher::copyBuffer(vk::Buffer srcBuffer, vk::Buffer dstBuffer, vk::Device
 	endSingleTimeCommands(commandBuffer);
 }
 
+void Launcher::loadScene() {
+	if (!_scenePath.empty()) {
+		_scene.open(_scenePath);
+	} else {
+		_scene.openMemory(SceneBuilder::defaultScene().serialize());
+	}
+
+	auto nodes = _scene.nodes();
+	for (uint32_t i = 0; i < nodes.size() && _drawNode == kSceneNone; ++i) {
+		if (nodes[i].mesh != kSceneNone) {
+			_drawNode = i;
+		}
+	}
+	if (_drawNode == kSceneNone) {
+		throw std::runtime_error("scene has nothing to draw!");
+	}
+
+	_transforms.clear();
+	for (const auto& node : nodes) {
+		_transforms.addNode(node.parent == kSceneNone ? kTransformNone : node.parent, node.local);
+	}
+	_spinTransform = _transforms.addNode(_drawNode);
+
+	// bounds follow the spinning model matrix in updateUniformBuffer
+	_culling.clear();
+	_culling.addObject(glm::vec3(nodes[_drawNode].bounds), nodes[_drawNode].bounds.w, _drawNode);
+}
+
 void Launcher::createVertexBuffer() {
-	_vertices = 
-	{ 
-		{ {-0.5f, -0.5f, 0 }, { 1.0, 0.0f, 0.0f }, {1.0f, 0.0f} },
-		{ { 0.5f, -0.5f, 0 }, { 1.0f, 1.0f, 0.0f }, {0.0f, 0.0f} },
-		{ { 0.5f, 0.5f, 0 }, { 0.0f, 0.0f, 1.0f }, {0.0, 1.0f} },
-		{ { -0.5f, 0.5f, 0 }, { 1.0f, 1.0f, 1.0f }, {1.0f, 1.0f} }
-	};
-	vk::DeviceSize bufferSize = sizeof(_vertices[0]) * _vertices.size();
+	// straight from the mapped scene into the staging buffer
+	auto vertices = _scene.vertices();
+	createDeviceLocalBuffer(vertices.data(), sizeof(Vertex) * vertices.size(), vk::BufferUsageFlagBits::eVertexBuffer,
+		_vertexBuffer, _vertexBufferMemory);
+}
+
+void Launcher::createDeviceLocalBuffer(const void *contents, vk::DeviceSize size, vk::BufferUsageFlags usage,
+	vk::Buffer& buffer, vk::DeviceMemory& deviceMemory) {
 	auto properties = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
 
 	vk::Buffer stagingBuffer;
 	vk::DeviceMemory stagingBufferMemory;
-	createBuffer(bufferSize, vk::BufferUsageFlagBits::eTransferSrc, properties,
-		stagingBuffer, stagingBufferMemory);
+	createBuffer(size, vk::BufferUsageFlagBits::eTransferSrc, properties, stagingBuffer, stagingBufferMemory);
 
-	// filling vertex buffer
 	void* data;
-	data = _device.mapMemory(stagingBufferMemory, 0, bufferSize, {});
-	memcpy(data, _vertices.data(), (size_t)bufferSize);
+	data = _device.mapMemory(stagingBufferMemory, 0, size, {});
+	memcpy(data, contents, (size_t)size);
 	_device.unmapMemory(stagingBufferMemory);
 
-	auto usageFlags = vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst;
-	properties = vk::MemoryPropertyFlagBits::eDeviceLocal;
-	createBuffer(bufferSize, usageFlags, properties,
-		_vertexBuffer, _vertexBufferMemory);
-	copyBuffer(stagingBuffer, _vertexBuffer, bufferSize);
+	createBuffer(size, usage | vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal,
+		buffer, deviceMemory);
+	copyBuffer(stagingBuffer, buffer, size);
 
 	_device.destroyBuffer(stagingBuffer);
 	_device.freeMemory(stagingBufferMemory);
-	
 }
 
-void Launcher::createIndexBuffer() {
-	_indices = { 0, 1, 2, 2, 3, 0 };
-	vk::DeviceSize bufferSize = sizeof(_indices[0]) * _indices.size();
+void Launcher::createClusterBuffers() {
+	// meshlets of every lod were built offline, the cull pass only walks the selected lod's run
+	auto storage = vk::BufferUsageFlagBits::eStorageBuffer;
+	auto meshlets = _scene.meshlets();
+	auto meshletVertices = _scene.meshletVertices();
+	auto meshletTriangles = _scene.meshletTriangles();
+	createDeviceLocalBuffer(meshlets.data(), sizeof(Meshlet) * meshlets.size(), storage,
+		_meshletBuffer, _meshletBufferMemory);
+	createDeviceLocalBuffer(meshletVertices.data(), sizeof(uint32_t) * meshletVertices.size(), storage,
+		_meshletVertexBuffer, _meshletVertexBufferMemory);
+	createDeviceLocalBuffer(meshletTriangles.data(), sizeof(uint32_t) * meshletTriangles.size(), storage,
+		_meshletTriangleBuffer, _meshletTriangleBufferMemory);
+
+	// the cull pass writes these every frame, one set per swapchain image like the uniform buffers
+	const SceneMesh& mesh = _scene.meshes()[_scene.nodes()[_drawNode].mesh];
+	vk::DeviceSize indexBufferSize = sizeof(uint32_t) * _scene.lods()[mesh.firstLod].indexCount;
+	_clusterTriangleCounts.assign(_swapchainImages.size(), 0);
+	_clusterIndexBuffers.resize(_swapchainImages.size());
+	_clusterIndexBufferMemories.resize(_swapchainImages.size());
+	_clusterDrawBuffers.resize(_swapchainImages.size());
+	_clusterDrawBufferMemories.resize(_swapchainImages.size());
+	auto indexMemory = _clusterCullOnGpu ? vk::MemoryPropertyFlags(vk::MemoryPropertyFlagBits::eDeviceLocal)
+		: vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+	for (size_t i = 0; i < _swapchainImages.size(); ++i) {
+		createBuffer(indexBufferSize, storage | vk::BufferUsageFlagBits::eIndexBuffer, indexMemory,
+			_clusterIndexBuffers[i], _clusterIndexBufferMemories[i]);
+		// host visible so the surviving index count can be read back once the frame is done
+		createBuffer(sizeof(vk::DrawIndexedIndirectCommand), storage | vk::BufferUsageFlagBits::eIndirectBuffer
+			| vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible
+			| vk::MemoryPropertyFlagBits::eHostCoherent, _clusterDrawBuffers[i], _clusterDrawBufferMemories[i]);
+	}
+}
 
-	auto properties = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+void Launcher::createClusterCullPipeline() {
+	std::array<vk::DescriptorSetLayoutBinding, 5> bindings;
+	for (uint32_t i = 0; i < bindings.size(); ++i) {
+		bindings[i].binding = i;
+		bindings[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = vk::ShaderStageFlagBits::eCompute;
+	}
 
-	vk::Buffer stagingBuffer;
-	vk::DeviceMemory stagingBufferMemory;
-	createBuffer(bufferSize, vk::BufferUsageFlagBits::eTransferSrc, properties,
-		stagingBuffer, stagingBufferMemory);
+	vk::DescriptorSetLayoutCreateInfo layoutCreateInfo;
+	layoutCreateInfo.bindingCount = bindings.size();
+	layoutCreateInfo.pBindings = bindings.data();
+	_clusterDescriptorSetLayout = _device.createDescriptorSetLayout(layoutCreateInfo);
 
-	// filling index buffer
-	void* data;
-	data = _device.mapMemory(stagingBufferMemory, 0, bufferSize, {});
-	memcpy(data, _indices.data(), (size_t)bufferSize);
-	_device.unmapMemory(stagingBufferMemory);
+	vk::PushConstantRange pushConstantRange;
+	pushConstantRange.stageFlags = vk::ShaderStageFlagBits::eCompute;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(ClusterCullConstants);
 
-	auto usageFlags = vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst;
-	properties = vk::MemoryPropertyFlagBits::eDeviceLocal;
-	createBuffer(bufferSize, usageFlags, properties,
-		_indexBuffer, _indexBufferMemory);
-	copyBuffer(stagingBuffer, _indexBuffer, bufferSize);
+	vk::PipelineLayoutCreateInfo pipelineLayoutCreateInfo;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &_clusterDescriptorSetLayout;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+	_clusterPipelineLayout = _device.createPipelineLayout(pipelineLayoutCreateInfo);
+
+	// a build without the compiled shader still draws, the pass runs on the cpu then
+	if (!std::ifstream("shaders/cluster_cull.spv").is_open()) {
+		std::cout << "shaders/cluster_cull.spv not found, culling clusters on the cpu" << std::endl;
+		_clusterCullOnGpu = false;
+		return;
+	}
+	auto computeShaderCode = readFile("shaders/cluster_cull.spv");
+	vk::ShaderModule computeShaderModule = createShaderModule(computeShaderCode);
 
-	_device.destroyBuffer(stagingBuffer);
-	_device.freeMemory(stagingBufferMemory);
+	vk::ComputePipelineCreateInfo computePipelineCreateInfo;
+	computePipelineCreateInfo.stage.stage = vk::ShaderStageFlagBits::eCompute;
+	computePipelineCreateInfo.stage.module = computeShaderModule;
+	computePipelineCreateInfo.stage.pName = "main";
+	computePipelineCreateInfo.layout = _clusterPipelineLayout;
+
+	_clusterCullPipeline = _device.createComputePipelines(_pipelineCache, computePipelineCreateInfo)[0];
+	_device.destroyShaderModule(computeShaderModule);
+}
+
+void Launcher::createClusterDescriptorSets() {
+	vk::DescriptorPoolSize poolSize;
+	poolSize.type = vk::DescriptorType::eStorageBuffer;
+	poolSize.descriptorCount = 5 * _swapchainImages.size();
+
+	vk::DescriptorPoolCreateInfo poolCreateInfo;
+	poolCreateInfo.poolSizeCount = 1;
+	poolCreateInfo.pPoolSizes = &poolSize;
+	poolCreateInfo.maxSets = _swapchainImages.size();
+	_clusterDescriptorPool = _device.createDescriptorPool(poolCreateInfo);
+
+	std::vector<vk::DescriptorSetLayout> layouts(_swapchainImages.size(), _clusterDescriptorSetLayout);
+	vk::DescriptorSetAllocateInfo descriptorSetAllocateInfo;
+	descriptorSetAllocateInfo.descriptorPool = _clusterDescriptorPool;
+	descriptorSetAllocateInfo.descriptorSetCount = _swapchainImages.size();
+	descriptorSetAllocateInfo.pSetLayouts = layouts.data();
+	_clusterDescriptorSets = _device.allocateDescriptorSets(descriptorSetAllocateInfo);
+
+	for (size_t i = 0; i < _swapchainImages.size(); ++i) {
+		std::array<vk::DescriptorBufferInfo, 5> bufferInfos;
+		bufferInfos[0].buffer = _meshletBuffer;
+		bufferInfos[1].buffer = _meshletVertexBuffer;
+		bufferInfos[2].buffer = _meshletTriangleBuffer;
+		bufferInfos[3].buffer = _clusterIndexBuffers[i];
+		bufferInfos[4].buffer = _clusterDrawBuffers[i];
+
+		std::array<vk::WriteDescriptorSet, 5> descriptorWrites;
+		for (uint32_t binding = 0; binding < descriptorWrites.size(); ++binding) {
+			bufferInfos[binding].offset = 0;
+			bufferInfos[binding].range = VK_WHOLE_SIZE;
+			descriptorWrites[binding].dstSet = _clusterDescriptorSets[i];
+			descriptorWrites[binding].dstBinding = binding;
+			descriptorWrites[binding].dstArrayElement = 0;
+			descriptorWrites[binding].descriptorType = vk::DescriptorType::eStorageBuffer;
+			descriptorWrites[binding].descriptorCount = 1;
+			descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+		}
+		_device.updateDescriptorSets(descriptorWrites, nullptr);
+	}
+}
+
+void Launcher::recordClusterCull(vk::CommandBuffer commandBuffer, uint32_t imageIndex, uint32_t drawId) {
+	// cull in object space so the meshlet bounds can be used as stored
+	ClusterCullConstants constants;
+	Frustum frustum = Frustum::fromMatrix(_viewProjection * _model);
+	for (int i = 0; i < 6; ++i) {
+		constants.planes[i] = frustum.planes[i];
+	}
+	constants.cameraPosition = glm::inverse(_model) * glm::vec4(_cameraPosition, 1.0f);
+
+	// lod from the projected error of the world space bounds
+	const SceneNode& node = _scene.nodes()[_drawNode];
+	const SceneMesh& mesh = _scene.meshes()[node.mesh];
+	float scale = node.bounds.w / mesh.bounds.w;
+	glm::vec4 sphere(glm::vec3(_model * glm::vec4(glm::vec3(mesh.bounds), 1.0f)), node.bounds.w);
+	_currentLod = selectLod(&_scene.lods()[mesh.firstLod], mesh.lodCount, sphere, scale, _cameraPosition,
+		lodPixelScale(_proj, (float)_swapchainExtent.height));
+	glm::uvec2 lodMeshlets = _scene.lodMeshlets()[mesh.firstLod + _currentLod];
+	constants.meshletRange = glm::uvec4(lodMeshlets.y, lodMeshlets.x, 0, 0);
+	_clusterTriangleCounts[imageIndex] = _scene.lods()[mesh.firstLod + _currentLod].indexCount / 3;
+
+	vk::DrawIndexedIndirectCommand drawCommand;
+	drawCommand.indexCount = 0;
+	drawCommand.instanceCount = 1;
+	drawCommand.firstIndex = 0;
+	drawCommand.vertexOffset = 0;
+	drawCommand.firstInstance = drawId;
+	if (!_clusterCullOnGpu) {
+		// drawFrame waited for the image's last frame, so its buffers are free to write
+		void *indices = _device.mapMemory(_clusterIndexBufferMemories[imageIndex], 0, VK_WHOLE_SIZE, {});
+		drawCommand.indexCount = cullMeshlets(_scene.meshlets().data(), _scene.meshletVertices().data(),
+			_scene.meshletTriangles().data(), lodMeshlets.x, lodMeshlets.y, frustum,
+			glm::vec3(constants.cameraPosition), static_cast<uint32_t*>(indices));
+		_device.unmapMemory(_clusterIndexBufferMemories[imageIndex]);
+		void *data = _device.mapMemory(_clusterDrawBufferMemories[imageIndex], 0, sizeof(drawCommand), {});
+		memcpy(data, &drawCommand, sizeof(drawCommand));
+		_device.unmapMemory(_clusterDrawBufferMemories[imageIndex]);
+		return;
+	}
+	commandBuffer.updateBuffer(_clusterDrawBuffers[imageIndex], 0, sizeof(drawCommand), &drawCommand);
+
+	vk::MemoryBarrier resetBarrier;
+	resetBarrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+	resetBarrier.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+	commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader,
+		{}, resetBarrier, nullptr, nullptr);
+
+	commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, _clusterCullPipeline);
+	commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, _clusterPipelineLayout, 0,
+		_clusterDescriptorSets[imageIndex], nullptr);
+	commandBuffer.pushConstants(_clusterPipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(constants),
+		&constants);
+	commandBuffer.dispatch((lodMeshlets.y + 63) / 64, 1, 1);
+
+	vk::MemoryBarrier cullBarrier;
+	cullBarrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+	cullBarrier.dstAccessMask = vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eIndexRead;
+	commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+		vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexInput,
+		{}, cullBarrier, nullptr, nullptr);
+}
+
+void Launcher::updateFrameStatistics(uint32_t imageIndex) {
+	if (_view != View::Rasterized) {
+		auto now = std::chrono::high_resolution_clock::now();
+		if (now - _lastTitleTime > std::chrono::milliseconds(500)) {
+			_lastTitleTime = now;
+			uint32_t passCount = _view == View::PathTraced ? _progressive->passCount() : _tracePass;
+			std::string title = "FastPBR - " + std::to_string(_frameMilliseconds) + " ms, "
+				+ std::to_string(passCount) + " passes";
+			glfwSetWindowTitle(_window, title.c_str());
+		}
+		return;
+	}
+	vk::DrawIndexedIndirectCommand drawCommand;
+	void* data;
+	data = _device.mapMemory(_clusterDrawBufferMemories[imageIndex], 0, sizeof(drawCommand), {});
+	memcpy(&drawCommand, data, sizeof(drawCommand));
+	_device.unmapMemory(_clusterDrawBufferMemories[imageIndex]);
+	_trianglesCulled = _clusterTriangleCounts[imageIndex] - drawCommand.indexCount / 3;
+
+	auto now = std::chrono::high_resolution_clock::now();
+	if (now - _lastTitleTime > std::chrono::milliseconds(500)) {
+		_lastTitleTime = now;
+		std::string title = "FastPBR - " + std::to_string(_frameMilliseconds) + " ms, lod "
+			+ std::to_string(_currentLod) + ", " + std::to_string(drawCommand.indexCount / 3) + " triangles, "
+			+ std::to_string(_trianglesCulled) + " culled";
+		glfwSetWindowTitle(_window, title.c_str());
+	}
 }
 
 void Launcher::createUniformBuffers() {
@@ -949,14 +1586,17 @@ void Launcher::updateUniformBuffer(uint32_t currentImage) {
 	auto currentTime = std::chrono::high_resolution_clock::now(); 
 	float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
 
-	UniformBufferObject ubo = {};
-	ubo.invert = glm::mat4(	1.0f, 0.0f, 0.0f, 0.0f,
-							0.0f, -1.0f, 0.0f, 0.0f,
-							0.0f, 0.0f, 0.5f, 0.0f,
-							0.0f, 0.0f, 0.5f, 1.0f);
-	ubo.model = glm::rotate(glm::mat4(1.0f), time  * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	ubo.view = glm::lookAt(glm::vec3(0, 0, 2), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
-	ubo.proj = glm::perspective(glm::radians(45.0f), _swapchainExtent.width / (float)_swapchainExtent.height, 0.1f, 10.0f);
+	UniformBufferObject ubo = defaultFrame(_swapchainExtent.width / (float)_swapchainExtent.height);
+	const SceneNode& node = _scene.nodes()[_drawNode];
+	_transforms.setRotation(_spinTransform, glm::angleAxis(time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
+	_transforms.update();
+	ubo.model = _transforms.world(_spinTransform);
+	_cameraPosition = glm::vec3(glm::inverse(ubo.view)[3]);
+	_model = ubo.model;
+	const glm::vec4& bounds = _scene.meshes()[node.mesh].bounds;
+	_culling.setBounds(0, glm::vec3(_model * glm::vec4(glm::vec3(bounds), 1.0f)), node.bounds.w);
+	_proj = ubo.proj;
+	_viewProjection = ubo.proj * ubo.view;
 
 	void* data;
 	data = _device.mapMemory(_uniformBufferMemories[currentImage], 0, sizeof(ubo), {});
@@ -979,6 +1619,10 @@ uint32_t Launcher::findMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags p
 }
 
 void Launcher::drawFrame() {
+	auto frameTime = std::chrono::high_resolution_clock::now();
+	_frameMilliseconds = std::chrono::duration<double, std::milli>(frameTime - _lastFrameTime).count();
+	_lastFrameTime = frameTime;
+
 	_device.waitForFences(1, &_inFlightFences[_currentFrame], true, std::numeric_limits<uint64_t>::max());
 	auto imageIndex = _device.acquireNextImageKHR(_swapchain,
 		std::numeric_limits<uint64_t>::max(),
@@ -991,6 +1635,19 @@ void Launcher::drawFrame() {
 
 	updateUniformBuffer(imageIndex.value);
 
+	// the image may still be in use by another frame in flight, wait before re-recording its commands
+	if (_imagesInFlight[imageIndex.value]) {
+		_device.waitForFences(1, &_imagesInFlight[imageIndex.value], true, std::numeric_limits<uint64_t>::max());
+		updateFrameStatistics(imageIndex.value);
+	}
+	_imagesInFlight[imageIndex.value] = _inFlightFences[_currentFrame];
+	_culling.cull(_viewProjection);
+	if (_view == View::PathTraced) {
+		// the fence above freed this frame's staging buffer, the passes since it was last filled go in
+		_display.resolve(*_progressive, _displayStagingTexels[_currentFrame], _displayUpdates[_currentFrame]);
+	}
+	recordCommandBuffer(imageIndex.value);
+
 	vk::SubmitInfo submitInfo;
 
 	vk::Semaphore waitSemaphores[] = { _imageAvailableSemaphore[_currentFrame] };
@@ -1067,6 +1724,10 @@ int Launcher::run()
 	{
 		glfwPollEvents();
 		drawFrame();
+		// the frame's upload runs on the gpu meanwhile
+		if (_view == View::PathTraced) {
+			_progressive->renderPass();
+		}
 	}
 	_device.waitIdle();
 
@@ -1081,14 +1742,48 @@ int Launcher::run()
 		_device.destroyBuffer(_uniformBuffers[i]);
 		_device.freeMemory(_uniformBufferMemories[i]);
 	}
+	for (size_t i = 0; i < _displayStagingBuffers.size(); ++i) {
+		_device.unmapMemory(_displayStagingBufferMemories[i]);
+		_device.destroyBuffer(_displayStagingBuffers[i]);
+		_device.freeMemory(_displayStagingBufferMemories[i]);
+	}
 	_device.destroyImageView(_textureImageView);
 	_device.destroySampler(_textureSampler);
 	_device.destroyImage(_textureImage);
+	if (_view == View::ComputePathTraced) {
+		_device.destroyDescriptorPool(_traceDescriptorPool);
+		_device.destroyDescriptorSetLayout(_traceDescriptorSetLayout);
+		_device.destroyPipeline(_tracePipeline);
+		_device.destroyPipelineLayout(_tracePipelineLayout);
+		_device.destroyImageView(_accumulationImageView);
+		_device.destroyImage(_accumulationImage);
+		_device.freeMemory(_accumulationImageMemory);
+		_device.destroyBuffer(_traceNodeBuffer);
+		_device.freeMemory(_traceNodeBufferMemory);
+		_device.destroyBuffer(_traceTriangleBuffer);
+		_device.freeMemory(_traceTriangleBufferMemory);
+		_device.destroyBuffer(_traceMaterialBuffer);
+		_device.freeMemory(_traceMaterialBufferMemory);
+	}
 	_device.destroyDescriptorPool(_descriptorPool);
+	_device.destroyDescriptorPool(_clusterDescriptorPool);
+	_device.destroyDescriptorSetLayout(_clusterDescriptorSetLayout);
+	_device.destroyPipeline(_clusterCullPipeline);
+	_device.destroyPipelineLayout(_clusterPipelineLayout);
+	_device.destroyBuffer(_meshletBuffer);
+	_device.freeMemory(_meshletBufferMemory);
+	_device.destroyBuffer(_meshletVertexBuffer);
+	_device.freeMemory(_meshletVertexBufferMemory);
+	_device.destroyBuffer(_meshletTriangleBuffer);
+	_device.freeMemory(_meshletTriangleBufferMemory);
+	for (size_t i = 0; i < _clusterIndexBuffers.size(); ++i) {
+		_device.destroyBuffer(_clusterIndexBuffers[i]);
+		_device.freeMemory(_clusterIndexBufferMemories[i]);
+		_device.destroyBuffer(_clusterDrawBuffers[i]);
+		_device.freeMemory(_clusterDrawBufferMemories[i]);
+	}
 	_device.destroyBuffer(_vertexBuffer);
 	_device.freeMemory(_vertexBufferMemory);
-	_device.destroyBuffer(_indexBuffer);
-	_device.freeMemory(_indexBufferMemory);
 	_device.destroyCommandPool(_commandPool);
 	_device.destroy();
 	_instance.destroySurfaceKHR(_surface);
@@ -1108,6 +1803,9 @@ void Launcher::cleanupSwapchain() {
 		_device.destroyImageView(imageView);
 	}
 	_device.destroyPipeline(_graphicsPipeline);
+	if (_view != View::Rasterized) {
+		_device.destroyPipeline(_displayPipeline);
+	}
 	_device.destroyPipelineLayout(_pipelineLayout);
 	_device.destroyRenderPass(_renderPass);
 	_device.destroySwapchainKHR(_swapchain);
@@ -1,17 +1,32 @@
 #pragma once
+#include "culling.hh"
+#include "display.hh"
 #include "geometry.hh"
+#include "meshlet.hh"
+#include "pathtracer.hh"
+#include "progressive.hh"
+#include "scene.hh"
+#include "transform.hh"
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb\stb_image.h>
 #include <vulkan/vulkan.hpp>
 #include <GLFW/glfw3.h>
+#include <chrono>
+#include <memory>
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 
 class Launcher
 {
 public:
+	// Rasterized draws the scene, PathTraced shows it through the CPU path tracer instead and
+	// ComputePathTraced through shaders/pathtrace.comp, which runs on software devices like lavapipe too.
+	// the traced views accumulate passes while the window stays open
+	enum class View { Rasterized, PathTraced, ComputePathTraced };
+
 	//Launcher();
-	Launcher(int width, int height);
+	// an empty scenePath shows the built in textured quad
+	Launcher(int width, int height, const std::string& scenePath = "", View view = View::Rasterized);
 	//~Launcher();
 	void launch();
 	void setFramebufferResize(bool resized);
@@ -53,12 +68,9 @@ private:
 	std::vector<vk::Semaphore> _imageAvailableSemaphore;
 	std::vector<vk::Semaphore> _renderFinishedSemaphore;
 	std::vector<vk::Fence> _inFlightFences;
-	std::vector<Vertex> _vertices;
+	std::vector<vk::Fence> _imagesInFlight;
 	vk::Buffer _vertexBuffer;
 	vk::DeviceMemory _vertexBufferMemory;
-	std::vector<uint16_t> _indices;
-	vk::Buffer _indexBuffer;
-	vk::DeviceMemory _indexBufferMemory;
 	std::vector<vk::Buffer> _uniformBuffers;
 	std::vector<vk::DeviceMemory> _uniformBufferMemories; 
 	vk::DescriptorSetLayout _descriptorSetLayout;
@@ -68,6 +80,75 @@ private:
 	vk::ImageView _textureImageView;
 	vk::Sampler _textureSampler;
 	vk::DeviceMemory _textureImageMemory;
+	glm::mat4 _model;
+	glm::mat4 _proj;
+	glm::mat4 _viewProjection;
+	glm::vec3 _cameraPosition;
+	CullingSystem _culling;
+	std::string _scenePath;
+	SceneFile _scene;
+	// the node that gets drawn, the first one with a mesh
+	uint32_t _drawNode = kSceneNone;
+	// scene nodes keep their index as transform handle, the spin is a child of the draw node
+	TransformHierarchy _transforms;
+	uint32_t _spinTransform = kTransformNone;
+	uint32_t _currentLod = 0;
+	std::vector<uint32_t> _clusterTriangleCounts;
+	vk::Buffer _meshletBuffer;
+	vk::DeviceMemory _meshletBufferMemory;
+	vk::Buffer _meshletVertexBuffer;
+	vk::DeviceMemory _meshletVertexBufferMemory;
+	vk::Buffer _meshletTriangleBuffer;
+	vk::DeviceMemory _meshletTriangleBufferMemory;
+	std::vector<vk::Buffer> _clusterIndexBuffers;
+	std::vector<vk::DeviceMemory> _clusterIndexBufferMemories;
+	std::vector<vk::Buffer> _clusterDrawBuffers;
+	std::vector<vk::DeviceMemory> _clusterDrawBufferMemories;
+	vk::DescriptorSetLayout _clusterDescriptorSetLayout;
+	vk::DescriptorPool _clusterDescriptorPool;
+	std::vector<vk::DescriptorSet> _clusterDescriptorSets;
+	vk::PipelineLayout _clusterPipelineLayout;
+	vk::Pipeline _clusterCullPipeline;
+	// false without shaders/cluster_cull.spv, cullMeshlets then writes the host visible index buffers
+	bool _clusterCullOnGpu = true;
+	size_t _trianglesCulled = 0;
+	double _frameMilliseconds = 0;
+	std::chrono::high_resolution_clock::time_point _lastFrameTime;
+	std::chrono::high_resolution_clock::time_point _lastTitleTime;
+	View _view = View::Rasterized;
+	// the path traced view: passes resolve into the staging buffer of the frame in flight, which stays
+	// mapped, and the frame copies it into the texture image that the display pipeline samples
+
+	std::unique_ptr<PathTracer> _pathTracer;
+	std::unique_ptr<ProgressiveRenderer> _progressive;
+	DisplayResolver _display;
+	uint32_t _displayWidth = 0;
+	uint32_t _displayHeight = 0;
+	std::vector<vk::Buffer> _displayStagingBuffers;
+	std::vector<vk::DeviceMemory> _displayStagingBufferMemories;
+	std::vector<uint8_t*> _displayStagingTexels;
+	// the progressive renderer's update each staging buffer holds
+	std::vector<uint64_t> _displayUpdates;
+	vk::Pipeline _displayPipeline;
+	// the compute path traced view: every frame dispatches one pass into the accumulation image, which
+	// also writes the texture image the display pipeline samples, both stay in the general layout
+	uint32_t _tracePass = 0;
+	// ComputeScene::stackSize(), specializes the shader's traversal stack
+	uint32_t _traceStackSize = 0;
+	vk::Buffer _traceNodeBuffer;
+	vk::DeviceMemory _traceNodeBufferMemory;
+	vk::Buffer _traceTriangleBuffer;
+	vk::DeviceMemory _traceTriangleBufferMemory;
+	vk::Buffer _traceMaterialBuffer;
+	vk::DeviceMemory _traceMaterialBufferMemory;
+	vk::Image _accumulationImage;
+	vk::DeviceMemory _accumulationImageMemory;
+	vk::ImageView _accumulationImageView;
+	vk::DescriptorSetLayout _traceDescriptorSetLayout;
+	vk::DescriptorPool _traceDescriptorPool;
+	vk::DescriptorSet _traceDescriptorSet;
+	vk::PipelineLayout _tracePipelineLayout;
+	vk::Pipeline _tracePipeline;
 
 	int initializeVulkan();
 	void recreateSwapchain();
@@ -83,17 +164,26 @@ private:
 	void createSwapChain();
 	void createImageViews();
 	void createGraphicsPipeline();
+	void createDisplayPipeline();
 	void createRenderPass();
 	void createFramebuffers();
 	void createCommandPool();
 	void createCommandBuffers();
+	void recordCommandBuffer(uint32_t imageIndex);
 	void drawFrame();
 	void createSyncObjects();
 	void createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties,
 		vk::Buffer& buffer, vk::DeviceMemory& deviceMemory);
 	void copyBuffer(vk::Buffer srcBuffer, vk::Buffer dstBuffer, vk::DeviceSize size);
+	void loadScene();
 	void createVertexBuffer();
-	void createIndexBuffer();
+	void createDeviceLocalBuffer(const void *contents, vk::DeviceSize size, vk::BufferUsageFlags usage,
+		vk::Buffer& buffer, vk::DeviceMemory& deviceMemory);
+	void createClusterBuffers();
+	void createClusterCullPipeline();
+	void createClusterDescriptorSets();
+	void recordClusterCull(vk::CommandBuffer commandBuffer, uint32_t imageIndex, uint32_t drawId);
+	void updateFrameStatistics(uint32_t imageIndex);
 	uint32_t findMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags properties);
 	void createDescriptorSetLayout();
 	void createUniformBuffers();
@@ -111,4 +201,10 @@ private:
 	void copyBufferToImage(vk::Buffer buffer, vk::Image image, uint32_t width, uint32_t height);
 	void createTextureImageView();
 	void createTextureSampler();
+	void createDisplayTexture();
+	void recordDisplayUpload(vk::CommandBuffer commandBuffer);
+	void createPathTracePipeline();
+	void createPathTraceResources();
+	void createPathTraceDescriptorSet();
+	void recordPathTrace(vk::CommandBuffer commandBuffer);
 };
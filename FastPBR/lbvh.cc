@@ -0,0 +1,442 @@
+#include "bvh.hh"
+#include <chrono>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Linear bvh after Karras 2012: primitives are sorted along a morton curve, every interior node
+// finds its key range and split independently, and bounds are merged bottom up by whichever
+// thread reaches a node second. The optional pass after Karras and Aila 2013 rebuilds treelets
+// of up to seven leaves optimally under the sah during the same bottom up walk.
+
+namespace {
+
+const size_t kChunkSize = 16384;
+const uint32_t kRadixBits = 8;
+const uint32_t kRadixSize = 1 << kRadixBits;
+// 30 bit codes sort in half the passes, bigger inputs need the finer 63 bit grid to stay unique
+const size_t kMorton30Limit = 1 << 18;
+const uint32_t kTreeletLeaves = 7;
+// smaller subtrees have little to gain and would dominate the restructuring time
+const uint32_t kTreeletMinPrimitives = 32;
+const uint32_t kRestructurePasses = 2;
+const uint32_t kNone = ~0u;
+
+struct LinearNode {
+	Aabb bounds;
+	// primitive leaves keep their primitive in left
+	uint32_t left;
+	uint32_t right;
+	uint32_t parent;
+	uint32_t primitiveCount;
+	// sah cost scaled by the node's area, traversal and intersection cost 1 like Bvh::build
+	float cost;
+	bool collapse;
+};
+
+uint32_t countLeadingZeros(uint64_t value) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return 63 - index;
+#else
+	return __builtin_clzll(value);
+#endif
+}
+
+uint32_t popCount(uint32_t value) {
+#ifdef _MSC_VER
+	return __popcnt(value);
+#else
+	return __builtin_popcount(value);
+#endif
+}
+
+uint64_t expandBits10(uint64_t value) {
+	value &= 0x3ff;
+	value = (value | value << 16) & 0x030000ff;
+	value = (value | value << 8) & 0x0300f00f;
+	value = (value | value << 4) & 0x030c30c3;
+	value = (value | value << 2) & 0x09249249;
+	return value;
+}
+
+uint64_t expandBits21(uint64_t value) {
+	value &= 0x1fffff;
+	value = (value | value << 32) & 0x1f00000000ffffull;
+	value = (value | value << 16) & 0x1f0000ff0000ffull;
+	value = (value | value << 8) & 0x100f00f00f00f00full;
+	value = (value | value << 4) & 0x10c30c30c30c30c3ull;
+	value = (value | value << 2) & 0x1249249249249249ull;
+	return value;
+}
+
+// lsd radix sort of key and primitive pairs, chunks count and scatter in parallel
+void radixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, uint32_t keyBits, JobSystem& jobs) {
+	size_t count = keys.size();
+	size_t chunkCount = (count + kChunkSize - 1) / kChunkSize;
+	std::vector<uint64_t> keysOut(count);
+	std::vector<uint32_t> valuesOut(count);
+	std::vector<size_t> offsets(chunkCount * kRadixSize);
+	for (uint32_t shift = 0; shift < keyBits; shift += kRadixBits) {
+		jobs.parallelFor(chunkCount, 1, [&](size_t first, size_t last) {
+			for (size_t chunk = first; chunk < last; ++chunk) {
+				size_t *histogram = &offsets[chunk * kRadixSize];
+				std::fill(histogram, histogram + kRadixSize, 0);
+				size_t end = std::min(count, (chunk + 1) * kChunkSize);
+				for (size_t i = chunk * kChunkSize; i < end; ++i) {
+					++histogram[(keys[i] >> shift) & (kRadixSize - 1)];
+				}
+			}
+		});
+		// digit major prefix sum keeps the sort stable across chunks
+		size_t total = 0;
+		bool single = false;
+		for (uint32_t digit = 0; digit < kRadixSize; ++digit) {
+			size_t digitBegin = total;
+			for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+				size_t digitCount = offsets[chunk * kRadixSize + digit];
+				offsets[chunk * kRadixSize + digit] = total;
+				total += digitCount;
+			}
+			single |= total - digitBegin == count;
+		}
+		// nothing moves when every key has the same digit
+		if (single) {
+			continue;
+		}
+		jobs.parallelFor(chunkCount, 1, [&](size_t first, size_t last) {
+			for (size_t chunk = first; chunk < last; ++chunk) {
+				size_t *offset = &offsets[chunk * kRadixSize];
+				size_t end = std::min(count, (chunk + 1) * kChunkSize);
+				for (size_t i = chunk * kChunkSize; i < end; ++i) {
+					size_t target = offset[(keys[i] >> shift) & (kRadixSize - 1)]++;
+					keysOut[target] = keys[i];
+					valuesOut[target] = values[i];
+				}
+			}
+		});
+		keys.swap(keysOut);
+		values.swap(valuesOut);
+	}
+}
+
+class LinearBuilder
+{
+public:
+	LinearBuilder(const std::vector<uint64_t>& keys, const std::vector<uint32_t>& primitives,
+		const Aabb *primitiveBounds, JobSystem& jobs)
+		: _keys(keys), _jobs(jobs), _count((uint32_t)keys.size()), _nodes(keys.size() * 2 - 1),
+		_visits(keys.size() - 1) {
+		_nodes[root()].parent = kNone;
+		jobs.parallelFor(_count, kChunkSize, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				LinearNode& leaf = _nodes[leafNode((uint32_t)i)];
+				leaf.bounds = primitiveBounds[primitives[i]];
+				leaf.left = primitives[i];
+				leaf.right = kNone;
+				leaf.primitiveCount = 1;
+				leaf.cost = leaf.bounds.surfaceArea();
+				leaf.collapse = true;
+			}
+		});
+	}
+
+	uint32_t root() const { return 0; }
+	const LinearNode& node(uint32_t index) const { return _nodes[index]; }
+	bool isPrimitive(uint32_t index) const { return index >= _count - 1; }
+
+	void emitHierarchy() {
+		_jobs.parallelFor(_count - 1, kChunkSize, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				emitNode((int64_t)i);
+			}
+		});
+	}
+
+	// one thread per leaf walks up and stops at nodes whose other child is still pending
+	void propagateBounds(bool restructure) {
+		_jobs.parallelFor(_visits.size(), kChunkSize, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				_visits[i].store(0, std::memory_order_relaxed);
+			}
+		});
+		_jobs.parallelFor(_count, kChunkSize / 4, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				uint32_t index = _nodes[leafNode((uint32_t)i)].parent;
+				while (index != kNone && _visits[index].fetch_add(1, std::memory_order_acq_rel) == 1) {
+					updateNode(index);
+					if (restructure && _nodes[index].primitiveCount >= kTreeletMinPrimitives) {
+						restructureTreelet(index);
+					}
+					index = _nodes[index].parent;
+				}
+			}
+		});
+	}
+
+private:
+	const std::vector<uint64_t>& _keys;
+	JobSystem& _jobs;
+	uint32_t _count;
+	std::vector<LinearNode> _nodes;
+	std::vector<std::atomic<uint32_t>> _visits;
+
+	uint32_t leafNode(uint32_t position) const { return _count - 1 + position; }
+
+	// common prefix of two sorted keys, equal keys fall back to their positions
+	int32_t delta(int64_t i, int64_t j) const {
+		if (j < 0 || j >= _count) {
+			return -1;
+		}
+		uint64_t a = _keys[(size_t)i], b = _keys[(size_t)j];
+		if (a == b) {
+			return 64 + (int32_t)countLeadingZeros((uint64_t)(i ^ j)) - 32;
+		}
+		return (int32_t)countLeadingZeros(a ^ b);
+	}
+
+	void emitNode(int64_t i) {
+		// direction of the range from the longer prefix with a neighbour, then its length by doubling
+		// and bisection, then the split where the prefix changes
+		int64_t direction = delta(i, i + 1) - delta(i, i - 1) > 0 ? 1 : -1;
+		int32_t minimumDelta = delta(i, i - direction);
+		int64_t maximumLength = 2;
+		while (delta(i, i + maximumLength * direction) > minimumDelta) {
+			maximumLength *= 2;
+		}
+		int64_t length = 0;
+		for (int64_t step = maximumLength / 2; step >= 1; step /= 2) {
+			if (delta(i, i + (length + step) * direction) > minimumDelta) {
+				length += step;
+			}
+		}
+		int64_t j = i + length * direction;
+		int32_t nodeDelta = delta(i, j);
+		int64_t split = 0;
+		for (int64_t divisor = 2;; divisor *= 2) {
+			int64_t step = (length + divisor - 1) / divisor;
+			if (delta(i, i + (split + step) * direction) > nodeDelta) {
+				split += step;
+			}
+			if (step == 1) {
+				break;
+			}
+		}
+		uint32_t gamma = (uint32_t)(i + split * direction + std::min<int64_t>(direction, 0));
+
+		LinearNode& current = _nodes[(size_t)i];
+		current.left = std::min(i, j) == gamma ? leafNode(gamma) : gamma;
+		current.right = std::max(i, j) == gamma + 1 ? leafNode(gamma + 1) : gamma + 1;
+		_nodes[current.left].parent = (uint32_t)i;
+		_nodes[current.right].parent = (uint32_t)i;
+	}
+
+	void updateNode(uint32_t index) {
+		LinearNode& current = _nodes[index];
+		const LinearNode& left = _nodes[current.left];
+		const LinearNode& right = _nodes[current.right];
+		current.bounds = left.bounds;
+		current.bounds.grow(right.bounds);
+		current.primitiveCount = left.primitiveCount + right.primitiveCount;
+		float area = current.bounds.surfaceArea();
+		float splitCost = area + left.cost + right.cost;
+		float leafCost = area * current.primitiveCount;
+		current.collapse = current.primitiveCount <= Bvh::kMaxLeafSize && leafCost <= splitCost;
+		current.cost = current.collapse ? leafCost : splitCost;
+	}
+
+	void rewire(uint32_t subset, uint32_t index, const uint32_t *leaves, const uint32_t *interiors,
+		const uint32_t *partition, uint32_t& nextInterior) {
+		uint32_t sides[2] = { partition[subset], subset ^ partition[subset] };
+		uint32_t children[2];
+		for (int side = 0; side < 2; ++side) {
+			if (popCount(sides[side]) == 1) {
+				children[side] = leaves[popCount(sides[side] - 1)];
+			} else {
+				children[side] = interiors[nextInterior++];
+				rewire(sides[side], children[side], leaves, interiors, partition, nextInterior);
+			}
+			_nodes[children[side]].parent = index;
+		}
+		_nodes[index].left = children[0];
+		_nodes[index].right = children[1];
+		updateNode(index);
+	}
+
+	void restructureTreelet(uint32_t treeletRoot) {
+		// grow the treelet by opening the leaf with the biggest area, those have the most to gain
+		uint32_t leaves[kTreeletLeaves];
+		uint32_t interiors[kTreeletLeaves - 1];
+		uint32_t leafCount = 2, interiorCount = 1;
+		leaves[0] = _nodes[treeletRoot].left;
+		leaves[1] = _nodes[treeletRoot].right;
+		interiors[0] = treeletRoot;
+		while (leafCount < kTreeletLeaves) {
+			int32_t largest = -1;
+			float largestArea = -1.0f;
+			for (uint32_t i = 0; i < leafCount; ++i) {
+				if (isPrimitive(leaves[i])) {
+					continue;
+				}
+				float area = _nodes[leaves[i]].bounds.surfaceArea();
+				if (area > largestArea) {
+					largest = (int32_t)i;
+					largestArea = area;
+				}
+			}
+			if (largest < 0) {
+				break;
+			}
+			uint32_t opened = leaves[largest];
+			interiors[interiorCount++] = opened;
+			leaves[largest] = _nodes[opened].left;
+			leaves[leafCount++] = _nodes[opened].right;
+		}
+
+		// optimal topology for every subset of the treelet leaves, from small subsets to large ones
+		const uint32_t subsetCount = 1u << leafCount;
+		Aabb bounds[1 << kTreeletLeaves];
+		float cost[1 << kTreeletLeaves];
+		uint32_t primitiveCount[1 << kTreeletLeaves];
+		uint32_t partition[1 << kTreeletLeaves];
+		for (uint32_t subset = 1; subset < subsetCount; ++subset) {
+			uint32_t lowest = subset & (0 - subset);
+			if (subset == lowest) {
+				const LinearNode& leaf = _nodes[leaves[popCount(lowest - 1)]];
+				bounds[subset] = leaf.bounds;
+				cost[subset] = leaf.cost;
+				primitiveCount[subset] = leaf.primitiveCount;
+				continue;
+			}
+			bounds[subset] = bounds[subset ^ lowest];
+			bounds[subset].grow(bounds[lowest]);
+			primitiveCount[subset] = primitiveCount[subset ^ lowest] + primitiveCount[lowest];
+			// partitions holding the lowest leaf on the left, each split is seen once
+			uint32_t rest = subset ^ lowest;
+			float bestCost = cost[lowest] + cost[rest];
+			uint32_t bestPartition = lowest;
+			for (uint32_t part = (rest - 1) & rest; part; part = (part - 1) & rest) {
+				float partitionCost = cost[part | lowest] + cost[rest ^ part];
+				if (partitionCost < bestCost) {
+					bestCost = partitionCost;
+					bestPartition = part | lowest;
+				}
+			}
+			float area = bounds[subset].surfaceArea();
+			float leafCost = area * primitiveCount[subset];
+			cost[subset] = area + bestCost;
+			if (primitiveCount[subset] <= Bvh::kMaxLeafSize) {
+				cost[subset] = std::min(cost[subset], leafCost);
+			}
+			partition[subset] = bestPartition;
+		}
+		if (!(cost[subsetCount - 1] < _nodes[treeletRoot].cost * 0.999f)) {
+			return;
+		}
+
+		// rewire the treelet's interior nodes to the new topology, the root keeps its parent
+		uint32_t nextInterior = 1;
+		rewire(subsetCount - 1, treeletRoot, leaves, interiors, partition, nextInterior);
+	}
+};
+
+}
+
+void Bvh::buildLinear(const Aabb *primitiveBounds, size_t primitiveCount, bool restructure, JobSystem& jobs) {
+	auto startTime = std::chrono::high_resolution_clock::now();
+	_nodes.clear();
+	_refitRanges.clear();
+	_primitives.clear();
+	if (primitiveCount == 0) {
+		_lastBuildMilliseconds = 0;
+		return;
+	}
+
+	// centroid bounds span the morton grid
+	size_t chunkCount = (primitiveCount + kChunkSize - 1) / kChunkSize;
+	std::vector<Aabb> chunkBounds(chunkCount);
+	jobs.parallelFor(chunkCount, 1, [&](size_t first, size_t last) {
+		for (size_t chunk = first; chunk < last; ++chunk) {
+			size_t end = std::min(primitiveCount, (chunk + 1) * kChunkSize);
+			for (size_t i = chunk * kChunkSize; i < end; ++i) {
+				chunkBounds[chunk].grow(primitiveBounds[i].center());
+			}
+		}
+	});
+	Aabb centroidBounds;
+	for (const auto& bounds : chunkBounds) {
+		centroidBounds.grow(bounds);
+	}
+
+	bool wideKeys = primitiveCount > kMorton30Limit;
+	uint32_t bitsPerAxis = wideKeys ? 21 : 10;
+	float gridSize = (float)((1u << bitsPerAxis) - 1);
+	glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+	glm::vec3 scale;
+	for (int axis = 0; axis < 3; ++axis) {
+		scale[axis] = extent[axis] > 0.0f ? gridSize / extent[axis] : 0.0f;
+	}
+	std::vector<uint64_t> keys(primitiveCount);
+	std::vector<uint32_t> order(primitiveCount);
+	jobs.parallelFor(primitiveCount, kChunkSize, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			glm::vec3 cell = glm::min((primitiveBounds[i].center() - centroidBounds.min) * scale, gridSize);
+			uint64_t x = (uint64_t)cell.x, y = (uint64_t)cell.y, z = (uint64_t)cell.z;
+			keys[i] = wideKeys ? expandBits21(x) << 2 | expandBits21(y) << 1 | expandBits21(z)
+				: expandBits10(x) << 2 | expandBits10(y) << 1 | expandBits10(z);
+			order[i] = (uint32_t)i;
+		}
+	});
+	radixSort(keys, order, bitsPerAxis * 3, jobs);
+
+	LinearBuilder builder(keys, order, primitiveBounds, jobs);
+	builder.emitHierarchy();
+	for (uint32_t pass = 0; pass < (restructure ? kRestructurePasses : 1); ++pass) {
+		builder.propagateBounds(restructure);
+	}
+
+	// depth first like flatten(), collapsed subtrees gather their primitives into one leaf
+	_nodes.reserve(primitiveCount * 2 - 1);
+	_primitives.reserve(primitiveCount);
+	std::vector<std::pair<uint32_t, uint32_t>> stack;
+	std::vector<uint32_t> gather;
+	stack.push_back({ builder.root(), ~0u });
+	while (!stack.empty()) {
+		uint32_t buildIndex = stack.back().first;
+		uint32_t patch = stack.back().second;
+		stack.pop_back();
+		uint32_t index = (uint32_t)_nodes.size();
+		if (patch != ~0u) {
+			_nodes[patch].offset = index;
+		}
+		const LinearNode& buildNode = builder.node(buildIndex);
+		BvhNode node;
+		node.boundsMin = buildNode.bounds.min;
+		node.boundsMax = buildNode.bounds.max;
+		node.offset = 0;
+		node.count = 0;
+		if (buildNode.collapse) {
+			node.offset = (uint32_t)_primitives.size();
+			node.count = buildNode.primitiveCount;
+			gather.push_back(buildIndex);
+			while (!gather.empty()) {
+				uint32_t gathered = gather.back();
+				gather.pop_back();
+				if (builder.isPrimitive(gathered)) {
+					_primitives.push_back(builder.node(gathered).left);
+				} else {
+					gather.push_back(builder.node(gathered).right);
+					gather.push_back(builder.node(gathered).left);
+				}
+			}
+		} else {
+			stack.push_back({ buildNode.right, index });
+			stack.push_back({ buildNode.left, ~0u });
+		}
+		_nodes.push_back(node);
+	}
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	_lastBuildMilliseconds = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+}
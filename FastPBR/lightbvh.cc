@@ -0,0 +1,244 @@
+#include "lightbvh.hh"
+#include <glm/gtc/constants.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// u is rescaled at every choice, kept below one so rounding never leaves the range
+static const float kOneBelow = 0.99999994f;
+
+void LightBounds::grow(const LightBounds& other) {
+	if (other.bounds.empty()) {
+		return;
+	}
+	if (bounds.empty()) {
+		*this = other;
+		return;
+	}
+	bounds.grow(other.bounds);
+	power += other.power;
+
+	// smallest cone around both, after Conty and Kulla with lines instead of directions, so the other
+	// axis is flipped to the closer side and half a right angle already covers every line
+	const float kAnyLine = glm::half_pi<float>();
+	glm::vec3 otherAxis = glm::dot(axis, other.axis) < 0.0f ? -other.axis : other.axis;
+	float spread = std::acos(glm::clamp(cosSpread, 0.0f, 1.0f));
+	float otherSpread = std::acos(glm::clamp(other.cosSpread, 0.0f, 1.0f));
+	float between = std::acos(glm::clamp(glm::dot(axis, otherAxis), -1.0f, 1.0f));
+	if (std::min(between + otherSpread, kAnyLine) <= spread) {
+		return;
+	}
+	if (std::min(between + spread, kAnyLine) <= otherSpread) {
+		axis = otherAxis;
+		cosSpread = other.cosSpread;
+		return;
+	}
+	float merged = 0.5f * (spread + between + otherSpread);
+	glm::vec3 turn = glm::cross(axis, otherAxis);
+	if (merged >= kAnyLine || glm::dot(turn, turn) < 1e-12f) {
+		cosSpread = 0.0f;
+		return;
+	}
+	// rotate the axis toward the other one until the cone touches both edges
+	float rotation = merged - spread;
+	turn = glm::normalize(turn);
+	axis = glm::normalize(axis * std::cos(rotation) + glm::cross(turn, axis) * std::sin(rotation));
+	cosSpread = std::cos(merged);
+}
+
+float LightBounds::importance(const glm::vec3& point, const glm::vec3& normal) const {
+	if (!(power > 0.0f)) {
+		return 0.0f;
+	}
+	glm::vec3 center = bounds.center();
+	glm::vec3 offset = point - center;
+	float distance2 = glm::dot(offset, offset);
+	float radius2 = 0.25f * glm::dot(bounds.max - bounds.min, bounds.max - bounds.min);
+	// inside the bounding sphere every direction is possible and the distance means little
+	if (distance2 <= radius2) {
+		return power / std::max(radius2, 1e-12f);
+	}
+	glm::vec3 toPoint = offset / std::sqrt(distance2);
+	// angle the bounds subtend from the point
+	float sinBounds2 = radius2 / distance2;
+	float cosBounds = std::sqrt(1.0f - sinBounds2), sinBounds = std::sqrt(sinBounds2);
+
+	// emission: the normal closest to toPoint is the axis turned by the spread, then by the bounds
+	float cosAxis = std::abs(glm::dot(axis, toPoint));
+	float sinAxis = std::sqrt(std::max(0.0f, 1.0f - cosAxis * cosAxis));
+	float sinSpread = std::sqrt(std::max(0.0f, 1.0f - cosSpread * cosSpread));
+	float cosRemaining = 1.0f, sinRemaining = 0.0f;
+	if (cosAxis < cosSpread) {
+		cosRemaining = cosAxis * cosSpread + sinAxis * sinSpread;
+		sinRemaining = sinAxis * cosSpread - cosAxis * sinSpread;
+	}
+	float cosEmitted = cosRemaining >= cosBounds ? 1.0f : cosRemaining * cosBounds + sinRemaining * sinBounds;
+	if (cosEmitted <= 0.0f) {
+		return 0.0f;
+	}
+	// reception: the point only takes light from above its normal
+	float cosReceived = -glm::dot(normal, toPoint);
+	if (cosReceived < cosBounds) {
+		float sinReceived = std::sqrt(std::max(0.0f, 1.0f - cosReceived * cosReceived));
+		cosReceived = cosReceived * cosBounds + sinReceived * sinBounds;
+		if (cosReceived <= 0.0f) {
+			return 0.0f;
+		}
+	} else {
+		cosReceived = 1.0f;
+	}
+	return power * cosEmitted * cosReceived / distance2;
+}
+
+void LightBvh::build(const LightTriangle *lights, size_t lightCount, JobSystem& jobs) {
+	auto startTime = std::chrono::high_resolution_clock::now();
+	_lights.assign(lights, lights + lightCount);
+	_areas.resize(lightCount);
+	_lightBounds.resize(lightCount);
+	_lightLeaves.resize(lightCount);
+	std::vector<Aabb> boxes(lightCount);
+	jobs.parallelFor(lightCount, 1024, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			const LightTriangle& light = _lights[i];
+			glm::vec3 cross = glm::cross(light.corners[1] - light.corners[0], light.corners[2] - light.corners[0]);
+			float length = glm::length(cross);
+			glm::vec3 emission = glm::max(light.emission, glm::vec3(0.0f));
+			LightBounds& bounds = _lightBounds[i];
+			bounds = LightBounds();
+			for (const glm::vec3& corner : light.corners) {
+				bounds.bounds.grow(corner);
+			}
+			bounds.axis = length > 0.0f ? cross / length : glm::vec3(0.0f, 0.0f, 1.0f);
+			bounds.power = (0.2126f * emission.r + 0.7152f * emission.g + 0.0722f * emission.b) * 0.5f * length;
+			_areas[i] = 0.5f * length;
+			boxes[i] = bounds.bounds;
+		}
+	});
+	Bvh bvh;
+	bvh.build(boxes.data(), lightCount, jobs);
+	const std::vector<BvhNode>& nodes = bvh.nodes();
+	_leafLights = bvh.primitives();
+	_nodes.resize(nodes.size());
+	_parents.resize(nodes.size());
+	if (!nodes.empty()) {
+		_parents[0] = ~0u;
+	}
+
+	// leaves gather their lights in parallel, every node also tells its children where they hang
+	jobs.parallelFor(nodes.size(), 1024, [&](size_t begin, size_t end) {
+		for (size_t node = begin; node < end; ++node) {
+			const BvhNode& source = nodes[node];
+			Node& target = _nodes[node];
+			target.bounds = LightBounds();
+			target.offset = source.offset;
+			target.count = source.count;
+			if (!source.isLeaf()) {
+				_parents[node + 1] = (uint32_t)node;
+				_parents[source.offset] = (uint32_t)node;
+				continue;
+			}
+			for (uint32_t k = source.offset; k < source.offset + source.count; ++k) {
+				target.bounds.grow(_lightBounds[_leafLights[k]]);
+				_lightLeaves[_leafLights[k]] = (uint32_t)node;
+			}
+		}
+	});
+	// children are stored after their parents
+	for (size_t node = nodes.size(); node-- > 0;) {
+		Node& target = _nodes[node];
+		if (target.count == 0) {
+			target.bounds = _nodes[node + 1].bounds;
+			target.bounds.grow(_nodes[target.offset].bounds);
+		}
+	}
+	auto endTime = std::chrono::high_resolution_clock::now();
+	_lastBuildMilliseconds = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+}
+
+uint32_t LightBvh::select(const glm::vec3& point, const glm::vec3& normal, float u, float& probability) const {
+	probability = 0.0f;
+	if (_nodes.empty()) {
+		return ~0u;
+	}
+	float chance = 1.0f;
+	uint32_t node = 0;
+	while (_nodes[node].count == 0) {
+		uint32_t left = node + 1, right = _nodes[node].offset;
+		float leftImportance = _nodes[left].bounds.importance(point, normal);
+		float rightImportance = _nodes[right].bounds.importance(point, normal);
+		if (!(leftImportance + rightImportance > 0.0f)) {
+			return ~0u;
+		}
+		float leftChance = leftImportance / (leftImportance + rightImportance);
+		if (u < leftChance) {
+			u = std::min(u / leftChance, kOneBelow);
+			chance *= leftChance;
+			node = left;
+		} else {
+			u = std::min((u - leftChance) / (1.0f - leftChance), kOneBelow);
+			chance *= 1.0f - leftChance;
+			node = right;
+		}
+	}
+
+	// the same choice among the leaf's lights, one pass for the total and one to find u in it
+	const Node& leaf = _nodes[node];
+	float total = 0.0f;
+	for (uint32_t k = leaf.offset; k < leaf.offset + leaf.count; ++k) {
+		total += _lightBounds[_leafLights[k]].importance(point, normal);
+	}
+	if (!(total > 0.0f)) {
+		return ~0u;
+	}
+	float target = u * total, sum = 0.0f;
+	uint32_t picked = ~0u;
+	float pickedImportance = 0.0f;
+	for (uint32_t k = leaf.offset; k < leaf.offset + leaf.count; ++k) {
+		float importance = _lightBounds[_leafLights[k]].importance(point, normal);
+		if (importance > 0.0f) {
+			picked = _leafLights[k];
+			pickedImportance = importance;
+		}
+		sum += importance;
+		if (sum > target && importance > 0.0f) {
+			break;
+		}
+	}
+	probability = chance * pickedImportance / total;
+	return picked;
+}
+
+float LightBvh::selectionProbability(const glm::vec3& point, const glm::vec3& normal, uint32_t light) const {
+	uint32_t node = _lightLeaves[light];
+	const Node& leaf = _nodes[node];
+	float own = _lightBounds[light].importance(point, normal);
+	if (!(own > 0.0f)) {
+		return 0.0f;
+	}
+	float total = 0.0f;
+	for (uint32_t k = leaf.offset; k < leaf.offset + leaf.count; ++k) {
+		total += _lightBounds[_leafLights[k]].importance(point, normal);
+	}
+	float probability = own / total;
+	for (uint32_t parent = _parents[node]; parent != ~0u; node = parent, parent = _parents[parent]) {
+		float leftImportance = _nodes[parent + 1].bounds.importance(point, normal);
+		float rightImportance = _nodes[_nodes[parent].offset].bounds.importance(point, normal);
+		if (!(leftImportance + rightImportance > 0.0f)) {
+			return 0.0f;
+		}
+		probability *= (node == parent + 1 ? leftImportance : rightImportance) / (leftImportance + rightImportance);
+	}
+	return probability;
+}
+
+glm::vec3 LightBvh::samplePoint(uint32_t light, glm::vec2 u) const {
+	const LightTriangle& triangle = _lights[light];
+	float root = std::sqrt(u.x);
+	float b0 = 1.0f - root, b1 = u.y * root;
+	return triangle.corners[0] * b0 + triangle.corners[1] * b1 + triangle.corners[2] * (1.0f - b0 - b1);
+}
+
+size_t LightBvh::memoryBytes() const {
+	return _lights.size() * (sizeof(LightTriangle) + sizeof(float) + sizeof(LightBounds) + 2 * sizeof(uint32_t))
+		+ _nodes.size() * (sizeof(Node) + sizeof(uint32_t));
+}
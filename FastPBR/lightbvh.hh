@@ -0,0 +1,82 @@
+#pragma once
+#include "bvh.hh"
+#include "jobs.hh"
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+// an emitting triangle in world space, both faces emit
+struct LightTriangle {
+	glm::vec3 corners[3];
+	glm::vec3 emission;
+};
+
+// what a shading point needs to connect to a point on a light
+struct LightSample {
+	// unit vector from the shading point toward the light
+	glm::vec3 direction;
+	float distance;
+	glm::vec3 emission;
+	// over solid angle with the light's selection included, 0 when nothing was picked
+	float pdf;
+	uint32_t light;
+};
+
+// Bounds of a set of lights for Conty and Kulla's importance, "Importance Sampling of Many Lights
+// with Adaptive Tree Splitting": where they are, how much they emit and a cone around the lines their
+// normals lie on. Triangles emit on both faces, so an axis and its opposite mean the same.
+struct LightBounds {
+	Aabb bounds;
+	glm::vec3 axis = glm::vec3(0.0f, 0.0f, 1.0f);
+	// cos of the cone's half angle, 0 when the normals can point anywhere
+	float cosSpread = 1.0f;
+	float power = 0.0f;
+
+	void grow(const LightBounds& other);
+	// an upper estimate of what the lights give a point, normal facing where the point receives from
+	float importance(const glm::vec3& point, const glm::vec3& normal) const;
+};
+
+// Light bvh over emitting triangles. A sample walks down from the root picking either child in
+// proportion to its importance at the shading point, so a point near a few of thousands of lights
+// mostly picks those, and ends with the same choice among a leaf's lights. The topology is the binned
+// sah build of bvh.hh over the lights' boxes, the light bounds are gathered bottom up afterwards.
+class LightBvh
+{
+public:
+	void build(const LightTriangle *lights, size_t lightCount, JobSystem& jobs = JobSystem::shared());
+
+	bool empty() const { return _lights.empty(); }
+	size_t lightCount() const { return _lights.size(); }
+	// ~0u when no light can reach the point, probability is the chance the light was picked with
+	uint32_t select(const glm::vec3& point, const glm::vec3& normal, float u, float& probability) const;
+	// the chance select() picks light at the point, walking up from its leaf
+	float selectionProbability(const glm::vec3& point, const glm::vec3& normal, uint32_t light) const;
+	// uniform over the triangle's area
+	glm::vec3 samplePoint(uint32_t light, glm::vec2 u) const;
+
+	const LightTriangle& light(uint32_t light) const { return _lights[light]; }
+	float area(uint32_t light) const { return _areas[light]; }
+	const glm::vec3& normal(uint32_t light) const { return _lightBounds[light].axis; }
+	size_t memoryBytes() const;
+	double lastBuildMilliseconds() const { return _lastBuildMilliseconds; }
+
+private:
+	struct Node {
+		LightBounds bounds;
+		// interior: index of the second child, the first one follows, leaf: first entry in _leafLights
+		uint32_t offset;
+		// 0 for interior nodes
+		uint32_t count;
+	};
+
+	std::vector<LightTriangle> _lights;
+	std::vector<float> _areas;
+	std::vector<LightBounds> _lightBounds;
+	std::vector<Node> _nodes;
+	std::vector<uint32_t> _parents;
+	// light indices in leaf order and the leaf of every light
+	std::vector<uint32_t> _leafLights;
+	std::vector<uint32_t> _lightLeaves;
+	double _lastBuildMilliseconds = 0;
+};
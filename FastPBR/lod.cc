@@ -0,0 +1,52 @@
+#include "lod.hh"
+#include "simplify.hh"
+#include <algorithm>
+#include <cfloat>
+
+std::vector<MeshLod> buildLodChain(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+	std::vector<uint32_t>& lodIndices, uint32_t maxLodCount, float reduction) {
+	std::vector<MeshLod> lods;
+	std::vector<uint32_t> current = indices;
+	float error = 0;
+
+	while (lods.size() < maxLodCount) {
+		MeshLod lod;
+		lod.indexOffset = (uint32_t)lodIndices.size();
+		lod.indexCount = (uint32_t)current.size();
+		lod.error = error;
+		lods.push_back(lod);
+		lodIndices.insert(lodIndices.end(), current.begin(), current.end());
+
+		// simplifying the previous lod is much cheaper than starting over, errors add up conservatively
+		size_t target = (size_t)(current.size() / 3 * reduction) * 3;
+		float stepError = 0;
+		std::vector<uint32_t> next = simplifyMesh(vertices, current, target, FLT_MAX, &stepError);
+		// stop once simplification stalls, locked borders and seams eventually take over
+		if (next.empty() || next.size() > current.size() * (reduction + 1.0f) / 2.0f) {
+			break;
+		}
+		current.swap(next);
+		error += stepError;
+	}
+	return lods;
+}
+
+float lodPixelScale(const glm::mat4& proj, float viewportHeight) {
+	// proj[1][1] is cot(fovy / 2)
+	return proj[1][1] * viewportHeight * 0.5f;
+}
+
+uint32_t selectLod(const MeshLod *lods, uint32_t lodCount, const glm::vec4& sphere, float scale,
+	const glm::vec3& cameraPosition, float pixelScale, float thresholdPixels) {
+	// distance to the closest point of the bounds so the error is never underestimated
+	float distance = std::max(glm::length(glm::vec3(sphere) - cameraPosition) - sphere.w, 1e-4f);
+	float errorLimit = thresholdPixels * distance / (pixelScale * scale);
+	uint32_t selected = 0;
+	for (uint32_t lod = 1; lod < lodCount; ++lod) {
+		if (lods[lod].error > errorLimit) {
+			break;
+		}
+		selected = lod;
+	}
+	return selected;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include "geometry.hh"
+#include <cstdint>
+#include <vector>
+
+struct MeshLod {
+	uint32_t indexOffset;
+	uint32_t indexCount;
+	// object space deviation from lod 0
+	float error;
+};
+
+// lod 0 is the input, every following lod keeps about reduction of the previous triangles.
+// the chain stops early once simplification stalls. lod index ranges are appended to lodIndices
+std::vector<MeshLod> buildLodChain(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+	std::vector<uint32_t>& lodIndices, uint32_t maxLodCount = 8, float reduction = 0.5f);
+
+// pixels per object space unit at distance 1, proj is the matrix built in updateUniformBuffer
+float lodPixelScale(const glm::mat4& proj, float viewportHeight);
+
+// coarsest lod whose error projects to at most thresholdPixels, sphere is the instance bounds in
+// world space and scale the instance scale so object space errors can be converted
+uint32_t selectLod(const MeshLod *lods, uint32_t lodCount, const glm::vec4& sphere, float scale,
+	const glm::vec3& cameraPosition, float pixelScale, float thresholdPixels = 1.0f);
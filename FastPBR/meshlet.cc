@@ -0,0 +1,215 @@
+#include "meshlet.hh"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <stdexcept>
+
+static const uint32_t kNoIndex = ~0u;
+
+size_t MeshletMesh::triangleCount() const {
+	return triangles.size();
+}
+
+static void computeMeshletBounds(Meshlet& meshlet, const MeshletMesh& mesh, const std::vector<glm::vec3>& positions) {
+	glm::vec3 lower(FLT_MAX), upper(-FLT_MAX);
+	for (uint32_t i = 0; i < meshlet.vertexCount; ++i) {
+		const glm::vec3& position = positions[mesh.vertices[meshlet.vertexOffset + i]];
+		lower = glm::min(lower, position);
+		upper = glm::max(upper, position);
+	}
+	glm::vec3 center = (lower + upper) * 0.5f;
+	float radius = 0;
+	for (uint32_t i = 0; i < meshlet.vertexCount; ++i) {
+		radius = std::max(radius, glm::length(positions[mesh.vertices[meshlet.vertexOffset + i]] - center));
+	}
+	meshlet.sphere = glm::vec4(center, radius);
+
+	// normal cone, counter clockwise triangles face their normal
+	std::vector<glm::vec3> normals;
+	normals.reserve(meshlet.triangleCount);
+	glm::vec3 axis(0.0f);
+	for (uint32_t i = 0; i < meshlet.triangleCount; ++i) {
+		uint32_t packed = mesh.triangles[meshlet.triangleOffset + i];
+		const glm::vec3& a = positions[mesh.vertices[meshlet.vertexOffset + (packed & 0xff)]];
+		const glm::vec3& b = positions[mesh.vertices[meshlet.vertexOffset + ((packed >> 8) & 0xff)]];
+		const glm::vec3& c = positions[mesh.vertices[meshlet.vertexOffset + ((packed >> 16) & 0xff)]];
+		glm::vec3 normal = glm::cross(b - a, c - a);
+		float length = glm::length(normal);
+		if (length > 0) {
+			normals.push_back(normal / length);
+			axis += normals.back();
+		}
+	}
+
+	meshlet.cone = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	if (normals.empty() || glm::length(axis) < 1e-6f) {
+		return;
+	}
+	axis = glm::normalize(axis);
+	float minDot = 1;
+	for (const auto& normal : normals) {
+		minDot = std::min(minDot, glm::dot(normal, axis));
+	}
+	// cones wider than ~85 degrees reject next to nothing
+	if (minDot <= 0.1f) {
+		return;
+	}
+	// the backface region is the normal cone widened by 90 degrees and flipped, cos(a + 90) = -sin(a)
+	meshlet.cone = glm::vec4(axis, std::sqrt(1 - minDot * minDot));
+}
+
+MeshletMesh buildMeshlets(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices,
+	uint32_t maxVertices, uint32_t maxTriangles) {
+	if (maxVertices < 3 || maxVertices > 256 || maxTriangles < 1) {
+		throw std::invalid_argument("meshlet limits out of range!");
+	}
+	size_t triangleCount = indices.size() / 3;
+
+	// triangles around every vertex
+	std::vector<uint32_t> adjacencyOffsets(positions.size() + 1, 0);
+	for (uint32_t index : indices) {
+		adjacencyOffsets[index + 1]++;
+	}
+	for (size_t i = 1; i < adjacencyOffsets.size(); ++i) {
+		adjacencyOffsets[i] += adjacencyOffsets[i - 1];
+	}
+	std::vector<uint32_t> adjacency(indices.size());
+	std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (size_t i = 0; i < indices.size(); ++i) {
+		adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+	}
+
+	MeshletMesh mesh;
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<uint32_t> localIndex(positions.size(), kNoIndex);
+	std::vector<uint32_t> candidates;
+	size_t seed = 0;
+
+	auto triangleCenter = [&](uint32_t triangle) {
+		return (positions[indices[triangle * 3]] + positions[indices[triangle * 3 + 1]]
+			+ positions[indices[triangle * 3 + 2]]) / 3.0f;
+	};
+	auto newVertexCount = [&](uint32_t triangle) {
+		uint32_t count = 0;
+		for (int corner = 0; corner < 3; ++corner) {
+			count += localIndex[indices[triangle * 3 + corner]] == kNoIndex;
+		}
+		return count;
+	};
+
+	while (true) {
+		while (seed < triangleCount && emitted[seed]) {
+			++seed;
+		}
+		if (seed == triangleCount) {
+			break;
+		}
+
+		Meshlet meshlet = {};
+		meshlet.vertexOffset = (uint32_t)mesh.vertices.size();
+		meshlet.triangleOffset = (uint32_t)mesh.triangles.size();
+		candidates.clear();
+		glm::vec3 centerSum(0.0f);
+
+		uint32_t triangle = (uint32_t)seed;
+		while (triangle != kNoIndex) {
+			uint32_t packed = 0;
+			for (int corner = 0; corner < 3; ++corner) {
+				uint32_t vertex = indices[triangle * 3 + corner];
+				if (localIndex[vertex] == kNoIndex) {
+					localIndex[vertex] = meshlet.vertexCount++;
+					mesh.vertices.push_back(vertex);
+				}
+				packed |= localIndex[vertex] << (corner * 8);
+				candidates.insert(candidates.end(), adjacency.begin() + adjacencyOffsets[vertex],
+					adjacency.begin() + adjacencyOffsets[vertex + 1]);
+			}
+			mesh.triangles.push_back(packed);
+			meshlet.triangleCount++;
+			centerSum += triangleCenter(triangle);
+			emitted[triangle] = true;
+
+			if (meshlet.triangleCount == maxTriangles) {
+				break;
+			}
+
+			// next up is the neighbour adding the fewest vertices, ties go to the one closest to the
+			// meshlet center which keeps meshlets round and their bounds tight
+			glm::vec3 center = centerSum / (float)meshlet.triangleCount;
+			triangle = kNoIndex;
+			uint32_t bestNewVertices = 4;
+			float bestDistance = FLT_MAX;
+			size_t kept = 0;
+			for (uint32_t candidate : candidates) {
+				if (emitted[candidate]) {
+					continue;
+				}
+				candidates[kept++] = candidate;
+				uint32_t newVertices = newVertexCount(candidate);
+				if (meshlet.vertexCount + newVertices > maxVertices || newVertices > bestNewVertices) {
+					continue;
+				}
+				glm::vec3 offset = triangleCenter(candidate) - center;
+				float distance = glm::dot(offset, offset);
+				if (newVertices < bestNewVertices || distance < bestDistance) {
+					triangle = candidate;
+					bestNewVertices = newVertices;
+					bestDistance = distance;
+				}
+			}
+			candidates.resize(kept);
+		}
+
+		for (uint32_t i = 0; i < meshlet.vertexCount; ++i) {
+			localIndex[mesh.vertices[meshlet.vertexOffset + i]] = kNoIndex;
+		}
+		computeMeshletBounds(meshlet, mesh, positions);
+		mesh.meshlets.push_back(meshlet);
+	}
+	return mesh;
+}
+
+uint32_t appendMeshlets(MeshletMesh& mesh, const MeshletMesh& other) {
+	uint32_t first = (uint32_t)mesh.meshlets.size();
+	uint32_t vertexOffset = (uint32_t)mesh.vertices.size();
+	uint32_t triangleOffset = (uint32_t)mesh.triangles.size();
+	for (Meshlet meshlet : other.meshlets) {
+		meshlet.vertexOffset += vertexOffset;
+		meshlet.triangleOffset += triangleOffset;
+		mesh.meshlets.push_back(meshlet);
+	}
+	mesh.vertices.insert(mesh.vertices.end(), other.vertices.begin(), other.vertices.end());
+	mesh.triangles.insert(mesh.triangles.end(), other.triangles.begin(), other.triangles.end());
+	return first;
+}
+
+bool isMeshletBackfacing(const Meshlet& meshlet, const glm::vec3& cameraPosition) {
+	if (meshlet.cone.w >= 1) {
+		return false;
+	}
+	glm::vec3 toMeshlet = glm::vec3(meshlet.sphere) - cameraPosition;
+	return glm::dot(toMeshlet, glm::vec3(meshlet.cone)) >= meshlet.cone.w * glm::length(toMeshlet) + meshlet.sphere.w;
+}
+
+uint32_t cullMeshlets(const Meshlet *meshlets, const uint32_t *meshletVertices, const uint32_t *meshletTriangles,
+	uint32_t first, uint32_t count, const Frustum& frustum, const glm::vec3& cameraPosition, uint32_t *indices) {
+	uint32_t indexCount = 0;
+	for (uint32_t m = first; m < first + count; ++m) {
+		const Meshlet& meshlet = meshlets[m];
+		glm::vec3 center(meshlet.sphere);
+		bool outside = false;
+		for (const glm::vec4& plane : frustum.planes) {
+			outside = outside || glm::dot(glm::vec3(plane), center) + plane.w < -meshlet.sphere.w;
+		}
+		if (outside || isMeshletBackfacing(meshlet, cameraPosition)) {
+			continue;
+		}
+		for (uint32_t i = 0; i < meshlet.triangleCount; ++i) {
+			uint32_t packed = meshletTriangles[meshlet.triangleOffset + i];
+			for (uint32_t corner = 0; corner < 3; ++corner) {
+				indices[indexCount++] = meshletVertices[meshlet.vertexOffset + (packed >> (corner * 8) & 0xff)];
+			}
+		}
+	}
+	return indexCount;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "culling.hh"
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+// matches struct Meshlet in shaders/cluster_cull.comp (std430)
+struct Meshlet {
+	uint32_t vertexOffset;		// into MeshletMesh::vertices
+	uint32_t triangleOffset;	// into MeshletMesh::triangles
+	uint32_t vertexCount;
+	uint32_t triangleCount;
+	glm::vec4 sphere;			// object space center, radius in w
+	glm::vec4 cone;				// normal cone axis, cutoff in w (1 when the cone can't cull)
+};
+
+// meshlets stored back to back, every meshlet indexes into its own slice of vertices and triangles
+struct MeshletMesh {
+	static const uint32_t kMaxVertices = 64;
+	static const uint32_t kMaxTriangles = 124;
+
+	std::vector<Meshlet> meshlets;
+	// mesh vertex index for every meshlet local vertex
+	std::vector<uint32_t> vertices;
+	// one triangle per entry, three meshlet local 8 bit indices packed low to high
+	std::vector<uint32_t> triangles;
+
+	size_t triangleCount() const;
+};
+
+// greedy clustering that grows each meshlet through triangles sharing its vertices
+MeshletMesh buildMeshlets(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices,
+	uint32_t maxVertices = MeshletMesh::kMaxVertices, uint32_t maxTriangles = MeshletMesh::kMaxTriangles);
+
+// appends other behind the meshlets already in mesh, returns the index of its first meshlet
+uint32_t appendMeshlets(MeshletMesh& mesh, const MeshletMesh& other);
+
+// same test the compute pass runs, cameraPosition in object space
+bool isMeshletBackfacing(const Meshlet& meshlet, const glm::vec3& cameraPosition);
+
+// shaders/cluster_cull.comp on the cpu, for when the launcher has no compiled shader: the mesh indices of the
+// triangles of meshlets first to first + count that pass the frustum and cone tests go to indices in meshlet
+// order, returns how many. frustum and cameraPosition in object space
+uint32_t cullMeshlets(const Meshlet *meshlets, const uint32_t *meshletVertices, const uint32_t *meshletTriangles,
+	uint32_t first, uint32_t count, const Frustum& frustum, const glm::vec3& cameraPosition, uint32_t *indices);
@@ -0,0 +1,332 @@
+#include "packet.hh"
+#include <immintrin.h>
+#include <algorithm>
+#include <cmath>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+
+// lane groups of the widest vectors the build allows
+#if defined(__AVX__)
+typedef __m256 Lanes;
+const uint32_t kLaneWidth = 8;
+inline Lanes load(const float *values) { return _mm256_load_ps(values); }
+inline void store(float *values, Lanes lanes) { _mm256_store_ps(values, lanes); }
+inline Lanes broadcast(float value) { return _mm256_set1_ps(value); }
+inline Lanes add(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+inline Lanes sub(Lanes a, Lanes b) { return _mm256_sub_ps(a, b); }
+inline Lanes mul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+inline Lanes div(Lanes a, Lanes b) { return _mm256_div_ps(a, b); }
+inline Lanes min(Lanes a, Lanes b) { return _mm256_min_ps(a, b); }
+inline Lanes max(Lanes a, Lanes b) { return _mm256_max_ps(a, b); }
+inline Lanes lessEqual(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+inline Lanes less(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline Lanes notEqual(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_OQ); }
+inline Lanes both(Lanes a, Lanes b) { return _mm256_and_ps(a, b); }
+inline Lanes select(Lanes mask, Lanes a, Lanes b) { return _mm256_blendv_ps(b, a, mask); }
+inline uint32_t bits(Lanes mask) { return (uint32_t)_mm256_movemask_ps(mask); }
+inline Lanes fromBits(uint32_t mask) {
+	const __m256i lanes = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	__m256i selected = _mm256_and_si256(_mm256_set1_epi32((int)mask), lanes);
+	return _mm256_castsi256_ps(_mm256_cmpeq_epi32(selected, lanes));
+}
+#else
+typedef __m128 Lanes;
+const uint32_t kLaneWidth = 4;
+inline Lanes load(const float *values) { return _mm_load_ps(values); }
+inline void store(float *values, Lanes lanes) { _mm_store_ps(values, lanes); }
+inline Lanes broadcast(float value) { return _mm_set1_ps(value); }
+inline Lanes add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+inline Lanes sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+inline Lanes mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+inline Lanes div(Lanes a, Lanes b) { return _mm_div_ps(a, b); }
+inline Lanes min(Lanes a, Lanes b) { return _mm_min_ps(a, b); }
+inline Lanes max(Lanes a, Lanes b) { return _mm_max_ps(a, b); }
+inline Lanes lessEqual(Lanes a, Lanes b) { return _mm_cmple_ps(a, b); }
+inline Lanes less(Lanes a, Lanes b) { return _mm_cmplt_ps(a, b); }
+inline Lanes notEqual(Lanes a, Lanes b) { return _mm_cmpneq_ps(a, b); }
+inline Lanes both(Lanes a, Lanes b) { return _mm_and_ps(a, b); }
+inline Lanes select(Lanes mask, Lanes a, Lanes b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+inline uint32_t bits(Lanes mask) { return (uint32_t)_mm_movemask_ps(mask); }
+inline Lanes fromBits(uint32_t mask) {
+	const __m128i lanes = _mm_setr_epi32(1, 2, 4, 8);
+	__m128i selected = _mm_and_si128(_mm_set1_epi32((int)mask), lanes);
+	return _mm_castsi128_ps(_mm_cmpeq_epi32(selected, lanes));
+}
+#endif
+
+struct Interval {
+	float lower;
+	float upper;
+};
+
+Interval multiply(Interval a, Interval b) {
+	float products[4] = { a.lower * b.lower, a.lower * b.upper, a.upper * b.lower, a.upper * b.upper };
+	return { *std::min_element(products, products + 4), *std::max_element(products, products + 4) };
+}
+
+// per packet constants of the traversal
+template <uint32_t Size>
+struct PacketSetup {
+	static const uint32_t kGroups = Size / kLaneWidth;
+
+	alignas(32) float inverseX[Size];
+	alignas(32) float inverseY[Size];
+	alignas(32) float inverseZ[Size];
+	// bounds of origins and inverse directions, only valid when every ray agrees on the direction signs
+	Interval origin[3];
+	Interval inverse[3];
+	float tMin;
+	float tMax;
+	bool coherent;
+	// summed direction, orders the children near to far for the whole packet
+	glm::vec3 direction;
+
+	PacketSetup(const RayPacket<Size>& packet, uint32_t activeMask) {
+		const float *origins[3] = { packet.originX, packet.originY, packet.originZ };
+		const float *directions[3] = { packet.directionX, packet.directionY, packet.directionZ };
+		float *inverses[3] = { inverseX, inverseY, inverseZ };
+		coherent = true;
+		direction = glm::vec3(0.0f);
+		tMin = FLT_MAX;
+		tMax = -FLT_MAX;
+		for (int axis = 0; axis < 3; ++axis) {
+			origin[axis] = { FLT_MAX, -FLT_MAX };
+			inverse[axis] = { FLT_MAX, -FLT_MAX };
+			bool positive = false, negative = false;
+			for (uint32_t lane = 0; lane < Size; ++lane) {
+				inverses[axis][lane] = 1.0f / directions[axis][lane];
+				if (!(activeMask >> lane & 1)) {
+					continue;
+				}
+				origin[axis].lower = std::min(origin[axis].lower, origins[axis][lane]);
+				origin[axis].upper = std::max(origin[axis].upper, origins[axis][lane]);
+				inverse[axis].lower = std::min(inverse[axis].lower, inverses[axis][lane]);
+				inverse[axis].upper = std::max(inverse[axis].upper, inverses[axis][lane]);
+				positive |= inverses[axis][lane] >= 0.0f;
+				negative |= inverses[axis][lane] < 0.0f;
+				direction[axis] += directions[axis][lane];
+			}
+			coherent &= !(positive && negative) && std::isfinite(inverse[axis].lower)
+				&& std::isfinite(inverse[axis].upper);
+		}
+		for (uint32_t lane = 0; lane < Size; ++lane) {
+			if (activeMask >> lane & 1) {
+				tMin = std::min(tMin, packet.tMin[lane]);
+				tMax = std::max(tMax, packet.tMax[lane]);
+			}
+		}
+	}
+
+	// false when no ray of the packet can enter the box
+	bool intersectsInterval(const BvhNode& node) const {
+		if (!coherent) {
+			return true;
+		}
+		float entry = tMin, exit = tMax;
+		for (int axis = 0; axis < 3; ++axis) {
+			Interval lower = multiply({ node.boundsMin[axis] - origin[axis].upper,
+				node.boundsMin[axis] - origin[axis].lower }, inverse[axis]);
+			Interval upper = multiply({ node.boundsMax[axis] - origin[axis].upper,
+				node.boundsMax[axis] - origin[axis].lower }, inverse[axis]);
+			// the slab's near plane depends on the shared direction sign
+			bool negative = inverse[axis].upper < 0.0f;
+			entry = std::max(entry, negative ? upper.lower : lower.lower);
+			exit = std::min(exit, negative ? lower.upper : upper.upper);
+		}
+		return entry <= exit;
+	}
+
+	// lanes of activeMask whose ray enters the box before limit
+	uint32_t intersectLanes(const BvhNode& node, const RayPacket<Size>& packet, const float *limit,
+		uint32_t activeMask) const {
+		uint32_t mask = 0;
+		for (uint32_t group = 0; group < kGroups; ++group) {
+			uint32_t groupMask = activeMask >> (group * kLaneWidth) & ((1u << kLaneWidth) - 1);
+			if (!groupMask) {
+				continue;
+			}
+			uint32_t first = group * kLaneWidth;
+			Lanes x0 = mul(sub(broadcast(node.boundsMin.x), load(packet.originX + first)), load(inverseX + first));
+			Lanes x1 = mul(sub(broadcast(node.boundsMax.x), load(packet.originX + first)), load(inverseX + first));
+			Lanes y0 = mul(sub(broadcast(node.boundsMin.y), load(packet.originY + first)), load(inverseY + first));
+			Lanes y1 = mul(sub(broadcast(node.boundsMax.y), load(packet.originY + first)), load(inverseY + first));
+			Lanes z0 = mul(sub(broadcast(node.boundsMin.z), load(packet.originZ + first)), load(inverseZ + first));
+			Lanes z1 = mul(sub(broadcast(node.boundsMax.z), load(packet.originZ + first)), load(inverseZ + first));
+			Lanes entry = max(max(min(x0, x1), min(y0, y1)), max(min(z0, z1), load(packet.tMin + first)));
+			Lanes exit = min(min(max(x0, x1), max(y0, y1)), min(max(z0, z1), load(limit + first)));
+			mask |= (bits(lessEqual(entry, exit)) & groupMask) << first;
+		}
+		return mask;
+	}
+};
+
+// one triangle against every lane of mask with the arithmetic of intersectTriangle, returns the hit lanes.
+// the lanes' limit is the closest hit so far, closest hits are written back when update is set
+template <uint32_t Size>
+uint32_t intersectTriangleLanes(RayPacket<Size>& packet, const float *limit, const glm::vec3 *corners,
+	uint32_t triangle, uint32_t mask, bool update) {
+	const glm::vec3& p0 = corners[(size_t)triangle * 3];
+	glm::vec3 edge1 = corners[(size_t)triangle * 3 + 1] - p0;
+	glm::vec3 edge2 = corners[(size_t)triangle * 3 + 2] - p0;
+	const Lanes e1x = broadcast(edge1.x), e1y = broadcast(edge1.y), e1z = broadcast(edge1.z);
+	const Lanes e2x = broadcast(edge2.x), e2y = broadcast(edge2.y), e2z = broadcast(edge2.z);
+	const Lanes zero = broadcast(0.0f), one = broadcast(1.0f);
+	uint32_t hitMask = 0;
+	for (uint32_t group = 0; group < Size / kLaneWidth; ++group) {
+		uint32_t groupMask = mask >> (group * kLaneWidth) & ((1u << kLaneWidth) - 1);
+		if (!groupMask) {
+			continue;
+		}
+		uint32_t first = group * kLaneWidth;
+		Lanes dx = load(packet.directionX + first), dy = load(packet.directionY + first);
+		Lanes dz = load(packet.directionZ + first);
+		Lanes px = sub(mul(dy, e2z), mul(e2y, dz));
+		Lanes py = sub(mul(dz, e2x), mul(e2z, dx));
+		Lanes pz = sub(mul(dx, e2y), mul(e2x, dy));
+		Lanes determinant = add(add(mul(e1x, px), mul(e1y, py)), mul(e1z, pz));
+		Lanes valid = both(fromBits(groupMask), notEqual(determinant, zero));
+		Lanes inverseDeterminant = div(one, determinant);
+		Lanes sx = sub(load(packet.originX + first), broadcast(p0.x));
+		Lanes sy = sub(load(packet.originY + first), broadcast(p0.y));
+		Lanes sz = sub(load(packet.originZ + first), broadcast(p0.z));
+		Lanes u = mul(add(add(mul(sx, px), mul(sy, py)), mul(sz, pz)), inverseDeterminant);
+		valid = both(valid, both(lessEqual(zero, u), lessEqual(u, one)));
+		Lanes qx = sub(mul(sy, e1z), mul(e1y, sz));
+		Lanes qy = sub(mul(sz, e1x), mul(e1z, sx));
+		Lanes qz = sub(mul(sx, e1y), mul(e1x, sy));
+		Lanes v = mul(add(add(mul(dx, qx), mul(dy, qy)), mul(dz, qz)), inverseDeterminant);
+		valid = both(valid, both(lessEqual(zero, v), lessEqual(add(u, v), one)));
+		Lanes t = mul(add(add(mul(e2x, qx), mul(e2y, qy)), mul(e2z, qz)), inverseDeterminant);
+		valid = both(valid, both(lessEqual(load(packet.tMin + first), t), less(t, load(limit + first))));
+		uint32_t groupHits = bits(valid);
+		if (!groupHits) {
+			continue;
+		}
+		hitMask |= groupHits << first;
+		if (update) {
+			store(packet.t + first, select(valid, t, load(packet.t + first)));
+			store(packet.u + first, select(valid, u, load(packet.u + first)));
+			store(packet.v + first, select(valid, v, load(packet.v + first)));
+			for (uint32_t lane = 0; lane < kLaneWidth; ++lane) {
+				if (groupHits >> lane & 1) {
+					packet.triangle[first + lane] = triangle;
+				}
+			}
+		}
+	}
+	return hitMask;
+}
+
+template <uint32_t Size>
+uint32_t traversePacket(const Bvh& bvh, const glm::vec3 *corners, RayPacket<Size>& packet, uint32_t activeMask,
+	bool anyHit) {
+	const std::vector<BvhNode>& nodes = bvh.nodes();
+	const std::vector<uint32_t>& primitives = bvh.primitives();
+	if (nodes.empty() || !activeMask) {
+		return 0;
+	}
+	PacketSetup<Size> setup(packet, activeMask);
+	// closest hits shrink the lanes' intervals, tMax is the inclusive end like intersectTriangle's
+	alignas(32) float limit[Size];
+	for (uint32_t lane = 0; lane < Size; ++lane) {
+		limit[lane] = anyHit ? std::nextafter(packet.tMax[lane], FLT_MAX)
+			: std::min(std::nextafter(packet.tMax[lane], FLT_MAX), packet.t[lane]);
+	}
+
+	uint32_t stack[Bvh::kStackSize];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = 0;
+	uint32_t occluded = 0;
+	while (stackSize > 0) {
+		const BvhNode& node = nodes[stack[--stackSize]];
+		if (!setup.intersectsInterval(node)) {
+			continue;
+		}
+		uint32_t nodeMask = setup.intersectLanes(node, packet, limit, activeMask);
+		if (!nodeMask) {
+			continue;
+		}
+		if (node.isLeaf()) {
+			for (uint32_t i = node.offset; i < node.offset + node.count && nodeMask; ++i) {
+				uint32_t hitMask = intersectTriangleLanes(packet, limit, corners, primitives[i], nodeMask, !anyHit);
+				for (uint32_t lane = 0; hitMask >> lane; ++lane) {
+					if (hitMask >> lane & 1) {
+						limit[lane] = anyHit ? -FLT_MAX : packet.t[lane];
+					}
+				}
+				if (anyHit) {
+					// occluded lanes are done
+					occluded |= hitMask;
+					nodeMask &= ~hitMask;
+					activeMask &= ~hitMask;
+					if (!activeMask) {
+						return occluded;
+					}
+				}
+			}
+			continue;
+		}
+		// the child lying further along the packet's mean direction waits on the stack
+		uint32_t nearChild = (uint32_t)(&node - nodes.data()) + 1, farChild = node.offset;
+		const BvhNode& first = nodes[nearChild];
+		const BvhNode& second = nodes[farChild];
+		glm::vec3 offset = second.boundsMin + second.boundsMax - first.boundsMin - first.boundsMax;
+		if (glm::dot(setup.direction, offset) < 0.0f) {
+			std::swap(nearChild, farChild);
+		}
+		stack[stackSize++] = farChild;
+		stack[stackSize++] = nearChild;
+	}
+	return occluded;
+}
+
+}
+
+template <uint32_t Size>
+void RayPacket<Size>::setRay(uint32_t lane, const Ray& ray) {
+	originX[lane] = ray.origin.x;
+	originY[lane] = ray.origin.y;
+	originZ[lane] = ray.origin.z;
+	directionX[lane] = ray.direction.x;
+	directionY[lane] = ray.direction.y;
+	directionZ[lane] = ray.direction.z;
+	tMin[lane] = ray.tMin;
+	tMax[lane] = ray.tMax;
+	t[lane] = FLT_MAX;
+	u[lane] = 0.0f;
+	v[lane] = 0.0f;
+	triangle[lane] = ~0u;
+}
+
+template <uint32_t Size>
+RayHit RayPacket<Size>::hit(uint32_t lane) const {
+	RayHit result;
+	result.t = t[lane];
+	result.u = u[lane];
+	result.v = v[lane];
+	result.triangle = triangle[lane];
+	return result;
+}
+
+template <uint32_t Size>
+void intersectPacket(const Bvh& bvh, const glm::vec3 *corners, RayPacket<Size>& packet, uint32_t activeMask) {
+	traversePacket(bvh, corners, packet, activeMask, false);
+}
+
+template <uint32_t Size>
+uint32_t occludedPacket(const Bvh& bvh, const glm::vec3 *corners, const RayPacket<Size>& packet,
+	uint32_t activeMask) {
+	// any hit never writes hits, the copy only keeps the packet's interface const
+	RayPacket<Size> shadow = packet;
+	return traversePacket(bvh, corners, shadow, activeMask, true);
+}
+
+template struct RayPacket<8>;
+template struct RayPacket<16>;
+template void intersectPacket<8>(const Bvh&, const glm::vec3*, RayPacket<8>&, uint32_t);
+template void intersectPacket<16>(const Bvh&, const glm::vec3*, RayPacket<16>&, uint32_t);
+template uint32_t occludedPacket<8>(const Bvh&, const glm::vec3*, const RayPacket<8>&, uint32_t);
+template uint32_t occludedPacket<16>(const Bvh&, const glm::vec3*, const RayPacket<16>&, uint32_t);
@@ -0,0 +1,46 @@
+#pragma once
+#include "bvh.hh"
+#include "ray.hh"
+#include <cstdint>
+#include <vector>
+
+// Size rays in SoA lanes, Size is 8 or 16. setRay() also clears the lane's hit.
+template <uint32_t Size>
+struct alignas(32) RayPacket {
+	static const uint32_t kAllLanes = (uint32_t)((1ull << Size) - 1);
+
+	float originX[Size];
+	float originY[Size];
+	float originZ[Size];
+	float directionX[Size];
+	float directionY[Size];
+	float directionZ[Size];
+	float tMin[Size];
+	float tMax[Size];
+	// closest hit per lane, t stays FLT_MAX on a miss
+	float t[Size];
+	float u[Size];
+	float v[Size];
+	uint32_t triangle[Size];
+
+	void setRay(uint32_t lane, const Ray& ray);
+	RayHit hit(uint32_t lane) const;
+};
+
+// Packet traversal of a triangle bvh with three corners per triangle, as given to Bvh::buildTriangles.
+// Every node is first tested against the packet as a whole with interval arithmetic over its origins
+// and directions, which rejects subtrees for the entire frustum of a coherent packet, then every
+// active ray gets its own SIMD slab test. Hits are those of Bvh::intersect with intersectTriangle up to
+// rounding, the lanes and the scalar test may contract to fma differently.
+// Closest hit packets don't pay off: in bench packets primary rays trace at 0.6 to 0.9 times the single
+// ray rate through the binary bvh in 8 ray packets and 0.8 to 1.5 times in 16 ray ones, both behind
+// single rays through Bvh8, so the renderers trace single rays.
+template <uint32_t Size>
+void intersectPacket(const Bvh& bvh, const glm::vec3 *corners, RayPacket<Size>& packet,
+	uint32_t activeMask = RayPacket<Size>::kAllLanes);
+
+// shadow rays, returns the lanes that hit anything between tMin and tMax. lanes stop at their first hit,
+// coherent packets of them run 1 to 5 times faster than closest hit single rays
+template <uint32_t Size>
+uint32_t occludedPacket(const Bvh& bvh, const glm::vec3 *corners, const RayPacket<Size>& packet,
+	uint32_t activeMask = RayPacket<Size>::kAllLanes);
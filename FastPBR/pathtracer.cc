@@ -0,0 +1,585 @@
+#include "pathtracer.hh"
+#include "jobs.hh"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <glm/gtc/constants.hpp>
+#include <iostream>
+
+static float luminance(const glm::vec3& color) {
+	return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+}
+
+glm::vec3 PathTracer::sky(const glm::vec3& direction) {
+	float t = 0.5f * (direction.y + 1.0f);
+	return glm::mix(glm::vec3(1.0f), glm::vec3(0.5f, 0.7f, 1.0f), t);
+}
+
+glm::vec3 PathTracer::environment(const glm::vec3& direction) const {
+	return _environment ? _environment->radiance(direction) : sky(direction);
+}
+
+void PathTracer::setScene(const SceneFile& scene) {
+	_meshes.clear();
+	_instances.clear();
+	_instanceMeshes.clear();
+	_instanceMaterials.clear();
+	_nodeInstances.assign(scene.nodes().size(), ~0u);
+	_materials.assign(scene.materials().begin(), scene.materials().end());
+	// nodes without a material get a white one
+	SceneMaterial fallback = {};
+	fallback.baseColor = glm::vec4(1.0f);
+	fallback.roughness = 1.0f;
+	fallback.baseColorTexture = kSceneNone;
+	fallback.metallicRoughnessTexture = kSceneNone;
+	uint32_t fallbackMaterial = (uint32_t)_materials.size();
+	_materials.push_back(fallback);
+
+	auto vertices = scene.vertices();
+	_texCoords.resize(vertices.size());
+	for (size_t i = 0; i < vertices.size(); ++i) {
+		_texCoords[i] = vertices[i].texCoord;
+	}
+
+	// lod 0 of every mesh in its own space, the blases have to stay put once instances point at them
+	auto indices = scene.indices();
+	_meshes.resize(scene.meshes().size());
+	std::vector<glm::vec3> positions;
+	for (size_t mesh = 0; mesh < scene.meshes().size(); ++mesh) {
+		const MeshLod& lod = scene.lods()[scene.meshes()[mesh].firstLod];
+		positions.clear();
+		_meshes[mesh].corners.assign(indices.begin() + lod.indexOffset, indices.begin() + lod.indexOffset
+			+ lod.indexCount);
+		for (uint32_t vertex : _meshes[mesh].corners) {
+			positions.push_back(vertices[vertex].pos);
+		}
+		_meshes[mesh].blas.build(positions.data(), lod.indexCount / 3);
+	}
+	for (size_t node = 0; node < scene.nodes().size(); ++node) {
+		const SceneNode& sceneNode = scene.nodes()[node];
+		if (sceneNode.mesh == kSceneNone) {
+			continue;
+		}
+		_nodeInstances[node] = (uint32_t)_instances.size();
+		_instances.push_back({ sceneNode.world, &_meshes[sceneNode.mesh].blas });
+		_instanceMeshes.push_back(sceneNode.mesh);
+		_instanceMaterials.push_back(sceneNode.material == kSceneNone ? fallbackMaterial : sceneNode.material);
+	}
+	_tlas.build(_instances.data(), _instances.size());
+	buildLights();
+	_instancesMoved = false;
+
+	// asking for the size loads every texture once, so a missing file shows up here
+	_textureCache.clear();
+	for (uint32_t i = 0; i < scene.textures().size(); ++i) {
+		_textureCache.addTexture(scene.texturePath(i));
+		if (_textureCache.width(i) == 0) {
+			std::cerr << "failed to load texture " << scene.texturePath(i) << ", using white" << std::endl;
+		}
+	}
+}
+
+void PathTracer::render(const UniformBufferObject& frame, HdrImage& target) {
+	if (_instancesMoved) {
+		_tlas.build(_instances.data(), _instances.size(), *_jobs);
+		buildLights();
+		_instancesMoved = false;
+	}
+	_lastRenderCancelled = false;
+	// unproject through the same matrices basic.vert uses, vulkan ndc has y pointing down
+	glm::mat4 inverseViewProjection = glm::inverse(frame.invert * frame.proj * frame.view);
+	// the angle one pixel spans at the image center starts every path's ray cone
+	auto direction = [&](glm::vec2 ndc) {
+		glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndc, 0.0f, 1.0f);
+		glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+		return glm::normalize(glm::vec3(farPoint) / farPoint.w - glm::vec3(nearPoint) / nearPoint.w);
+	};
+	glm::vec3 center = direction(glm::vec2(0.0f)), neighbour = direction(glm::vec2(2.0f / target.width, 0.0f));
+	_pixelSpread = std::atan2(glm::length(glm::cross(center, neighbour)), glm::dot(center, neighbour));
+	uint32_t firstSample = _frameIndex++ * _samplesPerPixel;
+	if (_features && (_features->width != target.width || _features->height != target.height)) {
+		_features->resize(target.width, target.height);
+	}
+	if (_schedule == Schedule::Wavefront) {
+		renderWavefront(inverseViewProjection, firstSample, target);
+	} else {
+		renderPixels(inverseViewProjection, firstSample, target);
+	}
+}
+
+void PathTracer::buildLights() {
+	// ranges first so every instance writes its own triangles
+	_instanceLights.assign(_instances.size(), ~0u);
+	uint32_t lightCount = 0;
+	for (size_t instance = 0; instance < _instances.size(); ++instance) {
+		if (glm::vec3(_materials[_instanceMaterials[instance]].emissive) != glm::vec3(0.0f)) {
+			_instanceLights[instance] = lightCount;
+			lightCount += (uint32_t)_instances[instance].blas->triangleCount();
+		}
+	}
+	std::vector<LightTriangle> lights(lightCount);
+	_jobs->parallelFor(_instances.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t instance = begin; instance < end; ++instance) {
+			uint32_t first = _instanceLights[instance];
+			if (first == ~0u) {
+				continue;
+			}
+			const BlasInstance& blasInstance = _instances[instance];
+			glm::vec3 emission(_materials[_instanceMaterials[instance]].emissive);
+			for (uint32_t triangle = 0; triangle < blasInstance.blas->triangleCount(); ++triangle) {
+				const glm::vec3 *corners = blasInstance.blas->corners(triangle);
+				LightTriangle& light = lights[first + triangle];
+				for (int k = 0; k < 3; ++k) {
+					light.corners[k] = glm::vec3(blasInstance.transform * glm::vec4(corners[k], 1.0f));
+				}
+				light.emission = emission;
+			}
+		}
+	});
+	_lights.build(lights.data(), lights.size(), *_jobs);
+}
+
+void PathTracer::renderPixels(const glm::mat4& inverseViewProjection, uint32_t firstSample, HdrImage& target) {
+	uint32_t tilesX = (target.width + kTileSize - 1) / kTileSize;
+	uint32_t tilesY = (target.height + kTileSize - 1) / kTileSize;
+	// neighbouring chunks of the curve stay close on screen, stolen work too
+	std::vector<uint32_t> tiles = hilbertTileOrder(tilesX, tilesY);
+	if (_tileSampleOffsets) {
+		tiles.erase(std::remove_if(tiles.begin(), tiles.end(), [&](uint32_t tile) {
+			return _tileSampleOffsets[tile] == kSkipTile;
+		}), tiles.end());
+	}
+	std::atomic<uint64_t> rayCount{ 0 };
+
+	_jobs->parallelFor(tiles.size(), 1, [&](size_t begin, size_t end) {
+		uint64_t jobRayCount = 0;
+		for (size_t i = begin; i < end && !cancelled(); ++i) {
+			uint32_t tile = tiles[i];
+			uint32_t x0 = (uint32_t)(tile % tilesX) * kTileSize;
+			uint32_t y0 = (uint32_t)(tile / tilesX) * kTileSize;
+			uint32_t tileFirstSample = _tileSampleOffsets ? _tileSampleOffsets[tile] : firstSample;
+			for (uint32_t y = y0; y < std::min(y0 + kTileSize, target.height); ++y) {
+				for (uint32_t x = x0; x < std::min(x0 + kTileSize, target.width); ++x) {
+					glm::vec3 color(0.0f);
+					FeatureSum features;
+					for (uint32_t sample = 0; sample < _samplesPerPixel; ++sample) {
+						Sampler sampler(_samplerType, x, y, _seed, tileFirstSample + sample);
+						FirstHit firstHit;
+						glm::vec3 radiance = trace(cameraRay(inverseViewProjection, x, y, target, sampler), sampler,
+							jobRayCount, _features ? &firstHit : nullptr);
+						color += radiance;
+						if (_features) {
+							features.add(firstHit, radiance);
+						}
+					}
+					target.at(x, y) = color / (float)_samplesPerPixel;
+					if (_features) {
+						features.store(*_features, (size_t)y * target.width + x);
+					}
+				}
+			}
+		}
+		rayCount += jobRayCount;
+	});
+	_lastRayCount = rayCount.load();
+	_lastRenderCancelled = cancelled();
+}
+
+Ray PathTracer::cameraRay(const glm::mat4& inverseViewProjection, uint32_t x, uint32_t y, const HdrImage& target,
+	Sampler& sampler) const {
+	sampler.startSet(kCameraSet);
+	float u0 = sampler.next(), u1 = sampler.next();
+	glm::vec2 ndc((x + u0) / target.width * 2.0f - 1.0f, (y + u1) / target.height * 2.0f - 1.0f);
+	glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndc, 0.0f, 1.0f);
+	glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+	Ray ray;
+	ray.origin = glm::vec3(nearPoint) / nearPoint.w;
+	ray.direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - ray.origin);
+	ray.tMin = 0.0f;
+	ray.tMax = FLT_MAX;
+	return ray;
+}
+
+void PathTracer::setSchedule(Schedule schedule) {
+	_schedule = schedule;
+}
+
+void PathTracer::setJobSystem(JobSystem& jobs) {
+	_jobs = &jobs;
+}
+
+void PathTracer::setCancelFlag(const std::atomic<bool> *cancel) {
+	_cancel = cancel;
+}
+
+void PathTracer::setEnvironment(const EnvironmentMap *environment) {
+	_environment = environment && !environment->empty() ? environment : nullptr;
+}
+
+void PathTracer::setEnvironmentSampling(EnvironmentSampling sampling) {
+	_environmentSampling = sampling;
+}
+
+void PathTracer::setLightSampling(LightSampling sampling) {
+	_lightSampling = sampling;
+}
+
+void PathTracer::setSampler(Sampler::Type type, uint32_t seed) {
+	_samplerType = type;
+	_seed = seed;
+}
+
+void PathTracer::restartSequences() {
+	_frameIndex = 0;
+}
+
+void PathTracer::setTileSampleOffsets(const uint32_t *offsets) {
+	_tileSampleOffsets = offsets;
+}
+
+void PathTracer::setFeatureBuffers(FeatureBuffers *features) {
+	_features = features;
+}
+
+void PathTracer::FeatureSum::add(const FirstHit& firstHit, const glm::vec3& radiance) {
+	albedo += firstHit.albedo;
+	if (firstHit.depth != std::numeric_limits<float>::infinity()) {
+		normal += firstHit.normal;
+		depth += firstHit.depth;
+		++hits;
+	}
+	// illumination is what the denoiser filters, the albedo goes back on after
+	double sample = luminance(radiance / glm::max(firstHit.albedo, glm::vec3(1e-3f)));
+	illumination += sample;
+	squaredIllumination += sample * sample;
+	++samples;
+}
+
+void PathTracer::FeatureSum::store(FeatureBuffers& features, size_t pixel) const {
+	features.albedo[pixel] = albedo / (float)samples;
+	features.normals[pixel] = hits > 0 && normal != glm::vec3(0.0f) ? glm::normalize(normal) : glm::vec3(0.0f);
+	features.depths[pixel] = hits > 0 ? depth / hits : std::numeric_limits<float>::infinity();
+	double mean = illumination / samples;
+	features.luminances[pixel] = (float)mean;
+	// sample variance over the count, the variance of the mean
+	features.variances[pixel] = samples > 1 ? (float)(std::max(0.0, squaredIllumination - mean * illumination)
+		/ ((double)(samples - 1) * samples)) : 0.0f;
+}
+
+void PathTracer::setSamplesPerPixel(uint32_t samplesPerPixel) {
+	_samplesPerPixel = std::max(1u, samplesPerPixel);
+}
+
+uint32_t PathTracer::samplesPerPixel() const {
+	return _samplesPerPixel;
+}
+
+void PathTracer::setMaxBounces(uint32_t maxBounces) {
+	_maxBounces = maxBounces;
+}
+
+void PathTracer::setNodeTransform(uint32_t node, const glm::mat4& world) {
+	uint32_t instance = _nodeInstances[node];
+	if (instance != ~0u) {
+		_instances[instance].transform = world;
+		_instancesMoved = true;
+	}
+}
+
+size_t PathTracer::triangleCount() const {
+	size_t count = 0;
+	for (const BlasInstance& instance : _instances) {
+		count += instance.blas->triangleCount();
+	}
+	return count;
+}
+
+uint64_t PathTracer::lastRayCount() const {
+	return _lastRayCount;
+}
+
+bool PathTracer::intersect(const Ray& ray, InstanceHit& hit) const {
+	return _tlas.intersect(ray, hit);
+}
+
+glm::vec3 PathTracer::trace(Ray ray, Sampler& sampler, uint64_t& rayCount, FirstHit *firstHit) const {
+	glm::vec3 radiance(0.0f);
+	glm::vec3 throughput(1.0f);
+	float pdf = 0.0f;
+	glm::vec3 normal(0.0f);
+	RayCone cone = { 0.0f, _pixelSpread };
+	for (uint32_t bounce = 0;; ++bounce) {
+		InstanceHit hit;
+		++rayCount;
+		if (!intersect(ray, hit)) {
+			radiance += throughput * escapedRadiance(ray.direction, pdf);
+			break;
+		}
+
+		const SceneMaterial& material = _materials[_instanceMaterials[hit.instance]];
+		radiance += throughput * emittedRadiance(material, hit, ray, pdf, normal);
+		if (bounce == _maxBounces) {
+			break;
+		}
+		cone.width += cone.spread * hit.t;
+		Surface surface = surfaceAt(hit, ray, cone.width);
+		applyMaterial(material, surface);
+		if (bounce == 0 && firstHit) {
+			*firstHit = { surface.material.baseColor, surface.normal, hit.t };
+		}
+		radiance += throughput * directLight(surface, surface.toLocal(-ray.direction), bounce, sampler, rayCount);
+		normal = surface.normal;
+		if (!scatter(surface, bounce, ray, throughput, sampler, pdf)) {
+			break;
+		}
+		cone.spread += bsdf::bsdfAlpha(surface.material.roughness);
+	}
+	return radiance;
+}
+
+PathTracer::Surface PathTracer::surfaceAt(const InstanceHit& hit, const Ray& ray, float coneWidth) const {
+	const Mesh& mesh = _meshes[_instanceMeshes[hit.instance]];
+	const glm::vec3 *corners = mesh.blas.corners(hit.triangle);
+	const uint32_t *vertices = &mesh.corners[(size_t)hit.triangle * 3];
+	glm::vec2 texCoord = _texCoords[vertices[0]] * (1.0f - hit.u - hit.v) + _texCoords[vertices[1]] * hit.u
+		+ _texCoords[vertices[2]] * hit.v;
+	Surface surface;
+	surface.position = ray.origin + ray.direction * hit.t;
+	surface.normal = glm::normalize(_tlas.normalTransform(hit.instance)
+		* glm::cross(corners[1] - corners[0], corners[2] - corners[0]));
+	if (glm::dot(surface.normal, ray.direction) > 0.0f) {
+		surface.normal = -surface.normal;
+	}
+	// branchless orthonormal basis, Duff et al.
+	const glm::vec3& normal = surface.normal;
+	float sign = std::copysign(1.0f, normal.z);
+	float a = -1.0f / (sign + normal.z);
+	float b = normal.x * normal.y * a;
+	surface.tangent = glm::vec3(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+	surface.bitangent = glm::vec3(b, sign + normal.y * normal.y * a, -normal.y);
+
+	// the cone's cross section laid onto the surface, stretched along the ray by the incidence, and carried
+	// into texture space by the triangle's uv mapping
+	glm::vec3 along = ray.direction - normal * glm::dot(ray.direction, normal);
+	along = glm::dot(along, along) > 1e-12f ? glm::normalize(along) : surface.tangent;
+	float radius = 0.5f * coneWidth;
+	glm::vec3 axisAlong = along * (radius / std::max(std::abs(glm::dot(ray.direction, normal)), 1e-3f));
+	glm::vec3 axisAcross = glm::cross(normal, along) * radius;
+	const glm::mat3 toWorld(_tlas.instance(hit.instance).transform);
+	glm::vec3 edge1 = toWorld * (corners[1] - corners[0]), edge2 = toWorld * (corners[2] - corners[0]);
+	glm::vec2 uvEdge1 = _texCoords[vertices[1]] - _texCoords[vertices[0]];
+	glm::vec2 uvEdge2 = _texCoords[vertices[2]] - _texCoords[vertices[0]];
+	float e11 = glm::dot(edge1, edge1), e12 = glm::dot(edge1, edge2), e22 = glm::dot(edge2, edge2);
+	float determinant = e11 * e22 - e12 * e12;
+	float inverse = determinant > 0.0f ? 1.0f / determinant : 0.0f;
+	// a vector in the triangle's plane as a edge1 + b edge2, by the normal equations
+	auto toTexture = [&](const glm::vec3& offset) {
+		float d1 = glm::dot(offset, edge1), d2 = glm::dot(offset, edge2);
+		return uvEdge1 * ((e22 * d1 - e12 * d2) * inverse) + uvEdge2 * ((e11 * d2 - e12 * d1) * inverse);
+	};
+	surface.footprint = { texCoord, toTexture(axisAlong), toTexture(axisAcross) };
+	return surface;
+}
+
+// gltf packs roughness in green and metallic in blue
+static bsdf::BsdfMaterial shadingMaterial(const SceneMaterial& material, const glm::vec3& baseColor,
+	const glm::vec3& metallicRoughness) {
+	bsdf::BsdfMaterial shading;
+	shading.baseColor = glm::vec3(material.baseColor) * baseColor;
+	shading.metallic = glm::clamp(material.metallic * metallicRoughness.b, 0.0f, 1.0f);
+	shading.roughness = glm::clamp(material.roughness * metallicRoughness.g, 0.0f, 1.0f);
+	return shading;
+}
+
+void PathTracer::applyMaterial(const SceneMaterial& material, Surface& surface) const {
+	surface.material = shadingMaterial(material, _textureCache.sample(material.baseColorTexture, surface.footprint, true),
+		_textureCache.sample(material.metallicRoughnessTexture, surface.footprint, false));
+}
+
+void PathTracer::applyMaterialLanes(const SceneMaterial& material, Surface surfaces[8]) const {
+	TextureFootprint footprints[8];
+	for (uint32_t lane = 0; lane < 8; ++lane) {
+		footprints[lane] = surfaces[lane].footprint;
+	}
+	glm::vec3 baseColors[8], metallicRoughness[8];
+	_textureCache.sampleLanes(material.baseColorTexture, footprints, true, baseColors);
+	_textureCache.sampleLanes(material.metallicRoughnessTexture, footprints, false, metallicRoughness);
+	for (uint32_t lane = 0; lane < 8; ++lane) {
+		surfaces[lane].material = shadingMaterial(material, baseColors[lane], metallicRoughness[lane]);
+	}
+}
+
+bool PathTracer::scatter(const Surface& surface, uint32_t bounce, Ray& ray, glm::vec3& throughput,
+	Sampler& sampler, float& pdf) const {
+	sampler.startSet(bounceSet(bounce, kBsdfSet));
+	float u0 = sampler.next(), u1 = sampler.next(), u2 = sampler.next();
+	glm::vec3 wi;
+	glm::vec3 weight = bsdf::sampleBsdf(surface.material, surface.toLocal(-ray.direction), u0, u1, u2, wi, pdf);
+	return continuePath(surface, weight, wi, bounce, ray, throughput, sampler);
+}
+
+bool PathTracer::continuePath(const Surface& surface, const glm::vec3& weight, const glm::vec3& wi, uint32_t bounce,
+	Ray& ray, glm::vec3& throughput, Sampler& sampler) const {
+	throughput *= weight;
+	if (throughput == glm::vec3(0.0f)) {
+		return false;
+	}
+	if (bounce >= 2) {
+		float survival = std::min(0.95f, std::max(throughput.r, std::max(throughput.g, throughput.b)));
+		if (sampler.next() >= survival) {
+			return false;
+		}
+		throughput /= survival;
+	}
+	ray.origin = surface.rayOrigin();
+	ray.direction = glm::normalize(surface.toWorld(wi));
+	ray.tMin = 0.0f;
+	ray.tMax = FLT_MAX;
+	return true;
+}
+
+glm::vec3 PathTracer::sampleEnvironment(glm::vec2 u, float& pdf) const {
+	if (_environmentSampling == EnvironmentSampling::Importance && _environment) {
+		return _environment->sample(u, pdf);
+	}
+	float z = 1.0f - 2.0f * u.x;
+	float radius = std::sqrt(std::max(0.0f, 1.0f - z * z));
+	float phi = glm::two_pi<float>() * u.y;
+	pdf = 0.25f * glm::one_over_pi<float>();
+	return glm::vec3(radius * std::cos(phi), z, radius * std::sin(phi));
+}
+
+float PathTracer::environmentPdf(const glm::vec3& direction) const {
+	if (_environmentSampling == EnvironmentSampling::Importance && _environment) {
+		return _environment->pdf(direction);
+	}
+	return 0.25f * glm::one_over_pi<float>();
+}
+
+// power heuristic with beta 2, Veach
+static float misWeight(float pdf, float otherPdf) {
+	float pdf2 = pdf * pdf, otherPdf2 = otherPdf * otherPdf;
+	return pdf2 > 0.0f ? pdf2 / (pdf2 + otherPdf2) : 0.0f;
+}
+
+glm::vec3 PathTracer::escapedRadiance(const glm::vec3& direction, float bsdfPdf) const {
+	// camera rays and the BSDF alone have nothing to share the environment with
+	if (_environmentSampling == EnvironmentSampling::Bsdf || bsdfPdf <= 0.0f) {
+		return environment(direction);
+	}
+	return environment(direction) * misWeight(bsdfPdf, environmentPdf(direction));
+}
+
+glm::vec3 PathTracer::connectEnvironment(const Surface& surface, const glm::vec3& direction, float lightPdf,
+	const glm::vec3& value, float bsdfPdf, uint64_t& rayCount) const {
+	if (!(lightPdf > 0.0f) || value == glm::vec3(0.0f)) {
+		return glm::vec3(0.0f);
+	}
+	Ray shadow;
+	shadow.origin = surface.rayOrigin();
+	shadow.direction = direction;
+	shadow.tMin = 0.0f;
+	shadow.tMax = FLT_MAX;
+	InstanceHit hit;
+	++rayCount;
+	if (intersect(shadow, hit)) {
+		return glm::vec3(0.0f);
+	}
+	return value * environment(direction) * (misWeight(lightPdf, bsdfPdf) / lightPdf);
+}
+
+glm::vec3 PathTracer::directLight(const Surface& surface, const glm::vec3& wo, uint32_t bounce, Sampler& sampler,
+	uint64_t& rayCount) const {
+	glm::vec3 radiance(0.0f);
+	float bsdfPdf;
+	if (_environmentSampling != EnvironmentSampling::Bsdf) {
+		sampler.startSet(bounceSet(bounce, kEnvironmentSet));
+		float u0 = sampler.next(), u1 = sampler.next();
+		float lightPdf;
+		glm::vec3 direction = sampleEnvironment(glm::vec2(u0, u1), lightPdf);
+		glm::vec3 value = bsdf::evaluateBsdf(surface.material, wo, surface.toLocal(direction), bsdfPdf);
+		radiance += connectEnvironment(surface, direction, lightPdf, value, bsdfPdf, rayCount);
+	}
+	if (_lightSampling != LightSampling::Bsdf && !_lights.empty()) {
+		sampler.startSet(bounceSet(bounce, kLightSet));
+		float u0 = sampler.next(), u1 = sampler.next(), u2 = sampler.next();
+		LightSample sample;
+		sampleLight(surface.rayOrigin(), surface.normal, glm::vec3(u0, u1, u2), sample);
+		glm::vec3 value = bsdf::evaluateBsdf(surface.material, wo, surface.toLocal(sample.direction), bsdfPdf);
+		radiance += connectLight(surface, sample, value, bsdfPdf, rayCount);
+	}
+	return radiance;
+}
+
+void PathTracer::sampleLight(const glm::vec3& point, const glm::vec3& normal, const glm::vec3& u,
+	LightSample& sample) const {
+	sample.direction = normal;
+	sample.distance = 0.0f;
+	sample.emission = glm::vec3(0.0f);
+	sample.pdf = 0.0f;
+	sample.light = ~0u;
+	uint32_t light;
+	float probability;
+	if (_lightSampling == LightSampling::Uniform) {
+		light = std::min((uint32_t)(u.x * _lights.lightCount()), (uint32_t)_lights.lightCount() - 1);
+		probability = 1.0f / _lights.lightCount();
+	} else if ((light = _lights.select(point, normal, u.x, probability)) == ~0u) {
+		return;
+	}
+	glm::vec3 offset = _lights.samplePoint(light, glm::vec2(u.y, u.z)) - point;
+	float distance2 = glm::dot(offset, offset);
+	if (!(distance2 > 0.0f)) {
+		return;
+	}
+	float distance = std::sqrt(distance2);
+	float cosLight = std::abs(glm::dot(_lights.normal(light), offset)) / distance;
+	if (!(cosLight * _lights.area(light) > 0.0f)) {
+		return;
+	}
+	sample.distance = distance;
+	sample.direction = offset / distance;
+	sample.emission = _lights.light(light).emission;
+	// area measure to solid angle
+	sample.pdf = probability * distance2 / (_lights.area(light) * cosLight);
+	sample.light = light;
+}
+
+float PathTracer::lightPdf(const glm::vec3& point, const glm::vec3& normal, uint32_t light,
+	const glm::vec3& direction, float distance) const {
+	float probability = _lightSampling == LightSampling::Uniform ? 1.0f / _lights.lightCount()
+		: _lights.selectionProbability(point, normal, light);
+	float cosLight = std::abs(glm::dot(_lights.normal(light), direction));
+	if (!(cosLight * _lights.area(light) > 0.0f)) {
+		return 0.0f;
+	}
+	return probability * distance * distance / (_lights.area(light) * cosLight);
+}
+
+glm::vec3 PathTracer::emittedRadiance(const SceneMaterial& material, const InstanceHit& hit, const Ray& ray,
+	float bsdfPdf, const glm::vec3& normal) const {
+	glm::vec3 emission(material.emissive);
+	uint32_t first = _instanceLights[hit.instance];
+	if (emission == glm::vec3(0.0f) || _lightSampling == LightSampling::Bsdf || bsdfPdf <= 0.0f || first == ~0u) {
+		return emission;
+	}
+	return emission * misWeight(bsdfPdf, lightPdf(ray.origin, normal, first + hit.triangle, ray.direction, hit.t));
+}
+
+glm::vec3 PathTracer::connectLight(const Surface& surface, const LightSample& sample, const glm::vec3& value,
+	float bsdfPdf, uint64_t& rayCount) const {
+	if (!(sample.pdf > 0.0f) || value == glm::vec3(0.0f)) {
+		return glm::vec3(0.0f);
+	}
+	// stops short of the light so its own triangle does not count as a blocker
+	Ray shadow;
+	shadow.origin = surface.rayOrigin();
+	shadow.direction = sample.direction;
+	shadow.tMin = 0.0f;
+	shadow.tMax = sample.distance * (1.0f - 1e-3f);
+	InstanceHit hit;
+	++rayCount;
+	if (intersect(shadow, hit)) {
+		return glm::vec3(0.0f);
+	}
+	return value * sample.emission * (misWeight(sample.pdf, bsdfPdf) / sample.pdf);
+}
@@ -0,0 +1,265 @@
+#pragma once
+#include "bsdf.hh"
+#include "environment.hh"
+#include "lightbvh.hh"
+#include "ray.hh"
+#include "renderer.hh"
+#include "sampler.hh"
+#include "texturecache.hh"
+#include "tlas.hh"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Reference CPU path tracer. Every mesh gets one blas in its own space and mesh nodes become
+// instances of it under a tlas, see tlas.hh. Paths bounce off the metallic roughness BSDF of
+// shaders/bsdf.glsl and gather light from the environment and emissive triangles.
+class PathTracer : public Renderer
+{
+public:
+	// PerPixel hands tiles of the frame to the job system in hilbert order and every pixel runs its own path
+	// loop, Wavefront runs the frame as stages over queues of paths, see wavefront.cc
+	enum class Schedule { PerPixel, Wavefront };
+	// how bounces look for the environment besides following the BSDF, a shadow ray toward a direction
+	// picked uniformly over the sphere or by the map's luminance, weighed against the BSDF's own by
+	// multiple importance sampling
+	enum class EnvironmentSampling { Bsdf, Uniform, Importance };
+	// how bounces pick one of the emissive triangles for a shadow ray, if at all, weighed the same way
+	enum class LightSampling { Bsdf, Uniform, Bvh };
+
+	void setScene(const SceneFile& scene) override;
+	void render(const UniformBufferObject& frame, HdrImage& target) override;
+
+	void setSchedule(Schedule schedule);
+	Schedule schedule() const { return _schedule; }
+	// jobs of render(), the shared job system by default. it has to outlive the tracer's use of it
+	void setJobSystem(JobSystem& jobs);
+	// once the flag is set, render() skips the tiles or waves that have not started and returns early
+	void setCancelFlag(const std::atomic<bool> *cancel);
+	bool lastRenderCancelled() const { return _lastRenderCancelled; }
+
+	// what misses see, nullptr for the sky gradient. the map has to outlive the tracer's use of it
+	void setEnvironment(const EnvironmentMap *environment);
+	void setEnvironmentSampling(EnvironmentSampling sampling);
+	EnvironmentSampling environmentSampling() const { return _environmentSampling; }
+	void setLightSampling(LightSampling sampling);
+	LightSampling lightSampling() const { return _lightSampling; }
+	const LightBvh& lights() const { return _lights; }
+
+	// Sobol by default, see sampler.hh. successive renders continue every pixel's sequence
+	void setSampler(Sampler::Type type, uint32_t seed = 0);
+	Sampler::Type samplerType() const { return _samplerType; }
+	// the next render starts every pixel's sequence over at its first sample
+	void restartSequences();
+
+	static const uint32_t kTileSize = 16;
+	static const uint32_t kSkipTile = ~0u;
+	// Per tile of kTileSize pixels, row major: the sample index the tile's pixels continue their sequences
+	// at, or kSkipTile to leave the tile's pixels of the target as they are. nullptr renders every tile at
+	// the render count. The offsets have to outlive the tracer's use of them
+	void setTileSampleOffsets(const uint32_t *offsets);
+	// render() also fills these, resized to the target, nullptr for none. pixels of skipped tiles keep
+	// theirs. The buffers have to outlive the tracer's use of them
+	void setFeatureBuffers(FeatureBuffers *features);
+
+	void setSamplesPerPixel(uint32_t samplesPerPixel);
+	uint32_t samplesPerPixel() const;
+	void setMaxBounces(uint32_t maxBounces);
+	// moves a mesh node of the scene, the tlas is rebuilt by the next render
+	void setNodeTransform(uint32_t node, const glm::mat4& world);
+	// triangles of all instances, as many as a flattened scene would have
+	size_t triangleCount() const;
+	// camera, bounce and shadow rays of the last render
+	uint64_t lastRayCount() const;
+	const Tlas& tlas() const { return _tlas; }
+	// the scene's textures, filtered over the footprint of the ray cone every path carries. for the filter
+	// and the memory budget
+	TextureCache& textures() { return _textureCache; }
+
+	// closest hit over the whole scene
+	bool intersect(const Ray& ray, InstanceHit& hit) const;
+
+private:
+	// paths in flight per wave and paths per job in every wavefront stage
+	static const uint32_t kWaveSize = 1 << 18;
+	static const uint32_t kWaveChunk = 2048;
+
+	// Ray differentials reduced to a cone, Amanatides' and Akenine-Moller et al.'s: the width of the
+	// footprint at the ray's origin and how fast it grows, a pixel's angle for camera rays. Bounces widen
+	// the spread by the GGX alpha, a stand in for the differentials of the scattered direction.
+	struct RayCone {
+		float width;
+		float spread;
+	};
+
+	struct Mesh {
+		Blas blas;
+		// scene vertex of every corner for attribute lookups
+		std::vector<uint32_t> corners;
+	};
+
+	// built once per scene, instances point into it
+	std::vector<Mesh> _meshes;
+	std::vector<BlasInstance> _instances;
+	std::vector<uint32_t> _instanceMeshes;
+	std::vector<uint32_t> _instanceMaterials;
+	// instance of every scene node, ~0u for nodes without a mesh
+	std::vector<uint32_t> _nodeInstances;
+	bool _instancesMoved = false;
+	Tlas _tlas;
+	std::vector<glm::vec2> _texCoords;
+	std::vector<SceneMaterial> _materials;
+	TextureCache _textureCache;
+	// angle between the camera rays of neighbouring pixels, set by render()
+	float _pixelSpread = 0.0f;
+	uint32_t _samplesPerPixel = 16;
+	uint32_t _maxBounces = 4;
+	// renders since restartSequences(), each one takes the next samplesPerPixel indices
+	uint32_t _frameIndex = 0;
+	Sampler::Type _samplerType = Sampler::Type::Sobol;
+	uint32_t _seed = 0;
+	const uint32_t *_tileSampleOffsets = nullptr;
+	FeatureBuffers *_features = nullptr;
+	uint64_t _lastRayCount = 0;
+	Schedule _schedule = Schedule::PerPixel;
+	JobSystem *_jobs = &JobSystem::shared();
+	const std::atomic<bool> *_cancel = nullptr;
+	bool _lastRenderCancelled = false;
+	const EnvironmentMap *_environment = nullptr;
+	EnvironmentSampling _environmentSampling = EnvironmentSampling::Importance;
+	LightSampling _lightSampling = LightSampling::Bvh;
+	// emissive triangles of every instance in world space, rebuilt with the tlas, see lightbvh.hh
+	LightBvh _lights;
+	// first light of every instance, ~0u for ones that do not emit
+	std::vector<uint32_t> _instanceLights;
+
+	// a path's first hit for the feature buffers, as a miss until it hits
+	struct FirstHit {
+		glm::vec3 albedo = glm::vec3(1.0f);
+		glm::vec3 normal = glm::vec3(0.0f);
+		float depth = std::numeric_limits<float>::infinity();
+	};
+
+	// a pixel's first hits and the luminance of its illumination summed over samples
+	struct FeatureSum {
+		glm::vec3 albedo = glm::vec3(0.0f);
+		glm::vec3 normal = glm::vec3(0.0f);
+		float depth = 0.0f;
+		uint32_t hits = 0;
+		uint32_t samples = 0;
+		double illumination = 0.0;
+		double squaredIllumination = 0.0;
+
+		void add(const FirstHit& firstHit, const glm::vec3& radiance);
+		void store(FeatureBuffers& features, size_t pixel) const;
+	};
+
+	// paths of one wave in SoA, a path's radiance is written to its slot when it ends
+	struct PathQueue {
+		std::vector<glm::vec3> origins;
+		std::vector<glm::vec3> directions;
+		std::vector<glm::vec3> throughputs;
+		std::vector<Sampler> samplers;
+		std::vector<RayCone> cones;
+		// pdf of the BSDF sample that made the ray, 0 for camera rays, and the normal it left from
+		std::vector<float> pdfs;
+		std::vector<glm::vec3> normals;
+		std::vector<uint32_t> slots;
+		std::vector<InstanceHit> hits;
+
+		void resize(size_t size);
+	};
+
+	// kept between frames so waves do not allocate
+	PathQueue _paths;
+	PathQueue _survivors;
+	std::vector<glm::vec3> _slotRadiance;
+	std::vector<uint32_t> _shadeOrder;
+	std::vector<uint8_t> _alive;
+	std::vector<glm::vec3> _film;
+	// with feature buffers, per slot of the wave and per pixel of the film
+	std::vector<FirstHit> _slotFirstHits;
+	std::vector<FeatureSum> _featureSums;
+	// the pixels a wavefront render covers and the sample index each continues at, the film follows them
+	std::vector<uint32_t> _wavePixels;
+	std::vector<uint32_t> _waveFirstSamples;
+
+	// dimension sets of a path, see sampler.hh: the camera's, then one per kind of decision at every bounce
+	enum SampleSet : uint32_t { kBsdfSet, kEnvironmentSet, kLightSet, kSetsPerBounce, kCameraSet = 0 };
+	static uint32_t bounceSet(uint32_t bounce, SampleSet set) { return 1 + bounce * kSetsPerBounce + set; }
+
+	static glm::vec3 sky(const glm::vec3& direction);
+	glm::vec3 environment(const glm::vec3& direction) const;
+
+	bool cancelled() const { return _cancel && _cancel->load(std::memory_order_relaxed); }
+
+	void buildLights();
+	void renderPixels(const glm::mat4& inverseViewProjection, uint32_t firstSample, HdrImage& target);
+	void renderWavefront(const glm::mat4& inverseViewProjection, uint32_t firstSample, HdrImage& target);
+	// scatter for up to 8 queued paths that hit the same material, with one lane wide BSDF sample
+	void scatterLanes(const SceneMaterial& material, const uint32_t *paths, uint32_t count, uint32_t bounce,
+		uint64_t& rayCount);
+	Ray cameraRay(const glm::mat4& inverseViewProjection, uint32_t x, uint32_t y, const HdrImage& target,
+		Sampler& sampler) const;
+	glm::vec3 trace(Ray ray, Sampler& sampler, uint64_t& rayCount, FirstHit *firstHit = nullptr) const;
+
+	// a hit with its textures applied and its shading frame, normal facing the incoming ray
+	struct Surface {
+		glm::vec3 position;
+		glm::vec3 tangent;
+		glm::vec3 bitangent;
+		glm::vec3 normal;
+		bsdf::BsdfMaterial material;
+		TextureFootprint footprint;
+
+		glm::vec3 toLocal(const glm::vec3& direction) const {
+			return glm::vec3(glm::dot(direction, tangent), glm::dot(direction, bitangent), glm::dot(direction, normal));
+		}
+		glm::vec3 toWorld(const glm::vec3& direction) const {
+			return tangent * direction.x + bitangent * direction.y + normal * direction.z;
+		}
+		// lifted off the surface so rays leaving it do not hit it again
+		glm::vec3 rayOrigin() const {
+			return position + normal * (1e-4f * std::max(1.0f, glm::length(position)));
+		}
+	};
+
+	// the hit's frame and texture footprint, cone width measured at the hit. the material comes after
+	Surface surfaceAt(const InstanceHit& hit, const Ray& ray, float coneWidth) const;
+	// the material with its textures, base color textures are srgb and metallic roughness ones linear
+	void applyMaterial(const SceneMaterial& material, Surface& surface) const;
+	// the same for the eight surfaces of scatterLanes, trilinear lookups go eight at a time
+	void applyMaterialLanes(const SceneMaterial& material, Surface surfaces[8]) const;
+	// bounce off a surface hit: the throughput takes the BSDF weight, russian roulette may end the path
+	// and otherwise ray becomes the bounce with the pdf it was sampled with. returns whether the path goes on
+	bool scatter(const Surface& surface, uint32_t bounce, Ray& ray, glm::vec3& throughput, Sampler& sampler,
+		float& pdf) const;
+	// the part of scatter after the BSDF was sampled, wi in the surface's frame. russian roulette takes the
+	// fourth dimension of the BSDF's set
+	bool continuePath(const Surface& surface, const glm::vec3& weight, const glm::vec3& wi, uint32_t bounce,
+		Ray& ray, glm::vec3& throughput, Sampler& sampler) const;
+	// a direction toward the environment as the current sampling picks it, with its pdf over solid angle
+	glm::vec3 sampleEnvironment(glm::vec2 u, float& pdf) const;
+	float environmentPdf(const glm::vec3& direction) const;
+	// environment seen by a ray that left a surface with a BSDF sample of the given pdf, weighted against
+	// the shadow rays that could have found it
+	glm::vec3 escapedRadiance(const glm::vec3& direction, float bsdfPdf) const;
+	// the shadow ray half of the estimate, f cos wi over the light pdf times its weight when unoccluded.
+	// bsdfPdf is the pdf the BSDF would have picked direction with
+	glm::vec3 connectEnvironment(const Surface& surface, const glm::vec3& direction, float lightPdf,
+		const glm::vec3& value, float bsdfPdf, uint64_t& rayCount) const;
+	// a point on an emissive triangle as seen from point, which receives light above normal
+	void sampleLight(const glm::vec3& point, const glm::vec3& normal, const glm::vec3& u, LightSample& sample) const;
+	float lightPdf(const glm::vec3& point, const glm::vec3& normal, uint32_t light, const glm::vec3& direction,
+		float distance) const;
+	// emission of a hit seen by a ray from origin, which left a surface with the given normal and BSDF pdf
+	glm::vec3 emittedRadiance(const SceneMaterial& material, const InstanceHit& hit, const Ray& ray, float bsdfPdf,
+		const glm::vec3& normal) const;
+	glm::vec3 connectLight(const Surface& surface, const LightSample& sample, const glm::vec3& value, float bsdfPdf,
+		uint64_t& rayCount) const;
+	// shadow rays toward the environment and the lights from one surface, for the per pixel loop
+	glm::vec3 directLight(const Surface& surface, const glm::vec3& wo, uint32_t bounce, Sampler& sampler,
+		uint64_t& rayCount) const;
+};
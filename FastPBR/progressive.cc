@@ -0,0 +1,134 @@
+#include "progressive.hh"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// luminance added to the denominator of the relative error, so dark pixels are held to an absolute error
+static const float kDarkLuminance = 0.1f;
+
+static float luminance(const glm::vec3& color) {
+	return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+}
+
+ProgressiveRenderer::ProgressiveRenderer(PathTracer& pathTracer) : _pathTracer(pathTracer) {
+	_pathTracer.setCancelFlag(&_cancel);
+}
+
+ProgressiveRenderer::~ProgressiveRenderer() {
+	_pathTracer.setCancelFlag(nullptr);
+}
+
+void ProgressiveRenderer::restart(const UniformBufferObject& frame, uint32_t width, uint32_t height) {
+	_frame = frame;
+	_image.resize(width, height);
+	_pass.resize(width, height);
+	_squaredDeviations.assign((size_t)width * height, 0.0f);
+	_tilesX = (width + PathTracer::kTileSize - 1) / PathTracer::kTileSize;
+	uint32_t tilesY = (height + PathTracer::kTileSize - 1) / PathTracer::kTileSize;
+	++_updateCount;
+	_tiles.assign((size_t)_tilesX * tilesY, { 0, std::numeric_limits<float>::infinity(), false, _updateCount });
+	_tileSampleOffsets.assign(_tiles.size(), 0);
+	_passCount = 0;
+	_sampleCount = 0;
+	_cancel = false;
+	_startTime = std::chrono::high_resolution_clock::now();
+	_pathTracer.restartSequences();
+}
+
+bool ProgressiveRenderer::renderPass() {
+	if (_cancel.load() || finished()) {
+		return false;
+	}
+	// every tile takes the next samples of its pixels' sequences, converged ones sit the pass out
+	const uint32_t samplesPerPixel = _pathTracer.samplesPerPixel();
+	for (size_t tile = 0; tile < _tiles.size(); ++tile) {
+		_tileSampleOffsets[tile] = _tiles[tile].converged ? PathTracer::kSkipTile
+			: _tiles[tile].passes * samplesPerPixel;
+	}
+	_pathTracer.setTileSampleOffsets(_tileSampleOffsets.data());
+	_pathTracer.render(_frame, _pass);
+	_pathTracer.setTileSampleOffsets(nullptr);
+	if (_pathTracer.lastRenderCancelled()) {
+		return false;
+	}
+	++_passCount;
+	++_updateCount;
+	for (uint32_t tile = 0; tile < _tiles.size(); ++tile) {
+		if (!_tiles[tile].converged) {
+			updateTile(tile);
+		}
+	}
+	return true;
+}
+
+void ProgressiveRenderer::updateTile(uint32_t tile) {
+	Tile& state = _tiles[tile];
+	uint32_t x0 = tile % _tilesX * PathTracer::kTileSize, y0 = tile / _tilesX * PathTracer::kTileSize;
+	uint32_t x1 = std::min(x0 + PathTracer::kTileSize, _image.width);
+	uint32_t y1 = std::min(y0 + PathTracer::kTileSize, _image.height);
+	uint32_t n = ++state.passes;
+	state.update = _updateCount;
+	float weight = 1.0f / n;
+	double relativeVariance = 0.0;
+	for (uint32_t y = y0; y < y1; ++y) {
+		for (uint32_t x = x0; x < x1; ++x) {
+			size_t i = (size_t)y * _image.width + x;
+			glm::vec3& mean = _image.pixels[i];
+			float sample = luminance(_pass.pixels[i]);
+			float deviation = sample - luminance(mean);
+			mean += (_pass.pixels[i] - mean) * weight;
+			float meanLuminance = luminance(mean);
+			_squaredDeviations[i] += deviation * (sample - meanLuminance);
+			if (n > 1) {
+				// variance of the mean over the mean squared
+				float denominator = meanLuminance + kDarkLuminance;
+				relativeVariance += _squaredDeviations[i] / ((float)n * (n - 1) * denominator * denominator);
+			}
+		}
+	}
+	uint32_t pixelCount = (x1 - x0) * (y1 - y0);
+	_sampleCount += (uint64_t)pixelCount * _pathTracer.samplesPerPixel();
+	state.error = n >= kMinimumPasses ? (float)std::sqrt(relativeVariance / pixelCount)
+		: std::numeric_limits<float>::infinity();
+	state.converged = _errorThreshold > 0.0f && state.error < _errorThreshold;
+}
+
+void ProgressiveRenderer::cancel() {
+	_cancel = true;
+}
+
+void ProgressiveRenderer::setErrorThreshold(float threshold) {
+	_errorThreshold = threshold;
+	for (Tile& tile : _tiles) {
+		tile.converged = _errorThreshold > 0.0f && tile.error < _errorThreshold;
+	}
+}
+
+void ProgressiveRenderer::setTimeLimit(double milliseconds) {
+	_timeLimit = milliseconds;
+}
+
+bool ProgressiveRenderer::outOfTime() const {
+	auto now = std::chrono::high_resolution_clock::now();
+	return _timeLimit > 0.0 && std::chrono::duration<double, std::milli>(now - _startTime).count() >= _timeLimit;
+}
+
+bool ProgressiveRenderer::finished() const {
+	return outOfTime() || (!_tiles.empty() && activeTileCount() == 0);
+}
+
+uint32_t ProgressiveRenderer::activeTileCount() const {
+	return (uint32_t)std::count_if(_tiles.begin(), _tiles.end(), [](const Tile& tile) { return !tile.converged; });
+}
+
+float ProgressiveRenderer::errorEstimate() const {
+	float error = 0.0f;
+	for (const Tile& tile : _tiles) {
+		error = std::max(error, tile.error);
+	}
+	return error;
+}
+
+double ProgressiveRenderer::meanSamplesPerPixel() const {
+	return _image.pixels.empty() ? 0.0 : (double)_sampleCount / _image.pixels.size();
+}
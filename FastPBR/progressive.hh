@@ -0,0 +1,83 @@
+#pragma once
+#include "pathtracer.hh"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Accumulates passes of a path tracer into a running mean, so the image refines while the camera
+// rests. cancel() may come from any thread and stops the pass in flight after the tiles or waves it
+// already started, that pass is dropped and the image keeps the passes that completed.
+// With an error threshold the sampling turns adaptive: every pixel keeps Welford's variance of its pass
+// luminances, and a tile stops taking passes once the relative standard error of its pixels' means falls
+// below the threshold. Passes of one Sobol sequence are not independent, so the estimate errs high there.
+class ProgressiveRenderer
+{
+public:
+	// passes a tile takes before its error estimate is trusted
+	static const uint32_t kMinimumPasses = 8;
+
+	explicit ProgressiveRenderer(PathTracer& pathTracer);
+	~ProgressiveRenderer();
+	ProgressiveRenderer(const ProgressiveRenderer&) = delete;
+	ProgressiveRenderer& operator=(const ProgressiveRenderer&) = delete;
+
+	// drops the accumulated passes, for a new camera or size
+	void restart(const UniformBufferObject& frame, uint32_t width, uint32_t height);
+	// one more pass over the tiles that have not converged, false when it was cancelled or finished()
+	bool renderPass();
+	void cancel();
+
+	// 0, the default, renders every tile in every pass
+	void setErrorThreshold(float threshold);
+	// renderPass() starts no pass once this long went by since restart(), 0 for no limit
+	void setTimeLimit(double milliseconds);
+	// every tile converged or the time ran out
+	bool finished() const;
+
+	const HdrImage& image() const { return _image; }
+	uint32_t passCount() const { return _passCount; }
+	uint32_t activeTileCount() const;
+	// the largest error estimate of a tile, infinite before every tile took kMinimumPasses
+	float errorEstimate() const;
+	// samples over pixels so far, to compare against a uniform samples per pixel
+	double meanSamplesPerPixel() const;
+
+	// PathTracer::kTileSize tiles, row major
+	uint32_t tilesX() const { return _tilesX; }
+	uint32_t tileCount() const { return (uint32_t)_tiles.size(); }
+	// grows with every restart() and completed pass and never goes back, so whoever shows the image can
+	// tell the tiles whose pixels changed since it last looked by their update
+	uint64_t updateCount() const { return _updateCount; }
+	uint64_t tileUpdate(uint32_t tile) const { return _tiles[tile].update; }
+
+private:
+	struct Tile {
+		uint32_t passes;
+		float error;
+		bool converged;
+		// updateCount() when the tile's pixels last changed
+		uint64_t update;
+	};
+
+	PathTracer& _pathTracer;
+	UniformBufferObject _frame = {};
+	HdrImage _image;
+	HdrImage _pass;
+	// per pixel sum of squared luminance deviations from the mean
+	std::vector<float> _squaredDeviations;
+	std::vector<Tile> _tiles;
+	// every tile's next sample index, or kSkipTile once it converged
+	std::vector<uint32_t> _tileSampleOffsets;
+	uint32_t _tilesX = 0;
+	uint32_t _passCount = 0;
+	uint64_t _sampleCount = 0;
+	uint64_t _updateCount = 0;
+	float _errorThreshold = 0.0f;
+	double _timeLimit = 0.0;
+	std::chrono::high_resolution_clock::time_point _startTime;
+	std::atomic<bool> _cancel{ false };
+
+	bool outOfTime() const;
+	void updateTile(uint32_t tile);
+};
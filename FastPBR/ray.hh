@@ -0,0 +1,53 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cfloat>
+#include <cstdint>
+
+struct Ray {
+	glm::vec3 origin;
+	float tMin;
+	glm::vec3 direction;
+	float tMax;
+};
+
+struct RayHit {
+	float t = FLT_MAX;
+	// barycentrics of the second and third vertex
+	float u = 0;
+	float v = 0;
+	uint32_t triangle = ~0u;
+
+	bool valid() const { return triangle != ~0u; }
+};
+
+// Moller-Trumbore, both sides count. hit is only written when closer than hit.t
+inline bool intersectTriangle(const Ray& ray, const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2,
+	uint32_t triangle, RayHit& hit) {
+	glm::vec3 edge1 = p1 - p0;
+	glm::vec3 edge2 = p2 - p0;
+	glm::vec3 p = glm::cross(ray.direction, edge2);
+	float determinant = glm::dot(edge1, p);
+	if (determinant == 0.0f) {
+		return false;
+	}
+	float inverseDeterminant = 1.0f / determinant;
+	glm::vec3 s = ray.origin - p0;
+	float u = glm::dot(s, p) * inverseDeterminant;
+	if (u < 0.0f || u > 1.0f) {
+		return false;
+	}
+	glm::vec3 q = glm::cross(s, edge1);
+	float v = glm::dot(ray.direction, q) * inverseDeterminant;
+	if (v < 0.0f || u + v > 1.0f) {
+		return false;
+	}
+	float t = glm::dot(edge2, q) * inverseDeterminant;
+	if (t < ray.tMin || t > ray.tMax || t >= hit.t) {
+		return false;
+	}
+	hit.t = t;
+	hit.u = u;
+	hit.v = v;
+	hit.triangle = triangle;
+	return true;
+}
@@ -0,0 +1,214 @@
+#include "refit.hh"
+#include <chrono>
+
+static float nodeArea(const BvhNode& node) {
+	glm::vec3 extent = glm::max(node.boundsMax - node.boundsMin, glm::vec3(0.0f));
+	return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+float Bvh::refit(const Aabb *primitiveBounds, bool rotate, JobSystem& jobs) {
+	auto startTime = std::chrono::high_resolution_clock::now();
+	if (_nodes.empty()) {
+		_lastRefitMilliseconds = 0;
+		return 0;
+	}
+
+	// rotations keep the size of every job's subtrees, so the split only changes with a new build
+	if (_refitRanges.empty()) {
+		_refitTop.clear();
+		std::vector<uint32_t> stack(1, 0);
+		while (!stack.empty()) {
+			uint32_t node = stack.back();
+			stack.pop_back();
+			uint32_t end = subtreeEnd(node);
+			if (end - node > kRefitNodesPerJob) {
+				_refitTop.push_back(node);
+				stack.push_back(_nodes[node].offset);
+				stack.push_back(node + 1);
+			} else if (!_refitRanges.empty() && _refitRanges.back().end == node
+				&& _refitRanges.back().end - _refitRanges.back().begin < kRefitNodesPerJob) {
+				_refitRanges.back().end = end;
+			} else {
+				_refitRanges.push_back({ node, end });
+			}
+		}
+	}
+
+	std::vector<double> rangeCosts(_refitRanges.size());
+	jobs.parallelFor(_refitRanges.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t range = begin; range < end; ++range) {
+			rangeCosts[range] = refitRange(_refitRanges[range], primitiveBounds, rotate);
+		}
+	});
+	// the nodes above the jobs come in depth first order, backwards every child is done before its parent
+	double cost = 0;
+	for (double rangeCost : rangeCosts) {
+		cost += rangeCost;
+	}
+	for (auto node = _refitTop.rbegin(); node != _refitTop.rend(); ++node) {
+		refitNode(*node, primitiveBounds);
+		cost += nodeArea(_nodes[*node]);
+	}
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	_lastRefitMilliseconds = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+	return (float)(cost / std::max(nodeArea(_nodes[0]), FLT_MIN));
+}
+
+uint32_t Bvh::subtreeEnd(uint32_t node) const {
+	// the second child's subtree is always the last one
+	while (!_nodes[node].isLeaf()) {
+		node = _nodes[node].offset;
+	}
+	return node + 1;
+}
+
+void Bvh::refitNode(uint32_t node, const Aabb *primitiveBounds) {
+	BvhNode& current = _nodes[node];
+	Aabb bounds;
+	if (current.isLeaf()) {
+		for (uint32_t i = current.offset; i < current.offset + current.count; ++i) {
+			bounds.grow(primitiveBounds[_primitives[i]]);
+		}
+	} else {
+		const BvhNode& first = _nodes[node + 1];
+		const BvhNode& second = _nodes[current.offset];
+		bounds.min = glm::min(first.boundsMin, second.boundsMin);
+		bounds.max = glm::max(first.boundsMax, second.boundsMax);
+	}
+	current.boundsMin = bounds.min;
+	current.boundsMax = bounds.max;
+}
+
+double Bvh::refitRange(const RefitRange& range, const Aabb *primitiveBounds, bool rotate) {
+	// a range holds whole subtrees, backwards every child is refit before its parent
+	std::vector<BvhNode> scratch;
+	double cost = 0;
+	for (uint32_t node = range.end; node-- > range.begin;) {
+		refitNode(node, primitiveBounds);
+		if (rotate && !_nodes[node].isLeaf()) {
+			cost += rotateChildren(node, scratch);
+		}
+		cost += nodeArea(_nodes[node]) * (_nodes[node].isLeaf() ? (float)_nodes[node].count : 1.0f);
+	}
+	return cost;
+}
+
+float Bvh::rotateChildren(uint32_t node, std::vector<BvhNode>& scratch) {
+	// a grandchild trades places with its uncle, which only changes the area of the child in between.
+	// of the four candidates the one shrinking that child the most wins
+	const uint32_t children[2] = { node + 1, _nodes[node].offset };
+	float bestGain = 1e-3f * nodeArea(_nodes[node]);
+	int bestChild = -1, bestGrandchild = 0;
+	for (int child = 0; child < 2; ++child) {
+		const BvhNode& opened = _nodes[children[child]];
+		if (opened.isLeaf()) {
+			continue;
+		}
+		const BvhNode& uncle = _nodes[children[1 - child]];
+		const uint32_t grandchildren[2] = { children[child] + 1, opened.offset };
+		for (int grandchild = 0; grandchild < 2; ++grandchild) {
+			const BvhNode& sibling = _nodes[grandchildren[1 - grandchild]];
+			BvhNode merged;
+			merged.boundsMin = glm::min(uncle.boundsMin, sibling.boundsMin);
+			merged.boundsMax = glm::max(uncle.boundsMax, sibling.boundsMax);
+			float gain = nodeArea(opened) - nodeArea(merged);
+			if (gain > bestGain) {
+				bestGain = gain;
+				bestChild = child;
+				bestGrandchild = grandchild;
+			}
+		}
+	}
+	if (bestChild < 0) {
+		return 0.0f;
+	}
+
+	// depth first the new order is the kept grandchild, the merged node, then the uncle and the other
+	// grandchild under it. subtrees move as blocks with their second child indices shifted along
+	uint32_t opened = children[bestChild];
+	uint32_t uncle = children[1 - bestChild];
+	uint32_t grandchildren[2] = { opened + 1, _nodes[opened].offset };
+	uint32_t kept = grandchildren[bestGrandchild];
+	uint32_t sibling = grandchildren[1 - bestGrandchild];
+	float openedArea = nodeArea(_nodes[opened]);
+	uint32_t end = subtreeEnd(node);
+	scratch.assign(_nodes.begin() + node + 1, _nodes.begin() + end);
+	auto copyBlock = [&](uint32_t begin, uint32_t blockEnd, uint32_t target) {
+		for (uint32_t i = begin; i < blockEnd; ++i) {
+			BvhNode moved = scratch[i - node - 1];
+			if (!moved.isLeaf()) {
+				moved.offset = moved.offset - begin + target;
+			}
+			_nodes[target + i - begin] = moved;
+		}
+		return target + blockEnd - begin;
+	};
+	// block ends come from the old layout, before anything moves
+	uint32_t keptEnd = subtreeEnd(kept), uncleEnd = subtreeEnd(uncle), siblingEnd = subtreeEnd(sibling);
+	uint32_t position = copyBlock(kept, keptEnd, node + 1);
+	uint32_t merged = position++;
+	position = copyBlock(uncle, uncleEnd, position);
+	uint32_t second = position;
+	copyBlock(sibling, siblingEnd, position);
+
+	BvhNode& mergedNode = _nodes[merged];
+	mergedNode.boundsMin = glm::min(_nodes[merged + 1].boundsMin, _nodes[second].boundsMin);
+	mergedNode.boundsMax = glm::max(_nodes[merged + 1].boundsMax, _nodes[second].boundsMax);
+	mergedNode.offset = second;
+	mergedNode.count = 0;
+	_nodes[node].offset = merged;
+	return nodeArea(mergedNode) - openedArea;
+}
+
+void DeformingBvh::setThresholds(float rotateThreshold, float rebuildThreshold) {
+	_rotateThreshold = rotateThreshold;
+	_rebuildThreshold = rebuildThreshold;
+}
+
+void DeformingBvh::build(const glm::vec3 *corners, size_t triangleCount, JobSystem& jobs) {
+	_bounds.resize(triangleCount);
+	gatherBounds(corners, jobs);
+	rebuild(jobs);
+	_lastUpdate.update = Update::Rebuild;
+	_lastUpdate.milliseconds = _bvh.lastBuildMilliseconds();
+	_lastUpdate.sahCost = _builtCost;
+	_lastUpdate.drift = 1.0f;
+}
+
+const DeformingBvh::UpdateStats& DeformingBvh::update(const glm::vec3 *corners, JobSystem& jobs) {
+	auto startTime = std::chrono::high_resolution_clock::now();
+	gatherBounds(corners, jobs);
+	// rotations are decided from the previous frame, the refit itself tells whether to rebuild
+	bool rotate = _lastUpdate.drift > _rotateThreshold;
+	float cost = _bvh.refit(_bounds.data(), rotate, jobs);
+	_lastUpdate.update = rotate ? Update::Rotate : Update::Refit;
+	if (cost > _builtCost * _rebuildThreshold) {
+		rebuild(jobs);
+		cost = _builtCost;
+		_lastUpdate.update = Update::Rebuild;
+	}
+	_lastUpdate.sahCost = cost;
+	_lastUpdate.drift = cost / std::max(_builtCost, FLT_MIN);
+	auto endTime = std::chrono::high_resolution_clock::now();
+	_lastUpdate.milliseconds = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+	return _lastUpdate;
+}
+
+void DeformingBvh::gatherBounds(const glm::vec3 *corners, JobSystem& jobs) {
+	jobs.parallelFor(_bounds.size(), 16384, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			Aabb bounds;
+			bounds.grow(corners[i * 3]);
+			bounds.grow(corners[i * 3 + 1]);
+			bounds.grow(corners[i * 3 + 2]);
+			_bounds[i] = bounds;
+		}
+	});
+}
+
+void DeformingBvh::rebuild(JobSystem& jobs) {
+	// the linear builder with treelets is the better trade when rebuilds happen while animating
+	_bvh.buildLinear(_bounds.data(), _bounds.size(), true, jobs);
+	_builtCost = _bvh.sahCost();
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "bvh.hh"
+#include <cstdint>
+#include <vector>
+
+// Bvh over triangles that move every frame but keep their topology, like skinned or morphing
+// meshes. update() refits and compares the sah cost against the last build: past the rotation
+// threshold the next refits also rotate subtrees, past the rebuild threshold the tree is built again.
+class DeformingBvh
+{
+public:
+	enum class Update { Refit, Rotate, Rebuild };
+
+	struct UpdateStats {
+		Update update;
+		double milliseconds;
+		float sahCost;
+		// sah cost relative to the last build
+		float drift;
+	};
+
+	void setThresholds(float rotateThreshold, float rebuildThreshold);
+	// three corners per triangle
+	void build(const glm::vec3 *corners, size_t triangleCount, JobSystem& jobs = JobSystem::shared());
+	// corners of the same triangles as build()
+	const UpdateStats& update(const glm::vec3 *corners, JobSystem& jobs = JobSystem::shared());
+	const UpdateStats& lastUpdate() const { return _lastUpdate; }
+	const Bvh& bvh() const { return _bvh; }
+
+private:
+	Bvh _bvh;
+	std::vector<Aabb> _bounds;
+	float _builtCost = 0;
+	float _rotateThreshold = 1.05f;
+	float _rebuildThreshold = 1.3f;
+	UpdateStats _lastUpdate = {};
+
+	void gatherBounds(const glm::vec3 *corners, JobSystem& jobs);
+	void rebuild(JobSystem& jobs);
+};
@@ -0,0 +1,167 @@
+#include "renderer.hh"
+#include "pathtracer.hh"
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+void HdrImage::resize(uint32_t newWidth, uint32_t newHeight) {
+	width = newWidth;
+	height = newHeight;
+	pixels.assign((size_t)width * height, glm::vec3(0.0f));
+}
+
+void FeatureBuffers::resize(uint32_t newWidth, uint32_t newHeight) {
+	width = newWidth;
+	height = newHeight;
+	size_t count = (size_t)width * height;
+	albedo.assign(count, glm::vec3(1.0f));
+	normals.assign(count, glm::vec3(0.0f));
+	depths.assign(count, std::numeric_limits<float>::infinity());
+	luminances.assign(count, 0.0f);
+	variances.assign(count, 0.0f);
+}
+
+void writeHdr(const std::string& filename, const HdrImage& image) {
+	std::ofstream file(filename, std::ios::binary);
+	if (!file.is_open()) {
+		throw std::runtime_error("failed to open file!");
+	}
+	file << "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " << image.height << " +X " << image.width << "\n";
+
+	// shared exponent per pixel, scanlines run length encoded a channel at a time as readers expect
+	// for widths of 8 to 32767, flat otherwise
+	bool encode = image.width >= 8 && image.width < 0x8000;
+	std::vector<uint8_t> scanline((size_t)image.width * 4);
+	std::vector<uint8_t> encoded;
+	for (uint32_t y = 0; y < image.height; ++y) {
+		for (uint32_t x = 0; x < image.width; ++x) {
+			glm::vec3 color = glm::max(image.at(x, y), glm::vec3(0.0f));
+			float maximum = std::max(color.r, std::max(color.g, color.b));
+			uint8_t *rgbe = &scanline[(size_t)x * 4];
+			if (!(maximum > 1e-32f) || !std::isfinite(maximum)) {
+				rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+				continue;
+			}
+			int exponent;
+			float scale = std::frexp(maximum, &exponent) * 256.0f / maximum;
+			rgbe[0] = (uint8_t)(color.r * scale);
+			rgbe[1] = (uint8_t)(color.g * scale);
+			rgbe[2] = (uint8_t)(color.b * scale);
+			rgbe[3] = (uint8_t)(exponent + 128);
+		}
+		if (!encode) {
+			file.write(reinterpret_cast<const char*>(scanline.data()), scanline.size());
+			continue;
+		}
+
+		// runs of 4 or more equal bytes become a count above 128 and the byte, whatever lies between them
+		// goes out as literals of at most 128
+		encoded.assign({ 2, 2, (uint8_t)(image.width >> 8), (uint8_t)(image.width & 0xff) });
+		for (uint32_t channel = 0; channel < 4; ++channel) {
+			auto at = [&](uint32_t x) { return scanline[(size_t)x * 4 + channel]; };
+			uint32_t x = 0;
+			while (x < image.width) {
+				uint32_t runStart = x, runLength = 0;
+				while (runStart < image.width) {
+					runLength = 1;
+					while (runStart + runLength < image.width && runLength < 127
+						&& at(runStart + runLength) == at(runStart)) {
+						++runLength;
+					}
+					if (runLength >= 4) {
+						break;
+					}
+					runStart += runLength;
+				}
+				while (x < runStart) {
+					uint32_t count = std::min(runStart - x, 128u);
+					encoded.push_back((uint8_t)count);
+					for (uint32_t i = 0; i < count; ++i) {
+						encoded.push_back(at(x + i));
+					}
+					x += count;
+				}
+				if (runStart < image.width) {
+					encoded.push_back((uint8_t)(128 + runLength));
+					encoded.push_back(at(runStart));
+					x = runStart + runLength;
+				}
+			}
+		}
+		file.write(reinterpret_cast<const char*>(encoded.data()), encoded.size());
+	}
+}
+
+std::vector<uint32_t> hilbertTileOrder(uint32_t tilesX, uint32_t tilesY) {
+	// walk the curve over the enclosing power of two square and keep the tiles inside the grid
+	uint32_t side = 1;
+	while (side < tilesX || side < tilesY) {
+		side *= 2;
+	}
+	std::vector<uint32_t> order;
+	order.reserve((size_t)tilesX * tilesY);
+	for (uint32_t distance = 0; distance < side * side; ++distance) {
+		uint32_t x = 0, y = 0;
+		for (uint32_t scale = 1, rest = distance; scale < side; scale *= 2, rest /= 4) {
+			uint32_t rx = 1 & (rest / 2), ry = 1 & (rest ^ rx);
+			if (ry == 0) {
+				if (rx == 1) {
+					x = scale - 1 - x;
+					y = scale - 1 - y;
+				}
+				std::swap(x, y);
+			}
+			x += scale * rx;
+			y += scale * ry;
+		}
+		if (x < tilesX && y < tilesY) {
+			order.push_back(y * tilesX + x);
+		}
+	}
+	return order;
+}
+
+UniformBufferObject defaultFrame(float aspect) {
+	UniformBufferObject frame = {};
+	frame.invert = glm::mat4(	1.0f, 0.0f, 0.0f, 0.0f,
+								0.0f, -1.0f, 0.0f, 0.0f,
+								0.0f, 0.0f, 0.5f, 0.0f,
+								0.0f, 0.0f, 0.5f, 1.0f);
+	frame.model = glm::mat4(1.0f);
+	frame.view = glm::lookAt(glm::vec3(0, 0, 2), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+	frame.proj = glm::perspective(glm::radians(45.0f), aspect, 0.1f, 10.0f);
+	return frame;
+}
+
+int renderReference(const char *scenePath, const char *outputPath, uint32_t samplesPerPixel,
+	const char *environmentPath) {
+	SceneFile scene;
+	if (std::string(scenePath) == "default") {
+		scene.openMemory(SceneBuilder::defaultScene().serialize());
+	} else {
+		scene.open(scenePath);
+	}
+
+	PathTracer pathTracer;
+	pathTracer.setSamplesPerPixel(samplesPerPixel ? samplesPerPixel : 64);
+	pathTracer.setScene(scene);
+	EnvironmentMap environment;
+	if (environmentPath) {
+		environment.load(environmentPath);
+		pathTracer.setEnvironment(&environment);
+	}
+	HdrImage image;
+	image.resize(1280, 720);
+	auto startTime = std::chrono::high_resolution_clock::now();
+	pathTracer.render(defaultFrame(1280.0f / 720.0f), image);
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+	writeHdr(outputPath, image);
+
+	std::cout << "rendered " << image.width << "x" << image.height << " at " << pathTracer.samplesPerPixel()
+		<< " spp in " << seconds << " s, " << pathTracer.lastRayCount() / seconds / 1e6 << " Mrays/s" << std::endl;
+	return 0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "geometry.hh"
+#include "scene.hh"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// linear rgb frame, rows top to bottom like the swapchain images
+struct HdrImage {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<glm::vec3> pixels;
+
+	void resize(uint32_t newWidth, uint32_t newHeight);
+	glm::vec3& at(uint32_t x, uint32_t y) { return pixels[(size_t)y * width + x]; }
+	const glm::vec3& at(uint32_t x, uint32_t y) const { return pixels[(size_t)y * width + x]; }
+};
+
+// what a path tracer saw at the first hit of every pixel, averaged over the pixel's samples, for denoising.
+// albedo is the base color, 1 where the samples missed, so radiance over albedo is the illumination
+struct FeatureBuffers {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<glm::vec3> albedo;
+	// world space and facing the camera, 0 where every sample missed
+	std::vector<glm::vec3> normals;
+	// distance along the camera ray from the near plane, infinite where every sample missed
+	std::vector<float> depths;
+	// luminance of the illumination and the variance of that estimate over the pixel's samples
+	std::vector<float> luminances;
+	std::vector<float> variances;
+
+	void resize(uint32_t newWidth, uint32_t newHeight);
+};
+
+// radiance .hdr with run length encoded scanlines, readable by most image viewers
+void writeHdr(const std::string& filename, const HdrImage& image);
+
+// tile indices of a tilesX by tilesY grid along a hilbert curve, so any run of consecutive tiles
+// covers a compact patch of the image
+std::vector<uint32_t> hilbertTileOrder(uint32_t tilesX, uint32_t tilesY);
+
+// offline backends that turn a scene and the rasterizer's camera into an hdr frame
+class Renderer
+{
+public:
+	virtual ~Renderer() = default;
+
+	// the scene has to stay open while the renderer uses it
+	virtual void setScene(const SceneFile& scene) = 0;
+	// camera is invert * proj * view as in basic.vert, model is ignored since nodes carry their transforms
+	virtual void render(const UniformBufferObject& frame, HdrImage& target) = 0;
+};
+
+// the fixed camera of updateUniformBuffer
+UniformBufferObject defaultFrame(float aspect);
+
+// FastPBR --render <scene|default> <output.hdr> [samples per pixel] [environment.hdr]
+int renderReference(const char *scenePath, const char *outputPath, uint32_t samplesPerPixel,
+	const char *environmentPath = nullptr);
@@ -0,0 +1,337 @@
+#include "sampler.hh"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Sobol direction numbers of the first four dimensions, Joe and Kuo's primitive polynomials
+static const uint32_t *sobolDirections() {
+	static const std::vector<uint32_t> directions = []() {
+		std::vector<uint32_t> values(4 * 32);
+		const uint32_t degrees[4] = { 0, 1, 2, 3 }, coefficients[4] = { 0, 0, 1, 1 };
+		const uint32_t initial[4][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 3, 0 }, { 1, 3, 1 } };
+		for (uint32_t i = 0; i < 32; ++i) {
+			values[i] = 1u << (31 - i);
+		}
+		for (uint32_t dimension = 1; dimension < 4; ++dimension) {
+			uint32_t *v = &values[dimension * 32];
+			uint32_t s = degrees[dimension];
+			for (uint32_t i = 0; i < 32; ++i) {
+				if (i < s) {
+					v[i] = initial[dimension][i] << (31 - i);
+					continue;
+				}
+				v[i] = v[i - s] ^ (v[i - s] >> s);
+				for (uint32_t k = 1; k < s; ++k) {
+					v[i] ^= ((coefficients[dimension] >> (s - 1 - k)) & 1) * v[i - k];
+				}
+			}
+		}
+		return values;
+	}();
+	return directions.data();
+}
+
+static uint32_t sobol(uint32_t index, uint32_t dimension) {
+	const uint32_t *v = sobolDirections() + dimension * 32;
+	uint32_t value = 0;
+	for (uint32_t bit = 0; index; index >>= 1, ++bit) {
+		value ^= (index & 1) ? v[bit] : 0;
+	}
+	return value;
+}
+
+static uint32_t reverseBits(uint32_t x) {
+	x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+	x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+	x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+	x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+	return (x >> 16) | (x << 16);
+}
+
+// Burley, "Practical Hash-based Owen Scrambling": the Laine and Karras permutation on reversed bits
+// flips every bit depending on the bits above it only, which is what an Owen scramble does
+static uint32_t owenScramble(uint32_t x, uint32_t seed) {
+	x = reverseBits(x);
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return reverseBits(x);
+}
+
+// the x component of pcg4d
+static uint32_t pcg4d(uint32_t x, uint32_t y, uint32_t z, uint32_t w, uint32_t component) {
+	uint32_t v[4] = { x * 1664525u + 1013904223u, y * 1664525u + 1013904223u, z * 1664525u + 1013904223u,
+		w * 1664525u + 1013904223u };
+	v[0] += v[1] * v[3];
+	v[1] += v[2] * v[0];
+	v[2] += v[0] * v[1];
+	v[3] += v[1] * v[2];
+	for (uint32_t& lane : v) {
+		lane ^= lane >> 16;
+	}
+	v[0] += v[1] * v[3];
+	v[1] += v[2] * v[0];
+	v[2] += v[0] * v[1];
+	v[3] += v[1] * v[2];
+	return v[component];
+}
+
+static float toFloat(uint32_t value) {
+	return (value >> 8) * (1.0f / 16777216.0f);
+}
+
+uint32_t Sampler::hash(uint32_t value) {
+	uint32_t state = value * 747796405u + 2891336453u;
+	uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+Sampler::Sampler(Type type, uint32_t x, uint32_t y, uint32_t seed, uint32_t index)
+	: _x(x), _y(y), _index(index), _type(type) {
+	_seed = type == Type::Sobol ? hash(seed ^ hash(x ^ hash(y))) : hash(seed);
+}
+
+void Sampler::startSet(uint32_t set) {
+	_set = set;
+	_dimension = 0;
+}
+
+float Sampler::next() {
+	float result = value();
+	++_dimension;
+	return result;
+}
+
+float Sampler::value() const {
+	if (_type == Type::Independent || _dimension >= 4) {
+		return toFloat(pcg4d(_x, _y, _index, _seed ^ hash(_set * 64 + _dimension / 4), _dimension % 4));
+	}
+	uint32_t setSeed = hash(_seed ^ hash(_set));
+	uint32_t value = owenScramble(sobol(owenScramble(_index, setSeed), _dimension), hash(setSeed + _dimension));
+	if (_type == Type::Sobol) {
+		return toFloat(value);
+	}
+	// toroidal shift by the texel, a different part of the texture for every dimension
+	uint32_t offset = hash(_set * 4 + _dimension);
+	uint32_t texel = ((_y + (offset >> 8)) % kBlueNoiseSize) * kBlueNoiseSize + (_x + offset) % kBlueNoiseSize;
+	float shifted = toFloat(value) + blueNoise()[texel];
+	return shifted - std::floor(shifted);
+}
+
+#if defined(__AVX2__)
+
+static __m256i hash8(__m256i value) {
+	__m256i state = _mm256_add_epi32(_mm256_mullo_epi32(value, _mm256_set1_epi32((int)747796405u)),
+		_mm256_set1_epi32((int)2891336453u));
+	__m256i shift = _mm256_add_epi32(_mm256_srli_epi32(state, 28), _mm256_set1_epi32(4));
+	__m256i word = _mm256_mullo_epi32(_mm256_xor_si256(_mm256_srlv_epi32(state, shift), state),
+		_mm256_set1_epi32(277803737));
+	return _mm256_xor_si256(_mm256_srli_epi32(word, 22), word);
+}
+
+static __m256i reverseBits8(__m256i x) {
+	// bytes in reverse order within every lane, then the bits of every byte through nibble tables
+	const __m256i byteOrder = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	const __m256i reversedHigh = _mm256_setr_epi8(0x00, 0x80, 0x40, (char)0xc0, 0x20, (char)0xa0, 0x60, (char)0xe0,
+		0x10, (char)0x90, 0x50, (char)0xd0, 0x30, (char)0xb0, 0x70, (char)0xf0, 0x00, (char)0x80, 0x40, (char)0xc0,
+		0x20, (char)0xa0, 0x60, (char)0xe0, 0x10, (char)0x90, 0x50, (char)0xd0, 0x30, (char)0xb0, 0x70, (char)0xf0);
+	const __m256i reversedLow = _mm256_setr_epi8(0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb,
+		0x7, 0xf, 0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf);
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	x = _mm256_shuffle_epi8(x, byteOrder);
+	__m256i low = _mm256_and_si256(x, nibble);
+	__m256i high = _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble);
+	return _mm256_or_si256(_mm256_shuffle_epi8(reversedHigh, low), _mm256_shuffle_epi8(reversedLow, high));
+}
+
+static __m256i owenScramble8(__m256i x, __m256i seed) {
+	x = _mm256_add_epi32(reverseBits8(x), seed);
+	x = _mm256_xor_si256(x, _mm256_mullo_epi32(x, _mm256_set1_epi32(0x6c50b47c)));
+	x = _mm256_xor_si256(x, _mm256_mullo_epi32(x, _mm256_set1_epi32((int)0xb82f1e52u)));
+	x = _mm256_xor_si256(x, _mm256_mullo_epi32(x, _mm256_set1_epi32((int)0xc7afe638u)));
+	x = _mm256_xor_si256(x, _mm256_mullo_epi32(x, _mm256_set1_epi32((int)0x8d22f6e6u)));
+	return reverseBits8(x);
+}
+
+static __m256i sobol8(__m256i index, uint32_t dimension) {
+	const uint32_t *v = sobolDirections() + dimension * 32;
+	__m256i value = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi32(1);
+	for (int bit = 0; bit < 32; ++bit) {
+		__m256i set = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_srli_epi32(index, bit), one), one);
+		value = _mm256_xor_si256(value, _mm256_and_si256(set, _mm256_set1_epi32((int)v[bit])));
+	}
+	return value;
+}
+
+static __m256i pcg4d8(__m256i x, __m256i y, __m256i z, __m256i w, uint32_t component) {
+	const __m256i multiplier = _mm256_set1_epi32(1664525), increment = _mm256_set1_epi32(1013904223);
+	__m256i v[4] = { _mm256_add_epi32(_mm256_mullo_epi32(x, multiplier), increment),
+		_mm256_add_epi32(_mm256_mullo_epi32(y, multiplier), increment),
+		_mm256_add_epi32(_mm256_mullo_epi32(z, multiplier), increment),
+		_mm256_add_epi32(_mm256_mullo_epi32(w, multiplier), increment) };
+	for (int round = 0; round < 2; ++round) {
+		v[0] = _mm256_add_epi32(v[0], _mm256_mullo_epi32(v[1], v[3]));
+		v[1] = _mm256_add_epi32(v[1], _mm256_mullo_epi32(v[2], v[0]));
+		v[2] = _mm256_add_epi32(v[2], _mm256_mullo_epi32(v[0], v[1]));
+		v[3] = _mm256_add_epi32(v[3], _mm256_mullo_epi32(v[1], v[2]));
+		for (int k = 0; round == 0 && k < 4; ++k) {
+			v[k] = _mm256_xor_si256(v[k], _mm256_srli_epi32(v[k], 16));
+		}
+	}
+	return v[component];
+}
+
+static __m256 toFloat8(__m256i value) {
+	return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(value, 8)), _mm256_set1_ps(1.0f / 16777216.0f));
+}
+
+#endif
+
+void Sampler::nextLanes(Sampler *const samplers[8], float values[8]) {
+	const Sampler& first = *samplers[0];
+#if defined(__AVX2__)
+	bool together = true;
+	for (int lane = 1; lane < 8; ++lane) {
+		together &= samplers[lane]->_type == first._type && samplers[lane]->_set == first._set
+			&& samplers[lane]->_dimension == first._dimension;
+	}
+	if (together && (first._type == Type::Independent || first._dimension >= 4)) {
+		uint32_t xs[8], ys[8], indices[8], seeds[8];
+		const uint32_t setHash = hash(first._set * 64 + first._dimension / 4);
+		for (int lane = 0; lane < 8; ++lane) {
+			xs[lane] = samplers[lane]->_x;
+			ys[lane] = samplers[lane]->_y;
+			indices[lane] = samplers[lane]->_index;
+			seeds[lane] = samplers[lane]->_seed ^ setHash;
+		}
+		auto load = [](const uint32_t *lanes) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes)); };
+		_mm256_storeu_ps(values, toFloat8(pcg4d8(load(xs), load(ys), load(indices), load(seeds),
+			first._dimension % 4)));
+	} else if (together) {
+		uint32_t seeds[8], indices[8], texels[8];
+		const uint32_t offset = hash(first._set * 4 + first._dimension);
+		for (int lane = 0; lane < 8; ++lane) {
+			seeds[lane] = samplers[lane]->_seed;
+			indices[lane] = samplers[lane]->_index;
+			texels[lane] = ((samplers[lane]->_y + (offset >> 8)) % kBlueNoiseSize) * kBlueNoiseSize
+				+ (samplers[lane]->_x + offset) % kBlueNoiseSize;
+		}
+		__m256i seed = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(seeds));
+		__m256i setSeed = hash8(_mm256_xor_si256(seed, _mm256_set1_epi32((int)hash(first._set))));
+		__m256i index = owenScramble8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices)), setSeed);
+		__m256i value = owenScramble8(sobol8(index, first._dimension),
+			hash8(_mm256_add_epi32(setSeed, _mm256_set1_epi32((int)first._dimension))));
+		__m256 result = toFloat8(value);
+		if (first._type == Type::BlueNoise) {
+			__m256 noise = _mm256_i32gather_ps(blueNoise(), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(texels)),
+				4);
+			result = _mm256_add_ps(result, noise);
+			result = _mm256_sub_ps(result, _mm256_floor_ps(result));
+		}
+		_mm256_storeu_ps(values, result);
+	} else {
+		for (int lane = 0; lane < 8; ++lane) {
+			values[lane] = samplers[lane]->value();
+		}
+	}
+#else
+	for (int lane = 0; lane < 8; ++lane) {
+		values[lane] = samplers[lane]->value();
+	}
+#endif
+	for (int lane = 0; lane < 8; ++lane) {
+		if (lane == 0 || samplers[lane] != samplers[lane - 1]) {
+			++samplers[lane]->_dimension;
+		}
+	}
+}
+
+const float *Sampler::blueNoise() {
+	// Ulichney's void and cluster with a toroidal gaussian, ranks from removing the tightest clusters of an
+	// initial pattern and then filling the largest voids
+	static const std::vector<float> noise = []() {
+		const int size = (int)kBlueNoiseSize, count = size * size;
+		const float sigma = 1.5f;
+		std::vector<float> kernel(count);
+		for (int y = 0; y < size; ++y) {
+			for (int x = 0; x < size; ++x) {
+				float dx = (float)std::min(x, size - x), dy = (float)std::min(y, size - y);
+				kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+			}
+		}
+		std::vector<uint8_t> pattern(count, 0);
+		std::vector<float> energy(count, 0.0f);
+		auto splat = [&](int point, float sign) {
+			int px = point % size, py = point / size;
+			for (int y = 0; y < size; ++y) {
+				const float *row = &kernel[((y - py + size) % size) * size];
+				for (int x = 0; x < size; ++x) {
+					energy[y * size + x] += sign * row[(x - px + size) % size];
+				}
+			}
+		};
+		auto extreme = [&](uint8_t value, bool largest) {
+			int best = -1;
+			for (int i = 0; i < count; ++i) {
+				if (pattern[i] == value && (best < 0 || (largest ? energy[i] > energy[best] : energy[i] < energy[best]))) {
+					best = i;
+				}
+			}
+			return best;
+		};
+
+		// a tenth of the texels at random, then swapped from clusters into voids until that stops moving
+		const int initialCount = count / 10;
+		uint32_t random = 1;
+		for (int placed = 0; placed < initialCount;) {
+			random = hash(random);
+			int point = (int)(random % (uint32_t)count);
+			if (!pattern[point]) {
+				pattern[point] = 1;
+				splat(point, 1.0f);
+				++placed;
+			}
+		}
+		while (true) {
+			int cluster = extreme(1, true);
+			pattern[cluster] = 0;
+			splat(cluster, -1.0f);
+			int gap = extreme(0, false);
+			pattern[gap] = 1;
+			splat(gap, 1.0f);
+			if (gap == cluster) {
+				break;
+			}
+		}
+		std::vector<uint8_t> initialPattern = pattern;
+		std::vector<float> initialEnergy = energy;
+		std::vector<int> ranks(count);
+		for (int rank = initialCount - 1; rank >= 0; --rank) {
+			int cluster = extreme(1, true);
+			pattern[cluster] = 0;
+			splat(cluster, -1.0f);
+			ranks[cluster] = rank;
+		}
+		pattern = initialPattern;
+		energy = initialEnergy;
+		for (int rank = initialCount; rank < count; ++rank) {
+			int gap = extreme(0, false);
+			pattern[gap] = 1;
+			splat(gap, 1.0f);
+			ranks[gap] = rank;
+		}
+		std::vector<float> values(count);
+		for (int i = 0; i < count; ++i) {
+			values[i] = (ranks[i] + 0.5f) / count;
+		}
+		return values;
+	}();
+	return noise.data();
+}
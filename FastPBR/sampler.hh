@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+
+// Sample values for the path tracer. A sampler knows its pixel, its sample index within the pixel and
+// a seed, and a value depends on those and the dimension alone, never on what other paths drew:
+//   Independent  Jarzynski and Olano's pcg4d, a counter based generator over pixel, index and dimension
+//   Sobol        the first four Sobol dimensions with Burley's hash based Owen scrambling seeded per
+//                pixel, and every set of four shuffled by an Owen scramble of the index
+//   BlueNoise    one Owen scrambled Sobol sequence for the whole frame, rotated per pixel by a blue noise
+//                texture, so at low sample counts neighbouring pixels err in opposite directions
+// Dimensions come in sets of up to four that are stratified together, the tracer starts one set for
+// every kind of decision at every bounce. Dimensions past the fourth of a set are independent.
+class Sampler
+{
+public:
+	enum class Type : uint8_t { Independent, Sobol, BlueNoise };
+
+	static const uint32_t kBlueNoiseSize = 64;
+
+	Sampler() = default;
+	Sampler(Type type, uint32_t x, uint32_t y, uint32_t seed, uint32_t index);
+
+	void startSet(uint32_t set);
+	float next();
+	// the next value of eight samplers at the same set and dimension, what eight next() calls return.
+	// a sampler repeated on neighbouring lanes advances once
+	static void nextLanes(Sampler *const samplers[8], float values[8]);
+
+	// pcg hash
+	static uint32_t hash(uint32_t value);
+	// kBlueNoiseSize squared void and cluster ranks spread over [0, 1), built on first use
+	static const float *blueNoise();
+
+private:
+	uint32_t _x = 0;
+	uint32_t _y = 0;
+	// per pixel for Independent and Sobol, per frame for BlueNoise
+	uint32_t _seed = 0;
+	uint32_t _index = 0;
+	uint32_t _set = 0;
+	uint32_t _dimension = 0;
+	Type _type = Type::Independent;
+
+	float value() const;
+};
@@ -0,0 +1,294 @@
+#include "scene.hh"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char kSceneMagic[8] = { 'F', 'P', 'B', 'R', 'S', 'C', 'N', '\0' };
+// arrays start on cache lines, which covers the alignment of every element type
+static const size_t kSceneAlignment = 64;
+
+uint32_t SceneBuilder::addTexture(const std::string& path) {
+	SceneTexture texture;
+	texture.pathOffset = (uint32_t)_strings.size();
+	texture.pathLength = (uint32_t)path.size();
+	_strings.insert(_strings.end(), path.begin(), path.end());
+	_strings.push_back('\0');
+	_textures.push_back(texture);
+	return (uint32_t)_textures.size() - 1;
+}
+
+uint32_t SceneBuilder::addMaterial(const SceneMaterial& material) {
+	_materials.push_back(material);
+	return (uint32_t)_materials.size() - 1;
+}
+
+uint32_t SceneBuilder::addMesh(const MeshAsset& asset) {
+	SceneMesh mesh;
+	mesh.firstLod = (uint32_t)_lods.size();
+	mesh.lodCount = (uint32_t)asset.lods.size();
+	mesh.firstVertex = (uint32_t)_vertices.size();
+	mesh.vertexCount = (uint32_t)asset.vertices.size();
+	mesh.bounds = asset.bounds;
+
+	std::vector<glm::vec3> positions;
+	positions.reserve(asset.vertices.size());
+	for (const auto& vertex : asset.vertices) {
+		positions.push_back(vertex.pos);
+	}
+
+	for (const auto& assetLod : asset.lods) {
+		auto first = asset.indices.begin() + assetLod.indexOffset;
+		std::vector<uint32_t> lodIndices(first, first + assetLod.indexCount);
+		MeshletMesh lodMeshlets = buildMeshlets(positions, lodIndices);
+		for (auto& vertex : lodMeshlets.vertices) {
+			vertex += mesh.firstVertex;
+		}
+		uint32_t firstMeshlet = appendMeshlets(_meshlets, lodMeshlets);
+		_lodMeshlets.push_back(glm::uvec2(firstMeshlet, (uint32_t)lodMeshlets.meshlets.size()));
+
+		MeshLod lod = assetLod;
+		lod.indexOffset = (uint32_t)_indices.size();
+		for (uint32_t index : lodIndices) {
+			_indices.push_back(index + mesh.firstVertex);
+		}
+		_lods.push_back(lod);
+	}
+	_vertices.insert(_vertices.end(), asset.vertices.begin(), asset.vertices.end());
+	_meshes.push_back(mesh);
+	return (uint32_t)_meshes.size() - 1;
+}
+
+uint32_t SceneBuilder::addNode(const glm::mat4& local, uint32_t parent, uint32_t mesh, uint32_t material) {
+	if (parent != kSceneNone && parent >= _nodes.size()) {
+		throw std::invalid_argument("scene nodes must be added after their parent!");
+	}
+	SceneNode node;
+	node.local = local;
+	node.world = parent == kSceneNone ? local : _nodes[parent].world * local;
+	node.parent = parent;
+	node.mesh = mesh;
+	node.material = material;
+	node.reserved = 0;
+	node.bounds = glm::vec4(0.0f);
+	if (mesh != kSceneNone) {
+		const glm::vec4& bounds = _meshes[mesh].bounds;
+		float scale = std::max(glm::length(glm::vec3(node.world[0])),
+			std::max(glm::length(glm::vec3(node.world[1])), glm::length(glm::vec3(node.world[2]))));
+		node.bounds = glm::vec4(glm::vec3(node.world * glm::vec4(glm::vec3(bounds), 1.0f)), bounds.w * scale);
+	}
+	_nodes.push_back(node);
+	return (uint32_t)_nodes.size() - 1;
+}
+
+SceneBuilder SceneBuilder::defaultScene() {
+	std::vector<Vertex> vertices =
+	{
+		{ {-0.5f, -0.5f, 0 }, { 1.0, 0.0f, 0.0f }, {1.0f, 0.0f} },
+		{ { 0.5f, -0.5f, 0 }, { 1.0f, 1.0f, 0.0f }, {0.0f, 0.0f} },
+		{ { 0.5f, 0.5f, 0 }, { 0.0f, 0.0f, 1.0f }, {0.0, 1.0f} },
+		{ { -0.5f, 0.5f, 0 }, { 1.0f, 1.0f, 1.0f }, {1.0f, 1.0f} }
+	};
+	std::vector<uint32_t> indices = { 0, 1, 2, 2, 3, 0 };
+
+	SceneBuilder builder;
+	SceneMaterial material = {};
+	material.baseColor = glm::vec4(1.0f);
+	material.roughness = 1.0f;
+	material.baseColorTexture = builder.addTexture("textures/chicks.jpg");
+	material.metallicRoughnessTexture = kSceneNone;
+	// a quad has nothing to simplify, real meshes get their chains offline
+	builder.addNode(glm::mat4(1.0f), kSceneNone, builder.addMesh(buildMeshAsset(vertices, indices, 1)),
+		builder.addMaterial(material));
+	return builder;
+}
+
+std::vector<uint8_t> SceneBuilder::serialize() const {
+	SceneHeader header = {};
+	std::memcpy(header.magic, kSceneMagic, sizeof(header.magic));
+	header.version = kSceneVersion;
+
+	// first pass assigns offsets, second copies
+	size_t size = sizeof(SceneHeader);
+	auto place = [&](auto& array, const auto& items) {
+		size = (size + kSceneAlignment - 1) / kSceneAlignment * kSceneAlignment;
+		array.offset = size;
+		array.count = items.size();
+		size += sizeof(items[0]) * items.size();
+	};
+	place(header.nodes, _nodes);
+	place(header.meshes, _meshes);
+	place(header.materials, _materials);
+	place(header.textures, _textures);
+	place(header.vertices, _vertices);
+	place(header.indices, _indices);
+	place(header.lods, _lods);
+	place(header.lodMeshlets, _lodMeshlets);
+	place(header.meshlets, _meshlets.meshlets);
+	place(header.meshletVertices, _meshlets.vertices);
+	place(header.meshletTriangles, _meshlets.triangles);
+	place(header.strings, _strings);
+	header.fileSize = size;
+
+	std::vector<uint8_t> bytes(size, 0);
+	std::memcpy(bytes.data(), &header, sizeof(header));
+	auto copy = [&](const auto& array, const auto& items) {
+		if (!items.empty()) {
+			std::memcpy(bytes.data() + array.offset, items.data(), sizeof(items[0]) * items.size());
+		}
+	};
+	copy(header.nodes, _nodes);
+	copy(header.meshes, _meshes);
+	copy(header.materials, _materials);
+	copy(header.textures, _textures);
+	copy(header.vertices, _vertices);
+	copy(header.indices, _indices);
+	copy(header.lods, _lods);
+	copy(header.lodMeshlets, _lodMeshlets);
+	copy(header.meshlets, _meshlets.meshlets);
+	copy(header.meshletVertices, _meshlets.vertices);
+	copy(header.meshletTriangles, _meshlets.triangles);
+	copy(header.strings, _strings);
+	return bytes;
+}
+
+void SceneBuilder::write(const std::string& filename) const {
+	std::ofstream file(filename, std::ios::binary);
+	if (!file.is_open()) {
+		throw std::runtime_error("failed to open file!");
+	}
+	std::vector<uint8_t> bytes = serialize();
+	file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+SceneFile::~SceneFile() {
+	close();
+}
+
+void SceneFile::open(const std::string& filename) {
+	close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		throw std::runtime_error("failed to open file!");
+	}
+	LARGE_INTEGER size;
+	GetFileSizeEx(file, &size);
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	const void *bytes = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!bytes) {
+		if (mapping) {
+			CloseHandle(mapping);
+		}
+		CloseHandle(file);
+		throw std::runtime_error("failed to map scene file!");
+	}
+	_fileHandle = file;
+	_mappingHandle = mapping;
+	_size = (size_t)size.QuadPart;
+#else
+	int fileDescriptor = ::open(filename.c_str(), O_RDONLY);
+	if (fileDescriptor < 0) {
+		throw std::runtime_error("failed to open file!");
+	}
+	struct stat status;
+	fstat(fileDescriptor, &status);
+	void *bytes = status.st_size > 0
+		? mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0) : MAP_FAILED;
+	if (bytes == MAP_FAILED) {
+		::close(fileDescriptor);
+		throw std::runtime_error("failed to map scene file!");
+	}
+	// the whole file is about to be streamed into upload buffers
+	madvise(bytes, (size_t)status.st_size, MADV_SEQUENTIAL);
+	_fileDescriptor = fileDescriptor;
+	_size = (size_t)status.st_size;
+#endif
+	_bytes = static_cast<const uint8_t*>(bytes);
+	_mapped = true;
+	validate();
+}
+
+void SceneFile::openMemory(std::vector<uint8_t> bytes) {
+	close();
+	_memory = std::move(bytes);
+	_bytes = _memory.data();
+	_size = _memory.size();
+	validate();
+}
+
+void SceneFile::close() {
+	if (_mapped) {
+#ifdef _WIN32
+		UnmapViewOfFile(_bytes);
+		CloseHandle(_mappingHandle);
+		CloseHandle(_fileHandle);
+		_mappingHandle = nullptr;
+		_fileHandle = nullptr;
+#else
+		munmap(const_cast<uint8_t*>(_bytes), _size);
+		::close(_fileDescriptor);
+		_fileDescriptor = -1;
+#endif
+		_mapped = false;
+	}
+	_memory.clear();
+	_bytes = nullptr;
+	_size = 0;
+}
+
+bool SceneFile::isOpen() const {
+	return _bytes != nullptr;
+}
+
+size_t SceneFile::byteSize() const {
+	return _size;
+}
+
+const char *SceneFile::texturePath(uint32_t texture) const {
+	SceneView<SceneTexture> textureViews = textures();
+	SceneView<char> stringView = view(header().strings);
+	if (texture >= textureViews.size()
+		|| (size_t)textureViews[texture].pathOffset + textureViews[texture].pathLength >= stringView.size()) {
+		throw std::out_of_range("scene texture out of range!");
+	}
+	return stringView.data() + textureViews[texture].pathOffset;
+}
+
+void SceneFile::validate() {
+	// only the layout is checked, contents are used as they are
+	bool valid = _size >= sizeof(SceneHeader)
+		&& std::memcmp(header().magic, kSceneMagic, sizeof(kSceneMagic)) == 0;
+	if (valid && header().version != kSceneVersion) {
+		close();
+		throw std::runtime_error("unsupported scene version!");
+	}
+	valid = valid && header().fileSize == _size;
+
+	auto inside = [&](const auto& array, size_t elementSize) {
+		return array.offset % kSceneAlignment == 0 && array.offset <= _size
+			&& array.count <= (_size - array.offset) / elementSize;
+	};
+	const SceneHeader *h = valid ? &header() : nullptr;
+	valid = valid && inside(h->nodes, sizeof(SceneNode)) && inside(h->meshes, sizeof(SceneMesh))
+		&& inside(h->materials, sizeof(SceneMaterial)) && inside(h->textures, sizeof(SceneTexture))
+		&& inside(h->vertices, sizeof(Vertex)) && inside(h->indices, sizeof(uint32_t))
+		&& inside(h->lods, sizeof(MeshLod)) && inside(h->lodMeshlets, sizeof(glm::uvec2))
+		&& h->lodMeshlets.count == h->lods.count && inside(h->meshlets, sizeof(Meshlet))
+		&& inside(h->meshletVertices, sizeof(uint32_t)) && inside(h->meshletTriangles, sizeof(uint32_t))
+		&& inside(h->strings, sizeof(char));
+	if (!valid) {
+		close();
+		throw std::runtime_error("not a valid scene file!");
+	}
+}
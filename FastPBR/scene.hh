@@ -0,0 +1,168 @@
+#pragma once
+#include "asset.hh"
+#include "meshlet.hh"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Binary scene container. Every array is addressed by a byte offset from the start of the file,
+// so a mapped file is used in place: opening only checks the header and the array ranges.
+// All indices are global, index and meshlet vertex entries point straight into the vertex array.
+
+static const uint32_t kSceneVersion = 1;
+static const uint32_t kSceneNone = ~0u;
+
+template <typename T>
+struct SceneArray {
+	uint64_t offset;
+	uint64_t count;
+};
+
+// read only window into a mapped array
+template <typename T>
+struct SceneView {
+	const T *items = nullptr;
+	size_t count = 0;
+
+	const T *data() const { return items; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	const T *begin() const { return items; }
+	const T *end() const { return items + count; }
+	const T& operator[](size_t i) const { return items[i]; }
+};
+
+// nodes are stored parents first
+struct SceneNode {
+	glm::mat4 local;
+	glm::mat4 world;
+	// world space bounding sphere of the node's mesh, radius in w
+	glm::vec4 bounds;
+	uint32_t parent;
+	uint32_t mesh;
+	uint32_t material;
+	uint32_t reserved;
+};
+
+struct SceneMesh {
+	uint32_t firstLod;
+	uint32_t lodCount;
+	uint32_t firstVertex;
+	uint32_t vertexCount;
+	// object space bounding sphere, radius in w
+	glm::vec4 bounds;
+};
+
+struct SceneMaterial {
+	glm::vec4 baseColor;
+	glm::vec4 emissive;
+	float metallic;
+	float roughness;
+	uint32_t baseColorTexture;
+	uint32_t metallicRoughnessTexture;
+};
+
+struct SceneTexture {
+	// null terminated path into the string blob
+	uint32_t pathOffset;
+	uint32_t pathLength;
+};
+
+struct SceneHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t fileSize;
+	SceneArray<SceneNode> nodes;
+	SceneArray<SceneMesh> meshes;
+	SceneArray<SceneMaterial> materials;
+	SceneArray<SceneTexture> textures;
+	SceneArray<Vertex> vertices;
+	SceneArray<uint32_t> indices;
+	SceneArray<MeshLod> lods;
+	// first meshlet and meshlet count, parallel to lods
+	SceneArray<glm::uvec2> lodMeshlets;
+	SceneArray<Meshlet> meshlets;
+	SceneArray<uint32_t> meshletVertices;
+	SceneArray<uint32_t> meshletTriangles;
+	SceneArray<char> strings;
+};
+
+// offline side, collects everything in memory and lays it out in one go
+class SceneBuilder
+{
+public:
+	uint32_t addTexture(const std::string& path);
+	uint32_t addMaterial(const SceneMaterial& material);
+	// builds meshlets for every lod of the asset
+	uint32_t addMesh(const MeshAsset& asset);
+	uint32_t addNode(const glm::mat4& local, uint32_t parent, uint32_t mesh, uint32_t material);
+	// the textured quad shown when no scene file is given
+	static SceneBuilder defaultScene();
+
+	std::vector<uint8_t> serialize() const;
+	void write(const std::string& filename) const;
+
+private:
+	std::vector<SceneNode> _nodes;
+	std::vector<SceneMesh> _meshes;
+	std::vector<SceneMaterial> _materials;
+	std::vector<SceneTexture> _textures;
+	std::vector<Vertex> _vertices;
+	std::vector<uint32_t> _indices;
+	std::vector<MeshLod> _lods;
+	std::vector<glm::uvec2> _lodMeshlets;
+	MeshletMesh _meshlets;
+	std::vector<char> _strings;
+};
+
+// runtime side, a memory mapped scene file or a serialized scene kept in memory
+class SceneFile
+{
+public:
+	SceneFile() = default;
+	~SceneFile();
+	SceneFile(const SceneFile&) = delete;
+	SceneFile& operator=(const SceneFile&) = delete;
+
+	void open(const std::string& filename);
+	void openMemory(std::vector<uint8_t> bytes);
+	void close();
+	bool isOpen() const;
+	size_t byteSize() const;
+
+	SceneView<SceneNode> nodes() const { return view(header().nodes); }
+	SceneView<SceneMesh> meshes() const { return view(header().meshes); }
+	SceneView<SceneMaterial> materials() const { return view(header().materials); }
+	SceneView<SceneTexture> textures() const { return view(header().textures); }
+	SceneView<Vertex> vertices() const { return view(header().vertices); }
+	SceneView<uint32_t> indices() const { return view(header().indices); }
+	SceneView<MeshLod> lods() const { return view(header().lods); }
+	SceneView<glm::uvec2> lodMeshlets() const { return view(header().lodMeshlets); }
+	SceneView<Meshlet> meshlets() const { return view(header().meshlets); }
+	SceneView<uint32_t> meshletVertices() const { return view(header().meshletVertices); }
+	SceneView<uint32_t> meshletTriangles() const { return view(header().meshletTriangles); }
+	const char *texturePath(uint32_t texture) const;
+
+private:
+	const uint8_t *_bytes = nullptr;
+	size_t _size = 0;
+	std::vector<uint8_t> _memory;
+	bool _mapped = false;
+#ifdef _WIN32
+	void *_fileHandle = nullptr;
+	void *_mappingHandle = nullptr;
+#else
+	int _fileDescriptor = -1;
+#endif
+
+	const SceneHeader& header() const { return *reinterpret_cast<const SceneHeader*>(_bytes); }
+	template <typename T>
+	SceneView<T> view(const SceneArray<T>& array) const {
+		SceneView<T> result;
+		result.items = reinterpret_cast<const T*>(_bytes + array.offset);
+		result.count = (size_t)array.count;
+		return result;
+	}
+	void validate();
+};
@@ -1,13 +1,61 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+// bsdf.glsl over plain floats
+#define BsdfFloat float
+#define BsdfVec3 vec3
+#define BsdfBool bool
+#define BSDF_FUNCTION
+#define BSDF_OUT(type) out type
+#define bsdfSelect(condition, a, b) ((condition) ? (a) : (b))
+#include "bsdf.glsl"
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) in vec3 fragPosition;
 
 layout(binding = 1) uniform sampler2D texSampler;
 
+// MaterialConstants in geometry.hh
+layout(push_constant) uniform MaterialConstants {
+    vec4 baseColor;
+    vec4 emissive;
+    // metallic, roughness
+    vec4 parameters;
+    vec4 cameraPosition;
+    // toward the light, w is its intensity
+    vec4 lightDirection;
+} material;
+
 layout(location = 0) out vec4 outColor;
 
+// uniform light from every direction on top of the sun
+const vec3 kAmbient = vec3(0.15, 0.18, 0.22);
+
 void main() {
-    outColor = texture(texSampler, fragTexCoord);
+    // the vertices carry no normals, so faces are flat shaded from the position derivatives
+    vec3 normal = normalize(cross(dFdx(fragPosition), dFdy(fragPosition)));
+    vec3 toCamera = normalize(material.cameraPosition.xyz - fragPosition);
+    if (dot(normal, toCamera) < 0.0) {
+        normal = -normal;
+    }
+    // the path tracer's basis, Duff et al.
+    float flip = normal.z >= 0.0 ? 1.0 : -1.0;
+    float a = -1.0 / (flip + normal.z);
+    float b = normal.x * normal.y * a;
+    vec3 tangent = vec3(1.0 + flip * normal.x * normal.x * a, flip * b, -flip * normal.x);
+    vec3 bitangent = vec3(b, flip + normal.y * normal.y * a, -normal.y);
+    mat3 toLocal = transpose(mat3(tangent, bitangent, normal));
+
+    BsdfMaterial surface;
+    surface.baseColor = material.baseColor.rgb * texture(texSampler, fragTexCoord).rgb;
+    surface.metallic = material.parameters.x;
+    surface.roughness = material.parameters.y;
+    vec3 wo = toLocal * toCamera;
+    vec3 wi = toLocal * material.lightDirection.xyz;
+    float pdf;
+    vec3 direct = evaluateBsdf(surface, wo, wi, pdf) * material.lightDirection.w;
+    vec3 ambient = bsdfAlbedo(surface, max(wo.z, 0.0)) * kAmbient;
+    outColor = vec4(direct + ambient + material.emissive.rgb, 1.0);
 }
\ No newline at end of file
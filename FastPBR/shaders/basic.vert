@@ -14,6 +14,7 @@ layout(location = 2) in vec2 inTexCoord;
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) out vec3 fragPosition;
 
 void main() {
     mat4 correction = 
@@ -28,4 +29,5 @@ void main() {
         * vec4(inPosition, 1.0);
     fragColor = inColor;
     fragTexCoord = inTexCoord;
+    fragPosition = vec3(ubo.model * vec4(inPosition, 1.0));
 }
\ No newline at end of file
@@ -0,0 +1,165 @@
+// Metallic roughness BSDF: GGX specular with Smith height correlated masking and Schlick Fresnel over
+// a Lambert base, with multiple scattering compensation so rough and white surfaces keep their energy.
+// Specular directions are sampled from the visible normals (Dupuy and Benyoub, spherical caps), the
+// diffuse ones by cosine, and every sample comes with the pdf of both lobes.
+//
+// One source for the shaders and the CPU path tracer, written in the subset GLSL and C++ share. The
+// includer defines BsdfFloat, BsdfVec3, BsdfBool, BSDF_FUNCTION, BSDF_OUT(type) and
+// bsdfSelect(condition, a, b), see basic.frag and bsdf.hh, so the C++ side can build it over floats or
+// over lanes.
+//
+// Directions are in the shading frame with the normal along z, wo points toward the viewer and wi
+// toward the light. The diffuse lobe is scaled by what the specular lobe leaves of wo's energy, which
+// keeps white surfaces at an albedo of one but is not reciprocal.
+
+struct BsdfMaterial {
+    BsdfVec3 baseColor;
+    BsdfFloat metallic;
+    BsdfFloat roughness;
+};
+
+const float kBsdfPi = 3.14159265f;
+// reflectance of dielectrics at normal incidence, ior 1.5
+const float kBsdfDielectricF0 = 0.04f;
+
+BSDF_FUNCTION BsdfFloat bsdfAlpha(BsdfFloat roughness) {
+    // perceptual roughness squared, never a perfect mirror so D stays finite
+    return max(roughness * roughness, BsdfFloat(2e-3f));
+}
+
+BSDF_FUNCTION BsdfFloat ggxDistribution(BsdfFloat alpha, BsdfFloat cosHalf) {
+    BsdfFloat alpha2 = alpha * alpha;
+    BsdfFloat denominator = cosHalf * cosHalf * (alpha2 - 1.0f) + 1.0f;
+    return alpha2 / (kBsdfPi * denominator * denominator);
+}
+
+// masking of one direction, G1
+BSDF_FUNCTION BsdfFloat ggxMasking(BsdfFloat alpha, BsdfFloat cosTheta) {
+    BsdfFloat alpha2 = alpha * alpha;
+    return 2.0f * cosTheta / (cosTheta + sqrt(alpha2 + (1.0f - alpha2) * cosTheta * cosTheta));
+}
+
+// height correlated G2 / (4 cos wo cos wi), Heitz 2014
+BSDF_FUNCTION BsdfFloat ggxVisibility(BsdfFloat alpha, BsdfFloat cosOut, BsdfFloat cosIn) {
+    BsdfFloat alpha2 = alpha * alpha;
+    BsdfFloat lambdaOut = cosIn * sqrt(cosOut * cosOut * (1.0f - alpha2) + alpha2);
+    BsdfFloat lambdaIn = cosOut * sqrt(cosIn * cosIn * (1.0f - alpha2) + alpha2);
+    return 0.5f / max(lambdaOut + lambdaIn, BsdfFloat(1e-12f));
+}
+
+BSDF_FUNCTION BsdfVec3 schlickFresnel(BsdfVec3 f0, BsdfFloat cosTheta) {
+    BsdfFloat weight = clamp(1.0f - cosTheta, BsdfFloat(0.0f), BsdfFloat(1.0f));
+    BsdfFloat weight2 = weight * weight;
+    return f0 + (BsdfVec3(1.0f) - f0) * (weight2 * weight2 * weight);
+}
+
+// Fits over roughness and cos wo of the directional albedo of single scattering GGX with
+// F = f0 + (1 - f0) s, which is f0 * (albedo - schlick) + schlick. 0.4% and 0.3% mean error against
+// the integrals, a few percent at grazing angles.
+BSDF_FUNCTION BsdfFloat ggxAlbedo(BsdfFloat roughness, BsdfFloat cosOut) {
+    BsdfFloat m = cosOut;
+    BsdfFloat p1 = 1.3159f + m * (-12.1516f + m * (31.7839f + m * (-32.8759f + m * 12.1792f)));
+    BsdfFloat p2 = -4.9885f + m * (64.3313f + m * (-187.7375f + m * (203.6836f + m * -77.5179f)));
+    BsdfFloat p3 = 6.3223f + m * (-93.5240f + m * (297.2220f + m * (-333.6225f + m * 129.1978f)));
+    BsdfFloat p4 = -2.5800f + m * (43.4798f + m * (-145.2294f + m * (166.7301f + m * -65.3284f)));
+    BsdfFloat r = roughness;
+    return clamp(1.0f - r * (p1 + r * (p2 + r * (p3 + r * p4))), BsdfFloat(0.3f), BsdfFloat(1.0f));
+}
+
+BSDF_FUNCTION BsdfFloat ggxSchlickAlbedo(BsdfFloat roughness, BsdfFloat cosOut) {
+    BsdfFloat r = roughness;
+    BsdfFloat q1 = -0.1106f + r * (2.1187f + r * (-7.0002f + r * (8.2581f + r * -3.2729f)));
+    BsdfFloat q2 = 1.0031f + r * (-16.8702f + r * (53.5132f + r * (-61.0446f + r * 23.4459f)));
+    BsdfFloat q3 = -2.8107f + r * (37.5179f + r * (-107.6526f + r * (113.1812f + r * -40.2671f)));
+    BsdfFloat q4 = 2.9597f + r * (-23.8960f + r * (55.8318f + r * (-49.3888f + r * 14.4927f)));
+    BsdfFloat t = 1.0f - cosOut;
+    return clamp(t * (q1 + t * (q2 + t * (q3 + t * q4))), BsdfFloat(0.0f), BsdfFloat(1.0f));
+}
+
+// what both lobes need from the material and wo alone
+struct BsdfLobes {
+    BsdfVec3 f0;
+    BsdfFloat alpha;
+    // energy lost to single scattering, added back in proportion to f0 (Kulla and Conty)
+    BsdfVec3 specularScale;
+    BsdfVec3 specularAlbedo;
+    // lambert reflectance over pi, already reduced by the specular albedo
+    BsdfVec3 diffuse;
+    BsdfFloat specularProbability;
+};
+
+BSDF_FUNCTION BsdfLobes bsdfLobes(BsdfMaterial material, BsdfFloat cosOut) {
+    BsdfLobes lobes;
+    lobes.f0 = mix(BsdfVec3(kBsdfDielectricF0), material.baseColor, material.metallic);
+    lobes.alpha = bsdfAlpha(material.roughness);
+    BsdfFloat albedo = ggxAlbedo(material.roughness, cosOut);
+    BsdfFloat schlick = ggxSchlickAlbedo(material.roughness, cosOut);
+    lobes.specularScale = BsdfVec3(1.0f) + lobes.f0 * ((1.0f - albedo) / albedo);
+    lobes.specularAlbedo = lobes.specularScale * (lobes.f0 * (albedo - schlick) + BsdfVec3(schlick));
+    BsdfVec3 diffuseAlbedo = max(BsdfVec3(1.0f) - lobes.specularAlbedo, BsdfVec3(0.0f))
+        * material.baseColor * (1.0f - material.metallic);
+    lobes.diffuse = diffuseAlbedo * (1.0f / kBsdfPi);
+    // pick lobes by their share of the reflected energy
+    const BsdfVec3 luminance = BsdfVec3(0.2126f, 0.7152f, 0.0722f);
+    BsdfFloat specularEnergy = dot(lobes.specularAlbedo, luminance);
+    BsdfFloat diffuseEnergy = dot(diffuseAlbedo, luminance);
+    lobes.specularProbability = bsdfSelect(specularEnergy + diffuseEnergy > 0.0f,
+        specularEnergy / max(specularEnergy + diffuseEnergy, BsdfFloat(1e-12f)), BsdfFloat(0.5f));
+    return lobes;
+}
+
+// expected reflectance toward wo, for ambient light and the furnace test
+BSDF_FUNCTION BsdfVec3 bsdfAlbedo(BsdfMaterial material, BsdfFloat cosOut) {
+    BsdfLobes lobes = bsdfLobes(material, cosOut);
+    return lobes.specularAlbedo + lobes.diffuse * kBsdfPi;
+}
+
+// a visible normal of the GGX surface seen from wo
+BSDF_FUNCTION BsdfVec3 ggxSampleVisibleNormal(BsdfVec3 wo, BsdfFloat alpha, BsdfFloat u1, BsdfFloat u2) {
+    // stretch to the hemisphere configuration, sample the spherical cap and unstretch
+    BsdfVec3 stretched = normalize(BsdfVec3(wo.x * alpha, wo.y * alpha, wo.z));
+    BsdfFloat phi = 2.0f * kBsdfPi * u1;
+    BsdfFloat z = (1.0f - u2) * (1.0f + stretched.z) - stretched.z;
+    BsdfFloat sinTheta = sqrt(clamp(1.0f - z * z, BsdfFloat(0.0f), BsdfFloat(1.0f)));
+    BsdfVec3 halfway = BsdfVec3(sinTheta * cos(phi), sinTheta * sin(phi), z) + stretched;
+    return normalize(BsdfVec3(halfway.x * alpha, halfway.y * alpha, halfway.z));
+}
+
+// pdf of wi reflected about a visible normal, G1(wo) D(h) / (4 cos wo)
+BSDF_FUNCTION BsdfFloat ggxReflectionPdf(BsdfFloat alpha, BsdfFloat cosOut, BsdfFloat cosHalf) {
+    return ggxMasking(alpha, cosOut) * ggxDistribution(alpha, cosHalf) / (4.0f * cosOut);
+}
+
+BSDF_FUNCTION BsdfVec3 evaluateLobes(BsdfLobes lobes, BsdfVec3 wo, BsdfVec3 wi, BSDF_OUT(BsdfFloat) pdf) {
+    BsdfVec3 halfway = normalize(wo + wi);
+    BsdfFloat cosOut = max(wo.z, BsdfFloat(1e-6f));
+    BsdfFloat cosIn = max(wi.z, BsdfFloat(0.0f));
+    BsdfFloat cosHalf = max(halfway.z, BsdfFloat(0.0f));
+    BsdfVec3 fresnel = schlickFresnel(lobes.f0, dot(wo, halfway));
+    BsdfFloat specular = ggxDistribution(lobes.alpha, cosHalf) * ggxVisibility(lobes.alpha, cosOut, cosIn);
+    BsdfVec3 value = (lobes.specularScale * fresnel * specular + lobes.diffuse) * cosIn;
+    pdf = mix(cosIn * (1.0f / kBsdfPi), ggxReflectionPdf(lobes.alpha, cosOut, cosHalf), lobes.specularProbability);
+    BsdfBool above = wi.z > 0.0f && wo.z > 0.0f;
+    pdf = bsdfSelect(above, pdf, BsdfFloat(0.0f));
+    return bsdfSelect(above, value, BsdfVec3(0.0f));
+}
+
+// f(wo, wi) cos wi, and the pdf sampleBsdf picks wi with
+BSDF_FUNCTION BsdfVec3 evaluateBsdf(BsdfMaterial material, BsdfVec3 wo, BsdfVec3 wi, BSDF_OUT(BsdfFloat) pdf) {
+    return evaluateLobes(bsdfLobes(material, wo.z), wo, wi, pdf);
+}
+
+// Picks wi with u0 choosing the lobe and u1, u2 the direction, and returns f cos wi / pdf. The weight
+// is zero when wi ends up below the surface.
+BSDF_FUNCTION BsdfVec3 sampleBsdf(BsdfMaterial material, BsdfVec3 wo, BsdfFloat u0, BsdfFloat u1, BsdfFloat u2,
+    BSDF_OUT(BsdfVec3) wi, BSDF_OUT(BsdfFloat) pdf) {
+    BsdfLobes lobes = bsdfLobes(material, wo.z);
+    BsdfVec3 normal = ggxSampleVisibleNormal(wo, lobes.alpha, u1, u2);
+    BsdfVec3 reflected = normal * (2.0f * dot(wo, normal)) - wo;
+    BsdfFloat radius = sqrt(u1);
+    BsdfFloat phi = 2.0f * kBsdfPi * u2;
+    BsdfVec3 cosine = BsdfVec3(radius * cos(phi), radius * sin(phi), sqrt(max(1.0f - u1, BsdfFloat(0.0f))));
+    wi = bsdfSelect(u0 < lobes.specularProbability, reflected, cosine);
+    BsdfVec3 value = evaluateLobes(lobes, wo, wi, pdf);
+    return bsdfSelect(pdf > 0.0f, value / max(pdf, BsdfFloat(1e-12f)), BsdfVec3(0.0f));
+}
@@ -1,3 +1,10 @@
-C:/VulkanSDK/1.0.65.1/Bin/glslangValidator.exe -V basic.vert
-C:/VulkanSDK/1.0.65.1/Bin/glslangValidator.exe -V basic.frag
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V basic.vert
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V basic.frag
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V cluster_cull.comp -o cluster_cull.spv
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V display.vert -o display_vert.spv
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V display.frag -o display_frag.spv
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V pathtrace.comp -o pathtrace.spv
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V compute_add.comp -o compute_add.spv
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V compute_saxpy.comp -o compute_saxpy.spv
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V compute_hash.comp -o compute_hash.spv
 pause
\ No newline at end of file
@@ -0,0 +1,13 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec2 fragTexCoord;
+
+// the path tracer's frame, already tonemapped and sRGB encoded, see display.hh
+layout(binding = 1) uniform sampler2D texSampler;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    outColor = vec4(texture(texSampler, fragTexCoord).rgb, 1.0);
+}
@@ -0,0 +1,323 @@
+#include "simplify.hh"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+enum class VertexKind : uint8_t {
+	eManifold,	// single wedge, closed fan
+	eBorder,	// single wedge on an open edge loop
+	eSeam,		// two wedges whose open edges line up
+	eLocked,	// anything else
+};
+
+// attribute deviation in uv/color units is scaled by the mesh extent so it compares to position error
+const double kAttributeWeight = 0.1;
+const double kBorderWeight = 10.0;
+
+struct Quadric {
+	double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+	double b0 = 0, b1 = 0, b2 = 0, c = 0;
+	double weight = 0;
+
+	static Quadric fromPlane(const glm::dvec3& normal, double distance, double weight) {
+		Quadric q;
+		q.a00 = normal.x * normal.x * weight;
+		q.a01 = normal.x * normal.y * weight;
+		q.a02 = normal.x * normal.z * weight;
+		q.a11 = normal.y * normal.y * weight;
+		q.a12 = normal.y * normal.z * weight;
+		q.a22 = normal.z * normal.z * weight;
+		q.b0 = normal.x * distance * weight;
+		q.b1 = normal.y * distance * weight;
+		q.b2 = normal.z * distance * weight;
+		q.c = distance * distance * weight;
+		q.weight = weight;
+		return q;
+	}
+
+	void add(const Quadric& q) {
+		a00 += q.a00; a01 += q.a01; a02 += q.a02;
+		a11 += q.a11; a12 += q.a12; a22 += q.a22;
+		b0 += q.b0; b1 += q.b1; b2 += q.b2;
+		c += q.c;
+		weight += q.weight;
+	}
+
+	// weighted mean of the squared plane distances
+	double evaluate(const glm::vec3& p) const {
+		double x = p.x, y = p.y, z = p.z;
+		double error = a00 * x * x + a11 * y * y + a22 * z * z
+			+ 2 * (a01 * x * y + a02 * x * z + a12 * y * z)
+			+ 2 * (b0 * x + b1 * y + b2 * z) + c;
+		return weight > 0 ? std::fabs(error) / weight : 0;
+	}
+};
+
+struct Collapse {
+	uint32_t from;
+	uint32_t to;
+	double cost;
+};
+
+inline uint64_t edgeKey(uint32_t a, uint32_t b) {
+	return (uint64_t)a << 32 | b;
+}
+
+struct PositionHash {
+	size_t operator()(const glm::vec3& p) const {
+		uint32_t bits[3];
+		std::memcpy(bits, &p, sizeof(bits));
+		return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+	}
+};
+
+}
+
+std::vector<uint32_t> simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+	size_t targetIndexCount, float maxError, float *resultError) {
+	const size_t vertexCount = vertices.size();
+	std::vector<uint32_t> result = indices;
+	double worstError = 0;
+
+	// vertices with the same position share one position id and are linked in a wedge cycle
+	std::vector<uint32_t> positionIds(vertexCount);
+	std::vector<uint32_t> wedges(vertexCount);
+	std::vector<uint32_t> positionVertex;
+	{
+		std::unordered_map<glm::vec3, uint32_t, PositionHash> firstWithPosition;
+		for (uint32_t v = 0; v < vertexCount; ++v) {
+			auto inserted = firstWithPosition.emplace(vertices[v].pos, (uint32_t)positionVertex.size());
+			if (inserted.second) {
+				positionVertex.push_back(v);
+				wedges[v] = v;
+			} else {
+				uint32_t first = positionVertex[inserted.first->second];
+				wedges[v] = wedges[first];
+				wedges[first] = v;
+			}
+			positionIds[v] = inserted.first->second;
+		}
+	}
+
+	glm::vec3 lower(FLT_MAX), upper(-FLT_MAX);
+	for (const auto& vertex : vertices) {
+		lower = glm::min(lower, vertex.pos);
+		upper = glm::max(upper, vertex.pos);
+	}
+	double extent = vertexCount ? glm::length(upper - lower) : 0;
+	double attributeScale = kAttributeWeight * extent * extent;
+
+	auto attributeError = [&](uint32_t a, uint32_t b) {
+		glm::vec2 uv = vertices[a].texCoord - vertices[b].texCoord;
+		glm::vec3 color = vertices[a].color - vertices[b].color;
+		return attributeScale * (glm::dot(uv, uv) + glm::dot(color, color));
+	};
+
+	// classify once on the input topology
+	std::unordered_set<uint64_t> edges, positionEdges;
+	for (size_t i = 0; i < indices.size(); i += 3) {
+		for (int e = 0; e < 3; ++e) {
+			uint32_t a = indices[i + e], b = indices[i + (e + 1) % 3];
+			edges.insert(edgeKey(a, b));
+			positionEdges.insert(edgeKey(positionIds[a], positionIds[b]));
+		}
+	}
+	std::vector<uint8_t> openOut(vertexCount, 0), openIn(vertexCount, 0);
+	std::vector<bool> positionOpen(positionVertex.size(), false);
+	for (uint64_t edge : edges) {
+		uint32_t a = (uint32_t)(edge >> 32), b = (uint32_t)edge;
+		if (!edges.count(edgeKey(b, a))) {
+			openOut[a]++;
+			openIn[b]++;
+		}
+		if (!positionEdges.count(edgeKey(positionIds[b], positionIds[a]))) {
+			positionOpen[positionIds[a]] = true;
+			positionOpen[positionIds[b]] = true;
+		}
+	}
+
+	std::vector<VertexKind> kinds(vertexCount, VertexKind::eLocked);
+	for (uint32_t v = 0; v < vertexCount; ++v) {
+		uint32_t twin = wedges[v];
+		bool simpleLoop = openOut[v] == 1 && openIn[v] == 1;
+		if (twin == v) {
+			if (openOut[v] == 0 && openIn[v] == 0) {
+				kinds[v] = VertexKind::eManifold;
+			} else if (simpleLoop) {
+				kinds[v] = VertexKind::eBorder;
+			}
+		} else if (wedges[twin] == v && simpleLoop && openOut[twin] == 1 && openIn[twin] == 1
+			&& !positionOpen[positionIds[v]]) {
+			// open in index space but closed in position space
+			kinds[v] = VertexKind::eSeam;
+		}
+	}
+
+	// per position quadrics, open position edges get a perpendicular plane so borders stay put
+	std::vector<Quadric> quadrics(positionVertex.size());
+	for (size_t i = 0; i < indices.size(); i += 3) {
+		glm::dvec3 p[3] = { vertices[indices[i]].pos, vertices[indices[i + 1]].pos, vertices[indices[i + 2]].pos };
+		glm::dvec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+		double area = glm::length(normal);
+		if (area == 0) {
+			continue;
+		}
+		normal /= area;
+		Quadric face = Quadric::fromPlane(normal, -glm::dot(normal, p[0]), area * 0.5);
+		for (int e = 0; e < 3; ++e) {
+			uint32_t a = indices[i + e], b = indices[i + (e + 1) % 3];
+			quadrics[positionIds[a]].add(face);
+			if (!positionEdges.count(edgeKey(positionIds[b], positionIds[a]))) {
+				glm::dvec3 edge = p[(e + 1) % 3] - p[e];
+				double length = glm::length(edge);
+				glm::dvec3 borderNormal = glm::normalize(glm::cross(edge, normal));
+				Quadric border = Quadric::fromPlane(borderNormal, -glm::dot(borderNormal, p[e]),
+					length * length * kBorderWeight);
+				quadrics[positionIds[a]].add(border);
+				quadrics[positionIds[b]].add(border);
+			}
+		}
+	}
+
+	// directed edges of the current triangles, sorted for binary search
+	std::vector<uint64_t> currentEdges;
+	auto hasEdge = [&](uint32_t a, uint32_t b) {
+		return std::binary_search(currentEdges.begin(), currentEdges.end(), edgeKey(a, b));
+	};
+
+	// the twin of a seam collapse runs along the matching edge on the other side of the seam
+	auto seamTwinTarget = [&](uint32_t from, uint32_t to) {
+		uint32_t twinFrom = wedges[from];
+		for (uint32_t t = wedges[to]; t != to; t = wedges[t]) {
+			if (hasEdge(twinFrom, t) || hasEdge(t, twinFrom)) {
+				return t;
+			}
+		}
+		return ~0u;
+	};
+
+	std::vector<Collapse> collapses;
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<bool> touched(positionVertex.size());
+	std::vector<std::vector<uint32_t>> positionTriangles(positionVertex.size());
+
+	while (result.size() > targetIndexCount) {
+		currentEdges.clear();
+		for (auto& triangles : positionTriangles) {
+			triangles.clear();
+		}
+		for (size_t i = 0; i < result.size(); i += 3) {
+			for (int e = 0; e < 3; ++e) {
+				currentEdges.push_back(edgeKey(result[i + e], result[i + (e + 1) % 3]));
+				positionTriangles[positionIds[result[i + e]]].push_back((uint32_t)i);
+			}
+		}
+		std::sort(currentEdges.begin(), currentEdges.end());
+
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i += 3) {
+			for (int e = 0; e < 6; ++e) {
+				uint32_t from = result[i + e % 3];
+				uint32_t to = result[i + (e % 3 + (e < 3 ? 1 : 2)) % 3];
+				VertexKind kind = kinds[from];
+				bool open = !hasEdge(to, from) || !hasEdge(from, to);
+				if (kind == VertexKind::eLocked
+					|| (kind == VertexKind::eBorder && (kinds[to] != VertexKind::eBorder || !open))
+					|| (kind == VertexKind::eSeam && (kinds[to] != VertexKind::eSeam || !open))) {
+					continue;
+				}
+				double cost = quadrics[positionIds[from]].evaluate(vertices[to].pos) + attributeError(from, to);
+				if (kind == VertexKind::eSeam) {
+					uint32_t twinTo = seamTwinTarget(from, to);
+					if (twinTo == ~0u) {
+						continue;
+					}
+					cost += attributeError(wedges[from], twinTo);
+				}
+				collapses.push_back({ from, to, cost });
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) {
+			return a.cost < b.cost;
+		});
+
+		// each collapse removes about two triangles, don't overshoot the target in one pass
+		size_t collapseLimit = std::max<size_t>(1, (result.size() - targetIndexCount) / 6);
+		size_t collapseCount = 0;
+		for (uint32_t v = 0; v < vertexCount; ++v) {
+			remap[v] = v;
+		}
+		std::fill(touched.begin(), touched.end(), false);
+
+		for (const auto& collapse : collapses) {
+			if (collapseCount >= collapseLimit || collapse.cost > (double)maxError * maxError) {
+				break;
+			}
+			uint32_t fromPosition = positionIds[collapse.from], toPosition = positionIds[collapse.to];
+			if (touched[fromPosition] || touched[toPosition]) {
+				continue;
+			}
+
+			// moving the position must not flip any triangle that survives the collapse
+			bool flips = false;
+			glm::vec3 target = vertices[collapse.to].pos;
+			for (uint32_t triangle : positionTriangles[fromPosition]) {
+				glm::vec3 p[3], q[3];
+				bool degenerate = false;
+				for (int corner = 0; corner < 3; ++corner) {
+					uint32_t position = positionIds[result[triangle + corner]];
+					degenerate |= position == toPosition;
+					p[corner] = vertices[result[triangle + corner]].pos;
+					q[corner] = position == fromPosition ? target : p[corner];
+				}
+				if (degenerate) {
+					continue;
+				}
+				glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+				if (glm::dot(before, after) <= 0) {
+					flips = true;
+					break;
+				}
+			}
+			if (flips) {
+				continue;
+			}
+
+			remap[collapse.from] = collapse.to;
+			if (kinds[collapse.from] == VertexKind::eSeam) {
+				remap[wedges[collapse.from]] = seamTwinTarget(collapse.from, collapse.to);
+			}
+			quadrics[toPosition].add(quadrics[fromPosition]);
+			touched[fromPosition] = true;
+			touched[toPosition] = true;
+			worstError = std::max(worstError, collapse.cost);
+			collapseCount++;
+		}
+
+		if (collapseCount == 0) {
+			break;
+		}
+
+		size_t write = 0;
+		for (size_t i = 0; i < result.size(); i += 3) {
+			uint32_t a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+			if (positionIds[a] != positionIds[b] && positionIds[b] != positionIds[c] && positionIds[c] != positionIds[a]) {
+				result[write++] = a;
+				result[write++] = b;
+				result[write++] = c;
+			}
+		}
+		result.resize(write);
+	}
+
+	if (resultError) {
+		*resultError = (float)std::sqrt(worstError);
+	}
+	return result;
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include "geometry.hh"
+#include <cstdint>
+#include <vector>
+
+// quadric error edge collapse, vertices only ever collapse onto a neighbour so no attribute is
+// interpolated. vertices sharing a position with different attributes form a uv seam, a seam
+// vertex only moves along the seam and always together with its twin, so seams stay closed.
+// open borders and more complex wedges are kept in place.
+// returns the new index buffer, resultError is the object space distance the surface moved
+std::vector<uint32_t> simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+	size_t targetIndexCount, float maxError, float *resultError = nullptr);
@@ -0,0 +1,572 @@
+#include "texturecache.hh"
+#include "lanes.hh"
+#include <stb/stb_image.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// tiles every thread keeps on the side, direct mapped by key
+static const uint32_t kThreadTiles = 32;
+// falloff of the EWA gaussian, Heckbert's and pbrt's alpha
+static const float kEwaAlpha = 2.0f;
+static const uint32_t kEwaTableSize = 128;
+
+static std::atomic<uint64_t> nextGeneration{ 1 };
+
+static const float *decodeTable(bool srgb) {
+	static const std::vector<float> tables = []() {
+		std::vector<float> values(512);
+		for (int i = 0; i < 256; ++i) {
+			float c = i / 255.0f;
+			values[i] = c;
+			values[256 + i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		return values;
+	}();
+	return tables.data() + (srgb ? 256 : 0);
+}
+
+static glm::vec3 decode(uint32_t texel, const float *table) {
+	return glm::vec3(table[texel & 0xff], table[(texel >> 8) & 0xff], table[(texel >> 16) & 0xff]);
+}
+
+// offset of a texel within its tile, x and y bits interleaved
+static uint32_t mortonOffset(uint32_t x, uint32_t y) {
+	static const std::vector<uint32_t> spread = []() {
+		std::vector<uint32_t> values(TextureCache::kTileSize);
+		for (uint32_t i = 0; i < TextureCache::kTileSize; ++i) {
+			for (uint32_t bit = 0; (1u << bit) < TextureCache::kTileSize; ++bit) {
+				values[i] |= ((i >> bit) & 1) << (2 * bit);
+			}
+		}
+		return values;
+	}();
+	return spread[x] | spread[y] << 1;
+}
+
+static int wrap(int coordinate, uint32_t size) {
+	int wrapped = coordinate % (int)size;
+	return wrapped < 0 ? wrapped + (int)size : wrapped;
+}
+
+TextureCache::TextureCache(size_t memoryBudget) : _memoryBudget(memoryBudget), _generation(nextGeneration++) {
+}
+
+TextureCache::~TextureCache() {
+}
+
+uint32_t TextureCache::addTexture(const char *path) {
+	std::string file = path;
+	return addTexture([file](uint32_t& width, uint32_t& height, std::vector<uint8_t>& texels) {
+		int imageWidth, imageHeight, channels;
+		stbi_uc *pixels = stbi_load(file.c_str(), &imageWidth, &imageHeight, &channels, STBI_rgb_alpha);
+		if (!pixels) {
+			return false;
+		}
+		width = (uint32_t)imageWidth;
+		height = (uint32_t)imageHeight;
+		texels.assign(pixels, pixels + (size_t)width * height * 4);
+		stbi_image_free(pixels);
+		return true;
+	});
+}
+
+uint32_t TextureCache::addTexture(Loader loader) {
+	_textures.push_back(std::unique_ptr<Texture>(new Texture()));
+	_textures.back()->loader = std::move(loader);
+	return (uint32_t)_textures.size() - 1;
+}
+
+void TextureCache::clear() {
+	_textures.clear();
+	std::lock_guard<std::mutex> lock(_mutex);
+	_lru.clear();
+	_entries.clear();
+	_residentBytes = 0;
+	_generation = nextGeneration++;
+}
+
+void TextureCache::setMemoryBudget(size_t bytes) {
+	_memoryBudget = bytes;
+	std::lock_guard<std::mutex> lock(_mutex);
+	while (_residentBytes > _memoryBudget && !_lru.empty()) {
+		_entries.erase(_lru.back().key);
+		_lru.pop_back();
+		_residentBytes -= sizeof(Tile);
+	}
+}
+
+bool TextureCache::ensureKnown(uint32_t texture) const {
+	if (texture >= _textures.size()) {
+		return false;
+	}
+	const Texture& state = *_textures[texture];
+	if (!state.known.load(std::memory_order_acquire)) {
+		load(texture, tileKey(texture, 0, 0));
+	}
+	return !state.failed;
+}
+
+uint32_t TextureCache::width(uint32_t texture) const {
+	return ensureKnown(texture) ? _textures[texture]->levels[0].width : 0;
+}
+
+uint32_t TextureCache::height(uint32_t texture) const {
+	return ensureKnown(texture) ? _textures[texture]->levels[0].height : 0;
+}
+
+uint32_t TextureCache::levelCount(uint32_t texture) const {
+	return ensureKnown(texture) ? (uint32_t)_textures[texture]->levels.size() : 0;
+}
+
+const TextureCache::Tile *TextureCache::tile(uint32_t texture, uint32_t level, uint32_t tileX, uint32_t tileY) const {
+	struct ThreadTile {
+		uint64_t generation = 0;
+		uint64_t key = 0;
+		std::shared_ptr<const Tile> tile;
+	};
+	thread_local ThreadTile threadTiles[kThreadTiles];
+	uint64_t key = tileKey(texture, level, tileY * _textures[texture]->levels[level].tilesX + tileX);
+	// the top five bits of a fibonacci hash pick one of the 32 slots
+	static_assert(kThreadTiles == 32, "the slot hash keeps five bits");
+	ThreadTile& slot = threadTiles[(key * 0x9e3779b97f4a7c15ull) >> 59];
+	if (slot.generation == _generation && slot.key == key) {
+		return slot.tile.get();
+	}
+	++_tileRequests;
+	std::shared_ptr<const Tile> found;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto entry = _entries.find(key);
+		if (entry != _entries.end()) {
+			_lru.splice(_lru.begin(), _lru, entry->second);
+			found = entry->second->tile;
+		}
+	}
+	if (!found) {
+		++_tileMisses;
+		found = load(texture, key);
+	}
+	slot.generation = _generation;
+	slot.key = key;
+	slot.tile = std::move(found);
+	return slot.tile.get();
+}
+
+std::shared_ptr<const TextureCache::Tile> TextureCache::load(uint32_t texture, uint64_t key) const {
+	Texture& state = *_textures[texture];
+	std::lock_guard<std::mutex> loadLock(state.loadMutex);
+	// another thread may have brought the pyramid in while this one waited
+	if (state.known.load(std::memory_order_acquire)) {
+		if (state.failed) {
+			return nullptr;
+		}
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto entry = _entries.find(key);
+		if (entry != _entries.end()) {
+			_lru.splice(_lru.begin(), _lru, entry->second);
+			return entry->second->tile;
+		}
+	}
+
+	++_loads;
+	uint32_t width = 0, height = 0;
+	std::vector<uint8_t> texels;
+	bool loaded = state.loader(width, height, texels) && width > 0 && height > 0
+		&& texels.size() >= (size_t)width * height * 4;
+	if (state.known.load(std::memory_order_acquire)) {
+		// a texture that changed on disk keeps its first size
+		loaded &= width == state.levels[0].width && height == state.levels[0].height;
+		if (!loaded) {
+			return nullptr;
+		}
+	} else {
+		for (uint32_t levelWidth = width, levelHeight = height; loaded;) {
+			state.levels.push_back({ levelWidth, levelHeight, (levelWidth + kTileSize - 1) / kTileSize,
+				(levelHeight + kTileSize - 1) / kTileSize });
+			if (levelWidth == 1 && levelHeight == 1) {
+				break;
+			}
+			levelWidth = std::max(1u, levelWidth / 2);
+			levelHeight = std::max(1u, levelHeight / 2);
+		}
+		state.failed = !loaded;
+		state.known.store(true, std::memory_order_release);
+		if (!loaded) {
+			return nullptr;
+		}
+	}
+
+	// box filtered levels in the stored encoding, like a blit of the unorm image would make them
+	std::vector<uint32_t> current((size_t)width * height), next;
+	for (size_t i = 0; i < current.size(); ++i) {
+		const uint8_t *rgba = &texels[i * 4];
+		current[i] = rgba[0] | rgba[1] << 8 | rgba[2] << 16 | (uint32_t)rgba[3] << 24;
+	}
+	std::shared_ptr<const Tile> requested;
+	std::vector<std::pair<uint64_t, std::shared_ptr<const Tile>>> tiles;
+	for (uint32_t levelIndex = 0; levelIndex < state.levels.size(); ++levelIndex) {
+		const Level& level = state.levels[levelIndex];
+		if (levelIndex > 0) {
+			const Level& above = state.levels[levelIndex - 1];
+			next.resize((size_t)level.width * level.height);
+			for (uint32_t y = 0; y < level.height; ++y) {
+				for (uint32_t x = 0; x < level.width; ++x) {
+					uint32_t x0 = std::min(2 * x, above.width - 1), x1 = std::min(2 * x + 1, above.width - 1);
+					uint32_t y0 = std::min(2 * y, above.height - 1), y1 = std::min(2 * y + 1, above.height - 1);
+					const uint32_t corners[4] = { current[(size_t)y0 * above.width + x0],
+						current[(size_t)y0 * above.width + x1], current[(size_t)y1 * above.width + x0],
+						current[(size_t)y1 * above.width + x1] };
+					uint32_t texel = 0;
+					for (uint32_t shift = 0; shift < 32; shift += 8) {
+						uint32_t sum = 2;
+						for (uint32_t corner : corners) {
+							sum += (corner >> shift) & 0xff;
+						}
+						texel |= (sum / 4) << shift;
+					}
+					next[(size_t)y * level.width + x] = texel;
+				}
+			}
+			current.swap(next);
+		}
+		for (uint32_t tileY = 0; tileY < level.tilesY; ++tileY) {
+			for (uint32_t tileX = 0; tileX < level.tilesX; ++tileX) {
+				std::shared_ptr<Tile> tile = std::make_shared<Tile>();
+				for (uint32_t y = 0; y < kTileSize; ++y) {
+					for (uint32_t x = 0; x < kTileSize; ++x) {
+						uint32_t sourceX = std::min(tileX * kTileSize + x, level.width - 1);
+						uint32_t sourceY = std::min(tileY * kTileSize + y, level.height - 1);
+						tile->texels[mortonOffset(x, y)] = current[(size_t)sourceY * level.width + sourceX];
+					}
+				}
+				uint64_t tileKeyValue = tileKey(texture, levelIndex, tileY * level.tilesX + tileX);
+				if (tileKeyValue == key) {
+					requested = tile;
+				} else {
+					tiles.emplace_back(tileKeyValue, std::move(tile));
+				}
+			}
+		}
+	}
+	std::lock_guard<std::mutex> lock(_mutex);
+	for (auto& tile : tiles) {
+		insert(tile.first, std::move(tile.second), false);
+	}
+	insert(key, requested, true);
+	return requested;
+}
+
+void TextureCache::insert(uint64_t key, std::shared_ptr<const Tile> tile, bool used) const {
+	auto entry = _entries.find(key);
+	if (entry != _entries.end()) {
+		if (used) {
+			_lru.splice(_lru.begin(), _lru, entry->second);
+		}
+		return;
+	}
+	_entries[key] = used ? _lru.insert(_lru.begin(), { key, std::move(tile) })
+		: _lru.insert(_lru.end(), { key, std::move(tile) });
+	_residentBytes += sizeof(Tile);
+	// the newest tile stays even when it alone is over the budget
+	while (_residentBytes > _memoryBudget && _lru.size() > 1) {
+		_entries.erase(_lru.back().key);
+		_lru.pop_back();
+		_residentBytes -= sizeof(Tile);
+	}
+	_peakResidentBytes = std::max(_peakResidentBytes, _residentBytes);
+}
+
+uint32_t TextureCache::texel(uint32_t texture, uint32_t level, int x, int y) const {
+	const Level& size = _textures[texture]->levels[level];
+	uint32_t wrappedX = (uint32_t)wrap(x, size.width), wrappedY = (uint32_t)wrap(y, size.height);
+	const Tile *texels = tile(texture, level, wrappedX / kTileSize, wrappedY / kTileSize);
+	return texels ? texels->texels[mortonOffset(wrappedX % kTileSize, wrappedY % kTileSize)] : 0xffffffffu;
+}
+
+glm::vec3 TextureCache::bilinear(uint32_t texture, uint32_t level, glm::vec2 uv, bool srgb) const {
+	if (!ensureKnown(texture)) {
+		return glm::vec3(1.0f);
+	}
+	const std::vector<Level>& levels = _textures[texture]->levels;
+	level = std::min(level, (uint32_t)levels.size() - 1);
+	const Level& size = levels[level];
+	float x = (uv.x - std::floor(uv.x)) * size.width - 0.5f;
+	float y = (uv.y - std::floor(uv.y)) * size.height - 0.5f;
+	float floorX = std::floor(x), floorY = std::floor(y);
+	float fractionX = x - floorX, fractionY = y - floorY;
+	int x0 = wrap((int)floorX, size.width), y0 = wrap((int)floorY, size.height);
+	int x1 = wrap(x0 + 1, size.width), y1 = wrap(y0 + 1, size.height);
+	uint32_t corners[4];
+	if (x0 / kTileSize == x1 / kTileSize && y0 / kTileSize == y1 / kTileSize) {
+		// the common case, all four in one tile
+		const Tile *texels = tile(texture, level, x0 / kTileSize, y0 / kTileSize);
+		if (!texels) {
+			return glm::vec3(1.0f);
+		}
+		corners[0] = texels->texels[mortonOffset(x0 % kTileSize, y0 % kTileSize)];
+		corners[1] = texels->texels[mortonOffset(x1 % kTileSize, y0 % kTileSize)];
+		corners[2] = texels->texels[mortonOffset(x0 % kTileSize, y1 % kTileSize)];
+		corners[3] = texels->texels[mortonOffset(x1 % kTileSize, y1 % kTileSize)];
+	} else {
+		corners[0] = texel(texture, level, x0, y0);
+		corners[1] = texel(texture, level, x1, y0);
+		corners[2] = texel(texture, level, x0, y1);
+		corners[3] = texel(texture, level, x1, y1);
+	}
+	const float *table = decodeTable(srgb);
+	return glm::mix(glm::mix(decode(corners[0], table), decode(corners[1], table), fractionX),
+		glm::mix(decode(corners[2], table), decode(corners[3], table), fractionX), fractionY);
+}
+
+void TextureCache::bilinear8(uint32_t texture, const uint32_t levels[8], const glm::vec2 uvs[8], bool srgb,
+	glm::vec3 results[8]) const {
+	if (!ensureKnown(texture)) {
+		std::fill(results, results + 8, glm::vec3(1.0f));
+		return;
+	}
+	const std::vector<Level>& pyramid = _textures[texture]->levels;
+	float us[8], vs[8], widths[8], heights[8];
+	uint32_t laneLevels[8];
+	for (int lane = 0; lane < 8; ++lane) {
+		laneLevels[lane] = std::min(levels[lane], (uint32_t)pyramid.size() - 1);
+		us[lane] = uvs[lane].x;
+		vs[lane] = uvs[lane].y;
+		widths[lane] = (float)pyramid[laneLevels[lane]].width;
+		heights[lane] = (float)pyramid[laneLevels[lane]].height;
+	}
+	Float8 u = Float8::load(us), v = Float8::load(vs);
+	Float8 x = (u - floor(u)) * Float8::load(widths) - 0.5f;
+	Float8 y = (v - floor(v)) * Float8::load(heights) - 0.5f;
+	Float8 floorX = floor(x), floorY = floor(y);
+	Float8 fractionX = x - floorX, fractionY = y - floorY;
+
+	// loads per lane, a lane's four texels usually share one tile
+	float cornerXs[8], cornerYs[8];
+	floorX.store(cornerXs);
+	floorY.store(cornerYs);
+	alignas(32) uint32_t corners[4][8];
+	for (int lane = 0; lane < 8; ++lane) {
+		const Level& size = pyramid[laneLevels[lane]];
+		int x0 = wrap((int)cornerXs[lane], size.width), y0 = wrap((int)cornerYs[lane], size.height);
+		int x1 = wrap(x0 + 1, size.width), y1 = wrap(y0 + 1, size.height);
+		const Tile *texels = x0 / kTileSize == x1 / kTileSize && y0 / kTileSize == y1 / kTileSize
+			? tile(texture, laneLevels[lane], x0 / kTileSize, y0 / kTileSize) : nullptr;
+		if (texels) {
+			corners[0][lane] = texels->texels[mortonOffset(x0 % kTileSize, y0 % kTileSize)];
+			corners[1][lane] = texels->texels[mortonOffset(x1 % kTileSize, y0 % kTileSize)];
+			corners[2][lane] = texels->texels[mortonOffset(x0 % kTileSize, y1 % kTileSize)];
+			corners[3][lane] = texels->texels[mortonOffset(x1 % kTileSize, y1 % kTileSize)];
+		} else {
+			corners[0][lane] = texel(texture, laneLevels[lane], x0, y0);
+			corners[1][lane] = texel(texture, laneLevels[lane], x1, y0);
+			corners[2][lane] = texel(texture, laneLevels[lane], x0, y1);
+			corners[3][lane] = texel(texture, laneLevels[lane], x1, y1);
+		}
+	}
+
+	// decoded through the table, a gather per channel and corner
+	const float *table = decodeTable(srgb);
+	Float8 channels[4][3];
+	for (int corner = 0; corner < 4; ++corner) {
+#if defined(__AVX2__)
+		__m256i packed = _mm256_load_si256(reinterpret_cast<const __m256i*>(corners[corner]));
+		const __m256i byte = _mm256_set1_epi32(0xff);
+		for (int channel = 0; channel < 3; ++channel) {
+			__m256i index = _mm256_and_si256(_mm256_srli_epi32(packed, 8 * channel), byte);
+			channels[corner][channel] = Float8(_mm256_i32gather_ps(table, index, 4));
+		}
+#else
+		for (int channel = 0; channel < 3; ++channel) {
+			float values[8];
+			for (int lane = 0; lane < 8; ++lane) {
+				values[lane] = table[(corners[corner][lane] >> (8 * channel)) & 0xff];
+			}
+			channels[corner][channel] = Float8::load(values);
+		}
+#endif
+	}
+	// glm::mix's x (1 - a) + y a, so lanes match bilinear()
+	auto mixLanes = [](Float8 a, Float8 b, Float8 t) { return a * (1.0f - t) + b * t; };
+	float values[3][8];
+	for (int channel = 0; channel < 3; ++channel) {
+		Float8 top = mixLanes(channels[0][channel], channels[1][channel], fractionX);
+		Float8 bottom = mixLanes(channels[2][channel], channels[3][channel], fractionX);
+		mixLanes(top, bottom, fractionY).store(values[channel]);
+	}
+	for (int lane = 0; lane < 8; ++lane) {
+		results[lane] = glm::vec3(values[0][lane], values[1][lane], values[2][lane]);
+	}
+}
+
+float TextureCache::levelOf(uint32_t texture, const TextureFootprint& footprint, bool& anisotropic) const {
+	const std::vector<Level>& levels = _textures[texture]->levels;
+	glm::vec2 size((float)levels[0].width, (float)levels[0].height);
+	float lengthX = glm::length(footprint.axisX * size), lengthY = glm::length(footprint.axisY * size);
+	float major = std::max(lengthX, lengthY), minor = std::min(lengthX, lengthY);
+	anisotropic = _filter == Filter::Anisotropic && major > kEwaAnisotropy * minor;
+	// the footprint's diameter in texels picks the level, like the GPU's derivatives. EWA goes by the width
+	float diameter = 2.0f * (anisotropic ? std::max(minor, major / kMaxAnisotropy) : major);
+	return glm::clamp(std::log2(std::max(diameter, 1e-8f)), 0.0f, (float)(levels.size() - 1));
+}
+
+glm::vec3 TextureCache::sample(uint32_t texture, const TextureFootprint& footprint, bool srgb) const {
+	if (!ensureKnown(texture)) {
+		return glm::vec3(1.0f);
+	}
+	if (_filter == Filter::Bilinear) {
+		return bilinear(texture, 0, footprint.uv, srgb);
+	}
+	bool anisotropic;
+	float level = levelOf(texture, footprint, anisotropic);
+	uint32_t lower = (uint32_t)level;
+	float blend = level - lower;
+	if (anisotropic) {
+		glm::vec3 color = ewa(texture, lower, footprint.uv, footprint.axisX, footprint.axisY, srgb);
+		return blend > 0.0f ? glm::mix(color, ewa(texture, lower + 1, footprint.uv, footprint.axisX,
+			footprint.axisY, srgb), blend) : color;
+	}
+	glm::vec3 color = bilinear(texture, lower, footprint.uv, srgb);
+	return blend > 0.0f ? glm::mix(color, bilinear(texture, lower + 1, footprint.uv, srgb), blend) : color;
+}
+
+void TextureCache::sampleLanes(uint32_t texture, const TextureFootprint footprints[8], bool srgb,
+	glm::vec3 results[8]) const {
+	if (!ensureKnown(texture)) {
+		std::fill(results, results + 8, glm::vec3(1.0f));
+		return;
+	}
+	uint32_t lower[8], upper[8];
+	float blends[8];
+	bool anisotropic[8];
+	glm::vec2 uvs[8];
+	for (int lane = 0; lane < 8; ++lane) {
+		float level = 0.0f;
+		anisotropic[lane] = false;
+		if (_filter != Filter::Bilinear) {
+			level = levelOf(texture, footprints[lane], anisotropic[lane]);
+		}
+		lower[lane] = (uint32_t)level;
+		upper[lane] = lower[lane] + 1;
+		blends[lane] = level - lower[lane];
+		uvs[lane] = footprints[lane].uv;
+	}
+	// EWA lanes filter one at a time, the rest go through bilinear8 unless none is left
+	bool anyBilinear = false, anyBlend = false;
+	for (int lane = 0; lane < 8; ++lane) {
+		anyBilinear |= !anisotropic[lane];
+		anyBlend |= !anisotropic[lane] && blends[lane] > 0.0f;
+	}
+	glm::vec3 upperResults[8];
+	if (anyBilinear) {
+		bilinear8(texture, lower, uvs, srgb, results);
+	}
+	if (anyBlend) {
+		bilinear8(texture, upper, uvs, srgb, upperResults);
+	}
+	for (int lane = 0; lane < 8; ++lane) {
+		if (anisotropic[lane] && lane > 0 && anisotropic[lane - 1]
+			&& std::memcmp(&footprints[lane], &footprints[lane - 1], sizeof(TextureFootprint)) == 0) {
+			results[lane] = results[lane - 1];
+		} else if (anisotropic[lane]) {
+			results[lane] = sample(texture, footprints[lane], srgb);
+		} else if (blends[lane] > 0.0f) {
+			results[lane] = glm::mix(results[lane], upperResults[lane], blends[lane]);
+		}
+	}
+}
+
+glm::vec3 TextureCache::ewa(uint32_t texture, uint32_t level, glm::vec2 uv, glm::vec2 axisX, glm::vec2 axisY,
+	bool srgb) const {
+	static const std::vector<float> weights = []() {
+		std::vector<float> values(kEwaTableSize);
+		for (uint32_t i = 0; i < kEwaTableSize; ++i) {
+			float r2 = i / (float)(kEwaTableSize - 1);
+			values[i] = std::exp(-kEwaAlpha * r2) - std::exp(-kEwaAlpha);
+		}
+		return values;
+	}();
+	const std::vector<Level>& levels = _textures[texture]->levels;
+	level = std::min(level, (uint32_t)levels.size() - 1);
+	const Level& size = levels[level];
+	glm::vec2 scale((float)size.width, (float)size.height);
+	// the ellipse in this level's texels, its minor axis grown to keep the anisotropy bounded
+	glm::vec2 major = axisX * scale, minor = axisY * scale;
+	if (glm::length(minor) > glm::length(major)) {
+		std::swap(major, minor);
+	}
+	float majorLength = glm::length(major), minorLength = glm::length(minor);
+	if (minorLength * kMaxAnisotropy < majorLength) {
+		glm::vec2 across = minorLength > 0.0f ? minor / minorLength
+			: glm::vec2(-major.y, major.x) / std::max(majorLength, 1e-20f);
+		minor = across * (majorLength / kMaxAnisotropy);
+	}
+	// implicit ellipse a s^2 + b s t + c t^2 < 1, widened by a texel so it never falls between texels
+	float a = major.y * major.y + minor.y * minor.y + 1.0f;
+	float b = -2.0f * (major.x * major.y + minor.x * minor.y);
+	float c = major.x * major.x + minor.x * minor.x + 1.0f;
+	float inverseF = 1.0f / (a * c - b * b * 0.25f);
+	a *= inverseF;
+	b *= inverseF;
+	c *= inverseF;
+	float determinant = -b * b + 4.0f * a * c;
+	float inverseDeterminant = 1.0f / determinant;
+	float extentS = 2.0f * inverseDeterminant * std::sqrt(determinant * c);
+	float extentT = 2.0f * inverseDeterminant * std::sqrt(determinant * a);
+	float s = (uv.x - std::floor(uv.x)) * size.width - 0.5f, t = (uv.y - std::floor(uv.y)) * size.height - 0.5f;
+	int s0 = (int)std::ceil(s - extentS), s1 = (int)std::floor(s + extentS);
+	int t0 = (int)std::ceil(t - extentT), t1 = (int)std::floor(t + extentT);
+
+	const float *table = decodeTable(srgb);
+	glm::vec3 sum(0.0f);
+	float weightSum = 0.0f;
+	for (int it = t0; it <= t1; ++it) {
+		// the row's span inside the ellipse, the roots of a ds^2 + b dt ds + c dt^2 - 1
+		float dt = it - t;
+		float discriminant = b * b * dt * dt - 4.0f * a * (c * dt * dt - 1.0f);
+		if (discriminant <= 0.0f) {
+			continue;
+		}
+		float root = std::sqrt(discriminant);
+		int first = std::max(s0, (int)std::ceil(s + (-b * dt - root) / (2.0f * a)));
+		int last = std::min(s1, (int)std::floor(s + (-b * dt + root) / (2.0f * a)));
+		uint32_t y = (uint32_t)wrap(it, size.height), rowOffset = mortonOffset(0, y % kTileSize);
+		const Tile *texels = nullptr;
+		uint32_t tileX = ~0u;
+		for (int is = first, x = first <= last ? wrap(first, size.width) : 0; is <= last;
+			++is, x = x + 1 == (int)size.width ? 0 : x + 1) {
+			float ds = is - s;
+			float r2 = a * ds * ds + b * ds * dt + c * dt * dt;
+			if (r2 >= 1.0f) {
+				continue;
+			}
+			// the tile changes once every kTileSize texels along the row
+			if ((uint32_t)x / kTileSize != tileX) {
+				tileX = (uint32_t)x / kTileSize;
+				texels = tile(texture, level, tileX, y / kTileSize);
+			}
+			uint32_t packed = texels ? texels->texels[mortonOffset(x % kTileSize, 0) | rowOffset] : 0xffffffffu;
+			float weight = weights[std::min((uint32_t)(r2 * (kEwaTableSize - 1)), kEwaTableSize - 1)];
+			sum += weight * decode(packed, table);
+			weightSum += weight;
+		}
+	}
+	return weightSum > 0.0f ? sum / weightSum : bilinear(texture, level, uv, srgb);
+}
+
+TextureCache::Statistics TextureCache::statistics() const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return { _tileRequests.load(), _tileMisses.load(), _loads.load(), _residentBytes, _peakResidentBytes };
+}
+
+void TextureCache::resetStatistics() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_tileRequests = 0;
+	_tileMisses = 0;
+	_loads = 0;
+	_peakResidentBytes = _residentBytes;
+}
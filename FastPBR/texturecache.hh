@@ -0,0 +1,143 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Where a texture lookup lands: the ellipse uv + axisX cos t + axisY sin t in texture coordinates,
+// from the ray differentials or ray cone of the hit.
+struct TextureFootprint {
+	glm::vec2 uv;
+	glm::vec2 axisX;
+	glm::vec2 axisY;
+};
+
+// Textures for the CPU tracers, the same RGBA8 images the rasterizer uploads. Every texture becomes a
+// mip pyramid of kTileSize square tiles with the texels of a tile in Morton order, so a filter footprint
+// touches a few pages instead of a row each. Tiles live in an LRU cache that keeps resident texture memory
+// under a budget: a miss decodes the texture again and rebuilds its pyramid, the tiles it did not ask for
+// enter at the cold end. Each thread keeps its last few tiles on the side, so most lookups take no lock,
+// and those tiles may outlive their eviction by that many tiles per thread.
+// Footprints pick the filter: trilinear when they are about round, elliptical weighted averages (Heckbert)
+// when they are stretched, like the floor at grazing angles. Addressing repeats like the rasterizer's sampler.
+class TextureCache
+{
+public:
+	enum class Filter { Bilinear, Trilinear, Anisotropic };
+
+	static const uint32_t kTileSize = 32;
+	// footprints longer than this over their width are filtered with EWA
+	static constexpr float kEwaAnisotropy = 2.0f;
+	// EWA keeps the ellipse to this ratio by growing its minor axis, which bounds the texels per lookup
+	static constexpr float kMaxAnisotropy = 16.0f;
+
+	// fills width, height and width * height RGBA8 texels, false when it could not
+	using Loader = std::function<bool(uint32_t& width, uint32_t& height, std::vector<uint8_t>& texels)>;
+
+	struct Statistics {
+		// lookups that missed the thread's own tiles and went to the shared cache
+		uint64_t tileRequests;
+		uint64_t tileMisses;
+		// textures decoded, every miss costs one
+		uint64_t loads;
+		size_t residentBytes;
+		size_t peakResidentBytes;
+	};
+
+	explicit TextureCache(size_t memoryBudget = 256u << 20);
+	~TextureCache();
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	// adding and clearing must not overlap lookups
+	uint32_t addTexture(const char *path);
+	uint32_t addTexture(Loader loader);
+	void clear();
+	size_t textureCount() const { return _textures.size(); }
+
+	void setMemoryBudget(size_t bytes);
+	size_t memoryBudget() const { return _memoryBudget; }
+	void setFilter(Filter filter) { _filter = filter; }
+	Filter filter() const { return _filter; }
+
+	// linear RGB, srgb textures are decoded. white for textures that failed to load
+	glm::vec3 sample(uint32_t texture, const TextureFootprint& footprint, bool srgb) const;
+	// eight footprints in one texture, trilinear lanes filter together with bilinear8. a lane that repeats
+	// the one before it, like the padding past a partial batch, takes its result without filtering again
+	void sampleLanes(uint32_t texture, const TextureFootprint footprints[8], bool srgb, glm::vec3 results[8]) const;
+	// one mip level, texel centers at half integers like the GPU's
+	glm::vec3 bilinear(uint32_t texture, uint32_t level, glm::vec2 uv, bool srgb) const;
+	// the same for eight lanes: texel loads per lane, decoding and weights eight wide
+	void bilinear8(uint32_t texture, const uint32_t levels[8], const glm::vec2 uvs[8], bool srgb,
+		glm::vec3 results[8]) const;
+
+	// level 0 size and mip count, the texture is loaded to learn them. 0 for textures that failed
+	uint32_t width(uint32_t texture) const;
+	uint32_t height(uint32_t texture) const;
+	uint32_t levelCount(uint32_t texture) const;
+
+	Statistics statistics() const;
+	void resetStatistics();
+
+private:
+	struct Tile {
+		uint32_t texels[kTileSize * kTileSize];
+	};
+
+	struct Level {
+		uint32_t width;
+		uint32_t height;
+		uint32_t tilesX;
+		uint32_t tilesY;
+	};
+
+	struct Texture {
+		Loader loader;
+		std::mutex loadMutex;
+		// set once the first load learned the levels, which never change after
+		std::atomic<bool> known{ false };
+		bool failed = false;
+		std::vector<Level> levels;
+	};
+
+	struct Entry {
+		uint64_t key;
+		std::shared_ptr<const Tile> tile;
+	};
+
+	std::vector<std::unique_ptr<Texture>> _textures;
+	size_t _memoryBudget;
+	Filter _filter = Filter::Anisotropic;
+	// tells the threads' own tiles of this cache and of earlier contents apart
+	uint64_t _generation;
+
+	mutable std::mutex _mutex;
+	// most recently used first
+	mutable std::list<Entry> _lru;
+	mutable std::unordered_map<uint64_t, std::list<Entry>::iterator> _entries;
+	mutable size_t _residentBytes = 0;
+	mutable size_t _peakResidentBytes = 0;
+	mutable std::atomic<uint64_t> _tileRequests{ 0 };
+	mutable std::atomic<uint64_t> _tileMisses{ 0 };
+	mutable std::atomic<uint64_t> _loads{ 0 };
+
+	static uint64_t tileKey(uint32_t texture, uint32_t level, uint32_t tile) {
+		return (uint64_t)texture << 32 | (uint64_t)level << 24 | tile;
+	}
+	// learns the levels on first use, false when the texture has no texels
+	bool ensureKnown(uint32_t texture) const;
+	// valid until the thread's next call, nullptr when the texture no longer loads
+	const Tile *tile(uint32_t texture, uint32_t level, uint32_t tileX, uint32_t tileY) const;
+	// decodes the texture and caches its whole pyramid, the tile of key as the most recently used
+	std::shared_ptr<const Tile> load(uint32_t texture, uint64_t key) const;
+	void insert(uint64_t key, std::shared_ptr<const Tile> tile, bool used) const;
+	uint32_t texel(uint32_t texture, uint32_t level, int x, int y) const;
+	glm::vec3 ewa(uint32_t texture, uint32_t level, glm::vec2 uv, glm::vec2 axisX, glm::vec2 axisY, bool srgb) const;
+	// the mip level and whether EWA has to filter it, from the footprint's axes in level 0 texels
+	float levelOf(uint32_t texture, const TextureFootprint& footprint, bool& anisotropic) const;
+};
@@ -0,0 +1,80 @@
+#include "tlas.hh"
+#include <chrono>
+
+void Blas::build(const glm::vec3 *corners, size_t triangleCount, JobSystem& jobs) {
+	_corners.assign(corners, corners + triangleCount * 3);
+	_bounds = Aabb();
+	for (const glm::vec3& corner : _corners) {
+		_bounds.grow(corner);
+	}
+	// the binary bvh only lives until it is collapsed and its leaves are copied into blocks
+	Bvh bvh;
+	bvh.setLeafBlocks(8, TriangleBlocks<8>::kBlockCost);
+	bvh.buildTriangles(_corners.data(), triangleCount, jobs);
+	_bvh.collapse(bvh);
+	_blocks.build(bvh, _corners.data());
+}
+
+bool Blas::intersect(const Ray& ray, RayHit& hit) const {
+	const WatertightRay watertight(ray);
+	return _bvh.intersectLeaves(ray, hit, [&](uint32_t first, uint32_t count, RayHit& closest) {
+		return _blocks.intersect(watertight, first, count, closest);
+	});
+}
+
+size_t Blas::memoryBytes() const {
+	return _corners.size() * sizeof(glm::vec3) + _bvh.nodes().size() * sizeof(WideBvhNode<8>)
+		+ _bvh.primitives().size() * sizeof(uint32_t) + _blocks.memoryBytes();
+}
+
+void Tlas::build(const BlasInstance *instances, size_t instanceCount, JobSystem& jobs) {
+	auto startTime = std::chrono::high_resolution_clock::now();
+	_instances.assign(instances, instances + instanceCount);
+	_worldToObject.resize(instanceCount);
+	_bounds.resize(instanceCount);
+	jobs.parallelFor(instanceCount, 1024, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			const BlasInstance& instance = _instances[i];
+			_worldToObject[i] = glm::inverse(instance.transform);
+			Aabb bounds;
+			const Aabb& local = instance.blas->bounds();
+			if (local.empty()) {
+				// nothing to hit, a point keeps the builder's centroids finite
+				bounds.grow(glm::vec3(instance.transform[3]));
+			}
+			for (int corner = 0; corner < 8 && !local.empty(); ++corner) {
+				glm::vec3 point(corner & 1 ? local.max.x : local.min.x, corner & 2 ? local.max.y : local.min.y,
+					corner & 4 ? local.max.z : local.min.z);
+				bounds.grow(glm::vec3(instance.transform * glm::vec4(point, 1.0f)));
+			}
+			_bounds[i] = bounds;
+		}
+	});
+	// the binned sah build costs a few more milliseconds than the linear one but traces a good deal faster
+	_bvh.build(_bounds.data(), instanceCount, jobs);
+	auto endTime = std::chrono::high_resolution_clock::now();
+	_lastBuildMilliseconds = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+}
+
+bool Tlas::intersect(const Ray& ray, InstanceHit& hit) const {
+	return _bvh.intersect(ray, hit, [&](uint32_t index, RayHit& closest) {
+		// the direction stays unnormalized, so t means the same distance in both spaces
+		const glm::mat4& worldToObject = _worldToObject[index];
+		Ray local;
+		local.origin = glm::vec3(worldToObject * glm::vec4(ray.origin, 1.0f));
+		local.direction = glm::mat3(worldToObject) * ray.direction;
+		local.tMin = ray.tMin;
+		local.tMax = ray.tMax;
+		if (!_instances[index].blas->intersect(local, closest)) {
+			return false;
+		}
+		hit.instance = index;
+		return true;
+	});
+}
+
+size_t Tlas::memoryBytes() const {
+	return _instances.size() * sizeof(BlasInstance) + _worldToObject.size() * sizeof(glm::mat4)
+		+ _bounds.size() * sizeof(Aabb) + _bvh.nodes().size() * sizeof(BvhNode)
+		+ _bvh.primitives().size() * sizeof(uint32_t);
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include "bvh.hh"
+#include "jobs.hh"
+#include "ray.hh"
+#include "triangles.hh"
+#include "widebvh.hh"
+#include <cstdint>
+#include <vector>
+
+// Bottom level structure of one mesh in its own space, built once and shared by every instance:
+// an 8 wide bvh with the leaf triangles in watertight blocks.
+class Blas
+{
+public:
+	// three corners per triangle
+	void build(const glm::vec3 *corners, size_t triangleCount, JobSystem& jobs = JobSystem::shared());
+
+	// closest hit, t is measured along ray.direction as given, so an unnormalized object space
+	// direction keeps the world space t
+	bool intersect(const Ray& ray, RayHit& hit) const;
+
+	const Aabb& bounds() const { return _bounds; }
+	size_t triangleCount() const { return _corners.size() / 3; }
+	const glm::vec3 *corners(uint32_t triangle) const { return &_corners[(size_t)triangle * 3]; }
+	size_t memoryBytes() const;
+
+private:
+	std::vector<glm::vec3> _corners;
+	Aabb _bounds;
+	Bvh8 _bvh;
+	TriangleBlocks<8> _blocks;
+};
+
+struct BlasInstance {
+	glm::mat4 transform;
+	const Blas *blas;
+};
+
+struct InstanceHit : RayHit {
+	uint32_t instance = ~0u;
+};
+
+// Top level bvh over instances of shared blases. Rays are moved into the instance's object space on
+// entry, so memory grows with the unique meshes and not with the instances. The build only
+// transforms the blas bounds and bins them, cheap enough to redo every frame that instances move.
+class Tlas
+{
+public:
+	void build(const BlasInstance *instances, size_t instanceCount, JobSystem& jobs = JobSystem::shared());
+
+	bool intersect(const Ray& ray, InstanceHit& hit) const;
+
+	size_t instanceCount() const { return _instances.size(); }
+	const BlasInstance& instance(uint32_t index) const { return _instances[index]; }
+	// the inverse transpose of the instance transform, for normals
+	glm::mat3 normalTransform(uint32_t index) const { return glm::transpose(glm::mat3(_worldToObject[index])); }
+	size_t memoryBytes() const;
+	double lastBuildMilliseconds() const { return _lastBuildMilliseconds; }
+
+private:
+	std::vector<BlasInstance> _instances;
+	std::vector<glm::mat4> _worldToObject;
+	std::vector<Aabb> _bounds;
+	Bvh _bvh;
+	double _lastBuildMilliseconds = 0;
+};
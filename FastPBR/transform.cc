@@ -0,0 +1,337 @@
+#include "transform.hh"
+#include <algorithm>
+#include <chrono>
+#include <immintrin.h>
+#include <stdexcept>
+
+template <typename T>
+static void permute(std::vector<T>& values, const std::vector<uint32_t>& order) {
+	std::vector<T> permuted(values.size());
+	for (size_t slot = 0; slot < order.size(); ++slot) {
+		permuted[slot] = values[order[slot]];
+	}
+	std::copy(values.begin() + order.size(), values.end(), permuted.begin() + order.size());
+	values.swap(permuted);
+}
+
+uint32_t TransformHierarchy::addNode(uint32_t parent, const glm::vec3& translation, const glm::quat& rotation,
+	const glm::vec3& scale) {
+	if (parent != kTransformNone && parent >= _nodeCount) {
+		throw std::invalid_argument("transform nodes must be added after their parent!");
+	}
+	uint32_t node = (uint32_t)_nodeCount++;
+	size_t paddedCount = (_nodeCount + kLaneCount - 1) / kLaneCount * kLaneCount;
+	if (paddedCount > _scaleX.size()) {
+		_translationX.resize(paddedCount, 0.0f);
+		_translationY.resize(paddedCount, 0.0f);
+		_translationZ.resize(paddedCount, 0.0f);
+		_rotationX.resize(paddedCount, 0.0f);
+		_rotationY.resize(paddedCount, 0.0f);
+		_rotationZ.resize(paddedCount, 0.0f);
+		_rotationW.resize(paddedCount, 1.0f);
+		_scaleX.resize(paddedCount, 1.0f);
+		_scaleY.resize(paddedCount, 1.0f);
+		_scaleZ.resize(paddedCount, 1.0f);
+	}
+	// appending keeps parents first, the subtree runs are fixed up by the next update
+	_parentSlots.push_back(parent == kTransformNone ? kTransformNone : _slots[parent]);
+	_subtreeEnds.push_back(node + 1);
+	_dirty.push_back(1);
+	_world.push_back(glm::mat4(1.0f));
+	_slots.push_back(node);
+	_nodes.push_back(node);
+	_layoutDirty = _layoutDirty || parent != kTransformNone;
+	setTranslation(node, translation);
+	setRotation(node, rotation);
+	setScale(node, scale);
+	return node;
+}
+
+uint32_t TransformHierarchy::addNode(uint32_t parent, const glm::mat4& local) {
+	glm::vec3 scale(glm::length(glm::vec3(local[0])), glm::length(glm::vec3(local[1])),
+		glm::length(glm::vec3(local[2])));
+	// a mirrored basis keeps a proper rotation by flipping one axis
+	if (glm::determinant(glm::mat3(local)) < 0.0f) {
+		scale.x = -scale.x;
+	}
+	glm::mat3 rotation(glm::vec3(local[0]) / scale.x, glm::vec3(local[1]) / scale.y, glm::vec3(local[2]) / scale.z);
+	return addNode(parent, glm::vec3(local[3]), glm::normalize(glm::quat_cast(rotation)), scale);
+}
+
+void TransformHierarchy::clear() {
+	_nodeCount = 0;
+	_layoutDirty = false;
+	_translationX.clear();
+	_translationY.clear();
+	_translationZ.clear();
+	_rotationX.clear();
+	_rotationY.clear();
+	_rotationZ.clear();
+	_rotationW.clear();
+	_scaleX.clear();
+	_scaleY.clear();
+	_scaleZ.clear();
+	_parentSlots.clear();
+	_subtreeEnds.clear();
+	_dirty.clear();
+	_world.clear();
+	_slots.clear();
+	_nodes.clear();
+}
+
+size_t TransformHierarchy::size() const {
+	return _nodeCount;
+}
+
+void TransformHierarchy::setTranslation(uint32_t node, const glm::vec3& translation) {
+	uint32_t slot = _slots[node];
+	_translationX[slot] = translation.x;
+	_translationY[slot] = translation.y;
+	_translationZ[slot] = translation.z;
+	_dirty[slot] = 1;
+}
+
+void TransformHierarchy::setRotation(uint32_t node, const glm::quat& rotation) {
+	uint32_t slot = _slots[node];
+	_rotationX[slot] = rotation.x;
+	_rotationY[slot] = rotation.y;
+	_rotationZ[slot] = rotation.z;
+	_rotationW[slot] = rotation.w;
+	_dirty[slot] = 1;
+}
+
+void TransformHierarchy::setScale(uint32_t node, const glm::vec3& scale) {
+	uint32_t slot = _slots[node];
+	_scaleX[slot] = scale.x;
+	_scaleY[slot] = scale.y;
+	_scaleZ[slot] = scale.z;
+	_dirty[slot] = 1;
+}
+
+glm::vec3 TransformHierarchy::translation(uint32_t node) const {
+	uint32_t slot = _slots[node];
+	return glm::vec3(_translationX[slot], _translationY[slot], _translationZ[slot]);
+}
+
+glm::quat TransformHierarchy::rotation(uint32_t node) const {
+	uint32_t slot = _slots[node];
+	return glm::quat(_rotationW[slot], _rotationX[slot], _rotationY[slot], _rotationZ[slot]);
+}
+
+glm::vec3 TransformHierarchy::scale(uint32_t node) const {
+	uint32_t slot = _slots[node];
+	return glm::vec3(_scaleX[slot], _scaleY[slot], _scaleZ[slot]);
+}
+
+uint32_t TransformHierarchy::parent(uint32_t node) const {
+	uint32_t parentSlot = _parentSlots[_slots[node]];
+	return parentSlot == kTransformNone ? kTransformNone : _nodes[parentSlot];
+}
+
+const glm::mat4& TransformHierarchy::world(uint32_t node) const {
+	return _world[_slots[node]];
+}
+
+size_t TransformHierarchy::update(JobSystem& jobs) {
+	auto startTime = std::chrono::high_resolution_clock::now();
+	if (_layoutDirty) {
+		relayout();
+	}
+
+	// a dirty node takes its whole subtree along, clean parents in front of it are final already
+	size_t updatedCount = 0;
+	_ranges.clear();
+	for (uint32_t slot = 0; slot < _nodeCount;) {
+		if (!_dirty[slot]) {
+			++slot;
+			continue;
+		}
+		collectSubtree(slot);
+		updatedCount += _subtreeEnds[slot] - slot;
+		slot = _subtreeEnds[slot];
+	}
+
+	jobs.parallelFor(_ranges.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t range = begin; range < end; ++range) {
+			updateRange(_ranges[range].begin, _ranges[range].end);
+		}
+	});
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	_lastUpdateMilliseconds = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+	return updatedCount;
+}
+
+double TransformHierarchy::lastUpdateMilliseconds() const {
+	return _lastUpdateMilliseconds;
+}
+
+void TransformHierarchy::relayout() {
+	// depth first order, children keep their relative order
+	std::vector<uint32_t> childOffsets(_nodeCount + 1, 0);
+	for (size_t slot = 0; slot < _nodeCount; ++slot) {
+		if (_parentSlots[slot] != kTransformNone) {
+			++childOffsets[_parentSlots[slot] + 1];
+		}
+	}
+	for (size_t slot = 0; slot < _nodeCount; ++slot) {
+		childOffsets[slot + 1] += childOffsets[slot];
+	}
+	std::vector<uint32_t> children(childOffsets[_nodeCount]);
+	std::vector<uint32_t> childCounts(_nodeCount, 0);
+	for (uint32_t slot = 0; slot < _nodeCount; ++slot) {
+		uint32_t parentSlot = _parentSlots[slot];
+		if (parentSlot != kTransformNone) {
+			children[childOffsets[parentSlot] + childCounts[parentSlot]++] = slot;
+		}
+	}
+
+	std::vector<uint32_t> order;
+	order.reserve(_nodeCount);
+	for (uint32_t root = 0; root < _nodeCount; ++root) {
+		if (_parentSlots[root] != kTransformNone) {
+			continue;
+		}
+		_stack.push_back(root);
+		while (!_stack.empty()) {
+			uint32_t slot = _stack.back();
+			_stack.pop_back();
+			order.push_back(slot);
+			for (uint32_t child = childOffsets[slot + 1]; child > childOffsets[slot]; --child) {
+				_stack.push_back(children[child - 1]);
+			}
+		}
+	}
+
+	std::vector<uint32_t> newSlots(_nodeCount);
+	for (uint32_t slot = 0; slot < _nodeCount; ++slot) {
+		newSlots[order[slot]] = slot;
+	}
+	permute(_translationX, order);
+	permute(_translationY, order);
+	permute(_translationZ, order);
+	permute(_rotationX, order);
+	permute(_rotationY, order);
+	permute(_rotationZ, order);
+	permute(_rotationW, order);
+	permute(_scaleX, order);
+	permute(_scaleY, order);
+	permute(_scaleZ, order);
+	permute(_parentSlots, order);
+	permute(_dirty, order);
+	permute(_world, order);
+	permute(_nodes, order);
+	for (uint32_t slot = 0; slot < _nodeCount; ++slot) {
+		if (_parentSlots[slot] != kTransformNone) {
+			_parentSlots[slot] = newSlots[_parentSlots[slot]];
+		}
+		_slots[_nodes[slot]] = slot;
+		_subtreeEnds[slot] = slot + 1;
+	}
+	for (uint32_t slot = (uint32_t)_nodeCount; slot-- > 0;) {
+		uint32_t parentSlot = _parentSlots[slot];
+		if (parentSlot != kTransformNone) {
+			_subtreeEnds[parentSlot] = std::max(_subtreeEnds[parentSlot], _subtreeEnds[slot]);
+		}
+	}
+	_layoutDirty = false;
+}
+
+void TransformHierarchy::collectSubtree(uint32_t root) {
+	// subtrees too big for one job get their root updated here, the child subtrees are then
+	// independent of each other
+	_stack.push_back(root);
+	while (!_stack.empty()) {
+		uint32_t slot = _stack.back();
+		_stack.pop_back();
+		uint32_t end = _subtreeEnds[slot];
+		if (end - slot <= kNodesPerJob) {
+			addRange(slot, end);
+			continue;
+		}
+		updateRange(slot, slot + 1);
+		size_t first = _stack.size();
+		for (uint32_t child = slot + 1; child < end; child = _subtreeEnds[child]) {
+			_stack.push_back(child);
+		}
+		std::reverse(_stack.begin() + first, _stack.end());
+	}
+}
+
+void TransformHierarchy::addRange(uint32_t begin, uint32_t end) {
+	// neighbouring small subtrees share a job
+	if (!_ranges.empty() && _ranges.back().end == begin && _ranges.back().end - _ranges.back().begin < kNodesPerJob) {
+		_ranges.back().end = end;
+		return;
+	}
+	_ranges.push_back({ begin, end });
+}
+
+void TransformHierarchy::updateRange(uint32_t begin, uint32_t end) {
+	// local = translate * rotate * scale for 4 nodes per iteration, columns come out transposed
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	for (uint32_t base = begin; base < end; base += kLaneCount) {
+		__m128 x = _mm_loadu_ps(&_rotationX[base]);
+		__m128 y = _mm_loadu_ps(&_rotationY[base]);
+		__m128 z = _mm_loadu_ps(&_rotationZ[base]);
+		__m128 w = _mm_loadu_ps(&_rotationW[base]);
+		__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+		__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+		__m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+		__m128 scaleX = _mm_loadu_ps(&_scaleX[base]);
+		__m128 scaleY = _mm_loadu_ps(&_scaleY[base]);
+		__m128 scaleZ = _mm_loadu_ps(&_scaleZ[base]);
+
+		__m128 columns[4][4];
+		columns[0][0] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), scaleX);
+		columns[0][1] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), scaleX);
+		columns[0][2] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), scaleX);
+		columns[0][3] = _mm_setzero_ps();
+		columns[1][0] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), scaleY);
+		columns[1][1] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), scaleY);
+		columns[1][2] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), scaleY);
+		columns[1][3] = _mm_setzero_ps();
+		columns[2][0] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), scaleZ);
+		columns[2][1] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), scaleZ);
+		columns[2][2] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), scaleZ);
+		columns[2][3] = _mm_setzero_ps();
+		columns[3][0] = _mm_loadu_ps(&_translationX[base]);
+		columns[3][1] = _mm_loadu_ps(&_translationY[base]);
+		columns[3][2] = _mm_loadu_ps(&_translationZ[base]);
+		columns[3][3] = one;
+		// afterwards columns[c][lane] is column c of that lane's local matrix
+		for (int c = 0; c < 4; ++c) {
+			_MM_TRANSPOSE4_PS(columns[c][0], columns[c][1], columns[c][2], columns[c][3]);
+		}
+
+		// one node after the other, a parent may sit in the same block
+		uint32_t laneCount = std::min<uint32_t>((uint32_t)kLaneCount, end - base);
+		for (uint32_t lane = 0; lane < laneCount; ++lane) {
+			uint32_t slot = base + lane;
+			float *world = &_world[slot][0][0];
+			uint32_t parentSlot = _parentSlots[slot];
+			if (parentSlot == kTransformNone) {
+				for (int c = 0; c < 4; ++c) {
+					_mm_storeu_ps(world + c * 4, columns[c][lane]);
+				}
+			} else {
+				const float *parentWorld = &_world[parentSlot][0][0];
+				__m128 parent0 = _mm_loadu_ps(parentWorld);
+				__m128 parent1 = _mm_loadu_ps(parentWorld + 4);
+				__m128 parent2 = _mm_loadu_ps(parentWorld + 8);
+				__m128 parent3 = _mm_loadu_ps(parentWorld + 12);
+				for (int c = 0; c < 4; ++c) {
+					__m128 local = columns[c][lane];
+					__m128 column = _mm_add_ps(
+						_mm_add_ps(_mm_mul_ps(parent0, _mm_shuffle_ps(local, local, _MM_SHUFFLE(0, 0, 0, 0))),
+							_mm_mul_ps(parent1, _mm_shuffle_ps(local, local, _MM_SHUFFLE(1, 1, 1, 1)))),
+						_mm_add_ps(_mm_mul_ps(parent2, _mm_shuffle_ps(local, local, _MM_SHUFFLE(2, 2, 2, 2))),
+							_mm_mul_ps(parent3, _mm_shuffle_ps(local, local, _MM_SHUFFLE(3, 3, 3, 3)))));
+					_mm_storeu_ps(world + c * 4, column);
+				}
+			}
+			_dirty[slot] = 0;
+		}
+	}
+}
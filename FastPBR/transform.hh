@@ -0,0 +1,76 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <cstdint>
+#include <vector>
+#include "jobs.hh"
+
+static const uint32_t kTransformNone = ~0u;
+
+// Local translation, rotation and scale live in SoA arrays, laid out depth first so every
+// subtree is one contiguous run with its parent in front. update() only walks dirty subtrees,
+// builds 4 local matrices at a time with SSE and composes them with an SSE 4x4 multiply.
+// Node handles stay stable, the layout behind them is rebuilt when nodes are added.
+class TransformHierarchy
+{
+public:
+	// parent must already exist, new nodes start dirty
+	uint32_t addNode(uint32_t parent, const glm::vec3& translation = glm::vec3(0.0f),
+		const glm::quat& rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f), const glm::vec3& scale = glm::vec3(1.0f));
+	// local must be translation * rotation * scale without shear
+	uint32_t addNode(uint32_t parent, const glm::mat4& local);
+	void clear();
+	size_t size() const;
+
+	void setTranslation(uint32_t node, const glm::vec3& translation);
+	void setRotation(uint32_t node, const glm::quat& rotation);
+	void setScale(uint32_t node, const glm::vec3& scale);
+	glm::vec3 translation(uint32_t node) const;
+	glm::quat rotation(uint32_t node) const;
+	glm::vec3 scale(uint32_t node) const;
+	uint32_t parent(uint32_t node) const;
+	// valid after update()
+	const glm::mat4& world(uint32_t node) const;
+
+	// recomputes world matrices of every dirty subtree, returns how many nodes were touched
+	size_t update(JobSystem& jobs = JobSystem::shared());
+	double lastUpdateMilliseconds() const;
+
+private:
+	static const size_t kLaneCount = 4;
+	static const uint32_t kNodesPerJob = 4096;
+
+	struct Range {
+		uint32_t begin;
+		uint32_t end;
+	};
+
+	size_t _nodeCount = 0;
+	bool _layoutDirty = false;
+	// indexed by slot and padded to kLaneCount
+	std::vector<float> _translationX;
+	std::vector<float> _translationY;
+	std::vector<float> _translationZ;
+	std::vector<float> _rotationX;
+	std::vector<float> _rotationY;
+	std::vector<float> _rotationZ;
+	std::vector<float> _rotationW;
+	std::vector<float> _scaleX;
+	std::vector<float> _scaleY;
+	std::vector<float> _scaleZ;
+	std::vector<uint32_t> _parentSlots;
+	// one past the last slot of the subtree
+	std::vector<uint32_t> _subtreeEnds;
+	std::vector<uint8_t> _dirty;
+	std::vector<glm::mat4> _world;
+	std::vector<uint32_t> _slots;
+	std::vector<uint32_t> _nodes;
+	std::vector<Range> _ranges;
+	std::vector<uint32_t> _stack;
+	double _lastUpdateMilliseconds = 0;
+
+	void relayout();
+	void collectSubtree(uint32_t root);
+	void addRange(uint32_t begin, uint32_t end);
+	void updateRange(uint32_t begin, uint32_t end);
+};
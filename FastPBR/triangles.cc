@@ -0,0 +1,245 @@
+#include "triangles.hh"
+#include "widebvh.hh"
+#include <immintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+namespace {
+
+// An edge function is a difference of two products. Products of floats are exact in double, so taking the
+// difference there rounds once, to the negation of what the triangle across the edge gets. Fusing a product
+// into the difference can't change an exact product either, so builds that contract to fma stay watertight.
+struct SseLanes {
+	typedef __m128 Lanes;
+	static const uint32_t kWidth = 4;
+	static Lanes load(const float *values) { return _mm_load_ps(values); }
+	static void store(float *values, Lanes lanes) { _mm_store_ps(values, lanes); }
+	static Lanes broadcast(float value) { return _mm_set1_ps(value); }
+	static Lanes add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+	static Lanes sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+	static Lanes mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+	static Lanes div(Lanes a, Lanes b) { return _mm_div_ps(a, b); }
+	static Lanes either(Lanes a, Lanes b) { return _mm_or_ps(a, b); }
+	// comparisons are ordered, NaN lanes compare false
+	static uint32_t less(Lanes a, Lanes b) { return (uint32_t)_mm_movemask_ps(_mm_cmplt_ps(a, b)); }
+	static uint32_t lessEqual(Lanes a, Lanes b) { return (uint32_t)_mm_movemask_ps(_mm_cmple_ps(a, b)); }
+	// a * b - c * d in double
+	static Lanes differenceOfProducts(Lanes a, Lanes b, Lanes c, Lanes d) {
+		auto half = [](__m128 a, __m128 b, __m128 c, __m128 d) {
+			return _mm_cvtpd_ps(_mm_sub_pd(_mm_mul_pd(_mm_cvtps_pd(a), _mm_cvtps_pd(b)),
+				_mm_mul_pd(_mm_cvtps_pd(c), _mm_cvtps_pd(d))));
+		};
+		return _mm_movelh_ps(half(a, b, c, d),
+			half(_mm_movehl_ps(a, a), _mm_movehl_ps(b, b), _mm_movehl_ps(c, c), _mm_movehl_ps(d, d)));
+	}
+};
+
+#if defined(__AVX__)
+struct AvxLanes {
+	typedef __m256 Lanes;
+	static const uint32_t kWidth = 8;
+	static Lanes load(const float *values) { return _mm256_load_ps(values); }
+	static void store(float *values, Lanes lanes) { _mm256_store_ps(values, lanes); }
+	static Lanes broadcast(float value) { return _mm256_set1_ps(value); }
+	static Lanes add(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+	static Lanes sub(Lanes a, Lanes b) { return _mm256_sub_ps(a, b); }
+	static Lanes mul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+	static Lanes div(Lanes a, Lanes b) { return _mm256_div_ps(a, b); }
+	static Lanes either(Lanes a, Lanes b) { return _mm256_or_ps(a, b); }
+	static uint32_t less(Lanes a, Lanes b) { return (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LT_OQ)); }
+	static uint32_t lessEqual(Lanes a, Lanes b) {
+		return (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LE_OQ));
+	}
+	static Lanes differenceOfProducts(Lanes a, Lanes b, Lanes c, Lanes d) {
+		auto half = [](__m128 a, __m128 b, __m128 c, __m128 d) {
+			return _mm256_cvtpd_ps(_mm256_sub_pd(_mm256_mul_pd(_mm256_cvtps_pd(a), _mm256_cvtps_pd(b)),
+				_mm256_mul_pd(_mm256_cvtps_pd(c), _mm256_cvtps_pd(d))));
+		};
+		__m128 low = half(_mm256_castps256_ps128(a), _mm256_castps256_ps128(b), _mm256_castps256_ps128(c),
+			_mm256_castps256_ps128(d));
+		__m128 high = half(_mm256_extractf128_ps(a, 1), _mm256_extractf128_ps(b, 1), _mm256_extractf128_ps(c, 1),
+			_mm256_extractf128_ps(d, 1));
+		return _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1);
+	}
+};
+#endif
+
+// one group of L::kWidth lanes starting at lane first, candidate hits go to t, u and v. returns the
+// lanes hit within [tMin, tMax] and before limit
+template <typename L, uint32_t Width>
+uint32_t intersectLanes(const WatertightRay& ray, const TriangleBlock<Width>& block, uint32_t first, float limit,
+	float *t, float *u, float *v) {
+	typedef typename L::Lanes Lanes;
+	const Lanes shearX = L::broadcast(ray.shearX), shearY = L::broadcast(ray.shearY);
+	const Lanes originX = L::broadcast(ray.origin[ray.kx]), originY = L::broadcast(ray.origin[ray.ky]);
+	const Lanes originZ = L::broadcast(ray.origin[ray.kz]);
+	// corners relative to the origin and sheared onto the plane facing the ray
+	Lanes x[3], y[3], z[3];
+	for (uint32_t corner = 0; corner < 3; ++corner) {
+		z[corner] = L::sub(L::load(&block.corners[corner * 3 + ray.kz][first]), originZ);
+		x[corner] = L::sub(L::sub(L::load(&block.corners[corner * 3 + ray.kx][first]), originX),
+			L::mul(shearX, z[corner]));
+		y[corner] = L::sub(L::sub(L::load(&block.corners[corner * 3 + ray.ky][first]), originY),
+			L::mul(shearY, z[corner]));
+	}
+	Lanes edgeU = L::differenceOfProducts(x[2], y[1], y[2], x[1]);
+	Lanes edgeV = L::differenceOfProducts(x[0], y[2], y[0], x[2]);
+	Lanes edgeW = L::differenceOfProducts(x[1], y[0], y[1], x[0]);
+
+	const Lanes zero = L::broadcast(0.0f);
+	// inside when no edge function disagrees in sign with another, either winding counts
+	uint32_t negative = L::less(edgeU, zero) | L::less(edgeV, zero) | L::less(edgeW, zero);
+	uint32_t positive = L::less(zero, edgeU) | L::less(zero, edgeV) | L::less(zero, edgeW);
+	Lanes determinant = L::add(L::add(edgeU, edgeV), edgeW);
+	uint32_t mask = ~(negative & positive) & (L::less(determinant, zero) | L::less(zero, determinant));
+	if (!mask) {
+		return 0;
+	}
+	const Lanes shearZ = L::broadcast(ray.shearZ);
+	Lanes scaledT = L::add(L::add(L::mul(edgeU, L::mul(shearZ, z[0])), L::mul(edgeV, L::mul(shearZ, z[1]))),
+		L::mul(edgeW, L::mul(shearZ, z[2])));
+	Lanes distance = L::div(scaledT, determinant);
+	mask &= L::lessEqual(L::broadcast(ray.tMin), distance) & L::lessEqual(distance, L::broadcast(ray.tMax))
+		& L::less(distance, L::broadcast(limit));
+	if (mask) {
+		L::store(t, distance);
+		L::store(u, L::div(edgeV, determinant));
+		L::store(v, L::div(edgeW, determinant));
+	}
+	return mask;
+}
+
+template <uint32_t Width>
+uint32_t intersectGroups(const WatertightRay& ray, const TriangleBlock<Width>& block, float limit, float *t, float *u,
+	float *v);
+
+template <>
+uint32_t intersectGroups<4>(const WatertightRay& ray, const TriangleBlock<4>& block, float limit, float *t, float *u,
+	float *v) {
+	return intersectLanes<SseLanes>(ray, block, 0, limit, t, u, v);
+}
+
+template <>
+uint32_t intersectGroups<8>(const WatertightRay& ray, const TriangleBlock<8>& block, float limit, float *t, float *u,
+	float *v) {
+#if defined(__AVX__)
+	return intersectLanes<AvxLanes>(ray, block, 0, limit, t, u, v);
+#else
+	// without avx the block is two sse halves
+	return intersectLanes<SseLanes>(ray, block, 0, limit, t, u, v)
+		| intersectLanes<SseLanes>(ray, block, 4, limit, t + 4, u + 4, v + 4) << 4;
+#endif
+}
+
+}
+
+WatertightRay::WatertightRay(const Ray& ray) {
+	glm::vec3 magnitude = glm::abs(ray.direction);
+	kz = magnitude.x > magnitude.y ? (magnitude.x > magnitude.z ? 0 : 2) : (magnitude.y > magnitude.z ? 1 : 2);
+	kx = (kz + 1) % 3;
+	ky = (kx + 1) % 3;
+	// keeps the winding, so the sign of the edge functions tells the side
+	if (ray.direction[kz] < 0.0f) {
+		std::swap(kx, ky);
+	}
+	shearX = ray.direction[kx] / ray.direction[kz];
+	shearY = ray.direction[ky] / ray.direction[kz];
+	shearZ = 1.0f / ray.direction[kz];
+	origin = ray.origin;
+	tMin = ray.tMin;
+	tMax = ray.tMax;
+}
+
+bool intersectTriangleWatertight(const WatertightRay& ray, const glm::vec3& p0, const glm::vec3& p1,
+	const glm::vec3& p2, uint32_t triangle, RayHit& hit) {
+	const glm::vec3 corners[3] = { p0 - ray.origin, p1 - ray.origin, p2 - ray.origin };
+	float sheared[6];
+	for (int corner = 0; corner < 3; ++corner) {
+		sheared[corner * 2] = corners[corner][ray.kx] - ray.shearX * corners[corner][ray.kz];
+		sheared[corner * 2 + 1] = corners[corner][ray.ky] - ray.shearY * corners[corner][ray.kz];
+	}
+	const double ax = sheared[0], ay = sheared[1], bx = sheared[2], by = sheared[3], cx = sheared[4], cy = sheared[5];
+	float u = (float)(cx * by - cy * bx);
+	float v = (float)(ax * cy - ay * cx);
+	float w = (float)(bx * ay - by * ax);
+	if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f)) {
+		return false;
+	}
+	float determinant = u + v + w;
+	if (!(determinant < 0.0f || determinant > 0.0f)) {
+		return false;
+	}
+	float scaledT = u * (ray.shearZ * corners[0][ray.kz]) + v * (ray.shearZ * corners[1][ray.kz])
+		+ w * (ray.shearZ * corners[2][ray.kz]);
+	float t = scaledT / determinant;
+	if (t < ray.tMin || t > ray.tMax || t >= hit.t) {
+		return false;
+	}
+	hit.t = t;
+	hit.u = v / determinant;
+	hit.v = w / determinant;
+	hit.triangle = triangle;
+	return true;
+}
+
+template <uint32_t Width>
+bool intersectBlock(const WatertightRay& ray, const TriangleBlock<Width>& block, RayHit& hit) {
+	alignas(32) float t[Width], u[Width], v[Width];
+	uint32_t mask = intersectGroups<Width>(ray, block, hit.t, t, u, v);
+	if (!mask) {
+		return false;
+	}
+	// the closest lane wins, the lowest one on ties
+	uint32_t closest = lowestLane(mask);
+	for (mask &= mask - 1; mask; mask &= mask - 1) {
+		uint32_t lane = lowestLane(mask);
+		if (t[lane] < t[closest]) {
+			closest = lane;
+		}
+	}
+	hit.t = t[closest];
+	hit.u = u[closest];
+	hit.v = v[closest];
+	hit.triangle = block.triangle[closest];
+	return true;
+}
+
+template <uint32_t Width>
+void TriangleBlocks<Width>::build(const Bvh& bvh, const glm::vec3 *corners) {
+	const std::vector<uint32_t>& primitives = bvh.primitives();
+	_blocks.clear();
+	_leafBlocks.assign(primitives.size(), ~0u);
+	for (const BvhNode& node : bvh.nodes()) {
+		if (!node.isLeaf()) {
+			continue;
+		}
+		_leafBlocks[node.offset] = (uint32_t)_blocks.size();
+		for (uint32_t first = node.offset; first < node.offset + node.count; first += Width) {
+			TriangleBlock<Width> block;
+			for (uint32_t lane = 0; lane < Width; ++lane) {
+				uint32_t entry = first + lane;
+				bool used = entry < node.offset + node.count;
+				block.triangle[lane] = used ? primitives[entry] : ~0u;
+				for (uint32_t corner = 0; corner < 3; ++corner) {
+					for (uint32_t axis = 0; axis < 3; ++axis) {
+						block.corners[corner * 3 + axis][lane] = used ? corners[(size_t)primitives[entry] * 3 + corner][axis]
+							: std::numeric_limits<float>::quiet_NaN();
+					}
+				}
+			}
+			_blocks.push_back(block);
+		}
+	}
+}
+
+template <uint32_t Width>
+size_t TriangleBlocks<Width>::memoryBytes() const {
+	return _blocks.size() * sizeof(TriangleBlock<Width>) + _leafBlocks.size() * sizeof(uint32_t);
+}
+
+template bool intersectBlock<4>(const WatertightRay&, const TriangleBlock<4>&, RayHit&);
+template bool intersectBlock<8>(const WatertightRay&, const TriangleBlock<8>&, RayHit&);
+template class TriangleBlocks<4>;
+template class TriangleBlocks<8>;
@@ -0,0 +1,68 @@
+#pragma once
+#include "bvh.hh"
+#include "ray.hh"
+#include <cstdint>
+#include <vector>
+
+// Ray constants of the watertight test of Woop et al.: the dominant direction axis becomes z and
+// the triangle is sheared so the ray points down z from the origin. Triangles sharing an edge then
+// compute the same edge function with opposite signs, so rays through edges and vertices never
+// slip between them.
+struct WatertightRay {
+	// permuted axes, z is the largest direction component
+	uint32_t kx, ky, kz;
+	float shearX, shearY, shearZ;
+	glm::vec3 origin;
+	float tMin;
+	float tMax;
+
+	explicit WatertightRay(const Ray& ray);
+};
+
+// Width triangles with their corners in SoA rows: rows 0-2 the first corner's x, y, z, rows 3-5 the
+// second's and rows 6-8 the third's. Unused lanes have NaN corners and never hit.
+template <uint32_t Width>
+struct alignas(32) TriangleBlock {
+	float corners[9][Width];
+	uint32_t triangle[Width];
+};
+
+// both sides count and hit is only written when closer than hit.t, like intersectTriangle.
+// u and v are the barycentrics of the second and third corner
+template <uint32_t Width>
+bool intersectBlock(const WatertightRay& ray, const TriangleBlock<Width>& block, RayHit& hit);
+
+// scalar version of the same test
+bool intersectTriangleWatertight(const WatertightRay& ray, const glm::vec3& p0, const glm::vec3& p1,
+	const glm::vec3& p2, uint32_t triangle, RayHit& hit);
+
+// The triangles of every bvh leaf copied into blocks, so leaves are tested Width triangles at a time
+// without going through the primitive indices. Leaves are found by their first entry in
+// Bvh::primitives(), which wide bvhs collapsed from the same bvh share.
+template <uint32_t Width>
+class TriangleBlocks
+{
+public:
+	// measured cost of one block test relative to one scalar test, for Bvh::setLeafBlocks
+	static constexpr float kBlockCost = Width == 8 ? 1.7f : 1.0f;
+
+	// corners three per triangle, as given to Bvh::buildTriangles
+	void build(const Bvh& bvh, const glm::vec3 *corners);
+
+	const std::vector<TriangleBlock<Width>>& blocks() const { return _blocks; }
+	size_t memoryBytes() const;
+
+	bool intersect(const WatertightRay& ray, uint32_t first, uint32_t count, RayHit& hit) const {
+		const TriangleBlock<Width> *block = &_blocks[_leafBlocks[first]];
+		bool found = false;
+		for (uint32_t i = 0; i < count; i += Width) {
+			found |= intersectBlock(ray, *block++, hit);
+		}
+		return found;
+	}
+
+private:
+	std::vector<TriangleBlock<Width>> _blocks;
+	// first block of the leaf starting at each primitive entry
+	std::vector<uint32_t> _leafBlocks;
+};
@@ -0,0 +1,363 @@
+#include "pathtracer.hh"
+#include "jobs.hh"
+#include <algorithm>
+#include <atomic>
+#include <utility>
+
+// Wavefront schedule after Laine et al., "Megakernels Considered Harmful". Instead of one loop per
+// pixel that runs every kind of work for its own path, the frame is cut into waves of paths that go
+// through one stage at a time, each stage parallel over chunks of the queue:
+//   generate  camera rays for every path of the wave
+//   extend    closest hits for every queued ray
+//   shade     hits sorted by material, so a job shades runs of one material, samples its BSDF and
+//             evaluates it toward the environment and light samples for eight paths at a time
+//   connect   paths that ended hand their radiance to the film, survivors are compacted into the next queue
+// Both schedules draw the same sample values for a path, so results match the per pixel loop except where
+// rounding flips a decision.
+
+void PathTracer::PathQueue::resize(size_t size) {
+	origins.resize(size);
+	directions.resize(size);
+	throughputs.resize(size);
+	samplers.resize(size);
+	cones.resize(size);
+	pdfs.resize(size);
+	normals.resize(size);
+	slots.resize(size);
+	hits.resize(size);
+}
+
+void PathTracer::renderWavefront(const glm::mat4& inverseViewProjection, uint32_t firstSample, HdrImage& target) {
+	JobSystem& jobs = *_jobs;
+	// the pixels of the tiles to render in row major order, with where their sequences continue
+	const uint32_t tilesX = (target.width + kTileSize - 1) / kTileSize;
+	_wavePixels.clear();
+	_waveFirstSamples.clear();
+	for (uint32_t y = 0; y < target.height; ++y) {
+		for (uint32_t x = 0; x < target.width; ++x) {
+			uint32_t tile = y / kTileSize * tilesX + x / kTileSize;
+			uint32_t offset = _tileSampleOffsets ? _tileSampleOffsets[tile] : firstSample;
+			if (offset != kSkipTile) {
+				_wavePixels.push_back(y * target.width + x);
+				_waveFirstSamples.push_back(offset);
+			}
+		}
+	}
+	const size_t pixelCount = _wavePixels.size();
+	const size_t pathCount = pixelCount * _samplesPerPixel;
+	if (_paths.origins.size() < kWaveSize) {
+		_paths.resize(kWaveSize);
+		_survivors.resize(kWaveSize);
+		_slotRadiance.resize(kWaveSize);
+		_shadeOrder.resize(kWaveSize);
+		_alive.resize(kWaveSize);
+	}
+	_film.assign(pixelCount, glm::vec3(0.0f));
+	if (_features) {
+		_slotFirstHits.resize(kWaveSize);
+		_featureSums.assign(pixelCount, FeatureSum());
+	}
+	// the miss queue sorts behind every material
+	const uint32_t missKey = (uint32_t)_materials.size();
+	const uint32_t keyCount = missKey + 1;
+	auto shadeKey = [&](const InstanceHit& hit) {
+		return hit.valid() ? _instanceMaterials[hit.instance] : missKey;
+	};
+	uint64_t rayCount = 0;
+	std::atomic<uint64_t> shadowRayCount{ 0 };
+	std::vector<uint32_t> chunkOffsets;
+
+	for (size_t waveBegin = 0; waveBegin < pathCount && !cancelled(); waveBegin += kWaveSize) {
+		uint32_t count = (uint32_t)std::min<size_t>(kWaveSize, pathCount - waveBegin);
+
+		// generate, path index is wave pixel * samples + sample
+		jobs.parallelFor(count, kWaveChunk, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				size_t path = waveBegin + i;
+				size_t wavePixel = path / _samplesPerPixel;
+				uint32_t pixel = _wavePixels[wavePixel], sample = (uint32_t)(path % _samplesPerPixel);
+				uint32_t x = pixel % target.width, y = pixel / target.width;
+				Sampler& sampler = _paths.samplers[i];
+				sampler = Sampler(_samplerType, x, y, _seed, _waveFirstSamples[wavePixel] + sample);
+				Ray ray = cameraRay(inverseViewProjection, x, y, target, sampler);
+				_paths.origins[i] = ray.origin;
+				_paths.directions[i] = ray.direction;
+				_paths.throughputs[i] = glm::vec3(1.0f);
+				_paths.cones[i] = { 0.0f, _pixelSpread };
+				_paths.pdfs[i] = 0.0f;
+				_paths.normals[i] = glm::vec3(0.0f);
+				_paths.slots[i] = (uint32_t)i;
+				_slotRadiance[i] = glm::vec3(0.0f);
+				if (_features) {
+					_slotFirstHits[i] = FirstHit();
+				}
+			}
+		});
+
+		for (uint32_t bounce = 0; count > 0; ++bounce) {
+			size_t chunkCount = (count + kWaveChunk - 1) / kWaveChunk;
+			auto chunkEnd = [&](size_t chunk) { return std::min<size_t>(count, (chunk + 1) * kWaveChunk); };
+
+			// extend
+			jobs.parallelFor(count, kWaveChunk, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; ++i) {
+					Ray ray;
+					ray.origin = _paths.origins[i];
+					ray.direction = _paths.directions[i];
+					ray.tMin = 0.0f;
+					ray.tMax = FLT_MAX;
+					_paths.hits[i] = InstanceHit();
+					intersect(ray, _paths.hits[i]);
+				}
+			});
+			rayCount += count;
+
+			// counting sort by material, histograms per chunk and then every chunk scatters its own keys
+			chunkOffsets.assign(chunkCount * keyCount, 0);
+			jobs.parallelFor(chunkCount, 1, [&](size_t begin, size_t end) {
+				for (size_t chunk = begin; chunk < end; ++chunk) {
+					for (size_t i = chunk * kWaveChunk; i < chunkEnd(chunk); ++i) {
+						++chunkOffsets[chunk * keyCount + shadeKey(_paths.hits[i])];
+					}
+				}
+			});
+			uint32_t offset = 0;
+			for (uint32_t key = 0; key < keyCount; ++key) {
+				for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+					uint32_t keys = chunkOffsets[chunk * keyCount + key];
+					chunkOffsets[chunk * keyCount + key] = offset;
+					offset += keys;
+				}
+			}
+			jobs.parallelFor(chunkCount, 1, [&](size_t begin, size_t end) {
+				for (size_t chunk = begin; chunk < end; ++chunk) {
+					for (size_t i = chunk * kWaveChunk; i < chunkEnd(chunk); ++i) {
+						_shadeOrder[chunkOffsets[chunk * keyCount + shadeKey(_paths.hits[i])]++] = (uint32_t)i;
+					}
+				}
+			});
+
+			// shade runs of one material
+			jobs.parallelFor(count, kWaveChunk, [&](size_t begin, size_t end) {
+				uint64_t jobRayCount = 0;
+				for (size_t run = begin; run < end;) {
+					uint32_t key = shadeKey(_paths.hits[_shadeOrder[run]]);
+					size_t runEnd = run + 1;
+					while (runEnd < end && shadeKey(_paths.hits[_shadeOrder[runEnd]]) == key) {
+						++runEnd;
+					}
+					if (key == missKey) {
+						for (size_t k = run; k < runEnd; ++k) {
+							uint32_t i = _shadeOrder[k];
+							_slotRadiance[_paths.slots[i]] += _paths.throughputs[i]
+								* escapedRadiance(_paths.directions[i], _paths.pdfs[i]);
+							_alive[i] = 0;
+						}
+						run = runEnd;
+						continue;
+					}
+					const SceneMaterial& material = _materials[key];
+					for (size_t k = run; k < runEnd; ++k) {
+						uint32_t i = _shadeOrder[k];
+						Ray ray;
+						ray.origin = _paths.origins[i];
+						ray.direction = _paths.directions[i];
+						_slotRadiance[_paths.slots[i]] += _paths.throughputs[i] * emittedRadiance(material,
+							_paths.hits[i], ray, _paths.pdfs[i], _paths.normals[i]);
+						_alive[i] = 0;
+					}
+					for (size_t k = run; k < runEnd && bounce < _maxBounces; k += 8) {
+						scatterLanes(material, &_shadeOrder[k], (uint32_t)std::min<size_t>(8, runEnd - k), bounce,
+							jobRayCount);
+					}
+					run = runEnd;
+				}
+				shadowRayCount += jobRayCount;
+			});
+
+			// connect: finished paths already left their radiance in their slot, survivors move up in order
+			chunkOffsets.assign(chunkCount + 1, 0);
+			jobs.parallelFor(chunkCount, 1, [&](size_t begin, size_t end) {
+				for (size_t chunk = begin; chunk < end; ++chunk) {
+					for (size_t i = chunk * kWaveChunk; i < chunkEnd(chunk); ++i) {
+						chunkOffsets[chunk + 1] += _alive[i];
+					}
+				}
+			});
+			for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+				chunkOffsets[chunk + 1] += chunkOffsets[chunk];
+			}
+			jobs.parallelFor(chunkCount, 1, [&](size_t begin, size_t end) {
+				for (size_t chunk = begin; chunk < end; ++chunk) {
+					uint32_t target = chunkOffsets[chunk];
+					for (size_t i = chunk * kWaveChunk; i < chunkEnd(chunk); ++i) {
+						if (!_alive[i]) {
+							continue;
+						}
+						_survivors.origins[target] = _paths.origins[i];
+						_survivors.directions[target] = _paths.directions[i];
+						_survivors.throughputs[target] = _paths.throughputs[i];
+						_survivors.samplers[target] = _paths.samplers[i];
+						_survivors.cones[target] = _paths.cones[i];
+						_survivors.pdfs[target] = _paths.pdfs[i];
+						_survivors.normals[target] = _paths.normals[i];
+						_survivors.slots[target] = _paths.slots[i];
+						++target;
+					}
+				}
+			});
+			std::swap(_paths, _survivors);
+			count = chunkOffsets[chunkCount];
+		}
+
+		// a pixel's samples are neighbours in path order, one job owns every pixel it touches
+		size_t waveEnd = std::min(pathCount, waveBegin + kWaveSize);
+		size_t firstPixel = waveBegin / _samplesPerPixel, lastPixel = (waveEnd - 1) / _samplesPerPixel;
+		jobs.parallelFor(lastPixel - firstPixel + 1, kWaveChunk, [&](size_t begin, size_t end) {
+			for (size_t pixel = firstPixel + begin; pixel < firstPixel + end; ++pixel) {
+				size_t first = std::max(waveBegin, pixel * _samplesPerPixel);
+				size_t last = std::min(waveEnd, (pixel + 1) * _samplesPerPixel);
+				for (size_t path = first; path < last; ++path) {
+					_film[pixel] += _slotRadiance[path - waveBegin];
+					if (_features) {
+						_featureSums[pixel].add(_slotFirstHits[path - waveBegin], _slotRadiance[path - waveBegin]);
+					}
+				}
+			}
+		});
+	}
+
+	jobs.parallelFor(pixelCount, kWaveChunk, [&](size_t begin, size_t end) {
+		for (size_t pixel = begin; pixel < end; ++pixel) {
+			target.pixels[_wavePixels[pixel]] = _film[pixel] / (float)_samplesPerPixel;
+			// pixels a cancelled render never reached keep their features
+			if (_features && _featureSums[pixel].samples > 0) {
+				_featureSums[pixel].store(*_features, _wavePixels[pixel]);
+			}
+		}
+	});
+	_lastRayCount = rayCount + shadowRayCount.load();
+	_lastRenderCancelled = cancelled();
+}
+
+void PathTracer::scatterLanes(const SceneMaterial& material, const uint32_t *paths, uint32_t count, uint32_t bounce,
+	uint64_t& rayCount) {
+	// lanes past count repeat the last path and are dropped afterwards
+	Surface surfaces[8];
+	glm::vec3 wo[8], baseColors[8];
+	float metallic[8], roughness[8];
+	Sampler *samplers[8];
+	for (uint32_t lane = 0; lane < 8; ++lane) {
+		uint32_t i = paths[std::min(lane, count - 1)];
+		Ray ray;
+		ray.origin = _paths.origins[i];
+		ray.direction = _paths.directions[i];
+		if (lane < count) {
+			_paths.cones[i].width += _paths.cones[i].spread * _paths.hits[i].t;
+			surfaces[lane] = surfaceAt(_paths.hits[i], ray, _paths.cones[i].width);
+		} else {
+			surfaces[lane] = surfaces[count - 1];
+		}
+		wo[lane] = surfaces[lane].toLocal(-ray.direction);
+		samplers[lane] = &_paths.samplers[i];
+	}
+	applyMaterialLanes(material, surfaces);
+	if (bounce == 0 && _features) {
+		for (uint32_t lane = 0; lane < count; ++lane) {
+			_slotFirstHits[_paths.slots[paths[lane]]] = { surfaces[lane].material.baseColor, surfaces[lane].normal,
+				_paths.hits[paths[lane]].t };
+		}
+	}
+	for (uint32_t lane = 0; lane < 8; ++lane) {
+		baseColors[lane] = surfaces[lane].material.baseColor;
+		metallic[lane] = surfaces[lane].material.metallic;
+		roughness[lane] = surfaces[lane].material.roughness;
+	}
+	// every lane is at the same bounce, so a dimension of all eight comes out of one batch
+	auto drawLanes = [&](SampleSet set, uint32_t dimensions, float (*values)[8]) {
+		for (uint32_t lane = 0; lane < count; ++lane) {
+			samplers[lane]->startSet(bounceSet(bounce, set));
+		}
+		for (uint32_t k = 0; k < dimensions; ++k) {
+			Sampler::nextLanes(samplers, values[k]);
+		}
+	};
+
+	// environment and light samples
+	glm::vec3 environmentDirections[8], environmentWi[8], lightWi[8];
+	float environmentPdfs[8], u[3][8];
+	LightSample lightSamples[8];
+	const bool sampleEnvironments = _environmentSampling != EnvironmentSampling::Bsdf;
+	const bool sampleLights = _lightSampling != LightSampling::Bsdf && !_lights.empty();
+	if (sampleEnvironments) {
+		drawLanes(kEnvironmentSet, 2, u);
+		for (uint32_t lane = 0; lane < 8; ++lane) {
+			if (lane < count) {
+				glm::vec2 sample(u[0][lane], u[1][lane]);
+				environmentDirections[lane] = sampleEnvironment(sample, environmentPdfs[lane]);
+				environmentWi[lane] = surfaces[lane].toLocal(environmentDirections[lane]);
+			} else {
+				environmentWi[lane] = environmentWi[count - 1];
+			}
+		}
+	}
+	if (sampleLights) {
+		drawLanes(kLightSet, 3, u);
+		for (uint32_t lane = 0; lane < 8; ++lane) {
+			if (lane < count) {
+				sampleLight(surfaces[lane].rayOrigin(), surfaces[lane].normal, glm::vec3(u[0][lane], u[1][lane],
+					u[2][lane]), lightSamples[lane]);
+				lightWi[lane] = surfaces[lane].toLocal(lightSamples[lane].direction);
+			} else {
+				lightWi[lane] = lightWi[count - 1];
+			}
+		}
+	}
+	bsdf8::BsdfMaterial lanes = { Vec3x8::gather(baseColors), Float8::load(metallic), Float8::load(roughness) };
+	const Vec3x8 wo8 = Vec3x8::gather(wo);
+	glm::vec3 values[8];
+	float bsdfPdfs[8];
+	if (sampleEnvironments) {
+		Float8 bsdfPdf;
+		bsdf8::evaluateBsdf(lanes, wo8, Vec3x8::gather(environmentWi), bsdfPdf).scatter(values);
+		bsdfPdf.store(bsdfPdfs);
+		for (uint32_t lane = 0; lane < count; ++lane) {
+			uint32_t i = paths[lane];
+			_slotRadiance[_paths.slots[i]] += _paths.throughputs[i] * connectEnvironment(surfaces[lane],
+				environmentDirections[lane], environmentPdfs[lane], values[lane], bsdfPdfs[lane], rayCount);
+		}
+	}
+	if (sampleLights) {
+		Float8 bsdfPdf;
+		bsdf8::evaluateBsdf(lanes, wo8, Vec3x8::gather(lightWi), bsdfPdf).scatter(values);
+		bsdfPdf.store(bsdfPdfs);
+		for (uint32_t lane = 0; lane < count; ++lane) {
+			uint32_t i = paths[lane];
+			_slotRadiance[_paths.slots[i]] += _paths.throughputs[i] * connectLight(surfaces[lane], lightSamples[lane],
+				values[lane], bsdfPdfs[lane], rayCount);
+		}
+	}
+	drawLanes(kBsdfSet, 3, u);
+	Vec3x8 wi;
+	Float8 pdf;
+	Vec3x8 weight = bsdf8::sampleBsdf(lanes, wo8, Float8::load(u[0]), Float8::load(u[1]),
+		Float8::load(u[2]), wi, pdf);
+	glm::vec3 weights[8], directions[8];
+	float pdfs[8];
+	weight.scatter(weights);
+	wi.scatter(directions);
+	pdf.store(pdfs);
+	for (uint32_t lane = 0; lane < count; ++lane) {
+		uint32_t i = paths[lane];
+		Ray ray;
+		_alive[i] = continuePath(surfaces[lane], weights[lane], directions[lane], bounce, ray, _paths.throughputs[i],
+			_paths.samplers[i]);
+		if (_alive[i]) {
+			_paths.origins[i] = ray.origin;
+			_paths.directions[i] = ray.direction;
+			_paths.pdfs[i] = pdfs[lane];
+			_paths.normals[i] = surfaces[lane].normal;
+			_paths.cones[i].spread += bsdf::bsdfAlpha(surfaces[lane].material.roughness);
+		}
+	}
+}
@@ -0,0 +1,76 @@
+#include "widebvh.hh"
+#include <chrono>
+#include <limits>
+
+static float binaryNodeArea(const BvhNode& node) {
+	glm::vec3 extent = glm::max(node.boundsMax - node.boundsMin, glm::vec3(0.0f));
+	return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+template <uint32_t Width>
+void WideBvh<Width>::collapse(const Bvh& bvh) {
+	auto startTime = std::chrono::high_resolution_clock::now();
+	_nodes.clear();
+	_primitives = bvh.primitives();
+	if (!bvh.empty()) {
+		_nodes.reserve(bvh.nodes().size() / (Width - 1) + 1);
+		collapseNode(bvh, 0);
+	}
+	auto endTime = std::chrono::high_resolution_clock::now();
+	_lastCollapseMilliseconds = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+}
+
+template <uint32_t Width>
+uint32_t WideBvh<Width>::collapseNode(const Bvh& bvh, uint32_t binaryNode) {
+	// open the interior child with the biggest area until the node is full, that child is the one
+	// most rays would have to descend into anyway
+	const std::vector<BvhNode>& binaryNodes = bvh.nodes();
+	uint32_t children[Width] = { binaryNode };
+	uint32_t childCount = 1;
+	while (childCount < Width) {
+		int32_t largest = -1;
+		float largestArea = -1.0f;
+		for (uint32_t i = 0; i < childCount; ++i) {
+			const BvhNode& child = binaryNodes[children[i]];
+			if (!child.isLeaf() && binaryNodeArea(child) > largestArea) {
+				largest = (int32_t)i;
+				largestArea = binaryNodeArea(child);
+			}
+		}
+		if (largest < 0) {
+			break;
+		}
+		uint32_t opened = children[largest];
+		children[largest] = opened + 1;
+		children[childCount++] = binaryNodes[opened].offset;
+	}
+
+	uint32_t index = (uint32_t)_nodes.size();
+	_nodes.emplace_back();
+	WideBvhNode<Width> node;
+	for (uint32_t i = 0; i < Width; ++i) {
+		for (int row = 0; row < 6; ++row) {
+			node.bounds[row][i] = std::numeric_limits<float>::quiet_NaN();
+		}
+		node.child[i] = 0;
+		node.count[i] = 0;
+	}
+	for (uint32_t i = 0; i < childCount; ++i) {
+		const BvhNode& child = binaryNodes[children[i]];
+		for (int axis = 0; axis < 3; ++axis) {
+			node.bounds[axis][i] = child.boundsMin[axis];
+			node.bounds[axis + 3][i] = child.boundsMax[axis];
+		}
+		if (child.isLeaf()) {
+			node.child[i] = child.offset;
+			node.count[i] = child.count;
+		} else {
+			node.child[i] = collapseNode(bvh, children[i]);
+		}
+	}
+	_nodes[index] = node;
+	return index;
+}
+
+template class WideBvh<4>;
+template class WideBvh<8>;
@@ -0,0 +1,223 @@
+#pragma once
+#include "bvh.hh"
+#include <immintrin.h>
+#include <cstdint>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Width children per node with their bounds in SoA rows, so one ray tests every child at once.
+// Rows 0-2 hold the lower x, y, z bounds and rows 3-5 the upper ones. Unused slots have NaN bounds,
+// the slab tests below keep the NaN and fail them.
+template <uint32_t Width>
+struct alignas(32) WideBvhNode {
+	float bounds[6][Width];
+	// interior children: wide node index, leaf children: first entry in WideBvh::primitives()
+	uint32_t child[Width];
+	// 0 for interior children
+	uint32_t count[Width];
+};
+
+inline uint32_t lowestLane(uint32_t mask) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+// ray constants broadcast once per traversal, the near and far rows follow the direction signs
+template <uint32_t Width>
+struct WideRay;
+
+template <>
+struct WideRay<4>
+{
+	__m128 origin[3];
+	__m128 inverseDirection[3];
+	uint32_t nearRow[3];
+	uint32_t farRow[3];
+
+	explicit WideRay(const Ray& ray) {
+		for (int axis = 0; axis < 3; ++axis) {
+			float inverse = 1.0f / ray.direction[axis];
+			origin[axis] = _mm_set1_ps(ray.origin[axis]);
+			inverseDirection[axis] = _mm_set1_ps(inverse);
+			nearRow[axis] = inverse < 0.0f ? axis + 3 : axis;
+			farRow[axis] = inverse < 0.0f ? axis : axis + 3;
+		}
+	}
+
+	// mask of children whose slab interval overlaps [tMin, tMax], entry distances go to entries
+	uint32_t intersect(const WideBvhNode<4>& node, float tMin, float tMax, float *entries) const {
+		__m128 entry = _mm_set1_ps(tMin);
+		__m128 exit = _mm_set1_ps(tMax);
+		for (int axis = 0; axis < 3; ++axis) {
+			entry = _mm_max_ps(entry, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[nearRow[axis]]), origin[axis]),
+				inverseDirection[axis]));
+			exit = _mm_min_ps(exit, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[farRow[axis]]), origin[axis]),
+				inverseDirection[axis]));
+		}
+		_mm_store_ps(entries, entry);
+		return (uint32_t)_mm_movemask_ps(_mm_cmple_ps(entry, exit));
+	}
+};
+
+template <>
+struct WideRay<8>
+{
+#if defined(__AVX__)
+	__m256 origin[3];
+	__m256 inverseDirection[3];
+#else
+	WideRay<4> half;
+#endif
+	uint32_t nearRow[3];
+	uint32_t farRow[3];
+
+#if defined(__AVX__)
+	explicit WideRay(const Ray& ray) {
+		for (int axis = 0; axis < 3; ++axis) {
+			float inverse = 1.0f / ray.direction[axis];
+			origin[axis] = _mm256_set1_ps(ray.origin[axis]);
+			inverseDirection[axis] = _mm256_set1_ps(inverse);
+			nearRow[axis] = inverse < 0.0f ? axis + 3 : axis;
+			farRow[axis] = inverse < 0.0f ? axis : axis + 3;
+		}
+	}
+
+	uint32_t intersect(const WideBvhNode<8>& node, float tMin, float tMax, float *entries) const {
+		__m256 entry = _mm256_set1_ps(tMin);
+		__m256 exit = _mm256_set1_ps(tMax);
+		for (int axis = 0; axis < 3; ++axis) {
+			entry = _mm256_max_ps(entry, _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[nearRow[axis]]),
+				origin[axis]), inverseDirection[axis]));
+			exit = _mm256_min_ps(exit, _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[farRow[axis]]),
+				origin[axis]), inverseDirection[axis]));
+		}
+		_mm256_store_ps(entries, entry);
+		return (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(entry, exit, _CMP_LE_OQ));
+	}
+#else
+	// without avx the eight children are two sse halves
+	explicit WideRay(const Ray& ray) : half(ray) {
+		for (int axis = 0; axis < 3; ++axis) {
+			nearRow[axis] = half.nearRow[axis];
+			farRow[axis] = half.farRow[axis];
+		}
+	}
+
+	uint32_t intersect(const WideBvhNode<8>& node, float tMin, float tMax, float *entries) const {
+		uint32_t mask = 0;
+		for (int part = 0; part < 2; ++part) {
+			__m128 entry = _mm_set1_ps(tMin);
+			__m128 exit = _mm_set1_ps(tMax);
+			for (int axis = 0; axis < 3; ++axis) {
+				entry = _mm_max_ps(entry, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.bounds[nearRow[axis]][part * 4]),
+					half.origin[axis]), half.inverseDirection[axis]));
+				exit = _mm_min_ps(exit, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.bounds[farRow[axis]][part * 4]),
+					half.origin[axis]), half.inverseDirection[axis]));
+			}
+			_mm_store_ps(entries + part * 4, entry);
+			mask |= (uint32_t)_mm_movemask_ps(_mm_cmple_ps(entry, exit)) << (part * 4);
+		}
+		return mask;
+	}
+#endif
+};
+
+// Binary bvh collapsed into Width wide nodes by repeatedly opening the biggest interior child, after
+// Wald et al. Traversal tests all children of a node in one SIMD slab test and visits the hit
+// children nearest first. Leaves and primitive order are the binary bvh's.
+template <uint32_t Width>
+class WideBvh
+{
+public:
+	// every level leaves at most Width - 1 children on the stack, no deeper than the binary bvh
+	static const uint32_t kStackSize = Bvh::kStackSize * (Width - 1) + 1;
+
+	void collapse(const Bvh& bvh);
+
+	const std::vector<WideBvhNode<Width>>& nodes() const { return _nodes; }
+	const std::vector<uint32_t>& primitives() const { return _primitives; }
+	bool empty() const { return _nodes.empty(); }
+	double lastCollapseMilliseconds() const { return _lastCollapseMilliseconds; }
+
+	// closest hit, same contract as Bvh::intersect
+	template <typename IntersectPrimitive>
+	bool intersect(const Ray& ray, RayHit& hit, IntersectPrimitive&& intersectPrimitive) const {
+		return intersectLeaves(ray, hit, [&](uint32_t first, uint32_t count, RayHit& closest) {
+			bool found = false;
+			for (uint32_t i = first; i < first + count; ++i) {
+				found |= intersectPrimitive(_primitives[i], closest);
+			}
+			return found;
+		});
+	}
+
+	// same traversal with whole leaves handed over as their first entry in primitives() and count
+	template <typename IntersectLeaf>
+	bool intersectLeaves(const Ray& ray, RayHit& hit, IntersectLeaf&& intersectLeaf) const;
+
+private:
+	struct StackEntry {
+		uint32_t child;
+		uint32_t count;
+		float entry;
+	};
+
+	std::vector<WideBvhNode<Width>> _nodes;
+	std::vector<uint32_t> _primitives;
+	double _lastCollapseMilliseconds = 0;
+
+	uint32_t collapseNode(const Bvh& bvh, uint32_t binaryNode);
+};
+
+typedef WideBvh<4> Bvh4;
+typedef WideBvh<8> Bvh8;
+
+template <uint32_t Width>
+template <typename IntersectLeaf>
+bool WideBvh<Width>::intersectLeaves(const Ray& ray, RayHit& hit, IntersectLeaf&& intersectLeaf) const {
+	if (_nodes.empty()) {
+		return false;
+	}
+	const WideRay<Width> wideRay(ray);
+	StackEntry stack[kStackSize];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = { 0, 0, ray.tMin };
+	bool found = false;
+	while (stackSize > 0) {
+		StackEntry current = stack[--stackSize];
+		float tMax = std::min(ray.tMax, hit.t);
+		// entries pushed before a closer hit was found may lie behind it now
+		if (current.entry > tMax) {
+			continue;
+		}
+		if (current.count) {
+			found |= intersectLeaf(current.child, current.count, hit);
+			continue;
+		}
+
+		const WideBvhNode<Width>& node = _nodes[current.child];
+		alignas(32) float entries[Width];
+		uint32_t mask = wideRay.intersect(node, ray.tMin, tMax, entries);
+		// insertion sort far to near, so the nearest child is popped next
+		uint32_t first = stackSize;
+		while (mask) {
+			uint32_t lane = lowestLane(mask);
+			mask &= mask - 1;
+			StackEntry child = { node.child[lane], node.count[lane], entries[lane] };
+			uint32_t slot = stackSize++;
+			while (slot > first && stack[slot - 1].entry < child.entry) {
+				stack[slot] = stack[slot - 1];
+				--slot;
+			}
+			stack[slot] = child;
+		}
+	}
+	return found;
+}